@@ -228,7 +228,7 @@ namespace madness {
     
     void SCF::save_mos(World& world) {
         PROFILE_MEMBER_FUNC(SCF);
-        archive::ParallelOutputArchive ar(world, "restartdata", param.nio);
+        archive::SingleFileOutputArchive ar(world, "restartdata");
         ar & current_energy & param.spin_restricted;
         ar & (unsigned int) (amo.size());
         ar & aeps & aocc & aset;
@@ -244,6 +244,18 @@ namespace madness {
     
     void SCF::load_mos(World& world) {
         PROFILE_MEMBER_FUNC(SCF);
+        if (archive::SingleFileInputArchive::exists(world, "restartdata")) {
+            archive::SingleFileInputArchive ar(world, "restartdata");
+            load_mos(world, ar);
+        }
+        else { // one file per I/O node from older versions
+            archive::ParallelInputArchive ar(world, "restartdata");
+            load_mos(world, ar);
+        }
+    }
+
+    template <typename Archive>
+    void SCF::load_mos(World& world, const Archive& ar) {
         //        const double trantol = vtol / std::min(30.0, double(param.nalpha));
         const double thresh = FunctionDefaults < 3 > ::get_thresh();
         const int k = FunctionDefaults < 3 > ::get_k();
@@ -252,8 +264,6 @@ namespace madness {
         amo.clear();
         bmo.clear();
         
-        archive::ParallelInputArchive ar(world, "restartdata");
-        
         /*
           File format:
           
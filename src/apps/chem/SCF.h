@@ -783,6 +783,10 @@ public:
 
     void load_mos(World& world);
 
+    /// loads the orbitals from an archive written by save_mos
+    template <typename Archive>
+    void load_mos(World& world, const Archive& ar);
+
     void do_plots(World& world);
 
     void project(World & world);
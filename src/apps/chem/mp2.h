@@ -326,11 +326,17 @@ namespace madness {
 
         bool load_pair(World& world) {
         	std::string name="pair_"+stringify(i)+stringify(j);
-        	bool exists=archive::ParallelInputArchive::exists(world,name.c_str());
+        	bool single=archive::SingleFileInputArchive::exists(world,name.c_str());
+        	bool exists=single || archive::ParallelInputArchive::exists(world,name.c_str());
             if (exists) {
             	if (world.rank()==0) printf("loading matrix elements %s",name.c_str());
-                archive::ParallelInputArchive ar(world, name.c_str(), 1);
-                ar & *this;
+            	if (single) {
+            	    archive::SingleFileInputArchive ar(world, name.c_str());
+            	    ar & *this;
+            	} else {
+            	    archive::ParallelInputArchive ar(world, name.c_str(), 1);
+            	    ar & *this;
+            	}
             	if (world.rank()==0) printf(" %s\n",(converged)?" converged":" not converged");
             	function.set_thresh(FunctionDefaults<6>::get_thresh());
                 constant_term.set_thresh(FunctionDefaults<6>::get_thresh());
@@ -343,7 +349,7 @@ namespace madness {
         void store_pair(World& world) {
         	std::string name="pair_"+stringify(i)+stringify(j);
         	if (world.rank()==0) printf("storing matrix elements %s\n",name.c_str());
-            archive::ParallelOutputArchive ar(world, name.c_str(), 1);
+            archive::SingleFileOutputArchive ar(world, name.c_str());
         	ar & *this;
         }
     };
@@ -54,6 +54,13 @@ namespace madness {
 
     enum BCType {BC_ZERO, BC_PERIODIC, BC_FREE, BC_DIRICHLET, BC_ZERONEUMANN, BC_NEUMANN};
 
+    /// Precision in which the coefficients of a function are held between operations
+
+    /// With SP_FLOAT double (complex) coefficients are kept in float
+    /// (complex) and converted back on first use, so that all
+    /// arithmetic is still done in the type of the function.
+    enum StoragePrecision {SP_NATIVE, SP_FLOAT};
+
     /*!
       \brief This class is used to specify boundary conditions for all operators
       \ingroup mrabcext
@@ -191,6 +198,8 @@ namespace madness {
         static double cell_volume;      ///< Volume of simulation cell
         static double cell_min_width;   ///< Size of smallest dimension
         static TensorType tt;			///< structure of the tensor in FunctionNode
+        static RankReduceType rr;		///< rank reduction algorithm for low rank tensors
+        static StoragePrecision sp;     ///< precision of the coefficients between operations
         static std::shared_ptr< WorldDCPmapInterface< Key<NDIM> > > pmap; ///< Default mapping of keys to processes
 
         static void recompute_cell_info() {
@@ -364,6 +373,26 @@ namespace madness {
 #endif
         }
 
+        /// Returns the default rank reduction algorithm for low rank tensors
+        static RankReduceType get_rank_reduce_type() {
+        	return rr;
+        }
+
+        /// Sets the default rank reduction algorithm for low rank tensors
+        static void set_rank_reduce_type(const RankReduceType& r) {
+        	rr=r;
+        }
+
+        /// Returns the default storage precision of the coefficients
+        static StoragePrecision get_storage_precision() {
+            return sp;
+        }
+
+        /// Sets the default storage precision of the coefficients
+        static void set_storage_precision(StoragePrecision value) {
+            sp=value;
+        }
+
         /// Gets the user cell for the simulation
         static const Tensor<double>& get_cell() {
             return cell;
@@ -35,19 +35,23 @@
 /// \file funcimpl.h
 /// \brief Provides FunctionCommonData, FunctionImpl and FunctionFactory
 
+#include <atomic>
 #include <iostream>
+#include <map>
 #include <type_traits>
 #include <madness/world/MADworld.h>
 #include <madness/world/print.h>
 #include <madness/misc/misc.h>
 #include <madness/tensor/tensor.h>
 #include <madness/tensor/gentensor.h>
+#include <madness/tensor/cblas.h>
 
 #include <madness/mra/function_common_data.h>
 #include <madness/mra/indexit.h>
 #include <madness/mra/key.h>
 #include <madness/mra/funcdefaults.h>
 #include <madness/mra/function_factory.h>
+#include <madness/mra/packed_coeffs.h>
 
 namespace madness {
     template <typename T, std::size_t NDIM>
@@ -117,12 +121,24 @@ namespace madness {
     };
 
 
+    /// Type in which the coefficients of a FunctionNode are kept with SP_FLOAT
+    template <typename T> struct float_storage {typedef T type;};
+    template <> struct float_storage<double> {typedef float type;};
+    template <> struct float_storage<double_complex> {typedef float_complex type;};
+
+
     /// FunctionNode holds the coefficients, etc., at each node of the 2^NDIM-tree
+
+    /// Between operations the coefficients may be held in single
+    /// precision (see demote()).  They are converted back to T on the
+    /// first call to coeff(), so all arithmetic is done in T.  Read-only
+    /// operations use coeff_value(), which leaves the node demoted.
     template<typename T, std::size_t NDIM>
     class FunctionNode {
     public:
     	typedef GenTensor<T> coeffT;
     	typedef Tensor<T> tensorT;
+        typedef Tensor<typename float_storage<T>::type> floatT;
     private:
         // Should compile OK with these volatile but there should
         // be no need to set as volatile since the container internally
@@ -131,13 +147,25 @@ namespace madness {
         coeffT _coeffs; ///< The coefficients, if any
         double _norm_tree; ///< After norm_tree will contain norm of coefficients summed up tree
         bool _has_children; ///< True if there are children
-        coeffT buffer; ///< The coefficients, if any
+        coeffT buffer; ///< Staging buffer for low-rank contributions, see accumulate()
+        std::atomic<floatT*> _stored; ///< The coefficients in single precision while demoted, null otherwise
+
+        /// Number of terms the staging buffer collects before it is reduced
+        static const long max_staged_rank=64;
+
+        /// Serializes promote() of a node shared by readers
+
+        /// Nodes share a few locks by address, so that native nodes pay only for _stored
+        static Spinlock& storage_lock(const FunctionNode<T,NDIM>* node) {
+            static Spinlock locks[64];
+            return locks[(reinterpret_cast<std::size_t>(node)/sizeof(FunctionNode<T,NDIM>))%64];
+        }
 
     public:
         typedef WorldContainer<Key<NDIM> , FunctionNode<T, NDIM> > dcT; ///< Type of container holding the nodes
         /// Default constructor makes node without coeff or children
         FunctionNode() :
-            _coeffs(), _norm_tree(1e300), _has_children(false) {
+            _coeffs(), _norm_tree(1e300), _has_children(false), _stored(nullptr) {
         }
 
         /// Constructor from given coefficients with optional children
@@ -147,22 +175,30 @@ namespace madness {
         /// take ownership.
         explicit
         FunctionNode(const coeffT& coeff, bool has_children = false) :
-            _coeffs(coeff), _norm_tree(1e300), _has_children(has_children) {
+            _coeffs(coeff), _norm_tree(1e300), _has_children(has_children), _stored(nullptr) {
         }
 
         explicit
         FunctionNode(const coeffT& coeff, double norm_tree, bool has_children) :
-            _coeffs(coeff), _norm_tree(norm_tree), _has_children(has_children) {
+            _coeffs(coeff), _norm_tree(norm_tree), _has_children(has_children), _stored(nullptr) {
         }
 
-        FunctionNode(const FunctionNode<T, NDIM>& other) {
+        FunctionNode(const FunctionNode<T, NDIM>& other) : _stored(nullptr) {
             *this = other;
         }
 
+        ~FunctionNode() {
+            delete _stored.load();
+        }
+
+        /// Deep copy of the coefficients in whatever precision other holds them
         FunctionNode<T, NDIM>&
         operator=(const FunctionNode<T, NDIM>& other) {
             if (this != &other) {
-                coeff() = copy(other.coeff());
+                ScopedMutex<Spinlock> hold(storage_lock(&other));
+                _coeffs = copy(other._coeffs);
+                const floatT* stored = other._stored;
+                delete _stored.exchange(stored ? new floatT(copy(*stored)) : nullptr);
                 _norm_tree = other._norm_tree;
                 _has_children = other._has_children;
             }
@@ -182,7 +218,7 @@ namespace madness {
         /// Returns true if there are coefficients in this node
         bool
         has_coeff() const {
-            return _coeffs.has_data();
+            return _stored || _coeffs.has_data();
         }
 
 
@@ -209,6 +245,7 @@ namespace madness {
         /// Returns an empty tensor if there are no coefficients.
         coeffT&
         coeff() {
+            promote();
             MADNESS_ASSERT(_coeffs.ndim() == -1 || (_coeffs.dim(0) <= 2
                                                     * MAXK && _coeffs.dim(0) >= 0));
             return const_cast<coeffT&>(_coeffs);
@@ -219,19 +256,83 @@ namespace madness {
         /// Returns an empty tensor if there are no coefficeints.
         const coeffT&
         coeff() const {
+            promote();
             return const_cast<const coeffT&>(_coeffs);
         }
 
+        /// Returns the coeffs in T without converting a demoted node
+
+        /// For read-only operations such as norms, inner products and
+        /// evaluation.  A demoted node converts into a temporary that is
+        /// freed with the returned tensor, so the node stays in single
+        /// precision; otherwise the node's tensor is shared (shallow copy).
+        coeffT coeff_value() const {
+            if (_stored) {
+                ScopedMutex<Spinlock> hold(storage_lock(this));
+                if (const floatT* stored=_stored) return coeffT(tensorT(*stored),-1.0,TT_FULL);
+            }
+            return _coeffs;
+        }
+
         /// Returns the number of coefficients in this node
         size_t size() const {
+            if (_stored) {
+                ScopedMutex<Spinlock> hold(storage_lock(this));
+                if (const floatT* stored=_stored) return stored->size();
+            }
             return _coeffs.size();
         }
 
+        /// Returns the memory held by the coefficients in units of T
+        size_t real_size() const {
+            if (_stored) {
+                ScopedMutex<Spinlock> hold(storage_lock(this));
+                if (const floatT* stored=_stored) return (stored->size()*sizeof(typename floatT::type) + sizeof(T) - 1)/sizeof(T);
+            }
+            return _coeffs.real_size();
+        }
+
+        /// Returns true if the coefficients are held in single precision
+        bool is_demoted() const {
+            return _stored!=nullptr;
+        }
+
+        /// Converts full-rank coefficients to single precision until the next call to coeff()
+
+        /// Must not be called while references obtained from coeff() are in use
+        void demote() {
+            if (_stored || !_coeffs.has_data() || _coeffs.tensor_type()!=TT_FULL) return;
+            ScopedMutex<Spinlock> hold(storage_lock(this));
+            const tensorT& t=_coeffs.full_tensor();
+            _stored=new floatT(t);
+            _coeffs=coeffT();
+        }
+
+        /// Converts coefficients held in single precision back to T
+
+        /// Logically const since it does not change the value of the
+        /// node, and safe to be called by concurrent readers.
+        void promote() const {
+            if (!_stored) return;
+            ScopedMutex<Spinlock> hold(storage_lock(this));
+            if (const floatT* stored=_stored) {
+                FunctionNode<T,NDIM>* self=const_cast<FunctionNode<T,NDIM>*>(this);
+                self->_coeffs=coeffT(tensorT(*stored),-1.0,TT_FULL);
+                self->_stored=nullptr;
+                delete stored;
+            }
+        }
+
     public:
 
         /// reduces the rank of the coefficients (if applicable)
         void reduceRank(const double& eps) {
-            _coeffs.reduce_rank(eps);
+            coeff().reduce_rank(eps);
+        }
+
+        /// reduces the rank of the coefficients (if applicable)
+        void reduceRank(const TensorArgs& targs) {
+            coeff().reduce_rank(targs);
         }
 
         /// Sets \c has_children attribute to value of \c flag.
@@ -266,6 +367,7 @@ namespace madness {
 
         /// Takes a \em shallow copy of the coeff --- same as \c this->coeff()=coeff
         void set_coeff(const coeffT& coeffs) {
+            if (_stored) clear_coeff();
             coeff() = coeffs;
             if ((_coeffs.has_data()) and ((_coeffs.dim(0) < 0) || (_coeffs.dim(0)>2*MAXK))) {
                 print("set_coeff: may have a problem");
@@ -276,13 +378,17 @@ namespace madness {
 
         /// Clears the coefficients (has_coeff() will subsequently return false)
         void clear_coeff() {
-            coeff()=coeffT();
+            if (_stored) {
+                ScopedMutex<Spinlock> hold(storage_lock(this));
+                delete _stored.exchange(nullptr);
+            }
+            _coeffs=coeffT();
         }
 
         /// Scale the coefficients of this node
         template <typename Q>
         void scale(Q a) {
-            _coeffs.scale(a);
+            coeff().scale(a);
         }
 
         /// Sets the value of norm_tree
@@ -354,24 +460,18 @@ namespace madness {
                           const Key<NDIM>& key, const TensorArgs& args) {
             double cpu0=cpu_time();
             if (has_coeff()) {
-
-#if 1
-                coeff().add_SVD(t,args.thresh);
-                if (buffer.rank()<coeff().rank()) {
-                    if (buffer.has_data()) {
-                        buffer.add_SVD(coeff(),args.thresh);
+                if (coeff().tensor_type()==TT_2D) {
+                    // collect the terms without any rank reduction
+                    if (not buffer.has_data()) {
+                        buffer=copy(t);
+                        buffer.reserve(max_staged_rank);
                     } else {
-                        buffer=copy(coeff());
+                        t.append(buffer,1.0);
                     }
-                    coeff()=coeffT();
+                    if (buffer.rank()>=max_staged_rank) flush_buffer(args);
+                } else {
+                    coeff().add_SVD(t,args);
                 }
-
-#else
-                // always do low rank
-                coeff().add_SVD(t,args.thresh);
-
-#endif
-
             } else {
                 // No coeff and no children means the node is newly
                 // created for this operation and therefore we must
@@ -386,22 +486,47 @@ namespace madness {
             return cpu1-cpu0;
         }
 
+        /// Reduce the terms collected in the staging buffer in one go and add them to the coefficients
+
+        /// The memory of the buffer is kept for further contributions.
+        void flush_buffer(const TensorArgs& args) {
+            if (buffer.rank()<=0) return;
+            coeffT staged=copy(buffer.get_configs(0,buffer.rank()-1));
+            staged.reduce_rank(args);
+            coeff().add_SVD(staged,args);
+            buffer.clear_terms();
+        }
+
         void consolidate_buffer(const TensorArgs& args) {
-            if ((coeff().has_data()) and (buffer.has_data())) {
-                coeff().add_SVD(buffer,args.thresh);
-            } else if (buffer.has_data()) {
-                coeff()=buffer;
+            if (buffer.has_data()) {
+                if (coeff().has_data()) flush_buffer(args);
+                else {
+                    buffer.reduce_rank(args);
+                    coeff()=buffer;
+                }
             }
             buffer=coeffT();
         }
 
         T trace_conj(const FunctionNode<T,NDIM>& rhs) const {
-            return this->_coeffs.trace_conj((rhs._coeffs));
+            return coeff().trace_conj(rhs.coeff());
         }
 
+        /// Nodes are always sent and stored in T; sending a demoted node does not promote it
         template <typename Archive>
         void serialize(Archive& ar) {
-            ar & coeff() & _has_children & _norm_tree;
+            if (archive::is_output_archive<Archive>::value && _stored) {
+                coeffT c;
+                {
+                    ScopedMutex<Spinlock> hold(storage_lock(this));
+                    const floatT* stored = _stored;
+                    c = stored ? coeffT(tensorT(*stored),-1.0,TT_FULL) : _coeffs;
+                }
+                ar & c & _has_children & _norm_tree;
+            }
+            else {
+                ar & coeff() & _has_children & _norm_tree;
+            }
         }
 
     };
@@ -916,6 +1041,7 @@ namespace madness {
         bool truncate_on_project; ///< If true projection inserts at level n-1 not n
         bool nonstandard; ///< If true, compress keeps scaling coeff
         TensorArgs targs; ///< type of tensor to be used in the FunctionNodes
+        StoragePrecision storage_precision; ///< precision of the coefficients between operations
 
         const FunctionCommonData<T,NDIM>& cdata;
 
@@ -927,6 +1053,10 @@ namespace madness {
 
         dcT coeffs; ///< The coefficients
 
+        bool packed; ///< If true the local nodes are encoded in packed_nodes, see pack()
+        bool unpack_reconstructs; ///< If true the function was reconstructed when packed
+        std::vector<unsigned char> packed_nodes; ///< Local nodes while packed
+
         // Disable the default copy constructor
         FunctionImpl(const FunctionImpl<T,NDIM>& p);
 
@@ -952,13 +1082,17 @@ namespace madness {
             , autorefine(factory._autorefine)
             , truncate_on_project(factory._truncate_on_project)
             , nonstandard(false)
-            , targs(factory._thresh,FunctionDefaults<NDIM>::get_tensor_type())
+            , targs(factory._thresh,FunctionDefaults<NDIM>::get_tensor_type(),
+                    FunctionDefaults<NDIM>::get_rank_reduce_type())
+            , storage_precision(factory._storage_precision)
             , cdata(FunctionCommonData<T,NDIM>::get(k))
             , functor(factory.get_functor())
             , on_demand(factory._is_on_demand)
             , compressed(factory._compressed)
             , redundant(false)
             , coeffs(world,factory._pmap,false)
+            , packed(false)
+            , unpack_reconstructs(false)
             //, bc(factory._bc)
         {
             // PROFILE_MEMBER_FUNC(FunctionImpl); // No need to profile this
@@ -967,6 +1101,9 @@ namespace madness {
             // for this.  Otherwise, there is a race condition.
             MADNESS_ASSERT(k>0 && k<=MAXK);
 
+            // Tasks on a node run in the NUMA domain of its key (no effect unless the threads are bound)
+            coeffs.set_numa_affinity(true);
+
             bool empty = (factory._empty or is_on_demand());
             bool do_refine = factory._refine;
 
@@ -991,8 +1128,10 @@ namespace madness {
 
             coeffs.process_pending();
             this->process_pending();
-            if (factory._fence && functor)
+            if (factory._fence && functor) {
                 world.gop.fence();
+                demote_coeffs(true);
+            }
         }
 
         /// Copy constructor
@@ -1016,14 +1155,18 @@ namespace madness {
                          , truncate_on_project(other.truncate_on_project)
                          , nonstandard(other.nonstandard)
                          , targs(other.targs)
+                         , storage_precision(other.storage_precision)
                          , cdata(FunctionCommonData<T,NDIM>::get(k))
                          , functor()
                          , on_demand(false)	// since functor() is an default ctor
                          , compressed(other.compressed)
                          , redundant(other.redundant)
                          , coeffs(world, pmap ? pmap : other.coeffs.get_pmap())
+                         , packed(false)
+                         , unpack_reconstructs(false)
                          //, bc(other.bc)
         {
+            coeffs.set_numa_affinity(true);
             if (dozero) {
                 initial_level = 1;
                 insert_zero_down_to_initial_level(cdata.key0);
@@ -1162,6 +1305,30 @@ namespace madness {
             world.gop.fence();
         }
 
+        /// Encodes the local nodes of a compressed function into a compact buffer and frees them, optional fence
+
+        /// Each coefficient tensor is rounded with an error of at most
+        /// half of truncate_tol(tol,key) in the 2-norm, see PackedCoeffs.
+        /// Low-rank tensors are kept as they are.  The function must not
+        /// be used until unpack().
+        /// @param[in] tol  the truncation threshold the rounding is derived from
+        /// @param[in] reconstruct  if true unpack() leaves the function to reconstruct
+        void pack(double tol, bool reconstruct, bool fence);
+
+        /// Restores the nodes encoded by pack(), optional fence
+
+        /// Returns true if the function was reconstructed when packed
+        bool unpack(bool fence);
+
+        /// Returns true between pack() and unpack()
+        bool is_packed() const {return packed;}
+
+        /// Returns true if unpack() will leave the function to reconstruct
+        bool get_unpack_reconstructs() const {return unpack_reconstructs;}
+
+        /// Returns the size in bytes of the packed nodes ... collective global sum
+        std::size_t packed_size() const;
+
         /// Returns true if the function is compressed.
         bool is_compressed() const;
 
@@ -1186,6 +1353,19 @@ namespace madness {
 
         TensorArgs get_tensor_args() const;
 
+        StoragePrecision get_storage_precision() const;
+
+        void set_storage_precision(StoragePrecision value);
+
+        /// Holds the coefficients in the storage precision until next used, optional fence
+
+        /// Noop unless the storage precision is SP_FLOAT.  No other
+        /// operation may touch the function before the fence.
+        void demote_coeffs(bool fence);
+
+        /// Converts all coefficients back to T, optional fence
+        void promote_coeffs(bool fence);
+
         double get_thresh() const;
 
         void set_thresh(double value);
@@ -2072,7 +2252,7 @@ namespace madness {
             bool operator()(typename rangeT::iterator& it) const {
 
                 nodeT& node = it->second;
-                node.reduceRank(args.thresh);
+                node.reduceRank(args);
                 return true;
             }
             template <typename Archive> void serialize(const Archive& ar) {}
@@ -2275,6 +2455,23 @@ namespace madness {
             template <typename Archive> void serialize(const Archive& ar) {}
         };
 
+        struct do_convert_storage {
+            typedef Range<typename dcT::iterator> rangeT;
+
+            bool promote; ///< If true converts back to T
+
+            do_convert_storage() {}
+            do_convert_storage(bool promote) : promote(promote) {}
+
+            bool operator()(typename rangeT::iterator& it) const {
+                nodeT& node = it->second;
+                if (promote) node.promote();
+                else node.demote();
+                return true;
+            }
+            template <typename Archive> void serialize(const Archive& ar) {}
+        };
+
         struct do_consolidate_buffer {
             typedef Range<typename dcT::iterator> rangeT;
 
@@ -2320,48 +2517,102 @@ namespace madness {
             template <typename Archive> void serialize(const Archive& ar) {}
         };
 
+        /// Transforms the coefficients at a range of keys, blocked by key
+
+        /// At each key the block of \c c restricted to the input functions
+        /// present there is screened: contributions c(j,i)*old[j] whose norm
+        /// is below the truncation tolerance for the key are dropped, as are
+        /// outputs with no contribution above it, so for localized functions
+        /// only the nearby (key,j,i) triples are formed.  If the surviving
+        /// block is dense the coefficients are gathered into a (nj,ncoeff)
+        /// panel and transformed with one gemm, otherwise each output is
+        /// accumulated from its few contributions.  Either way every output
+        /// node is updated once per key.
+        /// @param[in] map the keys of the input functions, shared with the other tasks
+        /// @param[in] crows the nonzero elements (i,c(j,i)) of each row j of the transformation
+        /// @param[in] lstart first key in the range
+        /// @param[in] lend end of the range of keys
+        /// @param[in] vleft vector of the *newly* transformed functions (impl's)
+        /// @param[in] tol the truncation tolerance
         template <typename Q, typename R>
-        /// @todo I don't know what this does other than a trasform
-        void vtransform_doit(const std::shared_ptr< FunctionImpl<R,NDIM> >& right,
-                             const Tensor<Q>& c,
+        void vtransform_doit(const std::shared_ptr<typename FunctionImpl<R,NDIM>::mapT>& map,
+                             const std::shared_ptr< std::vector< std::vector< std::pair<long,Q> > > >& crows,
+                             const typename FunctionImpl<R,NDIM>::mapT::iterator lstart,
+                             const typename FunctionImpl<R,NDIM>::mapT::iterator lend,
                              const std::vector< std::shared_ptr< FunctionImpl<T,NDIM> > >& vleft,
                              double tol) {
-            // To reduce crunch on vectors being transformed each task
-            // does them in a random order
-            std::vector<unsigned int> ind(vleft.size());
-            for (unsigned int i=0; i<vleft.size(); ++i) {
-                ind[i] = i;
-            }
-            for (unsigned int i=0; i<vleft.size(); ++i) {
-                unsigned int j = RandomValue<int>()%vleft.size();
-                std::swap(ind[i],ind[j]);
-            }
-
-            typename FunctionImpl<R,NDIM>::dcT::const_iterator end = right->coeffs.end();
-            for (typename FunctionImpl<R,NDIM>::dcT::const_iterator it=right->coeffs.begin(); it != end; ++it) {
-                if (it->second.has_coeff()) {
-                    const Key<NDIM>& key = it->first;
-                    const GenTensor<R>& r = it->second.coeff();
-                    double norm = r.normf();
-                    double keytol = truncate_tol(tol,key);
-
-                    for (unsigned int j=0; j<vleft.size(); ++j) {
-                        unsigned int i = ind[j]; // Random permutation
-                        if (std::abs(norm*c(i)) > keytol) {
-                            implT* left = vleft[i].get();
-                            typename dcT::accessor acc;
-                            bool newnode = left->coeffs.insert(acc,key);
-                            if (newnode && key.level()>0) {
-                                Key<NDIM> parent = key.parent();
-                                left->coeffs.task(parent, &nodeT::set_has_children_recursive, left->coeffs, parent);
-                            }
-                            nodeT& node = acc->second;
-                            if (!node.has_coeff())
-                                node.set_coeff(coeffT(cdata.v2k,targs));
-                            coeffT& t = node.coeff();
-                            t.gaxpy(1.0, r, c(i));
-                        }
+            // Work space reused for all keys; contrib[i] lists the (jj,c(j,i)) kept at the key
+            std::vector< std::vector< std::pair<long,T> > > contrib(vleft.size());
+            std::vector<long> active;
+            std::vector< Tensor<R> > r;
+            for (typename FunctionImpl<R,NDIM>::mapT::iterator it=lstart; it!=lend; ++it) {
+                const keyT& key = it->first;
+                const typename FunctionImpl<R,NDIM>::mapvecT& rightv = it->second;
+                const long nj = rightv.size();
+                const double keytol = truncate_tol(tol,key);
+
+                // Screened block of c for the outputs with a contribution above the tolerance
+                r.resize(nj);
+                active.clear();
+                long nnz = 0;
+                for (long jj=0; jj<nj; ++jj) {
+                    const GenTensor<R>& g = *(rightv[jj].second);
+                    r[jj] = (g.tensor_type() == TT_FULL) ? Tensor<R>(g.full_tensor()) : Tensor<R>(g.full_tensor_copy());
+                    const double norm = r[jj].normf();
+                    const std::vector< std::pair<long,Q> >& row = (*crows)[rightv[jj].first];
+                    for (std::size_t p=0; p<row.size(); ++p) {
+                        if (std::abs(row[p].second)*norm <= keytol) continue;
+                        const long i = row[p].first;
+                        if (contrib[i].empty()) active.push_back(i);
+                        contrib[i].push_back(std::make_pair(jj,T(row[p].second)));
+                        ++nnz;
+                    }
+                }
+                if (active.empty()) continue;
+                const long na = active.size();
+
+                Tensor<T> x;
+                if (4*nnz > nj*na) {
+                    Tensor<T> cs(nj, na);
+                    for (long ia=0; ia<na; ++ia) {
+                        const std::vector< std::pair<long,T> >& ci = contrib[active[ia]];
+                        for (std::size_t p=0; p<ci.size(); ++p) cs(ci[p].first,ia) = ci[p].second;
+                    }
+                    const long size = r[0].size();
+                    Tensor<T> a(nj, size);
+                    for (long jj=0; jj<nj; ++jj) {
+                        MADNESS_ASSERT(r[jj].size() == size);
+                        a(jj,_) = r[jj].flat();
+                    }
+
+                    // x(ia,_) = sum(jj) cs(jj,ia)*a(jj,_), in column-major order x = a*cs
+                    x = Tensor<T>(na, size);
+                    cblas::gemm(cblas::NoTrans, cblas::Trans, size, na, nj, T(1.0),
+                                a.ptr(), size, cs.ptr(), na, T(0.0), x.ptr(), size);
+                }
+
+                for (long ia=0; ia<na; ++ia) {
+                    std::vector< std::pair<long,T> >& ci = contrib[active[ia]];
+                    tensorT t;
+                    if (x.size()) {
+                        t = copy(x(ia,_)).reshape(cdata.v2k);
+                    }
+                    else {
+                        t = tensorT(cdata.v2k);
+                        for (std::size_t p=0; p<ci.size(); ++p) t.gaxpy(1.0, r[ci[p].first], ci[p].second);
+                    }
+                    ci.clear();
+
+                    implT* left = vleft[active[ia]].get();
+                    typename dcT::accessor acc;
+                    bool newnode = left->coeffs.insert(acc,key);
+                    if (newnode && key.level()>0) {
+                        Key<NDIM> parent = key.parent();
+                        left->coeffs.task(parent, &nodeT::set_has_children_recursive, left->coeffs, parent);
                     }
+                    nodeT& node = acc->second;
+                    if (node.has_coeff()) node.coeff().gaxpy(1.0, coeffT(t,targs), 1.0);
+                    else node.set_coeff(coeffT(t,targs));
                 }
             }
         }
@@ -2416,11 +2667,43 @@ namespace madness {
                         const std::vector< std::shared_ptr< FunctionImpl<T,NDIM> > >& vleft,
                         double tol,
                         bool fence) {
+            typedef typename FunctionImpl<R,NDIM>::mapT rmapT;
+
+            // The map must outlive the tasks if there is no fence
+            std::shared_ptr<rmapT> map(new rmapT(100000));
             for (unsigned int j=0; j<vright.size(); ++j) {
-                world.taskq.add(*this, &implT:: template vtransform_doit<Q,R>, vright[j], copy(c(j,_)), vleft, tol);
+                world.taskq.add(*(vright[j]), &FunctionImpl<R,NDIM>::add_keys_to_map, map.get(), int(j));
             }
-            if (fence)
+            world.taskq.fence();
+
+            // Nonzero elements of each row of c
+            std::shared_ptr< std::vector< std::vector< std::pair<long,Q> > > >
+                crows(new std::vector< std::vector< std::pair<long,Q> > >(c.dim(0)));
+            for (long j=0; j<c.dim(0); ++j) {
+                for (long i=0; i<c.dim(1); ++i) {
+                    if (c(j,i) != Q(0.0)) (*crows)[j].push_back(std::make_pair(i,c(j,i)));
+                }
+            }
+
+            size_t chunk = (map->size()-1)/(3*4*5)+1;
+            typename rmapT::iterator lstart=map->begin();
+            while (lstart != map->end()) {
+                typename rmapT::iterator lend = lstart;
+                advance(lend,chunk);
+                world.taskq.add(*this, &implT:: template vtransform_doit<Q,R>, map, crows, lstart, lend, vleft, tol);
+                lstart = lend;
+            }
+            if (fence) {
                 world.gop.fence();
+                // The map promoted the coeffs of vright ... return them to their storage precision
+                bool demoted = false;
+                for (unsigned int j=0; j<vright.size(); ++j) {
+                    if (vright[j]->get_storage_precision() != SP_FLOAT) continue;
+                    vright[j]->demote_coeffs(false);
+                    demoted = true;
+                }
+                if (demoted) world.taskq.fence();
+            }
         }
 
         /// Unary operation applied inplace to the values with optional refinement and fence
@@ -2902,6 +3185,40 @@ namespace madness {
                   const keyT& keyin,
                   const typename Future<T>::remote_refT& ref);
 
+        /// The values of eval_many, collected on the invoking process
+        struct EvalManyGather {
+            Future< std::vector<T> > result; ///< Set when the last value is in
+            std::vector<T> values;           ///< In the order of the points
+            std::size_t nleft;               ///< Values still to come
+            Mutex mutex;
+
+            EvalManyGather(std::size_t n) : values(n), nleft(n) {}
+        };
+
+        /// Evaluate the function at points in \em simulation coordinates
+
+        /// Only the invoking process gets the values (in the order of
+        /// x) via the future.  Non-blocking comm.
+        Future< std::vector<T> > eval_many(const std::vector<coordT>& x) const;
+
+        /// Evaluate the function at points in the box of key, in coordinates relative to the box
+
+        /// Invoked on the owner of key.  The points in an interior box
+        /// are split among the children, and sent there in one task per
+        /// child.  A leaf box sends its values, with the indices idx of
+        /// its points, straight to the EvalManyGather at address gather
+        /// on process caller.
+        void eval_many_spawn(const keyT& key, const std::vector<coordT>& x,
+                             const std::vector<std::size_t>& idx,
+                             ProcessID caller, unsigned long gather) const;
+
+        /// Store the values of the points idx in the EvalManyGather at address gather
+
+        /// Invoked on the process that called eval_many.  The last
+        /// values to come in set the result and free the EvalManyGather.
+        void eval_many_gather(unsigned long gather, const std::vector<std::size_t>& idx,
+                              const std::vector<T>& values) const;
+
         /// Get the depth of the tree at a point in \em simulation coordinates
 
         /// Only the invoking process will get the result via the
@@ -3351,7 +3668,7 @@ namespace madness {
 
                             if (result.normf() > tol*0.3) {
                                 Key<NDIM> dest(n,lnew);
-                                coeffs.task(dest, &nodeT::accumulate2, result, coeffs, dest, TaskAttributes::hipri());
+                                coeffs.task(dest, &nodeT::accumulate2, handover(result), coeffs, dest, TaskAttributes::hipri());
                             }
                         }
                         else {
@@ -3822,6 +4139,12 @@ namespace madness {
 
         T eval_cube(Level n, coordT& x, const tensorT& c) const;
 
+        /// Evaluate the function at many points in the box at level n with coeffs c
+
+        /// The last dimension is contracted for all points in one matrix
+        /// multiplication, and the others point by point.
+        std::vector<T> eval_cube(Level n, const std::vector<coordT>& x, const tensorT& c) const;
+
         /// Transform sum coefficients at level n to sums+differences at level n-1
 
         /// Given scaling function coefficients s[n][l][i] and s[n][l+1][i]
@@ -3968,6 +4291,34 @@ namespace madness {
         // Invoked on node where key is local
         Future<coeffT > compress_spawn(const keyT& key, bool nonstandard, bool keepleaves, bool redundant);
 
+        /// compress, truncate and compute the norm tree in one sweep of a reconstructed tree
+
+        /// The result is the same as from norm_tree(), compress(false,false,false)
+        /// and truncate(tol) in sequence, but each node is visited once.
+        /// If tol<=0 the default value of this->thresh is used.
+        void compress_truncate(double tol, bool fence);
+
+        /// What compress_truncate_spawn returns to the parent of a node
+        struct compress_truncate_result {
+            coeffT s;       ///< sum coefficients of the node
+            double norm;    ///< norm of the function in the node
+            bool has_coeff; ///< the node has coefficients after truncation
+            compress_truncate_result() : norm(0.0), has_coeff(false) {}
+            compress_truncate_result(const coeffT& s, double norm, bool has_coeff)
+                : s(s), norm(norm), has_coeff(has_coeff) {}
+            template <typename Archive>
+            void serialize(const Archive& ar) {
+                ar & s & norm & has_coeff;
+            }
+        };
+
+        // Invoked on node where key is local
+        Future<compress_truncate_result> compress_truncate_spawn(const keyT& key, double tol);
+
+        /// compress_op, norm_tree_op and truncate_op for one node, given its children
+        compress_truncate_result compress_truncate_op(const keyT& key, double tol,
+                                                      const std::vector< Future<compress_truncate_result> >& v);
+
         /// convert this to redundant, i.e. have sum coefficients on all levels
         void make_redundant(const bool fence);
 
@@ -4075,14 +4426,14 @@ namespace madness {
             // and also to ensure we don't needlessly widen the tree when
             // applying the operator
             if (result.normf()> 0.3*args.tol/args.fac) {
-                Future<double> time=coeffs.task(args.dest, &nodeT::accumulate2, result, coeffs, args.dest, TaskAttributes::hipri());
+                Future<double> time=coeffs.task(args.dest, &nodeT::accumulate2, handover(result), coeffs, args.dest, TaskAttributes::hipri());
                 //woT::task(world.rank(),&implT::accumulate_timer,time,TaskAttributes::hipri());
                 // UGLY BUT ADDED THE OPTIMIZATION BACK IN HERE EXPLICITLY/
                 if (args.dest == world.rank()) {
-                    coeffs.send(args.dest, &nodeT::accumulate, result, coeffs, args.dest);
+                    coeffs.send(args.dest, &nodeT::accumulate, handover(result), coeffs, args.dest);
                 }
                 else {
-                    coeffs.task(args.dest, &nodeT::accumulate, result, coeffs, args.dest, TaskAttributes::hipri());
+                    coeffs.task(args.dest, &nodeT::accumulate, handover(result), coeffs, args.dest, TaskAttributes::hipri());
                 }
             }
         }
@@ -4111,11 +4462,12 @@ namespace madness {
                 small++;
                 //double cpu0=cpu_time();
                 coeffT result=coeffT(result_full,apply_targs);
-                MADNESS_ASSERT(result.tensor_type()==TT_FULL or result.tensor_type()==TT_2D);
+                MADNESS_ASSERT(result.tensor_type()==TT_FULL or result.tensor_type()==TT_2D
+                        or result.tensor_type()==TT_TENSORTRAIN);
                 //double cpu1=cpu_time();
                 //timer_lr_result.accumulate(cpu1-cpu0);
 
-                Future<double> time=coeffs.task(args.dest, &nodeT::accumulate, result, coeffs, args.dest, apply_targs,
+                Future<double> time=coeffs.task(args.dest, &nodeT::accumulate, handover(result), coeffs, args.dest, apply_targs,
                                                 TaskAttributes::hipri());
 
                 //woT::task(world.rank(),&implT::accumulate_timer,time,TaskAttributes::hipri());
@@ -4150,7 +4502,7 @@ namespace madness {
                 small++;
 
                 // accumulate also expects result in SVD form
-                Future<double> time=coeffs.task(args.dest, &nodeT::accumulate, result, coeffs, args.dest, apply_targs,
+                Future<double> time=coeffs.task(args.dest, &nodeT::accumulate, handover(result), coeffs, args.dest, apply_targs,
                                                 TaskAttributes::hipri());
                 //woT::task(world.rank(),&implT::accumulate_timer,time,TaskAttributes::hipri());
 
@@ -4213,7 +4565,7 @@ namespace madness {
                         // } else {
                             tensorT result = op->apply(source, *it, c, tol/fac/cnorm);
                             if (result.normf()> 0.3*tol/fac) {
-                                coeffs.task(dest, &nodeT::accumulate2, result, coeffs, dest, TaskAttributes::hipri());
+                                coeffs.task(dest, &nodeT::accumulate2, handover(result), coeffs, dest, TaskAttributes::hipri());
                             }
                         // }
                     } else if (d.distsq() >= 1)
@@ -4250,6 +4602,166 @@ namespace madness {
 
         }
 
+        /// accumulate the results of do_apply_batch at one node of several functions
+
+        /// @param[in]  key     the destination node, which is local
+        /// @param[in]  result  the functions to accumulate into
+        /// @param[in]  t       the tensor to add to each of them
+        void accumulate_batch(const keyT& key, const std::vector<implT*>& result,
+                              const std::vector<tensorT>& t) {
+            for (std::size_t i=0; i<result.size(); ++i) {
+                typename dcT::accessor acc;
+                result[i]->coeffs.insert(acc, key);
+                acc->second.accumulate2(t[i], result[i]->coeffs, key);
+            }
+        }
+
+        /// orders indices of coeffs by decreasing cnorm/tol
+        struct by_accuracy {
+            const std::vector<double>& cnorm;
+            const std::vector<double>& tol;
+            by_accuracy(const std::vector<double>& cnorm, const std::vector<double>& tol)
+                : cnorm(cnorm), tol(tol) {}
+            bool operator()(std::size_t i, std::size_t j) const {
+                return cnorm[i]*tol[j] > cnorm[j]*tol[i];
+            }
+        };
+
+        /// apply an operator on the coeffs of several functions at the same node
+
+        /// Same as do_apply for each of the functions, but the displacements are
+        /// screened and the operator applied for all of them at once, and the
+        /// results for a destination are sent in one message.
+        /// @param[in]  op      the operator to act on the source functions
+        /// @param[in]  key     key of the source nodes
+        /// @param[in]  result  the functions to accumulate into, with the same process map as this
+        /// @param[in]  c       coeffs of the source nodes, one for each of result
+        template <typename opT, typename R>
+        void do_apply_batch(const opT* op, const keyT& key, const std::vector<implT*>& result,
+                            const std::vector< Tensor<R> >& c) {
+            PROFILE_MEMBER_FUNC(FunctionImpl);
+
+            typedef typename opT::keyT opkeyT;
+            static const size_t opdim=opT::opdim;
+
+            const opkeyT source=op->get_source_key(key);
+            const double fac = 10.0; // see do_apply
+            const std::size_t nf = c.size();
+
+            std::vector<double> cnorm(nf), tol(nf);
+            for (std::size_t i=0; i<nf; ++i) {
+                cnorm[i] = c[i].normf();
+                tol[i] = result[i]->truncate_tol(result[i]->thresh, key);
+            }
+            std::vector<bool> done(nf, false);
+            std::size_t ndone = 0;
+
+            const std::vector<opkeyT>& disp = op->get_disp(key.level());
+            const std::vector<bool> is_periodic(NDIM,false); // Periodic sum is already done when making rnlp
+
+            std::vector<const Tensor<R>*> batch;
+            std::vector<std::size_t> which;
+            for (typename std::vector<opkeyT>::const_iterator it=disp.begin(); it != disp.end() && ndone < nf; ++it) {
+                keyT d;
+                Key<NDIM-opdim> nullkey(key.level());
+                if (op->particle()==1) d=it->merge_with(nullkey);
+                if (op->particle()==2) d=nullkey.merge_with(*it);
+
+                keyT dest = neighbor(key, d, is_periodic);
+                if (!dest.is_valid()) continue;
+
+                double opnorm = op->norm(key.level(), *it, source);
+                which.clear();
+                for (std::size_t i=0; i<nf; ++i) {
+                    if (done[i]) continue;
+                    if (cnorm[i]*opnorm > tol[i]/fac) {
+                        which.push_back(i);
+                    }
+                    else if (d.distsq() >= 1) {
+                        done[i] = true; // Assumes monotonic decay beyond nearest neighbor
+                        ++ndone;
+                    }
+                }
+
+                // The accuracy of a batch is set by its first coeffs, so batch
+                // only coeffs that need about the same accuracy
+                std::sort(which.begin(), which.end(), by_accuracy(cnorm, tol));
+                std::vector<implT*> to;
+                std::vector<tensorT> t;
+                for (std::size_t lo=0, hi=0; lo<which.size(); lo=hi) {
+                    const double cmax = cnorm[which[lo]]/tol[which[lo]];
+                    batch.clear();
+                    for (hi=lo; hi<which.size() && cnorm[which[hi]]/tol[which[hi]] > 0.5*cmax; ++hi)
+                        batch.push_back(&c[which[hi]]);
+
+                    std::vector<tensorT> r = op->apply_batch(source, *it, batch, 1.0/(fac*cmax));
+                    for (std::size_t j=0; j<r.size(); ++j) {
+                        if (r[j].normf() > 0.3*tol[which[lo+j]]/fac) {
+                            to.push_back(result[which[lo+j]]);
+                            t.push_back(r[j]);
+                        }
+                    }
+                }
+                if (!to.empty()) {
+                    woT::task(coeffs.owner(dest), &implT::accumulate_batch, dest, to, t, TaskAttributes::hipri());
+                }
+            }
+        }
+
+        /// apply an operator on several functions, this being the first result
+
+        /// The coeffs of all functions at the same node are processed together in
+        /// do_apply_batch, in batches of at most max_batch functions.  The tasks
+        /// refer to all results by id, so the results must have been made on all
+        /// processes (i.e. fenced) before this is called.
+        /// @param[in]  op      the operator to act on the source functions
+        /// @param[in]  f       the source functions in non-standard form, all with the process map of this
+        /// @param[in]  result  the result functions with result[0]==this, all with the process map of this
+        template <typename opT, typename R>
+        void apply_batch(opT& op, const std::vector<const FunctionImpl<R,NDIM>*>& f,
+                         const std::vector<implT*>& result, bool fence) {
+            PROFILE_MEMBER_FUNC(FunctionImpl);
+            MADNESS_ASSERT(!op.modified());
+            MADNESS_ASSERT(f.size()==result.size() && !f.empty() && result[0]==this);
+            const std::size_t max_batch = 64;
+
+            typedef std::pair< std::vector<implT*>, std::vector< Tensor<R> > > batchT;
+            std::map<keyT,batchT> batches;
+            for (std::size_t i=0; i<f.size(); ++i) {
+                MADNESS_ASSERT(f[i]->coeffs.get_pmap() == coeffs.get_pmap());
+                MADNESS_ASSERT(result[i]->coeffs.get_pmap() == coeffs.get_pmap());
+                typename FunctionImpl<R,NDIM>::dcT::const_iterator end = f[i]->coeffs.end();
+                for (typename FunctionImpl<R,NDIM>::dcT::const_iterator it=f[i]->coeffs.begin(); it!=end; ++it) {
+                    const FunctionNode<R,NDIM>& node = it->second;
+                    if (node.has_coeff() && (node.coeff().dim(0) != k || op.doleaves)) {
+                        batchT& b = batches[it->first];
+                        b.first.push_back(result[i]);
+                        b.second.push_back(node.coeff().reconstruct_tensor());
+                    }
+                }
+            }
+
+            for (typename std::map<keyT,batchT>::const_iterator it=batches.begin(); it!=batches.end(); ++it) {
+                const keyT& key = it->first;
+                const batchT& b = it->second;
+                for (std::size_t lo=0; lo<b.first.size(); lo+=max_batch) {
+                    const std::size_t hi = std::min(lo+max_batch, b.first.size());
+                    ProcessID p = FunctionDefaults<NDIM>::get_apply_randomize() ? world.random_proc() : coeffs.owner(key);
+                    woT::task(p, &implT:: template do_apply_batch<opT,R>, &op, key,
+                              std::vector<implT*>(b.first.begin()+lo, b.first.begin()+hi),
+                              std::vector< Tensor<R> >(b.second.begin()+lo, b.second.begin()+hi));
+                }
+            }
+            if (fence)
+                world.gop.fence();
+
+            for (std::size_t i=0; i<result.size(); ++i) {
+                result[i]->compressed=true;
+                result[i]->nonstandard=true;
+                result[i]->redundant=false;
+            }
+        }
+
         /// apply an operator on the coeffs c (at node key)
 
         /// invoked by result; the result is accumulated inplace to this's tree at various FunctionNodes
@@ -4641,7 +5153,8 @@ namespace madness {
             std::vector<long> vq(NDIM);
             for (std::size_t i=0; i<NDIM; ++i)
                 vq[i] = npt;
-            tensorT fval(vq,false), work(vq,false), result(vq,false);
+            TensorArena::Scope scope;
+            TensorView<T> fval(vq,false), work(vq,false), result(vq,false);
 
             // Compute the "exact" function in this volume at npt points
             // where npt is usually this->npt+1.
@@ -4654,7 +5167,7 @@ namespace madness {
             // Subtract to get the error ... the original coeffs are in the order k
             // basis but we just computed the coeffs in the order npt(=k+1) basis
             // so we can either use slices or an iterator macro.
-            const tensorT coeff = node.coeff().full_tensor_copy();
+            const tensorT coeff = node.coeff_value().full_tensor_copy();
             ITERATOR(coeff,fval(IND)-=coeff(IND););
             // flo note: we do want to keep a full tensor here!
 
@@ -4722,7 +5235,7 @@ namespace madness {
             double operator()(typename dcT::const_iterator& it) const {
                 const nodeT& node = it->second;
                 if (node.has_coeff()) {
-                    double norm = node.coeff().normf();
+                    double norm = node.coeff_value().normf();
                     return norm*norm;
                 }
                 else {
@@ -4761,16 +5274,18 @@ namespace madness {
                     if (other->coeffs.probe(it->first)) {
                         const FunctionNode<R,NDIM>& gnode = other->coeffs.find(key).get()->second;
                         if (gnode.has_coeff()) {
-                            if (gnode.coeff().dim(0) != fnode.coeff().dim(0)) {
-                                madness::print("INNER", it->first, gnode.coeff().dim(0),fnode.coeff().dim(0));
+                            const coeffT fc = fnode.coeff_value();
+                            const GenTensor<R> gc = gnode.coeff_value();
+                            if (gc.dim(0) != fc.dim(0)) {
+                                madness::print("INNER", it->first, gc.dim(0),fc.dim(0));
                                 MADNESS_EXCEPTION("functions have different k or compress/reconstruct error", 0);
                             }
                             if (leaves_only) {
                                 if (gnode.is_leaf() or fnode.is_leaf()) {
-                                    sum += fnode.coeff().trace_conj(gnode.coeff());
+                                    sum += fc.trace_conj(gc);
                                 }
                             } else {
-                                sum += fnode.coeff().trace_conj(gnode.coeff());
+                                sum += fc.trace_conj(gc);
                             }
                         }
                     }
@@ -4854,6 +5369,8 @@ namespace madness {
                 if (rit != rmap_ptr->end()) {
                     const mapvecT& leftv = lit->second;
                     const typename FunctionImpl<R,NDIM>::mapvecT& rightv =rit->second;
+                    if (inner_local_gemm(leftv, rightv, sym, r)) continue;
+
                     const int nleft = leftv.size();
                     const int nright= rightv.size();
 
@@ -4876,6 +5393,96 @@ namespace madness {
             mutex->unlock();
         }
 
+        /// Inner products of functions with differing types are done pairwise by do_inner_localX
+        template <typename R, typename resultT>
+        static bool inner_local_gemm(const mapvecT& leftv,
+                                     const std::vector< std::pair<int,const GenTensor<R>*> >& rightv,
+                                     const bool sym,
+                                     Tensor<resultT>& result) {
+            return false;
+        }
+
+        /// Gathers the coefficients of a pair of index vectors into (nfunc,ncoeff) panels
+
+        /// The entries are ordered by function index.  Returns false if the
+        /// coefficients are not all full rank, contiguous and of the same size.
+        static bool make_inner_panel(const mapvecT& v, std::vector<int>& index, Tensor<T>& panel) {
+            const long n = v.size();
+            const long size = v[0].second->size();
+            std::vector< std::pair<int,const coeffT*> > sorted(v);
+            std::sort(sorted.begin(), sorted.end(),
+                      [](const std::pair<int,const coeffT*>& a, const std::pair<int,const coeffT*>& b)
+                      {return a.first < b.first;});
+
+            index.resize(n);
+            const long dims[2] = {n, size};
+            panel = Tensor<T>(2, dims, false);
+            for (long i=0; i<n; ++i) {
+                const coeffT& c = *(sorted[i].second);
+                if (c.tensor_type() != TT_FULL) return false;
+                const Tensor<T> t = c.full_tensor();
+                if (t.size() != size || !t.iscontiguous()) return false;
+                index[i] = sorted[i].first;
+                std::memcpy(panel.ptr() + i*size, t.ptr(), size*sizeof(T));
+            }
+            return true;
+        }
+
+        /// Accumulates the inner products of all functions at one key with blocked gemm
+
+        /// The coefficients of the functions present at the key are gathered
+        /// into (nfunc,ncoeff) panels and the block \f$ A^\dagger B \f$ is
+        /// computed with one gemm.  If \c sym only blocks on or above the
+        /// diagonal in function index are computed, roughly halving the work.
+        /// Returns false, without touching the result, if the coefficients
+        /// cannot be gathered into panels.
+        static bool inner_local_gemm(const mapvecT& leftv,
+                                     const mapvecT& rightv,
+                                     const bool sym,
+                                     Tensor<T>& result) {
+            const long nleft = leftv.size();
+            const long nright = rightv.size();
+            if (nleft*nright < 4) return false;
+
+            std::vector<int> ileft, iright;
+            Tensor<T> a, b;
+            if (!make_inner_panel(leftv, ileft, a)) return false;
+            if (&leftv == &rightv) {
+                iright = ileft;
+                b = a;
+            }
+            else if (!make_inner_panel(rightv, iright, b)) {
+                return false;
+            }
+            const long size = a.dim(1);
+            if (b.dim(1) != size) return false;
+
+            const cblas::CBLAS_TRANSPOSE opa = TensorTypeData<T>::iscomplex ? cblas::ConjTrans : cblas::Trans;
+            const long nblock = sym ? 128 : std::max(nleft, nright);
+            Tensor<T> c(std::min(nblock,nleft)*std::min(nblock,nright));
+            for (long ilo=0; ilo<nleft; ilo+=nblock) {
+                const long ni = std::min(nblock, nleft-ilo);
+                for (long jlo=0; jlo<nright; jlo+=nblock) {
+                    const long nj = std::min(nblock, nright-jlo);
+                    // Entries are sorted so the whole block is below the diagonal
+                    if (sym && ileft[ilo] > iright[jlo+nj-1]) continue;
+
+                    // c(i,j) in column-major order is the inner product of ileft[ilo+i] and iright[jlo+j]
+                    cblas::gemm(opa, cblas::NoTrans, ni, nj, size, T(1.0),
+                                a.ptr()+ilo*size, size, b.ptr()+jlo*size, size,
+                                T(0.0), c.ptr(), ni);
+                    for (long j=0; j<nj; ++j) {
+                        const int jj = iright[jlo+j];
+                        for (long i=0; i<ni; ++i) {
+                            const int ii = ileft[ilo+i];
+                            if (!sym || ii<=jj) result(ii,jj) += c.ptr()[i+j*ni];
+                        }
+                    }
+                }
+            }
+            return true;
+        }
+
         static double conj(double x) {
             return x;
         }
@@ -4897,14 +5504,11 @@ namespace madness {
             // This is basically a sparse matrix^T * matrix product
             // Rij = sum(k) Aki * Bkj
             // where i and j index functions and k index the wavelet coeffs
-            // eventually the goal is this structure (don't have jtile yet)
             //
             // do in parallel tiles of k (tensors of coeffs)
-            //    do tiles of j
-            //       do i
-            //          do j in jtile
-            //             do k in ktile
-            //                Rij += Aki*Bkj
+            //    gather the functions present at k into panels
+            //    do tiles of i and j (upper triangle only if sym)
+            //       Rij += Aki*Bkj with one gemm
 
             mapT lmap = make_key_vec_map(left);
             typename FunctionImpl<R,NDIM>::mapT rmap;
@@ -4928,6 +5532,20 @@ namespace madness {
             }
             left[0]->world.taskq.fence();
 
+            // The maps promoted the local coeffs ... return them to their storage precision
+            bool demoted = false;
+            for (std::size_t i=0; i<left.size(); ++i) {
+                if (left[i]->get_storage_precision() != SP_FLOAT) continue;
+                const_cast<FunctionImpl<T,NDIM>*>(left[i])->demote_coeffs(false);
+                demoted = true;
+            }
+            for (std::size_t j=0; j<right.size(); ++j) {
+                if (right[j]->get_storage_precision() != SP_FLOAT) continue;
+                const_cast<FunctionImpl<R,NDIM>*>(right[j])->demote_coeffs(false);
+                demoted = true;
+            }
+            if (demoted) left[0]->world.taskq.fence();
+
             if (sym) {
                 for (long i=0; i<r.dim(0); i++) {
                     for (long j=0; j<i; j++) {
@@ -5366,7 +5984,7 @@ namespace madness {
                 }
 
                 // accumulate the result
-                result->coeffs.task(dest, &FunctionNode<T,LDIM>::accumulate2, final, result->coeffs, dest, TaskAttributes::hipri());
+                result->coeffs.task(dest, &FunctionNode<T,LDIM>::accumulate2, handover(final), result->coeffs, dest, TaskAttributes::hipri());
 
                 return Future<argT> (argT(fnode.is_leaf(),coeffT()));
             }
@@ -5492,7 +6110,7 @@ namespace madness {
             }
 
             // accumulate the result
-            coeffs.task(dest, &nodeT::accumulate2, result, coeffs, dest, TaskAttributes::hipri());
+            coeffs.task(dest, &nodeT::accumulate2, handover(result), coeffs, dest, TaskAttributes::hipri());
         }
 
 
@@ -95,6 +95,7 @@ namespace madness {
         bool _fence;
         bool _is_on_demand;
         bool _compressed;
+        StoragePrecision _storage_precision;
         //Tensor<int> _bc;
         std::shared_ptr<WorldDCPmapInterface<Key<NDIM> > > _pmap;
         
@@ -126,6 +127,7 @@ namespace madness {
             _fence(true), // _bc(FunctionDefaults<NDIM>::get_bc()),
             _is_on_demand(false),
             _compressed(false),
+            _storage_precision(FunctionDefaults<NDIM>::get_storage_precision()),
             _pmap(FunctionDefaults<NDIM>::get_pmap()), _functor() {
         }
         virtual ~FunctionFactory() {};
@@ -238,6 +240,11 @@ namespace madness {
             return self();
         }
         FunctionFactory&
+        storage_precision(StoragePrecision value) {
+            _storage_precision = value;
+            return self();
+        }
+        FunctionFactory&
         pmap(const std::shared_ptr<WorldDCPmapInterface<Key<NDIM> > >& pmap) {
             _pmap = pmap;
             return self();
@@ -70,6 +70,7 @@ namespace madness {
 #include <madness/mra/funcdefaults.h>
 #include <madness/mra/function_factory.h>
 #include <madness/mra/lbdeux.h>
+#include <madness/mra/sfcpmap.h>
 #include <madness/mra/funcimpl.h>
 
 // some forward declarations
@@ -135,6 +136,7 @@ namespace madness {
         /// Asserts that the function is initialized
         inline void verify() const {
             MADNESS_ASSERT(impl);
+            MADNESS_ASSERT(!impl->is_packed());
         }
 
         /// Returns true if the function is initialized
@@ -207,6 +209,47 @@ namespace madness {
             return result;
         }
 
+        /// Evaluates the function at many points in user coordinates.  Possible non-blocking comm.
+
+        /// Only the invoking process will receive the values (in the
+        /// order of the points) via the future.  The points travel down
+        /// the tree in batches, split among the children at each level,
+        /// so each box is visited once for all points in it and all
+        /// points in a leaf box are evaluated together.  Each leaf sends
+        /// its values straight back to the invoking process.  Much more
+        /// efficient than calling eval() for each point.
+        ///
+        /// Throws if function is not initialized.
+        Future< std::vector<T> > eval_many(const std::vector<coordT>& xuser) const {
+            PROFILE_MEMBER_FUNC(Function);
+            const double eps=1e-15;
+            verify();
+            MADNESS_ASSERT(!is_compressed());
+            std::vector<coordT> xsim(xuser.size());
+            for (std::size_t i=0; i<xuser.size(); ++i) {
+                user_to_sim(xuser[i],xsim[i]);
+                // If on the boundary, move the point just inside the
+                // volume so that the evaluation logic does not fail
+                for (std::size_t d=0; d<NDIM; ++d) {
+                    if (xsim[i][d] < -eps) {
+                        MADNESS_EXCEPTION("eval_many: coordinate lower-bound error in dimension", d);
+                    }
+                    else if (xsim[i][d] < eps) {
+                        xsim[i][d] = eps;
+                    }
+
+                    if (xsim[i][d] > 1.0+eps) {
+                        MADNESS_EXCEPTION("eval_many: coordinate upper-bound error in dimension", d);
+                    }
+                    else if (xsim[i][d] > 1.0-eps) {
+                        xsim[i][d] = 1.0-eps;
+                    }
+                }
+            }
+            if (xsim.empty()) return Future< std::vector<T> >(std::vector<T>());
+            return impl->eval_many(xsim);
+        }
+
         /// Evaluate function only if point is local returning (true,value); otherwise return (false,0.0)
 
         /// maxlevel is the maximum depth to search down to --- the max local depth can be
@@ -552,6 +595,29 @@ namespace madness {
         }
 
 
+        /// Returns the precision in which the coefficients are held between operations.  No communication.
+        StoragePrecision get_storage_precision() const {
+            PROFILE_MEMBER_FUNC(Function);
+            verify();
+            return impl->get_storage_precision();
+        }
+
+
+        /// Sets the storage precision and converts the coefficients accordingly.  Optional global fence.
+
+        /// With SP_FLOAT the coefficients are held in single precision
+        /// whenever the function is at rest, i.e., after construction,
+        /// compress(), reconstruct() and truncate() with fence, and are
+        /// converted back to T node by node when next used.
+        void set_storage_precision(StoragePrecision value, bool fence = true) {
+            PROFILE_MEMBER_FUNC(Function);
+            verify();
+            impl->set_storage_precision(value);
+            if (value == SP_FLOAT) impl->demote_coeffs(fence);
+            else impl->promote_coeffs(fence);
+        }
+
+
         /// Returns the number of multiwavelets (k).  No communication.
         int k() const {
             PROFILE_MEMBER_FUNC(Function);
@@ -575,11 +641,31 @@ namespace madness {
             verify();
 //            if (!is_compressed()) compress();
             impl->truncate(tol,fence);
+            if (fence) impl->demote_coeffs(true);
             if (VERIFY_TREE) verify_tree();
             return *this;
         }
 
 
+        /// Compresses and truncates the function, and computes its norm tree, in one sweep
+
+        /// Same as norm_tree(), compress() and truncate(tol) in sequence,
+        /// but each node of the tree is visited once.  A compressed
+        /// function is reconstructed first.
+        ///
+        /// If tol<=0 the default truncation threshold is used.
+        Function<T,NDIM>& compress_truncate(double tol = 0.0, bool fence = true) {
+            PROFILE_MEMBER_FUNC(Function);
+            if (!impl) return *this;
+            verify();
+            if (is_compressed()) reconstruct();
+            if (VERIFY_TREE) verify_tree();
+            impl->compress_truncate(tol,fence);
+            if (fence) impl->demote_coeffs(true);
+            return *this;
+        }
+
+
         /// Returns a shared-pointer to the implementation
         const std::shared_ptr< FunctionImpl<T,NDIM> >& get_impl() const {
             PROFILE_MEMBER_FUNC(Function);
@@ -680,6 +766,7 @@ namespace madness {
             if (!impl || is_compressed()) return *this;
             if (VERIFY_TREE) verify_tree();
             const_cast<Function<T,NDIM>*>(this)->impl->compress(false, false, false, fence);
+            if (fence) impl->demote_coeffs(true);
             return *this;
         }
 
@@ -732,10 +819,54 @@ namespace madness {
             PROFILE_MEMBER_FUNC(Function);
             if (!impl || !is_compressed()) return;
             const_cast<Function<T,NDIM>*>(this)->impl->reconstruct(fence);
+            if (fence) impl->demote_coeffs(true);
             if (fence && VERIFY_TREE) verify_tree(); // Must be after in case nonstandard
         }
 
 
+        /// Packs an inactive function into a compact buffer until unpack().  Optional global fence.
+
+        /// The function is compressed and the coefficients of each node are
+        /// rounded such that the error of the node is at most half of the
+        /// truncation tolerance derived from tol, so the error is comparable
+        /// to that of truncate(tol).  They are then encoded into a byte buffer
+        /// in which coefficients below the threshold take next to no space
+        /// (see PackedCoeffs) and the tree is freed.  If tol is less than or
+        /// equal to zero the truncation threshold of the function is used.
+        ///
+        /// The packed function must not be used in any other way until it is
+        /// unpacked.  Noop if already packed or if not initialized.
+        void pack(double tol = 0.0, bool fence = true) {
+            PROFILE_MEMBER_FUNC(Function);
+            if (!impl || impl->is_packed()) return;
+            const bool reconstruct = !is_compressed();
+            compress();
+            impl->pack(tol, reconstruct, fence);
+        }
+
+
+        /// Restores a packed function into the state it was packed in.  Optional global fence.
+
+        /// Noop if not packed or if not initialized.  If the function was
+        /// reconstructed when packed, it is reconstructed again, which
+        /// needs the nodes of all processes in place and hence a fence
+        /// on more than one process even if fence is false.
+        void unpack(bool fence = true) {
+            PROFILE_MEMBER_FUNC(Function);
+            if (!impl || !impl->is_packed()) return;
+            const bool sync = fence || (impl->get_unpack_reconstructs() && impl->world.size() > 1);
+            if (impl->unpack(sync)) reconstruct(fence);
+            else impl->demote_coeffs(fence);
+        }
+
+
+        /// Returns true if the function is packed.  No communication.
+        bool is_packed() const {
+            PROFILE_MEMBER_FUNC(Function);
+            return impl && impl->is_packed();
+        }
+
+
         /// Sums scaling coeffs down tree restoring state with coeffs only at leaves.  Optional fence.  Possible non-blocking comm.
         void sum_down(bool fence = true) const {
             PROFILE_MEMBER_FUNC(Function);
@@ -1161,6 +1292,13 @@ namespace madness {
             if (g.get_impl()->is_redundant()) g.get_impl()->undo_redundant(false);
             impl->world.gop.fence();
 
+            // compress and make_redundant above leave new nodes in T
+            if (impl->get_storage_precision() == SP_FLOAT || g.get_storage_precision() == SP_FLOAT) {
+                impl->demote_coeffs(false);
+                g.get_impl()->demote_coeffs(false);
+                impl->world.gop.fence();
+            }
+
             return local;
         }
 
@@ -2290,6 +2428,20 @@ namespace madness {
                 f.store(ar);
             }
         };
+
+        template <class T, std::size_t NDIM>
+        struct ArchiveLoadImpl< SingleFileInputArchive, Function<T,NDIM> > {
+            static inline void load(const SingleFileInputArchive& ar, Function<T,NDIM>& f) {
+                f.load(*ar.get_world(), ar);
+            }
+        };
+
+        template <class T, std::size_t NDIM>
+        struct ArchiveStoreImpl< SingleFileOutputArchive, Function<T,NDIM> > {
+            static inline void store(const SingleFileOutputArchive& ar, const Function<T,NDIM>& f) {
+                f.store(ar);
+            }
+        };
     }
 
 
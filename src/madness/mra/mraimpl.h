@@ -43,6 +43,7 @@
 #include <madness/world/world_object.h>
 #include <madness/world/worlddc.h>
 #include <madness/world/worldhashmap.h>
+#include <madness/world/vector_archive.h>
 #include <madness/mra/function_common_data.h>
 
 #include <madness/mra/funcimpl.h>
@@ -284,6 +285,23 @@ namespace madness {
     template <typename T, std::size_t NDIM>
     TensorArgs FunctionImpl<T,NDIM>::get_tensor_args() const {return targs;}
 
+    template <typename T, std::size_t NDIM>
+    StoragePrecision FunctionImpl<T,NDIM>::get_storage_precision() const {return storage_precision;}
+
+    template <typename T, std::size_t NDIM>
+    void FunctionImpl<T,NDIM>::set_storage_precision(StoragePrecision value) {storage_precision = value;}
+
+    template <typename T, std::size_t NDIM>
+    void FunctionImpl<T,NDIM>::demote_coeffs(bool fence) {
+        if (storage_precision != SP_FLOAT) return;
+        flo_unary_op_node_inplace(do_convert_storage(false),fence);
+    }
+
+    template <typename T, std::size_t NDIM>
+    void FunctionImpl<T,NDIM>::promote_coeffs(bool fence) {
+        flo_unary_op_node_inplace(do_convert_storage(true),fence);
+    }
+
     template <typename T, std::size_t NDIM>
     double FunctionImpl<T,NDIM>::get_thresh() const {return thresh;}
 
@@ -1190,8 +1208,9 @@ namespace madness {
     /// No communication involved.
     template <typename T, std::size_t NDIM>
     typename FunctionImpl<T,NDIM>::tensorT FunctionImpl<T,NDIM>::filter(const tensorT& s) const {
+        TensorArena::Scope scope;
         tensorT r(cdata.v2k,false);
-        tensorT w(cdata.v2k,false);
+        TensorView<T> w(cdata.v2k,false);
         return fast_transform(s,cdata.hgT,r,w);
         //return transform(s,cdata.hgT);
     }
@@ -1219,8 +1238,9 @@ namespace madness {
     /// No communication involved.
     template <typename T, std::size_t NDIM>
     typename FunctionImpl<T,NDIM>::tensorT FunctionImpl<T,NDIM>::unfilter(const tensorT& s) const {
+        TensorArena::Scope scope;
         tensorT r(cdata.v2k,false);
-        tensorT w(cdata.v2k,false);
+        TensorView<T> w(cdata.v2k,false);
         return fast_transform(s,cdata.hg,r,w);
         //return transform(s, cdata.hg);
     }
@@ -1482,6 +1502,100 @@ namespace madness {
             world.gop.fence();
     }
 
+    template <typename T, std::size_t NDIM>
+    void FunctionImpl<T,NDIM>::compress_truncate(double tol, bool fence) {
+        MADNESS_ASSERT(not is_compressed());
+        MADNESS_ASSERT(not is_redundant());
+        // Cannot put tol into object since it would make a race condition
+        if (tol <= 0.0)
+            tol = thresh;
+        // Must set true here so that successive calls without fence do the right thing
+        this->compressed = true;
+        this->nonstandard = false;
+        this->redundant = false;
+
+        if (world.rank() == coeffs.owner(cdata.key0))
+            compress_truncate_spawn(cdata.key0, tol);
+        if (fence)
+            world.gop.fence();
+    }
+
+    template <typename T, std::size_t NDIM>
+    Future<typename FunctionImpl<T,NDIM>::compress_truncate_result>
+    FunctionImpl<T,NDIM>::compress_truncate_spawn(const keyT& key, double tol) {
+        nodeT& node = coeffs.find(key).get()->second;
+        if (node.has_children()) {
+            std::vector< Future<compress_truncate_result> > v = future_vector_factory<compress_truncate_result>(1<<NDIM);
+            int i=0;
+            for (KeyChildIterator<NDIM> kit(key); kit; ++kit,++i) {
+                v[i] = woT::task(coeffs.owner(kit.key()), &implT::compress_truncate_spawn, kit.key(),
+                                 tol, TaskAttributes::hipri());
+            }
+            return woT::task(world.rank(), &implT::compress_truncate_op, key, tol, v);
+        }
+        else {
+            // Leaves pass their sum coeffs up and have no coeffs in compressed form
+            const double norm = node.coeff().normf();
+            node.set_norm_tree(norm);
+            Future<compress_truncate_result> result(compress_truncate_result(node.coeff(), norm, false));
+            node.clear_coeff();
+            return result;
+        }
+    }
+
+    template <typename T, std::size_t NDIM>
+    typename FunctionImpl<T,NDIM>::compress_truncate_result
+    FunctionImpl<T,NDIM>::compress_truncate_op(const keyT& key, double tol,
+                                               const std::vector< Future<compress_truncate_result> >& v) {
+        double cpu0=cpu_time();
+        // Copy child scaling coeffs into contiguous block, and sum the norms
+        tensorT d(cdata.v2k);
+        double norm = 0.0;
+        bool child_has_coeff = false;
+        int i=0;
+        for (KeyChildIterator<NDIM> kit(key); kit; ++kit,++i) {
+            const compress_truncate_result& r = v[i].get();
+            d(child_patch(kit.key())) += r.s.full_tensor_copy();
+            norm += r.norm*r.norm;
+            child_has_coeff = child_has_coeff || r.has_coeff;
+        }
+        norm = sqrt(norm);
+
+        d = filter(d);
+        double cpu1=cpu_time();
+        timer_filter.accumulate(cpu1-cpu0);
+        cpu0=cpu1;
+
+        typename dcT::accessor acc;
+        MADNESS_ASSERT(coeffs.find(acc, key));
+        nodeT& node = acc->second;
+        node.set_norm_tree(norm);
+
+        // tighter thresh for internal nodes
+        TensorArgs targs2=targs;
+        targs2.thresh*=0.1;
+
+        // need the deep copy for contiguity
+        coeffT ss=coeffT(copy(d(cdata.s0)),targs2);
+        if (key.level() > 0) d(cdata.s0) = 0.0;
+        coeffT dd=coeffT(d,targs2);
+        cpu1=cpu_time();
+        timer_compress_svd.accumulate(cpu1-cpu0);
+
+        // If any child has coefficients, a parent cannot truncate, and
+        // >1 rather >0 otherwise reconstruct might get confused
+        if (!child_has_coeff && key.level() > 1 && dd.normf() < truncate_tol(tol,key)) {
+            node.clear_coeff();
+            node.set_has_children(false);
+            for (KeyChildIterator<NDIM> kit(key); kit; ++kit) {
+                coeffs.erase(kit.key());
+            }
+            return compress_truncate_result(ss, norm, false);
+        }
+        node.set_coeff(dd);
+        return compress_truncate_result(ss, norm, true);
+    }
+
     /// convert this to redundant, i.e. have sum coefficients on all levels
     template <typename T, std::size_t NDIM>
     void FunctionImpl<T,NDIM>::make_redundant(const bool fence) {
@@ -1848,13 +1962,85 @@ namespace madness {
         typename dcT::const_iterator end = coeffs.end();
         for (typename dcT::const_iterator it=coeffs.begin(); it!=end; ++it) {
             const nodeT& node = it->second;
-            if (node.has_coeff()) sum+=node.coeff().real_size();
+            if (node.has_coeff()) sum+=node.real_size();
         }
         world.gop.sum(sum);
         return sum;
     }
 
 
+    template <typename T, std::size_t NDIM>
+    void FunctionImpl<T,NDIM>::pack(double tol, bool reconstruct, bool fence) {
+        MADNESS_ASSERT(compressed && !packed);
+        if (tol <= 0.0) tol = thresh;
+
+        // Per node: key, children, norm_tree, kind (0=no coeff, 1=encoded, 2=serialized)
+        archive::VectorOutputArchive ar(packed_nodes);
+        std::vector<unsigned char> buf;
+        const std::size_t nnode = coeffs.size();
+        ar & nnode;
+        typename dcT::const_iterator end = coeffs.end();
+        for (typename dcT::const_iterator it=coeffs.begin(); it!=end; ++it) {
+            const keyT& key = it->first;
+            const nodeT& node = it->second;
+            const bool has_children = node.has_children();
+            const double norm_tree = node.get_norm_tree();
+            unsigned char kind = 0;
+            if (node.has_coeff()) kind = (node.coeff().tensor_type() == TT_FULL) ? 1 : 2;
+            ar & key & has_children & norm_tree & kind;
+            if (kind == 1) {
+                buf.clear();
+                PackedCoeffs::encode(tensorT(node.coeff().full_tensor()), truncate_tol(tol,key), buf);
+                ar & buf;
+            }
+            else if (kind == 2) {
+                ar & node.coeff();
+            }
+        }
+        std::vector<unsigned char>(packed_nodes).swap(packed_nodes);
+        coeffs.clear();
+        packed = true;
+        unpack_reconstructs = reconstruct;
+        if (fence) world.gop.fence();
+    }
+
+    template <typename T, std::size_t NDIM>
+    bool FunctionImpl<T,NDIM>::unpack(bool fence) {
+        MADNESS_ASSERT(packed);
+        archive::VectorInputArchive ar(packed_nodes);
+        std::vector<unsigned char> buf;
+        std::size_t nnode;
+        ar & nnode;
+        for (std::size_t i=0; i<nnode; ++i) {
+            keyT key;
+            bool has_children;
+            double norm_tree;
+            unsigned char kind;
+            ar & key & has_children & norm_tree & kind;
+            coeffT coeff;
+            if (kind == 1) {
+                ar & buf;
+                const unsigned char* p = &buf[0];
+                coeff = coeffT(PackedCoeffs::decode<T>(p),-1.0,TT_FULL);
+            }
+            else if (kind == 2) {
+                ar & coeff;
+            }
+            coeffs.replace(key,nodeT(coeff,norm_tree,has_children));
+        }
+        std::vector<unsigned char>().swap(packed_nodes);
+        packed = false;
+        if (fence) world.gop.fence();
+        return unpack_reconstructs;
+    }
+
+    template <typename T, std::size_t NDIM>
+    std::size_t FunctionImpl<T,NDIM>::packed_size() const {
+        std::size_t sum = packed_nodes.size();
+        world.gop.sum(sum);
+        return sum;
+    }
+
     /// print tree size and size
     template <typename T, std::size_t NDIM>
     void FunctionImpl<T,NDIM>::print_size(const std::string name) const {
@@ -1974,6 +2160,119 @@ namespace madness {
         return sum*pow(2.0,0.5*NDIM*n)/sqrt(FunctionDefaults<NDIM>::get_cell_volume());
     }
 
+    template <typename T, std::size_t NDIM>
+    std::vector<T> FunctionImpl<T,NDIM>::eval_cube(Level n, const std::vector<coordT>& x, const tensorT& c) const {
+        PROFILE_MEMBER_FUNC(FunctionImpl);
+        const long k = cdata.k;
+        const long npt = x.size();
+
+        // px(d,i,p) is polynomial p in dimension d at point i
+        Tensor<double> px(NDIM, npt, k);
+        for (long i=0; i<npt; ++i)
+            for (std::size_t d=0; d<NDIM; ++d)
+                legendre_scaling_functions(x[i][d], k, px.ptr()+(d*npt+i)*k);
+
+        // w(r,i) = sum(p) c(r,p) px(NDIM-1,i,p)
+        const tensorT cc = c.iscontiguous() ? c : copy(c);
+        long nrest = cc.size()/k;
+        tensorT w(nrest, npt);
+        mxmT(nrest, npt, k, w.ptr(), cc.ptr(), px.ptr()+(NDIM-1)*npt*k);
+
+        // w(r,i) = sum(p) w(r,p,i) px(d,i,p) for the remaining dimensions
+        for (long d=long(NDIM)-2; d>=0; --d) {
+            nrest /= k;
+            tensorT w2(nrest, npt);
+            const double* pd = px.ptr()+d*npt*k;
+            for (long r=0; r<nrest; ++r) {
+                T* restrict out = w2.ptr()+r*npt;
+                for (long p=0; p<k; ++p) {
+                    const T* in = w.ptr()+(r*k+p)*npt;
+                    for (long i=0; i<npt; ++i) out[i] += in[i]*pd[i*k+p];
+                }
+            }
+            w = w2;
+        }
+
+        const double fac = pow(2.0,0.5*NDIM*n)/sqrt(FunctionDefaults<NDIM>::get_cell_volume());
+        std::vector<T> result(npt);
+        for (long i=0; i<npt; ++i) result[i] = w.ptr()[i]*fac;
+        return result;
+    }
+
+    template <typename T, std::size_t NDIM>
+    Future< std::vector<T> > FunctionImpl<T,NDIM>::eval_many(const std::vector<coordT>& x) const {
+        // Freed by eval_many_gather when the last value is in ... only
+        // this process dereferences the address
+        EvalManyGather* g = new EvalManyGather(x.size());
+        Future< std::vector<T> > result = g->result;
+        std::vector<std::size_t> idx(x.size());
+        for (std::size_t i=0; i<idx.size(); ++i) idx[i] = i;
+        woT::task(coeffs.owner(cdata.key0), &implT::eval_many_spawn, cdata.key0, x, idx,
+                  world.rank(), reinterpret_cast<unsigned long>(g), TaskAttributes::hipri());
+        return result;
+    }
+
+    template <typename T, std::size_t NDIM>
+    void FunctionImpl<T,NDIM>::eval_many_spawn(const keyT& key, const std::vector<coordT>& x,
+                                               const std::vector<std::size_t>& idx,
+                                               ProcessID caller, unsigned long gather) const {
+        PROFILE_MEMBER_FUNC(FunctionImpl);
+        const nodeT& node = coeffs.find(key).get()->second;
+        if (node.has_coeff()) {
+            const std::vector<T> values = eval_cube(key.level(), x, node.coeff_value().full_tensor_copy());
+            if (caller == world.rank())
+                eval_many_gather(gather, idx, values);
+            else
+                woT::task(caller, &implT::eval_many_gather, gather, idx, values, TaskAttributes::hipri());
+            return;
+        }
+
+        // Split the points among the children and rescale them to the child box
+        const int nchild = 1<<NDIM;
+        std::vector< std::vector<coordT> > xc(nchild);
+        std::vector< std::vector<std::size_t> > ic(nchild);
+        for (std::size_t i=0; i<x.size(); ++i) {
+            coordT y;
+            int c = 0;
+            for (std::size_t d=0; d<NDIM; ++d) {
+                double xi = x[i][d]*2.0;
+                int li = int(xi);
+                if (li == 2) li = 1;
+                y[d] = xi - li;
+                c = 2*c + li;
+            }
+            xc[c].push_back(y);
+            ic[c].push_back(idx[i]);
+        }
+
+        const Vector<Translation,NDIM>& l = key.translation();
+        for (int c=0; c<nchild; ++c) {
+            if (xc[c].empty()) continue;
+            Vector<Translation,NDIM> lc;
+            for (std::size_t d=0; d<NDIM; ++d) lc[d] = 2*l[d] + ((c>>(NDIM-1-d)) & 1);
+            const keyT ckey(key.level()+1, lc);
+            woT::task(coeffs.owner(ckey), &implT::eval_many_spawn, ckey, xc[c], ic[c], caller, gather,
+                      TaskAttributes::hipri());
+        }
+    }
+
+    template <typename T, std::size_t NDIM>
+    void FunctionImpl<T,NDIM>::eval_many_gather(unsigned long gather, const std::vector<std::size_t>& idx,
+                                                const std::vector<T>& values) const {
+        EvalManyGather* g = reinterpret_cast<EvalManyGather*>(gather);
+        bool done;
+        {
+            ScopedMutex<Mutex> hold(g->mutex);
+            for (std::size_t i=0; i<idx.size(); ++i) g->values[idx[i]] = values[i];
+            g->nleft -= idx.size();
+            done = (g->nleft == 0);
+        }
+        if (done) {
+            g->result.set(g->values);
+            delete g;
+        }
+    }
+
     template <typename T, std::size_t NDIM>
     void FunctionImpl<T,NDIM>::reconstruct_op(const keyT& key, const coeffT& s) {
         //PROFILE_MEMBER_FUNC(FunctionImpl);
@@ -2636,9 +2935,10 @@ namespace madness {
         if (functor->provides_coeff()) return functor->coeff(key).full_tensor_copy();
 
         MADNESS_ASSERT(cdata.npt == cdata.k); // only necessary due to use of fast transform
+        TensorArena::Scope scope;
         tensorT fval(cdata.vq,false); // this will be the returned result
-        tensorT work(cdata.vk,false); // initially evaluate the function in here
-        tensorT workq(cdata.vq,false); // initially evaluate the function in here
+        TensorView<T> work(cdata.vk,false); // initially evaluate the function in here
+        TensorView<T> workq(cdata.vq,false); // initially evaluate the function in here
 
         // compute the values of the functor at the quadrature points and scale appropriately
         madness::fcube(key,*functor,cdata.quad_x,work);
@@ -2729,7 +3029,7 @@ namespace madness {
                 typename dcT::iterator it = fut.get();
                 nodeT& node = it->second;
                 if (node.has_coeff()) {
-                    Future<T>(ref).set(eval_cube(key.level(), x, node.coeff().full_tensor_copy()));
+                    Future<T>(ref).set(eval_cube(key.level(), x, node.coeff_value().full_tensor_copy()));
                     return;
                 }
                 else {
@@ -2762,7 +3062,7 @@ namespace madness {
                 if (it != coeffs.end()) {
                     nodeT& node = it->second;
                     if (node.has_coeff()) {
-                        return std::pair<bool,T>(true,eval_cube(key.level(), x, node.coeff().full_tensor_copy()));
+                        return std::pair<bool,T>(true,eval_cube(key.level(), x, node.coeff_value().full_tensor_copy()));
                     }
                 }
             }
@@ -2988,7 +3288,7 @@ namespace madness {
                 typename dcT::const_iterator it = coeffs.find(cdata.key0).get();
                 if (it != coeffs.end()) {
                     const nodeT& node = it->second;
-                    if (node.has_coeff()) sum = node.coeff().full_tensor_copy()(v0);
+                    if (node.has_coeff()) sum = node.coeff_value().full_tensor_copy()(v0);
                 }
             }
         }
@@ -2996,7 +3296,7 @@ namespace madness {
             for (typename dcT::const_iterator it=coeffs.begin(); it!=coeffs.end(); ++it) {
                 const keyT& key = it->first;
                 const nodeT& node = it->second;
-                if (node.has_coeff()) sum += node.coeff().full_tensor_copy()(v0)*pow(0.5,NDIM*key.level()*0.5);
+                if (node.has_coeff()) sum += node.coeff_value().full_tensor_copy()(v0)*pow(0.5,NDIM*key.level()*0.5);
             }
         }
         return sum*sqrt(FunctionDefaults<NDIM>::get_cell_volume());
@@ -3300,6 +3600,8 @@ namespace madness {
         project_randomize = false;
         bc = BoundaryConditions<NDIM>(BC_FREE);
         tt = TT_FULL;
+        rr = RR_SVD;
+        sp = SP_NATIVE;
         cell = Tensor<double>(NDIM,2);
         cell(_,1) = 1.0;
         recompute_cell_info();
@@ -3325,6 +3627,8 @@ namespace madness {
     template <std::size_t NDIM> bool FunctionDefaults<NDIM>::project_randomize;
     template <std::size_t NDIM> BoundaryConditions<NDIM> FunctionDefaults<NDIM>::bc;
     template <std::size_t NDIM> TensorType FunctionDefaults<NDIM>::tt;
+    template <std::size_t NDIM> RankReduceType FunctionDefaults<NDIM>::rr;
+    template <std::size_t NDIM> StoragePrecision FunctionDefaults<NDIM>::sp;
     template <std::size_t NDIM> Tensor<double> FunctionDefaults<NDIM>::cell;
     template <std::size_t NDIM> Tensor<double> FunctionDefaults<NDIM>::cell_width;
     template <std::size_t NDIM> Tensor<double> FunctionDefaults<NDIM>::rcell_width;
@@ -283,6 +283,99 @@ namespace madness {
         }
 
 
+        /// accumulate a batch of transformed tensors into result
+
+        /// f and result hold nr tensors as rows of a (nr,dimk^ndim) matrix. The batch is
+        /// transposed once, so that each dimension of all tensors is transformed with a
+        /// single matrix multiplication.
+        /// \code
+        ///  result(r,i',j',..) += mufac * sum(i,j,..) f(r,i,j,..) trans[0](i,i') trans[1](j,j') ..
+        /// \endcode
+        /// @param[in]  nr      number of tensors in the batch
+        /// @param[in]  dimk    extent of each dimension, trans are (dimk,dimk) matrices
+        /// @param[in]  ndim    number of dimensions of each tensor
+        /// @param[in]  w1, w2  workspace of at least nr*dimk^ndim elements
+        template <typename R>
+        void apply_transformation_batch(long nr, long dimk, std::size_t ndim,
+                                  const Tensor<Q>* trans,
+                                  const R* f,
+                                  R* restrict w1,
+                                  R* restrict w2,
+                                  const Q mufac,
+                                  R* restrict result) const {
+
+            long size = 1;
+            for (std::size_t i=0; i<ndim; ++i) size *= dimk;
+            const long dimi = nr*size/dimk;
+
+            // (r,i,j,..) -> (i,j,..,r); every transformation moves the transformed
+            // index to the end, so after ndim of them we are back at (r,i',j',..)
+            fast_transpose(nr, size, f, w1);
+            for (std::size_t d=0; d<ndim; ++d) {
+                mTxmq(dimi, dimk, dimk, w2, w1, trans[d].ptr());
+                std::swap(w1,w2);
+            }
+            aligned_axpy(nr*size, result, w1, mufac);
+        }
+
+
+        /// accumulate rows of transformed tensors into result, using the SVD of the blocks
+
+        /// Same as apply_transformation() for nr tensors stored one after the other
+        /// in f and in result. The blocks of U are shrunk once for all of them, and
+        /// each tensor is transformed on its own so that it stays in cache.
+        /// @param[in]  nr      number of tensors in the batch
+        /// @param[in]  w1, w2  workspace of at least dimk^NDIM elements
+        /// @param[in]  w3      workspace of at least NDIM*dimk*dimk elements
+        template <typename R>
+        void apply_transformation_rows(long nr, long dimk,
+                                 const Transformation trans[NDIM],
+                                 const R* f,
+                                 R* restrict w1,
+                                 R* restrict w2,
+                                 Q* restrict w3,
+                                 const Q mufac,
+                                 R* restrict result) const {
+
+            long size0 = 1;
+            for (std::size_t i=0; i<NDIM; ++i) size0 *= dimk;
+
+            const Q* U[NDIM];
+            bool doit = false;
+            for (std::size_t d=0; d<NDIM; ++d) {
+                U[d] = (trans[d].r == dimk) ? trans[d].U : shrink(dimk,dimk,trans[d].r,trans[d].U,w3+d*dimk*dimk);
+                doit = doit || trans[d].VT;
+            }
+
+            for (long i=0; i<nr; ++i, f+=size0, result+=size0) {
+                long size = size0;
+                const R* in = f;
+                R* out = w1;
+                R* other = w2;
+                for (std::size_t d=0; d<NDIM; ++d) {
+                    mTxmq(size/dimk, trans[d].r, dimk, out, in, U[d]);
+                    size = trans[d].r * size / dimk;
+                    in = out;
+                    std::swap(out,other);
+                }
+                if (doit) {
+                    for (std::size_t d=0; d<NDIM; ++d) {
+                        if (trans[d].VT) {
+                            mTxmq(size/trans[d].r, dimk, trans[d].r, out, in, trans[d].VT);
+                            size = dimk*size/trans[d].r;
+                        }
+                        else {
+                            fast_transpose(dimk, size/dimk, in, out);
+                        }
+                        in = out;
+                        std::swap(out,other);
+                    }
+                }
+                aligned_axpy(size, result, in, mufac);
+            }
+        }
+
+
         /// accumulate into result
         template <typename T, typename R>
         void apply_transformation3(const Tensor<T> trans2[NDIM],
@@ -367,6 +460,10 @@ namespace madness {
 
 
         /// Apply one of the separated terms, accumulating into the result
+
+        /// If nrow>1 f, f0, result and result0 hold nrow tensors stacked as rows,
+        /// which share the screening of the blocks (see apply_transformation_rows),
+        /// and work5 must hold NDIM blocks.
         template <typename T>
         void muopxv_fast(ApplyTerms at,
                          const ConvolutionData1D<Q>* const ops_1d[NDIM],
@@ -377,11 +474,11 @@ namespace madness {
                          const Q mufac,
                          Tensor<TENSOR_RESULT_TYPE(T,Q)>& work1,
                          Tensor<TENSOR_RESULT_TYPE(T,Q)>& work2,
-                         Tensor<Q>& work5) const {
+                         Tensor<Q>& work5,
+                         long nrow=1) const {
 
             //PROFILE_MEMBER_FUNC(SeparatedConvolution); // Too fine grain for routine profiling
             Transformation trans[NDIM];
-            Tensor<T> trans2[NDIM];
 
             double Rnorm = 1.0;
             for (std::size_t d=0; d<NDIM; ++d) Rnorm *= ops_1d[d]->Rnorm;
@@ -415,9 +512,10 @@ namespace madness {
                         trans[d].U = ops_1d[d]->RU.ptr();
                         trans[d].VT = ops_1d[d]->RVT.ptr();
                     }
-                    trans2[d]=ops_1d[d]->R;
                 }
-                apply_transformation(twok, trans, f, work1, work2, work5, mufac, result);
+                if (nrow == 1) apply_transformation(twok, trans, f, work1, work2, work5, mufac, result);
+                else apply_transformation_rows(nrow, twok, trans, f.ptr(), work1.ptr(), work2.ptr(),
+                                               work5.ptr(), mufac, result.ptr());
     //            apply_transformation2(n, twok, tol, trans2, f, work1, work2, work5, mufac, result);
 //                apply_transformation3(trans2, f, mufac, result);
             }
@@ -449,9 +547,10 @@ namespace madness {
                         trans[d].U = ops_1d[d]->TU.ptr();
                         trans[d].VT = ops_1d[d]->TVT.ptr();
                     }
-                    trans2[d]=ops_1d[d]->T;
                 }
-                apply_transformation(k, trans, f0, work1, work2, work5, -mufac, result0);
+                if (nrow == 1) apply_transformation(k, trans, f0, work1, work2, work5, -mufac, result0);
+                else apply_transformation_rows(nrow, k, trans, f0.ptr(), work1.ptr(), work2.ptr(),
+                                               work5.ptr(), -mufac, result0.ptr());
 //                apply_transformation2(n, k, tol, trans2, f0, work1, work2, work5, -mufac, result0);
 //                apply_transformation3(trans2, f0, -mufac, result0);
             }
@@ -1121,6 +1220,9 @@ namespace madness {
 
             double cpu0=cpu_time();
 
+            // all workspace is taken from this thread's arena
+            TensorArena::Scope scope;
+
             typedef TENSOR_RESULT_TYPE(T,Q) resultT;
             const Tensor<T>* input = &coeff;
             Tensor<T> dummy;
@@ -1133,7 +1235,7 @@ namespace madness {
                     // it is not necessary.  It is necessary for operators such
                     // as differentiation and time evolution and will also occur
                     // if the application of the operator widens the tree.
-                    dummy = Tensor<T>(v2k);
+                    dummy = TensorView<T>(v2k);
                     dummy(s0) = coeff;
                     input = &dummy;
                 }
@@ -1152,18 +1254,16 @@ namespace madness {
 
             //print("sepop",source,shift,op->norm,tol);
 
-            Tensor<resultT> r(v2k), r0(vk);
-            Tensor<resultT> work1(v2k,false), work2(v2k,false);
-            Tensor<Q> work5(2*k,2*k);
+            // only the result is allocated on the heap
+            const std::vector<long>& vr = (modified()) ? vk : v2k;
+            const long kr = (modified()) ? k : 2*k;
+            Tensor<resultT> r(vr);
+            TensorView<resultT> r0(vk);
+            TensorView<resultT> work1(vr,false), work2(vr,false);
+            TensorView<Q> work5(kr,kr);
 
-            if (modified()) {
-                   r=Tensor<resultT>(vk);
-                   work1=Tensor<resultT>(vk,false);
-                   work2=Tensor<resultT>(vk,false);
-                   work5=Tensor<Q>(k,k);
-            }
-
-            const Tensor<T> f0 = copy(coeff(s0));
+            TensorView<T> f0(vk,false);
+            f0(___) = coeff(s0);
             for (int mu=0; mu<rank; ++mu) {
                 // SeparatedConvolutionInternal keeps data for 1 term and all dimensions and 1 displacement
                 const SeparatedConvolutionInternal<Q,NDIM>& muop =  op->muops[mu];
@@ -1183,11 +1283,95 @@ namespace madness {
         }
 
 
+        /// apply this operator on the coefficients of several functions at the same source key
+
+        /// The coefficients are stacked as rows of one tensor, and every separated
+        /// term is screened and its blocks truncated once for all of them (see
+        /// muopxv_fast). A term and the rank of its blocks are chosen for the coeffs
+        /// that need the most accuracy, so each result is at least as accurate as
+        /// from apply().
+        /// @param[in]  source  the source key
+        /// @param[in]  shift   the displacement, where the source coeffs come from
+        /// @param[in]  coeff   source coeffs in full rank, all of the same shape
+        /// @param[in]  tol     thresh/#neigh/cnorm for the coeffs that need the most accuracy
+        /// @return     full rank tensors with the results op(*coeff[i])
+        template <typename T>
+        std::vector< Tensor<TENSOR_RESULT_TYPE(T,Q)> > apply_batch(const Key<NDIM>& source,
+                const Key<NDIM>& shift, const std::vector<const Tensor<T>*>& coeff, double tol) const {
+            typedef TENSOR_RESULT_TYPE(T,Q) resultT;
+            const long nf = coeff.size();
+            if (nf == 1) return std::vector< Tensor<resultT> >(1, apply(source, shift, *coeff[0], tol));
+
+            double cpu0=cpu_time();
+            TensorArena::Scope scope;
+
+            const std::vector<long>& vr = (modified()) ? vk : v2k;
+            const long kr = (modified()) ? k : 2*k;
+            std::vector<long> dims(1,nf), dims0(1,nf);
+            dims.insert(dims.end(), vr.begin(), vr.end());
+            dims0.insert(dims0.end(), vk.begin(), vk.end());
+
+            // row i of f holds coeff[i], padded with zeros if it has only
+            // scaling coefficients (see apply()), and row i of f0 its scaling block
+            TensorView<resultT> f(dims), f0(dims0,false);
+            TensorView<resultT> r(dims), r0(dims0);
+            TensorView<resultT> work1(vr,false), work2(vr,false);
+            TensorView<Q> work5(NDIM*kr,kr);
+            std::vector<Slice> row(NDIM+1,_), row0(NDIM+1,_);
+            for (long i=0; i<nf; ++i) {
+                const Tensor<T>& c = *coeff[i];
+                MADNESS_ASSERT(c.ndim()==NDIM);
+                row[0] = row0[0] = Slice(i,i,0);
+                if (c.dim(0) == kr) {
+                    f(row) = c;
+                }
+                else {
+                    MADNESS_ASSERT(c.dim(0)==k);
+                    for (std::size_t d=0; d<NDIM; ++d) row[d+1] = s0[d];
+                    f(row) = c;
+                    for (std::size_t d=0; d<NDIM; ++d) row[d+1] = _;
+                }
+                f0(row0) = c(s0);
+            }
+
+            tol = tol/rank; // Error is per separated term
+            ApplyTerms at;
+            at.r_term=true;
+            at.t_term=(source.level()>0);
+            const SeparatedConvolutionData<Q,NDIM>* op = getop(source.level(), shift, source);
+
+            for (int mu=0; mu<rank; ++mu) {
+                const SeparatedConvolutionInternal<Q,NDIM>& muop =  op->muops[mu];
+                if (muop.norm > tol) {
+                    Q fac = ops[mu].getfac();
+                    muopxv_fast(at, muop.ops, f, f0, r, r0, tol/std::abs(fac), fac,
+                                work1, work2, work5, nf);
+                }
+            }
+
+            std::vector< Tensor<resultT> > result(nf);
+            for (long i=0; i<nf; ++i) {
+                row[0] = row0[0] = Slice(i,i,0);
+                result[i] = copy(r(row));
+                result[i](s0).gaxpy(1.0,r0(row0),1.0);
+            }
+            double cpu1=cpu_time();
+            timer_full.accumulate(cpu1-cpu0);
+
+            return result;
+        }
+
+
         /// apply this operator on only 1 particle of the coefficients in low rank form
 
         /// note the unfortunate mess with NDIM: here NDIM is the operator dimension, and FDIM is the
         /// function's dimension, whereas in the function we have OPDIM for the operator and NDIM for
         /// the function
+        ///
+        /// All singular vectors of the particle the operator is acting on are transformed
+        /// as one batch per operator term, see apply_transformation_batch(). Operator terms
+        /// are screened against the singular values of coeff, so that small terms are only
+        /// applied to the leading singular vectors. The rank is reduced once at the end.
         /// @tparam T   the dimension of the function this operator is applied on. \todo MGR: Make sure info on T is correct. Was previously labeled FDIM.
         /// @param[in]  coeff   source coeffs in SVD (=optimal!) form, in high dimensionality (FDIM)
         /// @param[in]  source  the source key in low dimensionality (NDIM)
@@ -1201,6 +1385,8 @@ namespace madness {
 
             typedef TENSOR_RESULT_TYPE(T,Q) resultT;
 
+            if (coeff.tensor_type()==TT_TENSORTRAIN) return apply_tensortrain(source,shift,coeff,tol,tol2);
+
             // some checks
             MADNESS_ASSERT(coeff.tensor_type()==TT_2D);           // for now
             MADNESS_ASSERT(not modified());
@@ -1208,78 +1394,106 @@ namespace madness {
             MADNESS_ASSERT(coeff.dim(0)==2*k);
             MADNESS_ASSERT(2*NDIM==coeff.ndim());
 
+            const long nrank=coeff.rank();
+            if (nrank==0) return copy(coeff);
+
+            double cpu0=cpu_time();
             const SeparatedConvolutionData<Q,NDIM>* op = getop(source.level(), shift, source);
+            const bool t_term=(source.level()>0);
+
+            // the particle the operator is acting on, and the other one
+            const int p=particle()-1;
+            const int other=1-p;
 
-            // prepare access to the singular vectors
-            std::vector<Slice> s(coeff.config().dim_per_vector()+1,_);
+            // prepare access to the singular vectors: all terms, and the scaling block of all terms
             // can't use predefined slices and vectors -- they have the wrong dimension
-            const std::vector<Slice> s00(coeff.ndim(),Slice(0,k-1));
+            std::vector<Slice> s(NDIM+1,_);
+            s[0]=Slice(0,nrank-1);
+            std::vector<Slice> s0r(NDIM+1,Slice(0,k-1));
+            s0r[0]=Slice(0,nrank-1);
 
-            // some workspace
-            Tensor<resultT> work1(v2k,false), work2(v2k,false);
-            Tensor<Q> work5(2*k,2*k);
+            long size2k=1, sizek=1;
+            for (std::size_t d=0; d<NDIM; ++d) {
+                size2k*=2*k;
+                sizek*=k;
+            }
 
-            // sliced input and final result
-            const GenTensor<T> f0 = copy(coeff(s00));
-            GenTensor<resultT> final=copy(coeff);
-            GenTensor<resultT> final0=copy(f0);
+            // the singular vectors as rows of a (rank,(2k)^NDIM) and a (rank,k^NDIM) matrix
+            const SRConf<T>& config=coeff.config();
+            const Tensor<resultT> x=config.ref_vector(p)(s);
+            const Tensor<resultT> x0=copy(config.ref_vector(p)(s0r));
+            const Tensor<double>& weights=config.weights_;
+
+            // transformed singular vectors, and workspace shared by all operator terms
+            Tensor<resultT> y(nrank,size2k), y0(nrank,sizek);
+            const std::vector<long> wdims(1,nrank*size2k);
+            Tensor<resultT> work1(wdims,false), work2(wdims,false);
 
             tol = tol/rank*0.01; // Error is per separated term
             tol2= tol2/rank;
 
-            for (int r=0; r<coeff.rank(); ++r) {
-
-                // get the appropriate singular vector (left or right depends on particle)
-                // and apply the full tensor muopxv_fast on it, term by term
-                s[0]=Slice(r,r);
-                const Tensor<T> chunk=coeff.config().ref_vector(particle()-1)(s).reshape(2*k,2*k,2*k);
-                const Tensor<T> chunk0=f0.config().ref_vector(particle()-1)(s).reshape(k,k,k);
-//                const double weight=coeff.config().weights(r);
-
-                // accumulate all terms of the operator for a specific term of the function
-                Tensor<resultT> result(v2k), result0(vk);
-
-                ApplyTerms at;
-                at.r_term=true;
-                at.t_term=source.level()>0;
-
-                // this loop will return on result and result0 the terms [(P+Q) G (P+Q)]_1,
-                // and [P Q P]_1, respectively
-                for (int mu=0; mu<rank; ++mu) {
-                    const SeparatedConvolutionInternal<Q,NDIM>& muop =  op->muops[mu];
+            // this loop will return on y and y0 the terms [(P+Q) G (P+Q)]_1,
+            // and [P Q P]_1, respectively
+            for (int mu=0; mu<rank; ++mu) {
+                const SeparatedConvolutionInternal<Q,NDIM>& muop =  op->muops[mu];
 
-//                    if (muop.norm > tol2*std::abs(weight)) {
+                // delta(g)  <  delta(T) * || f ||
+                if (muop.norm < tol) continue;
 
-                        Q fac = ops[mu].getfac();
-                        muopxv_fast(at, muop.ops, chunk, chunk0, result, result0,
-                                tol/std::abs(fac), fac, work1, work2, work5);
+                // get maximum rank of coeff to contribute, note that max_sigma is inclusive;
+                // use the same safety margin as for tol
+                const long nr=SRConf<T>::max_sigma(0.01*tol2/muop.norm,nrank,weights)+1;
+                if (nr==0) continue;
 
-//                    }
+                Tensor<Q> trans[NDIM], trans0[NDIM];
+                double Rnorm=1.0, Tnorm=1.0;
+                for (std::size_t d=0; d<NDIM; ++d) {
+                    trans[d]=muop.ops[d]->R;
+                    trans0[d]=muop.ops[d]->T;
+                    Rnorm*=muop.ops[d]->Rnorm;
+                    Tnorm*=muop.ops[d]->Tnorm;
                 }
 
-
-                // reinsert the transformed terms into result, leaving the other particle unchanged
-                MADNESS_ASSERT(final.config().has_structure());
-                final.config().ref_vector(particle()-1)(s)=result;
-
-                if (source.level()>0) {
-                    final0.config().ref_vector(particle()-1)(s)=result0;
-                } else {
-                    final0.config().ref_vector(0)(s)=0.0;
-                    final0.config().ref_vector(1)(s)=0.0;
+                const Q fac = ops[mu].getfac();
+                if (Rnorm > 1.e-20) {
+                    apply_transformation_batch(nr, 2*k, NDIM, trans, x.ptr(),
+                            work1.ptr(), work2.ptr(), fac, y.ptr());
+                }
+                if (t_term and (Tnorm>0.0)) {
+                    apply_transformation_batch(nr, k, NDIM, trans0, x0.ptr(),
+                            work1.ptr(), work2.ptr(), -fac, y0.ptr());
                 }
-
             }
-
-            final(s00)+=final0;
+            double cpu1=cpu_time();
+            timer_low_transf.accumulate(cpu1-cpu0);
+
+            // reinsert the transformed terms into result, leaving the other particle unchanged
+            const Tensor<double> w=copy(weights(Slice(0,nrank-1)));
+            const Tensor<resultT> xother=copy(config.ref_vector(other)(s)).reshape(nrank,size2k);
+            const Tensor<resultT> v[2]={(p==0) ? y : xother, (p==0) ? xother : y};
+            GenTensor<resultT> final(SRConf<resultT>(w,v[0],v[1],coeff.ndim(),2*k));
+
+            if (t_term) {
+                const Tensor<resultT> xother0=copy(config.ref_vector(other)(s0r)).reshape(nrank,sizek);
+                const Tensor<resultT> v0[2]={(p==0) ? y0 : xother0, (p==0) ? xother0 : y0};
+                const GenTensor<resultT> final0(SRConf<resultT>(w,v0[0],v0[1],coeff.ndim(),k));
+                const std::vector<Slice> s00(coeff.ndim(),Slice(0,k-1));
+                final(s00)+=final0;
+            }
             final.reduce_rank(tol2);
 
+            timer_low_accumulate.accumulate(cpu_time()-cpu1);
             return final;
         }
 
 
         /// apply this operator on coefficients in low rank form
 
+        /// Both particles of all singular vectors are transformed as one batch per operator
+        /// term, see apply_transformation_batch(). Operator terms are screened against the
+        /// singular values of coeff, so that small terms are only applied to the leading
+        /// singular vectors. All resulting terms are collected in a single SRConf, whose
+        /// rank is reduced once at the end.
         /// @param[in]	coeff	source coeffs in SVD (=optimal!) form
         /// @param[in]	tol		thresh/#neigh*cnorm
         /// @param[in]	tol2	thresh/#neigh
@@ -1291,9 +1505,10 @@ namespace madness {
             PROFILE_MEMBER_FUNC(SeparatedConvolution);
             typedef TENSOR_RESULT_TYPE(T,Q) resultT;
 
+            if (coeff.tensor_type()==TT_TENSORTRAIN) return apply_tensortrain(source,shift,coeff,tol,tol2);
+
             MADNESS_ASSERT(coeff.ndim()==NDIM);
             MADNESS_ASSERT(coeff.tensor_type()==TT_2D);	// we use the rank below
-//            MADNESS_EXCEPTION("no apply2",1);
             const TensorType tt=coeff.tensor_type();
 
             const GenTensor<T>* input = &coeff;
@@ -1307,7 +1522,7 @@ namespace madness {
                     // it is not necessary.  It is necessary for operators such
                     // as differentiation and time evolution and will also occur
                     // if the application of the operator widens the tree.
-                    dummy = GenTensor<T>(v2k,coeff.tensor_type());
+                    dummy = GenTensor<T>(v2k,tt);
                     dummy(s0) += coeff;
                     input = &dummy;
                 }
@@ -1316,71 +1531,197 @@ namespace madness {
                 }
             }
 
+            const long nrank=input->rank();
+            if (nrank==0) return GenTensor<resultT>();
+
+            double cpu0=cpu_time();
             tol = tol/rank; // Error is per separated term
             tol2= tol2/rank;
 
             const SeparatedConvolutionData<Q,NDIM>* op = getop(source.level(), shift, source);
+            const bool t_term=(source.level()>0);
+
+            // each singular vector holds the coefficients of one particle
+            const SRConf<T>& config=input->config();
+            const std::size_t dpv=config.dim_per_vector();
+            MADNESS_ASSERT(2*dpv==NDIM);
+            const long twok=(modified()) ? k : 2*k;
+
+            long sizev=1, sizev0=1;
+            for (std::size_t d=0; d<dpv; ++d) {
+                sizev*=twok;
+                sizev0*=k;
+            }
 
-            GenTensor<resultT> r, r0, result, result0;
-            GenTensor<resultT> work1(v2k,tt), work2(v2k,tt);
-            GenTensor<Q> work5(v2k,tt);
+            // the singular vectors as rows of a (rank,twok^dpv) and a (rank,k^dpv) matrix
+            std::vector<Slice> s(dpv+1,_);
+            s[0]=Slice(0,nrank-1);
+            std::vector<Slice> s0r(dpv+1,Slice(0,k-1));
+            s0r[0]=Slice(0,nrank-1);
+            const Tensor<resultT> x[2]={config.ref_vector(0)(s), config.ref_vector(1)(s)};
+            const Tensor<resultT> x0[2]={copy(config.ref_vector(0)(s0r)), copy(config.ref_vector(1)(s0r))};
+            const Tensor<double>& weights=config.weights_;
+
+            // screen the operator terms, and determine the number of singular vectors
+            // each term is applied to
+            std::vector<long> nr(rank,0);
+            long rank_r=0, rank_t=0;
+            for (int mu=0; mu<rank; ++mu) {
+                const SeparatedConvolutionInternal<Q,NDIM>& muop =  op->muops[mu];
 
-            if (modified()) {
-                r=GenTensor<resultT>(vk,tt);
-                work1=GenTensor<resultT>(vk,tt);
-                work2=GenTensor<resultT>(vk,tt);
-                work5=GenTensor<Q>();
+                // delta(g)  <  delta(T) * || f ||
+                if (muop.norm < tol) continue;
 
+                // get maximum rank of coeff to contribute, note that max_sigma is inclusive:
+                //  delta(coeff) * || T || < tol2
+                nr[mu]=SRConf<T>::max_sigma(tol2/muop.norm,nrank,weights)+1;
+                rank_r+=nr[mu];
+                if (t_term) rank_t+=nr[mu];
             }
-
-            // collect the results of the individual operator terms
-            std::list<GenTensor<T> > r_list;
-            std::list<GenTensor<T> > r0_list;
-
-//            const GenTensor<T> f0 = copy(coeff(s0));
-            const GenTensor<T> f0 = copy((*input)(s0));
+            if (rank_r==0) return GenTensor<resultT>();
+
+            // all terms of the result; the T terms are appended after the R terms
+            Tensor<double> w(rank_r+rank_t);
+            Tensor<resultT> v[2]={Tensor<resultT>(rank_r+rank_t,sizev), Tensor<resultT>(rank_r+rank_t,sizev)};
+            std::vector<long> vdims(dpv+1,twok);
+            vdims[0]=rank_r+rank_t;
+            Tensor<resultT> y0(nrank,sizev0);
+            const std::vector<long> wdims(1,nrank*sizev);
+            Tensor<resultT> work1(wdims,false), work2(wdims,false);
+
+            long ir=0, it=rank_r;
             for (int mu=0; mu<rank; ++mu) {
+                if (nr[mu]==0) continue;
                 const SeparatedConvolutionInternal<Q,NDIM>& muop =  op->muops[mu];
-                //print("muop",source, shift, mu, muop.norm);
+                const Slice sw(0,nr[mu]-1);
 
-                // delta(g)  <  delta(T) * || f ||
-                if (muop.norm > tol) {
+                Tensor<Q> trans[NDIM], trans0[NDIM];
+                double Rnorm=1.0, Tnorm=1.0;
+                for (std::size_t d=0; d<NDIM; ++d) {
+                    trans[d]=muop.ops[d]->R;
+                    trans0[d]=muop.ops[d]->T;
+                    Rnorm*=muop.ops[d]->Rnorm;
+                    Tnorm*=muop.ops[d]->Tnorm;
+                }
+
+                const Q fac = ops[mu].getfac();
+                if (Rnorm > 1.e-20) {
+                    w(Slice(ir,ir+nr[mu]-1))=weights(sw);
+                    for (int i=0; i<2; ++i) {
+                        apply_transformation_batch(nr[mu], twok, dpv, trans+i*dpv, x[i].ptr(),
+                                work1.ptr(), work2.ptr(), (i==0) ? fac : Q(1.0),
+                                v[i].ptr()+ir*sizev);
+                    }
+                }
+                ir+=nr[mu];
+
+                if (t_term and (Tnorm > 1.e-20)) {
+                    w(Slice(it,it+nr[mu]-1))=weights(sw);
+                    s0r[0]=Slice(it,it+nr[mu]-1);
+                    std::vector<long> dims0(dpv+1,k);
+                    dims0[0]=nr[mu];
+                    for (int i=0; i<2; ++i) {
+                        y0=0.0;
+                        apply_transformation_batch(nr[mu], k, dpv, trans0+i*dpv, x0[i].ptr(),
+                                work1.ptr(), work2.ptr(), (i==0) ? -fac : Q(1.0), y0.ptr());
+                        v[i].reshape(vdims)(s0r)=y0(sw,_).reshape(dims0);
+                    }
+                }
+                if (t_term) it+=nr[mu];
+            }
+            double cpu1=cpu_time();
+            timer_low_transf.accumulate(cpu1-cpu0);
 
-                    // get maximum rank of coeff to contribute:
-                    //  delta(g)  <  eps  <  || T || * delta(f)
-                    //  delta(coeff) * || T || < tol2
-                	const int r_max=SRConf<T>::max_sigma(tol2/muop.norm,coeff.rank(),coeff.config().weights_);
-                    //                	print("r_max",coeff.config().weights(r_max));
+            // finally reduce all the resultant terms at once
+            GenTensor<resultT> result(SRConf<resultT>(w,v[0],v[1],NDIM,twok));
+            result.reduce_rank(tol2*rank);
 
-                	// note that max_sigma is inclusive!
-                    if (r_max>=0) {
-                        const GenTensor<resultT> chunk=input->get_configs(0,r_max);
-                        const GenTensor<resultT> chunk0=f0.get_configs(0,r_max);
+            timer_low_accumulate.accumulate(cpu_time()-cpu1);
+            return result;
+        }
 
-                        double cpu0=cpu_time();
+        /// apply this operator on coefficients in tensor train form
 
-                        Q fac = ops[mu].getfac();
-                        muopxv_fast2(source.level(), muop.ops, chunk, chunk0, r, r0,
-                                tol/std::abs(fac), fac,	work1, work2, work5);
-                        double cpu1=cpu_time();
-                        timer_low_transf.accumulate(cpu1-cpu0);
+        /// Each separated term is applied core by core, so the coefficients are never
+        /// reconstructed in full rank. The terms are summed up in tensor train form, whose
+        /// ranks are rounded whenever they grow beyond twice the rank of coeff, and again
+        /// at the end. Works for operators acting on all (NDIM) or on one particle (2*NDIM)
+        /// of coeff.
+        /// @param[in]  coeff   source coeffs in tensor train form
+        /// @param[in]  tol     thresh/#neigh*cnorm
+        /// @param[in]  tol2    thresh/#neigh
+        template <typename T>
+        GenTensor<TENSOR_RESULT_TYPE(T,Q)> apply_tensortrain(const Key<NDIM>& source,
+                const Key<NDIM>& shift, const GenTensor<T>& coeff, double tol, double tol2) const {
+            typedef TENSOR_RESULT_TYPE(T,Q) resultT;
 
-                        r_list.push_back(r);
-                        r0_list.push_back(r0);
-                    }
-                }
+            MADNESS_ASSERT(coeff.tensor_type()==TT_TENSORTRAIN);
+            MADNESS_ASSERT(not modified());
+            const long nd=coeff.ndim();
+            MADNESS_ASSERT(nd==NDIM or nd==2*NDIM);
+
+            // the first dimension the operator is acting on
+            const long d0=(nd==NDIM) ? 0 : (particle()-1)*NDIM;
+
+            const GenTensor<T>* input = &coeff;
+            GenTensor<T> dummy;
+            if (coeff.dim(0) == k) {
+                // leaf nodes with only scaling coefficients, see apply2()
+                dummy = GenTensor<T>(std::vector<long>(nd,2*k),TT_TENSORTRAIN);
+                dummy(std::vector<Slice>(nd,Slice(0,k-1))) += coeff;
+                input = &dummy;
             }
+            MADNESS_ASSERT(input->dim(0)==2*k);
+            if (input->rank()==0) return GenTensor<resultT>();
 
-            // finally accumulate all the resultant terms into one tensor
             double cpu0=cpu_time();
+            tol = tol/rank; // Error is per separated term
+            tol2= tol2/rank;
 
-            result0=reduce(r0_list,tol2*rank);
-            if (r_list.size()>0) r_list.front()(s0)+=result0;
-            result=reduce(r_list,tol2*rank);
-            result.reduce_rank(tol2*rank);
+            const SeparatedConvolutionData<Q,NDIM>* op = getop(source.level(), shift, source);
+            const bool t_term=(source.level()>0);
+            const long maxrank=2*std::max(1L,input->rank());
+
+            // the scaling block in all dimensions, see apply2_lowdim()
+            const std::vector<Slice> s00(nd,Slice(0,k-1));
+            GenTensor<T> f0;
+            if (t_term) f0=GenTensor<T>((*input)(s00));
+
+            GenTensor<resultT> result(std::vector<long>(nd,2*k),TT_TENSORTRAIN);
+            for (int mu=0; mu<rank; ++mu) {
+                const SeparatedConvolutionInternal<Q,NDIM>& muop =  op->muops[mu];
+
+                // delta(g)  <  delta(T) * || f ||
+                if (muop.norm < tol) continue;
 
+                // empty matrices leave the dimensions of the other particle unchanged
+                Tensor<Q> trans[2*NDIM], trans0[2*NDIM];
+                double Rnorm=1.0, Tnorm=1.0;
+                for (std::size_t d=0; d<NDIM; ++d) {
+                    trans[d0+d]=muop.ops[d]->R;
+                    trans0[d0+d]=muop.ops[d]->T;
+                    Rnorm*=muop.ops[d]->Rnorm;
+                    Tnorm*=muop.ops[d]->Tnorm;
+                }
+
+                const Q fac = ops[mu].getfac();
+                if (Rnorm > 1.e-20) {
+                    GenTensor<resultT> r=input->general_transform(trans);
+                    r.scale(fac);
+                    result+=r;
+                }
+                if (t_term and (Tnorm > 1.e-20)) {
+                    GenTensor<resultT> r0=f0.general_transform(trans0);
+                    r0.scale(-fac);
+                    result(s00)+=r0;
+                }
+                if (result.rank()>maxrank) result.reduce_rank(tol2);
+            }
             double cpu1=cpu_time();
-            timer_low_accumulate.accumulate(cpu1-cpu0);
+            timer_low_transf.accumulate(cpu1-cpu0);
+
+            result.reduce_rank(tol2*rank);
+            timer_low_accumulate.accumulate(cpu_time()-cpu1);
             return result;
         }
 
@@ -1400,7 +1741,8 @@ namespace madness {
                 double tol, double tol2) const {
 
             if (coeff.tensor_type()==TT_FULL) return 0.5;
-            if (2*NDIM==coeff.ndim()) return 1.5;
+            // tensor trains are applied core by core, see apply_tensortrain()
+            if (2*NDIM==coeff.ndim() or coeff.tensor_type()==TT_TENSORTRAIN) return 1.5;
             MADNESS_ASSERT(NDIM==coeff.ndim());
             MADNESS_ASSERT(coeff.tensor_type()==TT_2D);
 
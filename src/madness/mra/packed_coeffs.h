@@ -0,0 +1,168 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+#ifndef MADNESS_MRA_PACKED_COEFFS_H__INCLUDED
+#define MADNESS_MRA_PACKED_COEFFS_H__INCLUDED
+
+/// \file mra/packed_coeffs.h
+/// \brief Lossy byte encoding of coefficient tensors used by Function::pack()
+
+#include <madness/tensor/tensor.h>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace madness {
+
+    /// Encodes coefficient tensors into a compact stream of bytes
+
+    /// Each element is rounded to a multiple of a quantum chosen so that
+    /// the 2-norm of the error of the whole tensor is at most tol/2.  The
+    /// resulting integers are written as zig-zag varints and runs of
+    /// zeros are collapsed into a single token, so that wavelet
+    /// coefficients below the threshold cost next to nothing.  Tensors
+    /// that would not become smaller are stored verbatim.
+    class PackedCoeffs {
+        enum {RAW=0, QUANTIZED=1};
+
+        static void put_varint(std::vector<unsigned char>& buf, unsigned long long u) {
+            while (u >= 0x80) {
+                buf.push_back((u & 0x7f) | 0x80);
+                u >>= 7;
+            }
+            buf.push_back(u);
+        }
+
+        static unsigned long long get_varint(const unsigned char*& p) {
+            unsigned long long u = 0;
+            for (int shift=0; ; shift+=7) {
+                unsigned char b = *p++;
+                u |= static_cast<unsigned long long>(b & 0x7f) << shift;
+                if (!(b & 0x80)) return u;
+            }
+        }
+
+        template <typename Q>
+        static void put_raw(std::vector<unsigned char>& buf, const Q* x, long n) {
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(x);
+            buf.insert(buf.end(), p, p+n*sizeof(Q));
+        }
+
+        template <typename Q>
+        static void get_raw(const unsigned char*& p, Q* x, long n) {
+            std::memcpy(x, p, n*sizeof(Q));
+            p += n*sizeof(Q);
+        }
+
+    public:
+        /// Appends the encoding of t to buf
+        template <typename T>
+        static void encode(const Tensor<T>& t, double tol, std::vector<unsigned char>& buf) {
+            typedef typename TensorTypeData<T>::scalar_type scalar_type;
+            const Tensor<T> c = t.iscontiguous() ? t : copy(t);
+            const long n = c.size()*sizeof(T)/sizeof(scalar_type);
+            const scalar_type* x = reinterpret_cast<const scalar_type*>(c.ptr());
+
+            put_varint(buf, c.ndim());
+            for (int i=0; i<c.ndim(); ++i) put_varint(buf, c.dim(i));
+
+            const std::size_t start = buf.size();
+            double xmax = 0.0;
+            for (long i=0; i<n; ++i) xmax = std::max(xmax, double(std::abs(x[i])));
+            const double quantum = tol/std::sqrt(double(n));
+
+            // Integers must leave a bit for the zig-zag sign
+            if (quantum > 0.0 && xmax < 4.0e18*quantum) {
+                buf.push_back(QUANTIZED);
+                put_raw(buf, &quantum, 1);
+                const double rquantum = 1.0/quantum;
+                long nzero = 0;
+                for (long i=0; i<n; ++i) {
+                    const long long m = std::llround(x[i]*rquantum);
+                    if (m == 0) {
+                        ++nzero;
+                        continue;
+                    }
+                    if (nzero) {
+                        put_varint(buf, 0);
+                        put_varint(buf, nzero-1);
+                        nzero = 0;
+                    }
+                    put_varint(buf, (static_cast<unsigned long long>(m) << 1) ^ static_cast<unsigned long long>(m >> 63));
+                }
+                if (nzero) {
+                    put_varint(buf, 0);
+                    put_varint(buf, nzero-1);
+                }
+                if (buf.size()-start < n*sizeof(scalar_type)) return;
+                buf.resize(start);
+            }
+            buf.push_back(RAW);
+            put_raw(buf, x, n);
+        }
+
+        /// Decodes the tensor at p and advances p past it
+        template <typename T>
+        static Tensor<T> decode(const unsigned char*& p) {
+            typedef typename TensorTypeData<T>::scalar_type scalar_type;
+            long dims[TENSOR_MAXDIM];
+            const long ndim = get_varint(p);
+            for (long i=0; i<ndim; ++i) dims[i] = get_varint(p);
+
+            Tensor<T> c(ndim, dims, false);
+            const long n = c.size()*sizeof(T)/sizeof(scalar_type);
+            scalar_type* x = reinterpret_cast<scalar_type*>(c.ptr());
+
+            if (*p++ == RAW) {
+                get_raw(p, x, n);
+            }
+            else {
+                double quantum;
+                get_raw(p, &quantum, 1);
+                for (long i=0; i<n; ) {
+                    const unsigned long long u = get_varint(p);
+                    if (u == 0) {
+                        for (long nzero=get_varint(p)+1; nzero>0; --nzero) x[i++] = 0;
+                    }
+                    else {
+                        const long long m = static_cast<long long>(u >> 1) ^ -static_cast<long long>(u & 1);
+                        x[i++] = m*quantum;
+                    }
+                }
+            }
+            return c;
+        }
+    };
+
+}
+
+#endif // MADNESS_MRA_PACKED_COEFFS_H__INCLUDED
@@ -0,0 +1,299 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+#ifndef MADNESS_MRA_SFCPMAP_H__INCLUDED
+#define MADNESS_MRA_SFCPMAP_H__INCLUDED
+
+#include <madness/madness_config.h>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <madness/world/worlddc.h>
+
+#include <madness/mra/key.h>
+#include <madness/mra/funcdefaults.h>
+
+/// \file mra/sfcpmap.h
+/// \brief Process map along a Hilbert curve with incremental load balancing
+/// \ingroup function
+
+namespace madness {
+
+    template<typename T, std::size_t NDIM>
+    class FunctionNode;
+
+    template<typename T, std::size_t NDIM>
+    class Function;
+
+    /// Process map that cuts a Hilbert curve through the boxes into contiguous segments
+
+    /// Every key is given the position on the curve of the first box at
+    /// level \c nlevel it contains (finer keys that of their ancestor at
+    /// \c nlevel), and process \c p owns the positions in
+    /// <tt>[splitters[p-1],splitters[p])</tt>.  Since all descendants of a
+    /// box occupy a contiguous range of the curve, and consecutive boxes on
+    /// the curve are face neighbors, a subtree and most of its neighbors
+    /// live on the same process.  Level 0 always maps to process 0.
+    ///
+    /// The splitters are computed from costs by LoadBalanceSFC, which moves
+    /// them only as far as the drift in the costs requires.
+    template <std::size_t NDIM>
+    class SFCPmap : public WorldDCPmapInterface< Key<NDIM> > {
+    public:
+        typedef Key<NDIM> keyT;
+        typedef uint64_t indexT; ///< Position on the curve
+
+        /// Level at which positions are resolved, so that all NDIM*nlevel bits fit in indexT
+        static const int nlevel = (62/int(NDIM) < 30) ? 62/int(NDIM) : 30;
+
+    private:
+        std::vector<indexT> splitters; ///< First position of each process but the first
+
+        /// Hilbert index of the box at level nlevel with translation x (overwritten)
+
+        /// Transforms the coordinates into the transposed Hilbert index
+        /// (J. Skilling, AIP Conf. Proc. 707, 381 (2004)) and interleaves
+        /// its bits, most significant first.
+        static indexT hilbert(indexT* x) {
+            const indexT M = indexT(1) << (nlevel-1);
+            for (indexT Q=M; Q>1; Q>>=1) {
+                const indexT P = Q-1;
+                for (std::size_t i=0; i<NDIM; ++i) {
+                    if (x[i] & Q) {
+                        x[0] ^= P;
+                    }
+                    else {
+                        const indexT t = (x[0]^x[i]) & P;
+                        x[0] ^= t;
+                        x[i] ^= t;
+                    }
+                }
+            }
+            for (std::size_t i=1; i<NDIM; ++i) x[i] ^= x[i-1];
+            indexT t = 0;
+            for (indexT Q=M; Q>1; Q>>=1) if (x[NDIM-1] & Q) t ^= Q-1;
+            for (std::size_t i=0; i<NDIM; ++i) x[i] ^= t;
+
+            indexT h = 0;
+            for (int j=nlevel-1; j>=0; --j)
+                for (std::size_t i=0; i<NDIM; ++i)
+                    h = (h<<1) | ((x[i]>>j) & 1);
+            return h;
+        }
+
+    public:
+        /// Splits the curve into equal lengths, one per process
+        SFCPmap(World& world) : splitters(world.size()-1) {
+            for (std::size_t p=0; p<splitters.size(); ++p)
+                splitters[p] = (end()/world.size())*(p+1);
+        }
+
+        /// Process p+1 starts at position splitters[p], which must not decrease
+        SFCPmap(const std::vector<indexT>& splitters) : splitters(splitters) {}
+
+        /// One past the last position on the curve
+        static indexT end() {
+            return indexT(1) << (NDIM*nlevel);
+        }
+
+        /// Position of the key on the curve
+
+        /// All descendants of \c key lie in <tt>[index(key),index(key)+end()>>(NDIM*n))</tt>
+        /// where \c n is the level of key, if not finer than \c nlevel.
+        static indexT index(const keyT& key) {
+            const Level n = key.level();
+            indexT x[NDIM];
+            for (std::size_t d=0; d<NDIM; ++d) {
+                const indexT l = key.translation()[d];
+                x[d] = (n <= nlevel) ? l << (nlevel-n) : l >> (n-nlevel);
+            }
+            const indexT h = hilbert(x);
+            if (n >= nlevel) return h;
+
+            // The leading NDIM*n bits of the position only depend on the
+            // leading n bits of the translation, so the boxes of key fill an
+            // aligned range of the curve, which starts where these bits end
+            return h & ~((indexT(1) << (NDIM*(nlevel-n))) - 1);
+        }
+
+        ProcessID owner(const keyT& key) const {
+            if (key.level() == 0) return 0;
+            return std::upper_bound(splitters.begin(), splitters.end(), index(key)) - splitters.begin();
+        }
+
+        /// Number of processes in the map
+        int size() const {
+            return splitters.size()+1;
+        }
+
+        const std::vector<indexT>& get_splitters() const {
+            return splitters;
+        }
+
+        void print() const {
+            madness::print("SFCPmap", splitters);
+        }
+    };
+
+
+    /// Partitions functions along the Hilbert curve of SFCPmap by cumulative cost
+
+    /// Usage is the same as LoadBalanceDeux
+    /// \code
+    ///    LoadBalanceSFC<3> lb(world);
+    ///    lb.add_tree(vnuc, lbcost<double,3>(1.0,8.0), false);
+    ///    lb.add_tree(rho, lbcost<double,3>(1.0,8.0), true);
+    ///    std::shared_ptr< WorldDCPmapInterface< Key<3> > > pmap = lb.load_balance();
+    ///    if (pmap != FunctionDefaults<3>::get_pmap()) FunctionDefaults<3>::redistribute(world, pmap);
+    /// \endcode
+    /// but no tree of costs is built and nothing is gathered onto one
+    /// process.  The splitters are found by bisection on the curve with
+    /// global sums of the costs below each candidate.  If the current map is
+    /// an SFCPmap whose segments are within a tolerance of the average cost
+    /// it is returned unchanged, and otherwise only the boundaries move, so
+    /// when costs drift between iterations little data changes owner.
+    template <std::size_t NDIM>
+    class LoadBalanceSFC {
+        typedef Key<NDIM> keyT;
+        typedef SFCPmap<NDIM> pmapT;
+        typedef typename pmapT::indexT indexT;
+        World& world;
+        std::vector< std::pair<indexT,double> > costs; ///< Local costs by position
+
+        template <typename T, typename costT>
+        struct add_op {
+            LoadBalanceSFC* lb;
+            const costT& costfn;
+            add_op(LoadBalanceSFC* lb, const costT& costfn) : lb(lb), costfn(costfn) {}
+            void operator()(const keyT& key, const FunctionNode<T,NDIM>& node) const {
+                lb->costs.push_back(std::make_pair(pmapT::index(key), costfn(key,node)));
+            }
+        };
+
+        /// Global cost below each position (which must be the same on all processes)
+        std::vector<double> cost_below(const std::vector<indexT>& pos,
+                                       const std::vector<indexT>& index,
+                                       const std::vector<double>& cum) const {
+            std::vector<double> c(pos.size()+1, 0.0);
+            for (std::size_t k=0; k<pos.size(); ++k)
+                c[k] = cum[std::lower_bound(index.begin(), index.end(), pos[k]) - index.begin()];
+            c.back() = cum.back();
+            world.gop.sum(&c[0], c.size());
+            return c;
+        }
+
+    public:
+        LoadBalanceSFC(World& world) : world(world) {}
+
+        /// Accumulates cost from a function
+        template <typename T, typename costT>
+        void add_tree(const Function<T,NDIM>& f, const costT& costfn, bool fence=false) {
+            const_cast<Function<T,NDIM>&>(f).unaryop_node(add_op<T,costT>(this,costfn), fence);
+        }
+
+        /// Computes the partition, reusing the current map if it is still balanced
+
+        /// @param[in] current The map the functions are distributed with
+        /// @param[in] tol Largest accepted excess of a segment over the average cost
+        /// @return \c current if it is an SFCPmap within \c tol, otherwise a new SFCPmap
+        std::shared_ptr< WorldDCPmapInterface<keyT> >
+        load_balance(const std::shared_ptr< WorldDCPmapInterface<keyT> >& current = FunctionDefaults<NDIM>::get_pmap(),
+                     double tol = 0.1) {
+            world.gop.fence();
+            const std::size_t nsplit = world.size()-1;
+
+            // Merge the local costs at each position and accumulate
+            std::sort(costs.begin(), costs.end());
+            std::vector<indexT> index;
+            std::vector<double> cum(1, 0.0);
+            for (std::size_t i=0; i<costs.size(); ++i) {
+                if (index.empty() || index.back() != costs[i].first) {
+                    index.push_back(costs[i].first);
+                    cum.push_back(cum.back());
+                }
+                cum.back() += costs[i].second;
+            }
+
+            const std::shared_ptr<pmapT> sfc = std::dynamic_pointer_cast<pmapT>(current);
+            if (sfc && sfc->size() == world.size()) {
+                const std::vector<double> c = cost_below(sfc->get_splitters(), index, cum);
+                const double avg = c.back()/world.size();
+                double lo = 0.0, maxcost = 0.0;
+                for (std::size_t k=0; k<=nsplit; ++k) {
+                    const double hi = (k < nsplit) ? c[k] : c.back();
+                    maxcost = std::max(maxcost, hi-lo);
+                    lo = hi;
+                }
+                if (maxcost <= (1.0+tol)*avg) return current;
+            }
+
+            // Smallest position with at least k/nproc of the cost below,
+            // by simultaneous bisection for all k
+            std::vector<indexT> lo(nsplit, 0), hi(nsplit, pmapT::end());
+            const double total = cost_below(lo, index, cum).back();
+            if (total == 0.0) {
+                if (sfc) return current;
+                return std::shared_ptr< WorldDCPmapInterface<keyT> >(new pmapT(world));
+            }
+            while (lo != hi) {
+                std::vector<indexT> mid(nsplit);
+                for (std::size_t k=0; k<nsplit; ++k) mid[k] = lo[k] + (hi[k]-lo[k])/2;
+                const std::vector<double> c = cost_below(mid, index, cum);
+                for (std::size_t k=0; k<nsplit; ++k) {
+                    if (lo[k] == hi[k]) continue;
+                    if (c[k] < total*(k+1)/world.size()) lo[k] = mid[k]+1;
+                    else hi[k] = mid[k];
+                }
+            }
+
+            // The position found puts the box crossing the target below
+            // the split ... keep it above instead if that is closer
+            std::vector<indexT> prev(nsplit);
+            for (std::size_t k=0; k<nsplit; ++k) prev[k] = lo[k] ? lo[k]-1 : 0;
+            const std::vector<double> clo = cost_below(lo, index, cum);
+            const std::vector<double> cprev = cost_below(prev, index, cum);
+            std::vector<indexT> splitters(nsplit);
+            for (std::size_t k=0; k<nsplit; ++k) {
+                const double target = total*(k+1)/world.size();
+                splitters[k] = (target-cprev[k] < clo[k]-target) ? prev[k] : lo[k];
+                if (k > 0) splitters[k] = std::max(splitters[k], splitters[k-1]);
+            }
+
+            return std::shared_ptr< WorldDCPmapInterface<keyT> >(new pmapT(splitters));
+        }
+    };
+}
+
+
+#endif // MADNESS_MRA_SFCPMAP_H__INCLUDED
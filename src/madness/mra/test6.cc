@@ -543,6 +543,94 @@ int test_convolution(World& world, const long& k, const double thresh) {
 }
 
 
+#if HAVE_GENTENSOR
+/// test apply2 and apply2_lowdim on low rank coefficients against the full rank apply
+
+/// Both batch the operator terms over all singular vectors, so they are compared
+/// on one box with the term-by-term apply on the full tensor, or on each singular
+/// vector. apply2_lowdim adds the T terms only to the scaling block of both
+/// particles, which matches the 3D apply on the singular vectors if either the
+/// vector of the operator's particle has no scaling block, or that of the other
+/// particle has nothing else; the even and odd terms are made so. The rank of
+/// the results is reduced, so they agree to the truncation threshold only.
+int test_apply2(World& world, const long& k, const double thresh) {
+
+    print("entering apply2");
+    int nerror=0;
+
+    const long twok=2*k, size=twok*twok*twok, rank=8;
+    const double tol=1.e-5;
+    const Slice s0(0,k-1);
+
+    real_convolution_3d green3 = BSHOperator<3>(world, 1.0, 1.e-8, 1.e-6);
+    real_convolution_6d green6 = BSHOperator<6>(world, 1.0, 1.e-8, 1.e-6);
+
+    for (int p=0; p<2; ++p) {
+        green3.particle()=p+1;
+
+        // random singular vectors of decreasing weight
+        Tensor<double> v[2]={Tensor<double>(rank,twok,twok,twok), Tensor<double>(rank,twok,twok,twok)};
+        Tensor<double> weights(rank);
+        v[0].fillrandom();
+        v[1].fillrandom();
+        for (long r=0; r<rank; ++r) {
+            const Slice sr(r,r);
+            if (r%2==0) {
+                v[p](sr,s0,s0,s0)=0.0;
+            } else {
+                const Tensor<double> v0=copy(v[1-p](sr,s0,s0,s0));
+                v[1-p](sr,_,_,_)=0.0;
+                v[1-p](sr,s0,s0,s0)=v0;
+            }
+            for (int i=0; i<2; ++i) {
+                Tensor<double> vr=v[i](sr,_,_,_);
+                vr.scale(1.0/vr.normf());
+            }
+            weights(r)=std::pow(0.5,double(r));
+        }
+        const GenTensor<double> coeff(SRConf<double>(weights,
+                v[0].reshape(rank,size),v[1].reshape(rank,size),6,twok));
+        const Tensor<double> full=coeff.full_tensor_copy();
+        const GenTensor<double> tt(full,TensorArgs(1.e-10,TT_TENSORTRAIN));
+
+        for (Level n=0; n<3; n+=2) {
+            for (Translation l=0; l<2; ++l) {
+                const Key<3> source3(n,Vector<Translation,3>(0)), shift3(n,Vector<Translation,3>(l));
+                const Key<6> source6(n,Vector<Translation,6>(0)), shift6(n,Vector<Translation,6>(l));
+                const std::string where=" on level "+std::to_string(n)+" with shift "+std::to_string(l);
+
+                Tensor<double> ref(twok,twok,twok,twok,twok,twok);
+                for (long r=0; r<rank; ++r) {
+                    const Tensor<double> x=copy(v[p](Slice(r,r),_,_,_)).reshape(twok,twok,twok);
+                    const Tensor<double> y=copy(v[1-p](Slice(r,r),_,_,_)).reshape(twok,twok,twok);
+                    const Tensor<double> gx=green3.apply(source3,shift3,x,1.e-12);
+                    ref.gaxpy(1.0,(p==0) ? outer(gx,y) : outer(y,gx),weights(r));
+                }
+                const Tensor<double> lowdim=green3.apply2_lowdim(source3,shift3,coeff,tol,tol).full_tensor_copy();
+                double err=(lowdim-ref).normf();
+                nerror+=check_small(err,tol,"apply2_lowdim on particle "+std::to_string(p+1)+where);
+
+                const Tensor<double> lowdim_tt=green3.apply2_lowdim(source3,shift3,tt,tol,tol).full_tensor_copy();
+                err=(lowdim_tt-ref).normf();
+                nerror+=check_small(err,tol,"apply2_lowdim on a tensor train on particle "+std::to_string(p+1)+where);
+
+                if (p==1) continue;
+                const Tensor<double> ref6=green6.apply(source6,shift6,full,1.e-12);
+                const Tensor<double> result6=green6.apply2(source6,shift6,coeff,tol,tol).full_tensor_copy();
+                err=(result6-ref6).normf();
+                nerror+=check_small(err,tol,"apply2"+where);
+
+                const Tensor<double> result6_tt=green6.apply2(source6,shift6,tt,tol,tol).full_tensor_copy();
+                err=(result6_tt-ref6).normf();
+                nerror+=check_small(err,tol,"apply2 on a tensor train"+where);
+            }
+        }
+    }
+
+    print("all done\n");
+    return nerror;
+}
+#endif
 
 
 int test(World& world, const long& k, const double thresh) {
@@ -672,6 +760,7 @@ int main(int argc, char**argv) {
         if (key=="TT") {
             if (val=="TT_2D") tt=TT_2D;
             else if (val=="TT_FULL") tt=TT_FULL;
+            else if (val=="TT_TENSORTRAIN") tt=TT_TENSORTRAIN;
             else {
                 print("arg",arg, "key",key,"val",val);
                 MADNESS_EXCEPTION("confused tensor type",0);
@@ -711,6 +800,9 @@ int main(int argc, char**argv) {
     error+=test_convolution(world,k,thresh);
 //    error+=test_multiply(world,k,thresh);
     error+=test_add(world,k,thresh);
+#if HAVE_GENTENSOR
+    error+=test_apply2(world,k,thresh);
+#endif
 //    error+=test_exchange(world,k,thresh);
 //    error+=test_inner(world,k,thresh);
 
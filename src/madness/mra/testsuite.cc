@@ -167,7 +167,7 @@ public:
 #define CHECK(value, threshold, message)        \
         do { \
              if (world.rank() == 0) { \
-                 bool status = std::abs(value) < threshold;             \
+                 bool status = std::abs(value) < (threshold);           \
                 const char* msgs[2] = {"FAILED","OK"};                  \
                 std::printf("%20.20s :%5d :%30.30s : %10.2e  < %10.2e : %s\n", (__FUNCTION__),(__LINE__),(message),(std::abs(value)),(threshold), (msgs[int(status)])); \
                 if (!status) ok = false; \
@@ -1145,11 +1145,18 @@ int test_plot(World& world) {
     std::size_t maxlevel = f.max_local_depth();
     if (world.rank() == 0) {
         const double h = (2.0*L - 12e-13)/(npt[0]-1.0);
+        std::vector<coordT> xmany(npt[0]);
+        for (int i=0; i<npt[0]; ++i) xmany[i] = coordT(-L + i*h + 2e-13);
+        std::vector<T> fmany = f.eval_many(xmany).get();
+
         for (int i=0; i<npt[0]; ++i) {
             double x = -L + i*h + 2e-13;
 
             T fnum  = f.eval(coordT(x)).get();
 
+            // this checks if the batched evaluation agrees
+            CHECK(fnum-fmany[i],1e-12,"eval_many");
+
             // this checks if the numerical representation is consistent
             std::pair<bool,T> fnum2 = f.eval_local_only(coordT(x),maxlevel);
             if (world.size() == 1 && !fnum2.first) print("eval_local_only: non-local but nproc=1!");
@@ -1225,6 +1232,424 @@ int test_io(World& world) {
     return 1;
 }
 
+/// Returns the number of nodes with coefficients and how many of them are held in float
+template <typename T, std::size_t NDIM>
+std::pair<long,long> count_demoted(World& world, const Function<T,NDIM>& f) {
+    typedef typename FunctionImpl<T,NDIM>::dcT dcT;
+    long n[2] = {0,0};
+    const dcT& coeffs = f.get_impl()->get_coeffs();
+    for (typename dcT::const_iterator it=coeffs.begin(); it!=coeffs.end(); ++it) {
+        if (it->second.has_coeff()) ++n[0];
+        if (it->second.is_demoted()) ++n[1];
+    }
+    world.gop.sum(n,2);
+    return std::make_pair(n[0],n[1]);
+}
+
+template <typename T, std::size_t NDIM>
+int test_storage_precision(World& world) {
+    bool ok=true;
+    typedef Vector<double,NDIM> coordT;
+    typedef std::shared_ptr< FunctionFunctorInterface<T,NDIM> > functorT;
+
+    if (world.rank() == 0)
+        print("\nTest float storage of coefficients, type =",archive::get_type_name<T>(),", ndim =",NDIM);
+
+    FunctionDefaults<NDIM>::set_cubic_cell(-10,10);
+    FunctionDefaults<NDIM>::set_k(8);
+    FunctionDefaults<NDIM>::set_thresh(1e-6);
+    FunctionDefaults<NDIM>::set_refine(true);
+    FunctionDefaults<NDIM>::set_initial_level(2);
+    FunctionDefaults<NDIM>::set_truncate_mode(0);
+
+    const coordT origin(0.0);
+    const double expnt = 1.0;
+    const double coeff = pow(2.0/PI,0.25*NDIM);
+    functorT functor(new Gaussian<T,NDIM>(origin, expnt, coeff));
+
+    Function<T,NDIM> f = FunctionFactory<T,NDIM>(world).functor(functor);
+    Function<T,NDIM> g = FunctionFactory<T,NDIM>(world).functor(functor).storage_precision(SP_FLOAT);
+    CHECK(double(f.get_storage_precision()-SP_NATIVE), 0.5, "default storage precision");
+    CHECK(double(g.get_storage_precision()-SP_FLOAT), 0.5, "factory storage precision");
+
+    std::pair<long,long> n = count_demoted(world,f);
+    CHECK(double(n.second), 0.5, "native nodes in float");
+    n = count_demoted(world,g);
+    CHECK(double(n.first-n.second), 0.5, "nodes in float after projection");
+    const std::size_t fsize = f.get_impl()->real_size();
+    const std::size_t gsize = g.get_impl()->real_size();
+    const std::size_t nodesize = f.get_impl()->tree_size()*(sizeof(Key<NDIM>)+sizeof(FunctionNode<T,NDIM>));
+    CHECK(double(2*(gsize-nodesize))/(fsize-nodesize)-1.0, 0.01, "halved memory");
+
+    // Everything is computed in T, so only the initial rounding to float shows
+    const double norm = f.norm2();
+    const double eps = 1e-6;
+
+    // Read-only operations leave the nodes in float
+    CHECK(g.norm2()-norm, eps, "norm of float storage");
+    CHECK(g(origin)-f(origin), eps, "eval of float storage");
+    CHECK(g.err(*functor)-f.err(*functor), eps, "err of float storage");
+    CHECK(double(g.get_impl()->real_size())-double(gsize), 0.5, "memory after norm2, eval, err");
+    CHECK(inner(f,g)-inner(f,f), eps, "inner with float storage");
+    n = count_demoted(world,g);
+    CHECK(double(n.first-n.second), 0.5, "nodes in float after inner");
+
+    std::vector< Function<T,NDIM> > v(2);
+    v[0] = f;
+    v[1] = g;
+    Tensor<T> s = matrix_inner(world, v, v, true);
+    CHECK(s(0,1)-inner(f,f), eps, "matrix_inner with float storage");
+    n = count_demoted(world,g);
+    CHECK(double(n.first-n.second), 0.5, "nodes in float after matrix_inner");
+
+    CHECK((g-f).norm2()/norm, eps, "err of float storage");
+
+    // The difference above left g compressed and fully promoted
+    g.reconstruct();
+    n = count_demoted(world,g);
+    CHECK(double(n.first-n.second), 0.5, "nodes in float after reconstruct");
+    g.compress();
+    n = count_demoted(world,g);
+    CHECK(double(n.first-n.second), 0.5, "nodes in float after compress");
+    CHECK((g-f).norm2()/norm, eps, "err after compress");
+
+    g.truncate();
+    f.truncate();
+    n = count_demoted(world,g);
+    CHECK(double(n.first-n.second), 0.5, "nodes in float after truncate");
+    g.reconstruct();
+    f.reconstruct();
+    CHECK((g-f).norm2()/norm, eps, "err after truncate");
+    CHECK(g.err(*functor)-f.err(*functor), eps, "err of truncated function");
+
+    g.set_storage_precision(SP_NATIVE);
+    n = count_demoted(world,g);
+    CHECK(double(n.second), 0.5, "nodes in float after set_storage_precision");
+
+    world.gop.fence();
+    if (world.rank() == 0) print("test_storage_precision OK",ok);
+    if (ok) return 0;
+    return 1;
+}
+
+template <typename T, std::size_t NDIM>
+int test_pack(World& world) {
+    bool ok=true;
+    typedef Vector<double,NDIM> coordT;
+    typedef std::shared_ptr< FunctionFunctorInterface<T,NDIM> > functorT;
+
+    if (world.rank() == 0)
+        print("\nTest pack/unpack, type =",archive::get_type_name<T>(),", ndim =",NDIM);
+
+    const double thresh = 1e-6;
+    FunctionDefaults<NDIM>::set_cubic_cell(-10,10);
+    FunctionDefaults<NDIM>::set_k(8);
+    FunctionDefaults<NDIM>::set_thresh(thresh);
+    FunctionDefaults<NDIM>::set_refine(true);
+    FunctionDefaults<NDIM>::set_initial_level(2);
+    FunctionDefaults<NDIM>::set_truncate_mode(0);
+
+    const coordT origin(0.0);
+    const double expnt = 1.0;
+    const double coeff = pow(2.0/PI,0.25*NDIM);
+    functorT functor(new Gaussian<T,NDIM>(origin, expnt, coeff));
+
+    Function<T,NDIM> f = FunctionFactory<T,NDIM>(world).functor(functor);
+    Function<T,NDIM> g = copy(f);
+    const double norm = f.norm2();
+    const double nbyte = double(copy(f).compress().size()*sizeof(T));
+
+    // get_impl() refuses packed functions
+    const std::shared_ptr< FunctionImpl<T,NDIM> > gimpl = g.get_impl();
+    g.pack();
+    CHECK(double(!g.is_packed()), 0.5, "is_packed");
+    CHECK(double(gimpl->tree_size()), 0.5, "tree freed");
+    const double ratio = gimpl->packed_size()/nbyte;
+    if (world.rank() == 0) print("packed/unpacked size", ratio);
+    // About 0.07 in 3D; the shallow 1D trees gain little
+    CHECK(ratio, (NDIM==3 ? 0.1 : 1.0), "packed size");
+
+    g.unpack();
+    CHECK(double(g.is_packed()), 0.5, "is_packed after unpack");
+    CHECK(double(g.is_compressed()), 0.5, "reconstructed after unpack");
+    CHECK((g-f).norm2()/norm, 3.0*thresh, "err of packing");
+    CHECK(g.err(*functor)-f.err(*functor), thresh, "err of unpacked function");
+
+    f.compress();
+    Function<T,NDIM> h = copy(f);
+    h.pack(0.01*thresh);
+    h.unpack(false);
+    world.gop.fence();
+    CHECK(double(!h.is_compressed()), 0.5, "compressed after unpack");
+    CHECK((h-f).norm2()/norm, 0.03*thresh, "err of packing with tol");
+
+    world.gop.fence();
+    if (world.rank() == 0) print("test_pack OK",ok);
+    if (ok) return 0;
+    return 1;
+}
+
+template <typename T, std::size_t NDIM>
+int test_compress_truncate(World& world) {
+    bool ok=true;
+    typedef Vector<double,NDIM> coordT;
+    typedef std::shared_ptr< FunctionFunctorInterface<T,NDIM> > functorT;
+    typedef typename FunctionImpl<T,NDIM>::dcT dcT;
+
+    if (world.rank() == 0)
+        print("\nTest fused compress and truncate, type =",archive::get_type_name<T>(),", ndim =",NDIM);
+
+    FunctionDefaults<NDIM>::set_cubic_cell(-10,10);
+    FunctionDefaults<NDIM>::set_k(6);
+    FunctionDefaults<NDIM>::set_thresh(1e-5);
+    FunctionDefaults<NDIM>::set_refine(true);
+    FunctionDefaults<NDIM>::set_initial_level(2);
+    FunctionDefaults<NDIM>::set_truncate_mode(0);
+
+    const coordT origin(1.0);
+    functorT functor(new Gaussian<T,NDIM>(origin, 1.0, 1.0));
+    Function<T,NDIM> f = FunctionFactory<T,NDIM>(world).functor(functor);
+    Function<T,NDIM> g = copy(f);
+
+    // A truncation threshold that removes nodes
+    const double tol = 1e-3;
+    f.norm_tree();
+    f.compress();
+    f.truncate(tol);
+    g.compress_truncate(tol);
+    CHECK(double(f.size()) - double(g.size()), 0.5, "size");
+    CHECK((f-g).norm2(), 1e-14, "difference");
+
+    // Same nodes, coeffs and norm tree
+    double err[3] = {0.0, 0.0, 0.0};
+    const dcT& fc = f.get_impl()->get_coeffs();
+    const dcT& gc = g.get_impl()->get_coeffs();
+    for (typename dcT::const_iterator it=fc.begin(); it!=fc.end(); ++it) {
+        typename dcT::const_iterator jt = gc.find(it->first).get();
+        if (jt == gc.end()) {
+            err[0] += 1.0;
+            continue;
+        }
+        const FunctionNode<T,NDIM>& fn = it->second;
+        const FunctionNode<T,NDIM>& gn = jt->second;
+        if (fn.has_coeff() != gn.has_coeff() || fn.has_children() != gn.has_children()) err[0] += 1.0;
+        else if (fn.has_coeff()) err[1] = std::max(err[1], (fn.coeff().full_tensor_copy()-gn.coeff().full_tensor_copy()).normf());
+        err[2] = std::max(err[2], std::abs(fn.get_norm_tree()-gn.get_norm_tree()));
+    }
+    world.gop.sum(err[0]);
+    world.gop.max(err[1]);
+    world.gop.max(err[2]);
+    CHECK(err[0], 0.5, "nodes");
+    CHECK(err[1], 1e-14, "coeffs");
+    CHECK(err[2], 1e-14, "norm tree");
+
+    // The vector version
+    std::vector< Function<T,NDIM> > v(2);
+    v[0] = FunctionFactory<T,NDIM>(world).functor(functor);
+    v[1] = copy(v[0]);
+    compress_truncate(world, v, tol);
+    CHECK((v[0]-f).norm2(), 1e-14, "vector difference");
+
+    world.gop.fence();
+    if (world.rank() == 0) print("test_compress_truncate OK",ok);
+    if (ok) return 0;
+    return 1;
+}
+
+template <typename T, std::size_t NDIM>
+int test_sfcpmap(World& world) {
+    bool ok=true;
+    typedef Vector<double,NDIM> coordT;
+    typedef Key<NDIM> keyT;
+    typedef std::shared_ptr< WorldDCPmapInterface<keyT> > pmapT;
+    typedef std::shared_ptr< FunctionFunctorInterface<T,NDIM> > functorT;
+
+    if (world.rank() == 0)
+        print("\nTest space-filling-curve process map, type =",archive::get_type_name<T>(),", ndim =",NDIM);
+
+    // The boxes of a level tile the curve, and the children and
+    // grandchildren of a box lie in its range
+    std::vector<keyT> boxes(1, keyT(0));
+    for (Level n=0; n<=3; ++n) {
+        const uint64_t len = SFCPmap<NDIM>::end() >> (NDIM*n);
+        std::vector<uint64_t> first;
+        std::vector<keyT> next;
+        long nout = 0;
+        for (std::size_t b=0; b<boxes.size(); ++b) {
+            const uint64_t i0 = SFCPmap<NDIM>::index(boxes[b]);
+            first.push_back(i0);
+            std::vector<keyT> below(1, boxes[b]);
+            for (int generation=0; generation<2; ++generation) {
+                std::vector<keyT> children;
+                for (std::size_t j=0; j<below.size(); ++j) {
+                    for (KeyChildIterator<NDIM> kit(below[j]); kit; ++kit) {
+                        const uint64_t i = SFCPmap<NDIM>::index(kit.key());
+                        if (i < i0 || i >= i0+len) ++nout;
+                        children.push_back(kit.key());
+                    }
+                }
+                below.swap(children);
+            }
+            for (KeyChildIterator<NDIM> kit(boxes[b]); kit; ++kit) next.push_back(kit.key());
+        }
+        std::sort(first.begin(), first.end());
+        for (std::size_t b=0; b<first.size(); ++b) if (first[b] != b*len) ++nout;
+        CHECK(double(nout), 0.5, "descendants on curve");
+        boxes.swap(next);
+    }
+
+    // Random keys, also finer than the resolved level, lie in the range of their ancestors
+    long nout = 0;
+    for (int r=0; r<1000; ++r) {
+        const Level n = 1 + int(RandomValue<double>()*(SFCPmap<NDIM>::nlevel+3));
+        Vector<Translation,NDIM> l;
+        for (std::size_t d=0; d<NDIM; ++d) l[d] = Translation(RandomValue<double>()*std::pow(2.0,double(n)));
+        const keyT key(n, l);
+        const int generation = 1 + int(RandomValue<double>()*n);
+        const keyT ancestor = key.parent(generation);
+        const uint64_t i0 = SFCPmap<NDIM>::index(ancestor);
+        const uint64_t i = SFCPmap<NDIM>::index(key);
+        const Level na = std::min(ancestor.level(), SFCPmap<NDIM>::nlevel);
+        if (i < i0 || i >= i0+(SFCPmap<NDIM>::end() >> (NDIM*na))) ++nout;
+    }
+    CHECK(double(nout), 0.5, "random keys on curve");
+
+    FunctionDefaults<NDIM>::set_cubic_cell(-10,10);
+    FunctionDefaults<NDIM>::set_k(6);
+    FunctionDefaults<NDIM>::set_thresh(1e-5);
+    FunctionDefaults<NDIM>::set_refine(true);
+    FunctionDefaults<NDIM>::set_initial_level(2);
+    FunctionDefaults<NDIM>::set_truncate_mode(0);
+
+    const coordT origin(1.0);
+    functorT functor(new Gaussian<T,NDIM>(origin, 1.0, 1.0));
+    Function<T,NDIM> f = FunctionFactory<T,NDIM>(world).functor(functor);
+    const double norm = f.norm2();
+
+    const pmapT old = FunctionDefaults<NDIM>::get_pmap();
+    LoadBalanceSFC<NDIM> lb(world);
+    lb.add_tree(f, lbcost<T,NDIM>(), true);
+    const pmapT pmap = lb.load_balance(old, 0.5);
+    CHECK(double(pmap == old), 0.5, "new map");
+    FunctionDefaults<NDIM>::redistribute(world, pmap);
+    CHECK(f.norm2() - norm, 1e-12, "norm after redistribution");
+
+    // Every node is where the map puts it, and the nodes are shared evenly
+    const FunctionImpl<T,NDIM>& impl = *f.get_impl();
+    double nnode[2] = {0.0, 0.0};
+    for (typename FunctionImpl<T,NDIM>::dcT::const_iterator it=impl.get_coeffs().begin(); it!=impl.get_coeffs().end(); ++it) {
+        if (pmap->owner(it->first) != world.rank()) nnode[1] += 1.0;
+        nnode[0] += 1.0;
+    }
+    double nmax = nnode[0];
+    world.gop.sum(nnode, 2);
+    world.gop.max(nmax);
+    CHECK(nnode[1], 0.5, "nodes on their owner");
+    CHECK(nmax*world.size()/nnode[0] - 1.0, 0.5, "balance");
+
+    // A balanced map is kept, and redistributing to it does nothing
+    LoadBalanceSFC<NDIM> lb2(world);
+    lb2.add_tree(f, lbcost<T,NDIM>(), true);
+    CHECK(double(lb2.load_balance(pmap, 0.5) != pmap), 0.5, "balanced map kept");
+    FunctionDefaults<NDIM>::redistribute(world, lb2.load_balance(pmap, 0.5));
+
+    FunctionDefaults<NDIM>::redistribute(world, old);
+    CHECK(f.norm2() - norm, 1e-12, "norm after restoring map");
+
+    world.gop.fence();
+    if (world.rank() == 0) print("test_sfcpmap OK",ok);
+    if (ok) return 0;
+    return 1;
+}
+
+class TensorReceiver : public WorldObject<TensorReceiver> {
+public:
+    TensorReceiver(World& world) : WorldObject<TensorReceiver>(world) {
+        process_pending();
+    }
+
+    double sum(const Tensor<double>& t) const { return t.sum(); }
+
+    long address(const Tensor<double>& t) const { return long(t.ptr()); }
+};
+
+namespace madness {
+    template <> volatile std::list<detail::PendingMsg> WorldObject<TensorReceiver>::pending = std::list<detail::PendingMsg>();
+    template <> Spinlock WorldObject<TensorReceiver>::pending_mutex(0);
+}
+
+// Memcpy an attachment back out of the list made by BufferOutputArchive
+static void load_test_attachment(const void* context, long k, void* ptr, std::size_t nbyte) {
+    const std::vector<archive::BufferAttachment>& att =
+        *static_cast<const std::vector<archive::BufferAttachment>*>(context);
+    MADNESS_ASSERT(att[k].nbyte == nbyte);
+    memcpy(ptr, att[k].ptr, nbyte);
+}
+
+int test_tensor_am(World& world) {
+    bool ok=true;
+    if (world.rank() == 0) print("\nTest tensors in active messages and tasks");
+
+    Tensor<double> small(5l,7l), large(80l,80l,8l);
+    small.fillrandom();
+    large.fillrandom();
+    const std::size_t attach_min = 1024;
+
+    // Plain tensors are copied into the buffer
+    archive::BufferOutputArchive count0(attach_min);
+    count0 & small & large;
+    CHECK(double(count0.num_attachments()), 0.5, "no attachments without handover");
+
+    // Large data that is handed over is attached to a buffer and not copied
+    // into it ... a view does not own its storage so is copied
+    const Tensor<double> view = large(Slice(1,2),_,_);
+    std::vector<archive::BufferAttachment> att;
+    archive::BufferOutputArchive count(attach_min);
+    count & handover(small) & handover(large) & handover(view);
+    std::vector<unsigned char> buf(count.size());
+    archive::BufferOutputArchive oar(buf.data(), buf.size(), &att, attach_min);
+    oar & handover(small) & handover(large) & handover(view);
+    CHECK(double(count.num_attachments() - 1), 0.5, "no. of attachments counted");
+    CHECK(double(att.size() - 1), 0.5, "no. of attachments");
+    CHECK(double(att[0].ptr != large.ptr()), 0.5, "attachment not copied");
+    CHECK(double(buf.size() > 1024 + view.size()*sizeof(double)), 0.5, "size of buffer");
+
+    Tensor<double> small2, large2, view2;
+    archive::BufferInputArchive iar(buf.data(), buf.size(), &load_test_attachment, &att);
+    iar & small2 & large2 & view2;
+    CHECK((small2-small).normf(), 1e-14, "small tensor from buffer");
+    CHECK((large2-large).normf(), 1e-14, "large tensor from attachment");
+    CHECK((view2-view).normf(), 1e-14, "view from buffer");
+
+    // Local tasks share the tensor, remote ones receive it beside the message
+    // if it was handed over
+    TensorReceiver receiver(world);
+    world.gop.fence();
+    const ProcessID next = (world.rank() + 1) % world.size();
+    CHECK(double(receiver.task(world.rank(), &TensorReceiver::address, large).get() != long(large.ptr())),
+          0.5, "local task shares tensor");
+    CHECK(double(receiver.task(world.rank(), &TensorReceiver::address, handover(large)).get() != long(large.ptr())),
+          0.5, "local task shares handed over tensor");
+    CHECK(receiver.task(next, &TensorReceiver::sum, small).get() - small.sum(), 1e-12, "small tensor in task");
+    CHECK(receiver.task(next, &TensorReceiver::sum, large).get() - large.sum(), 1e-9, "large tensor in task");
+    CHECK(receiver.task(next, &TensorReceiver::sum, handover(large)).get() - large.sum(), 1e-9, "handed over tensor in task");
+    CHECK(receiver.send(next, &TensorReceiver::sum, handover(large)).get() - large.sum(), 1e-9, "handed over tensor in am");
+
+    // A tensor that was not handed over to a remote task may be changed once
+    // the send returns ... a local task shares it so must not be raced
+    if (next != world.rank()) {
+        Tensor<double> changed = copy(large);
+        Future<double> sum = receiver.task(next, &TensorReceiver::sum, changed);
+        changed.fill(0.0);
+        CHECK(sum.get() - large.sum(), 1e-9, "tensor changed after the send");
+    }
+    world.gop.fence();
+
+    if (world.rank() == 0) print("test_tensor_am OK",ok);
+    if (ok) return 0;
+    return 1;
+}
+
 template <typename T, std::size_t NDIM>
 int test_apply_push_1d(World& world) {
     typedef Vector<double,NDIM> coordT;
@@ -1334,6 +1759,9 @@ int main(int argc, char**argv) {
         nfail+=test_plot<double,1>(world);
         nfail+=test_apply_push_1d<double,1>(world);
         nfail+=test_io<double,1>(world);
+        nfail+=test_storage_precision<double,1>(world);
+        nfail+=test_pack<double,1>(world);
+        nfail+=test_tensor_am(world);
 
         // stupid location for this test
         GenericConvolution1D<double,GaussianGenericFunctor<double> > gen(10,GaussianGenericFunctor<double>(100.0,100.0),0);
@@ -1352,6 +1780,8 @@ int main(int argc, char**argv) {
         nfail+=test_op<double_complex,1>(world);
         nfail+=test_plot<double_complex,1>(world);
         nfail+=test_io<double_complex,1>(world);
+        nfail+=test_storage_precision<double_complex,1>(world);
+        nfail+=test_pack<double_complex,1>(world);
 
         //TaskInterface::debug = true;
         nfail+=test_basic<double,2>(world);
@@ -1370,6 +1800,10 @@ int main(int argc, char**argv) {
         nfail+=test_coulomb(world);
         nfail+=test_plot<double,3>(world);
         nfail+=test_io<double,3>(world);
+        nfail+=test_storage_precision<double,3>(world);
+        nfail+=test_pack<double,3>(world);
+        nfail+=test_sfcpmap<double,3>(world);
+        nfail+=test_compress_truncate<double,3>(world);
 
         test_plot<double,4>(world); // slow unless reduce npt in test_plot
 
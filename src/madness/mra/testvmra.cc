@@ -117,8 +117,183 @@ void test_inner(World& world) {
     Tensor<TENSOR_RESULT_TYPE(T,R)> rold = matrix_inner_old(world,left,*pright,sym);
     END_TIMER("old");
 
+    double err = (rold-rnew).normf();
     if (world.rank() == 0) 
-        print("error norm",(rold-rnew).normf(),"\n");
+        print("error norm",err,"\n");
+    MADNESS_ASSERT(err < 1e-10);
+}
+
+template <typename T, int NDIM, bool sym>
+void test_inner_distributed(World& world, int64_t chunk) {
+    typedef std::shared_ptr< FunctionFunctorInterface<T,NDIM> > functorT;
+
+    const int n=67, m=sym ? n : 71;
+
+    if (world.rank() == 0)
+        print("testing distributed matrix_inner<",archive::get_type_name<T>(),">","sym =",sym,"chunk =",chunk);
+
+    std::vector< Function<T,NDIM> > f(n), g(m);
+    for (int i=0; i<n; ++i) {
+        functorT p(RandomGaussian<T,NDIM>(FunctionDefaults<NDIM>::get_cell(),0.5));
+        f[i] = FunctionFactory<T,NDIM>(world).functor(p);
+    }
+    for (int j=0; j<m; ++j) {
+        functorT p(RandomGaussian<T,NDIM>(FunctionDefaults<NDIM>::get_cell(),0.5));
+        g[j] = FunctionFactory<T,NDIM>(world).functor(p);
+    }
+    const std::vector< Function<T,NDIM> >& right = sym ? f : g;
+
+    START_TIMER;
+    DistributedMatrix<T> A = matrix_inner(column_distributed_matrix_distribution(world, n, m, 13), f, right, sym, chunk);
+    END_TIMER("distributed");
+    Tensor<T> rnew(n,m);
+    A.copy_to_replicated(rnew);
+    Tensor<T> rold = matrix_inner_old(world,f,right,sym);
+
+    double err = (rold-rnew).normf();
+    if (world.rank() == 0)
+        print("error norm",err,"\n");
+    MADNESS_ASSERT(err < 1e-10);
+}
+
+template <typename T, typename R, int NDIM>
+void test_transform(World& world) {
+    typedef std::shared_ptr< FunctionFunctorInterface<T,NDIM> > functorT;
+    typedef TENSOR_RESULT_TYPE(T,R) resultT;
+
+    const double thresh=1.e-5;
+    FunctionDefaults<NDIM>::set_cubic_cell(-10.0,10.0);
+    FunctionDefaults<NDIM>::set_k(8);
+    FunctionDefaults<NDIM>::set_thresh(thresh);
+    FunctionDefaults<NDIM>::set_refine(true);
+    FunctionDefaults<NDIM>::set_initial_level(3);
+    FunctionDefaults<NDIM>::set_truncate_mode(1);
+
+    const int n=40, m=37;
+
+    if (world.rank() == 0)
+        print("testing transform<",archive::get_type_name<T>(),",",archive::get_type_name<R>(),">");
+
+    std::vector< Function<T,NDIM> > v(n);
+    for (int j=0; j<n; ++j) {
+        functorT f(RandomGaussian<T,NDIM>(FunctionDefaults<NDIM>::get_cell(),100.0));
+        v[j] = FunctionFactory<T,NDIM>(world).functor(f);
+    }
+
+    // Banded, like the transformation between localized sets of orbitals
+    Tensor<R> c(n,m);
+    for (int j=0; j<n; ++j) {
+        for (int i=std::max(0,j-5); i<std::min(m,j+6); ++i) c(j,i) = RandomValue<double>() - 0.5;
+    }
+    world.gop.broadcast(c.ptr(), c.size(), 0);
+    compress(world, v);
+
+    START_TIMER;
+    std::vector< Function<resultT,NDIM> > vold = transform(world, v, c);
+    END_TIMER("old");
+    START_TIMER;
+    std::vector< Function<resultT,NDIM> > vnew = transform(world, v, c, thresh*0.01, true);
+    END_TIMER("new");
+
+    double err = 0.0;
+    for (int i=0; i<m; ++i) err = std::max(err, (vold[i] - vnew[i]).norm2());
+    if (world.rank() == 0)
+        print("max error norm",err,"\n");
+    MADNESS_ASSERT(err < thresh);
+}
+
+template <typename T, int NDIM>
+void test_apply(World& world) {
+    typedef std::shared_ptr< FunctionFunctorInterface<T,NDIM> > ffunctorT;
+
+    const double thresh=1.e-5;
+    FunctionDefaults<NDIM>::set_cubic_cell(-10.0,10.0);
+    FunctionDefaults<NDIM>::set_k(8);
+    FunctionDefaults<NDIM>::set_thresh(thresh);
+    FunctionDefaults<NDIM>::set_refine(true);
+    FunctionDefaults<NDIM>::set_initial_level(3);
+    FunctionDefaults<NDIM>::set_truncate_mode(1);
+
+    const int nfunc=20;
+    if (world.rank() == 0)
+        print("testing apply<",archive::get_type_name<T>(),"> on",nfunc,"functions");
+
+    // Gaussians close to the origin, like the orbitals of a molecule
+    Tensor<double> cell = FunctionDefaults<NDIM>::get_cell()*0.2;
+    std::vector< Function<T,NDIM> > f(nfunc);
+    for (int i=0; i<nfunc; ++i) {
+        ffunctorT functor(RandomGaussian<T,NDIM>(cell,100.0));
+        f[i] = FunctionFactory<T,NDIM>(world).functor(functor);
+    }
+    truncate(world, f);
+    SeparatedConvolution<double,NDIM> op = CoulombOperator(world, 1.e-4, thresh);
+
+    // Make the operator blocks before timing
+    apply(world, op, f);
+
+    START_TIMER;
+    std::vector< Function<T,NDIM> > rold(nfunc);
+    for (int i=0; i<nfunc; ++i) rold[i] = apply(op, f[i]);
+    END_TIMER("old");
+    START_TIMER;
+    std::vector< Function<T,NDIM> > rnew = apply(world, op, f);
+    END_TIMER("new");
+
+    double err = 0.0, norm = 0.0;
+    for (int i=0; i<nfunc; ++i) {
+        err = std::max(err, (rnew[i]-rold[i]).norm2());
+        norm = std::max(norm, rold[i].norm2());
+    }
+    if (world.rank() == 0)
+        print("max norm",norm,"max error norm",err,"\n");
+    MADNESS_ASSERT(err < 10.0*thresh*norm);
+}
+
+template <typename T, int NDIM>
+void test_eval_many(World& world) {
+    typedef std::shared_ptr< FunctionFunctorInterface<T,NDIM> > ffunctorT;
+    typedef Vector<double,NDIM> coordT;
+
+    const double thresh=1.e-6;
+    FunctionDefaults<NDIM>::set_cubic_cell(-10.0,10.0);
+    FunctionDefaults<NDIM>::set_k(6);
+    FunctionDefaults<NDIM>::set_thresh(thresh);
+    FunctionDefaults<NDIM>::set_refine(true);
+    FunctionDefaults<NDIM>::set_initial_level(3);
+    FunctionDefaults<NDIM>::set_truncate_mode(1);
+
+    const int npt=2000;
+    if (world.rank() == 0)
+        print("testing eval_many<",archive::get_type_name<T>(),"> at",npt,"points on every process");
+
+    // Sharp, so the leaves near the center are much smaller than the others
+    ffunctorT functor(new Gaussian<T,NDIM>(coordT(0.5), 20.0, 1.0));
+    Function<T,NDIM> f = FunctionFactory<T,NDIM>(world).functor(functor);
+    const std::size_t nbox = f.tree_size();
+
+    // Every process evaluates points all over the cell and near the center
+    std::vector<coordT> x(npt);
+    for (int i=0; i<npt; ++i) {
+        for (std::size_t d=0; d<NDIM; ++d) {
+            const double r = RandomValue<double>()-0.5;
+            x[i][d] = (i%2) ? 20.0*r : 0.5 + 2.0*r;
+        }
+    }
+    START_TIMER;
+    std::vector<T> v = f.eval_many(x).get();
+    END_TIMER("eval_many");
+    MADNESS_ASSERT(v.size() == std::size_t(npt));
+
+    double err = 0.0, errexact = 0.0;
+    for (int i=0; i<npt; ++i) {
+        err = std::max(err, std::abs(v[i] - (*functor)(x[i])));
+        if (i%10 == 0) errexact = std::max(errexact, std::abs(v[i] - f.eval(x[i]).get()));
+    }
+    world.gop.max(err);
+    world.gop.max(errexact);
+    if (world.rank() == 0)
+        print("boxes",nbox,"max error",err,"max difference from eval",errexact,"\n");
+    MADNESS_ASSERT(err < 100.0*thresh && errexact < 1e-12);
 }
 
 int main(int argc, char**argv) {
@@ -128,6 +303,8 @@ int main(int argc, char**argv) {
         World world(SafeMPI::COMM_WORLD);
         startup(world,argc,argv);
 
+        test_apply<double,3>(world);
+        test_eval_many<double,3>(world);
         test_inner<double,double,3,false>(world);
         test_inner<double,double,3,true>(world);
 #if !HAVE_GENTENSOR
@@ -135,6 +312,19 @@ int main(int argc, char**argv) {
         test_inner<std::complex<double>,double,3,false>(world);
         test_inner<std::complex<double>,std::complex<double>,3,false>(world);
         test_inner<std::complex<double>,std::complex<double>,3,true>(world);
+#endif
+        test_transform<double,double,3>(world);
+#if !HAVE_GENTENSOR
+        test_transform<std::complex<double>,double,3>(world);
+#endif
+        test_inner_distributed<double,3,false>(world, 1000);
+        test_inner_distributed<double,3,true>(world, 1000);
+        // Patches off the diagonal and their mirrors
+        test_inner_distributed<double,3,false>(world, 16);
+        test_inner_distributed<double,3,true>(world, 16);
+#if !HAVE_GENTENSOR
+        test_inner_distributed<std::complex<double>,3,true>(world, 1000);
+        test_inner_distributed<std::complex<double>,3,true>(world, 16);
 #endif
     }
     catch (const SafeMPI::Exception& e) {
@@ -0,0 +1,18 @@
+#! /bin/sh
+
+# Runs testvmra.mpi on three processes, so that the operations on vectors
+# of functions send their work between processes.
+# MPIEXEC (default mpiexec) and MPIEXEC_FLAGS select how to launch it.
+# Handlers are sent as addresses, so address space randomization is turned
+# off where setarch can do so.
+
+set -e
+
+MPIEXEC=${MPIEXEC:-mpiexec}
+NORANDOM=
+if setarch `uname -m` -R true > /dev/null 2>&1; then
+    NORANDOM="setarch `uname -m` -R"
+fi
+
+echo "Running testvmra.mpi on 3 processes"
+$MPIEXEC $MPIEXEC_FLAGS -n 3 $NORANDOM ./testvmra.mpi
@@ -198,10 +198,27 @@ namespace madness {
                   bool fence=true) {
         PROFILE_BLOCK(Vtruncate);
 
-        compress(world, v);
+        // Reconstructed functions are compressed and truncated in one sweep
+        for (unsigned int i=0; i<v.size(); ++i) {
+            if (v[i].is_compressed()) v[i].truncate(tol, false);
+            else v[i].compress_truncate(tol, false);
+        }
+
+        if (fence) world.gop.fence();
+    }
+
+    /// Compress and truncate a vector of functions and compute their norm trees, in one sweep each
+    template <typename T, std::size_t NDIM>
+    void compress_truncate(World& world,
+                           std::vector< Function<T,NDIM> >& v,
+                           double tol=0.0,
+                           bool fence=true) {
+        PROFILE_BLOCK(Vcompress_truncate);
+
+        reconstruct(world, v);
 
         for (unsigned int i=0; i<v.size(); ++i) {
-            v[i].truncate(tol, false);
+            v[i].compress_truncate(tol, false);
         }
 
         if (fence) world.gop.fence();
@@ -285,6 +302,11 @@ namespace madness {
     }
 
 
+    /// Transforms a vector of functions according to new[i] = sum[j] old[j]*c[j,i]
+
+    /// Contributions c(j,i)*old[j] to a box whose norm falls below the
+    /// truncation tolerance \c tol for the box are skipped, so for localized
+    /// functions the cost grows about linearly with the size of the system.
     template <typename L, typename R, std::size_t NDIM>
     std::vector< Function<TENSOR_RESULT_TYPE(L,R),NDIM> >
     transform(World& world,  const std::vector< Function<L,NDIM> >& v, const Tensor<R>& c, double tol, bool fence) {
@@ -426,32 +448,143 @@ namespace madness {
 
 
 
+    /// Elementwise sum of matrix patches in WorldGopInterface::reduce
+    template <typename T>
+    struct MatrixPatchSumOp {
+        typedef Tensor<T> result_type;
+        typedef Tensor<T> argument_type;
+
+        result_type operator()() const {
+            return result_type();
+        }
+
+        void operator()(result_type& result, const argument_type& value) const {
+            if (result.size() == 0) result = copy(value);
+            else result += value;
+        }
+    };
+
+    /// Key of the reduction of a block in matrix_inner
+
+    /// The id of the call keeps the blocks of different calls, and other
+    /// reductions with integer keys, apart.
+    struct MatrixPatchKey {
+        uniqueidT call; ///< Same on all processes for one call
+        long block;     ///< Counts the blocks of the call
+
+        MatrixPatchKey() : call(), block(0) {}
+
+        MatrixPatchKey(const uniqueidT& call, long block) : call(call), block(block) {}
+
+        bool operator==(const MatrixPatchKey& other) const {
+            return call == other.call && block == other.block;
+        }
+
+        hashT hash() const {
+            hashT seed = hash_value(call);
+            detail::combine_hash(seed, hash_value(block));
+            return seed;
+        }
+
+        template <typename Archive>
+        void serialize(Archive& ar) {
+            ar & call & block;
+        }
+    };
+
+    /// Reduces the local contribution to a patch of \c A onto the processes owning it
+
+    /// Every process must make the same sequence of calls.  The futures of
+    /// the reduced blocks owned by this process are appended to \c blocks
+    /// and the corresponding ranges of the local data to \c where.
+    template <typename T>
+    void reduce_matrix_patch(DistributedMatrix<T>& A, int64_t ilow, int64_t jlow,
+                             const Tensor<T>& P, MatrixPatchKey& key,
+                             std::vector< Future< Tensor<T> > >& blocks,
+                             std::vector< std::vector<Slice> >& where)
+    {
+        World& world = A.get_world();
+        const int64_t ihigh = ilow + P.dim(0) - 1;
+        const int64_t jhigh = jlow + P.dim(1) - 1;
+        for (ProcessID p=0; p<world.size(); ++p) {
+            int64_t il, ih, jl, jh;
+            A.get_range(p, il, ih, jl, jh);
+            const int64_t i0 = std::max(il,ilow), i1 = std::min(ih,ihigh);
+            const int64_t j0 = std::max(jl,jlow), j1 = std::min(jh,jhigh);
+            if (i0>i1 || j0>j1) continue;
+
+            Tensor<T> value = copy(P(Slice(i0-ilow,i1-ilow),Slice(j0-jlow,j1-jlow)));
+            Future< Tensor<T> > block = world.gop.reduce(key, value, MatrixPatchSumOp<T>(), p);
+            ++key.block;
+            if (p == world.rank()) {
+                blocks.push_back(block);
+                std::vector<Slice> s(2);
+                s[0] = Slice(i0-il,i1-il);
+                s[1] = Slice(j0-jl,j1-jl);
+                where.push_back(s);
+            }
+        }
+    }
+
+    /// Computes the matrix inner product of two function vectors into a distributed matrix
+
+    /// The matrix is formed in patches of at most \c chunk x \c chunk.  Each
+    /// process computes its local contribution to a patch, which is then
+    /// reduced directly onto the processes that own it, so the full matrix is
+    /// never replicated.  If \c sym only the patches on or above the diagonal
+    /// are computed and the others follow by (Hermitian) symmetry.
     template <typename T, std::size_t NDIM>
     DistributedMatrix<T> matrix_inner(const DistributedMatrixDistribution& d,
                                       const std::vector< Function<T,NDIM> >& f,
                                       const std::vector< Function<T,NDIM> >& g,
-                                      bool sym=false)
+                                      bool sym=false, int64_t chunk=1000)
     {
         PROFILE_FUNC;
         DistributedMatrix<T> A(d);
+        World& world = A.get_world();
         const int64_t n = A.coldim();
         const int64_t m = A.rowdim();
         MADNESS_ASSERT(int64_t(f.size()) == n && int64_t(g.size()) == m);
+        MADNESS_ASSERT(!sym || n == m);
+
+        world.gop.fence();
+        compress(world, f);
+        if (&f != &g) compress(world, g);
+
+        std::vector<const FunctionImpl<T,NDIM>*> left(n);
+        std::vector<const FunctionImpl<T,NDIM>*> right(m);
+        for (int64_t i=0; i<n; i++) left[i] = f[i].get_impl().get();
+        for (int64_t j=0; j<m; j++) right[j]= g[j].get_impl().get();
 
         // Assume we can always create an ichunk*jchunk matrix locally
-        const int ichunk = 1000;
-        const int jchunk = 1000; // 1000*1000*8 = 8 MBytes
+        const int64_t ichunk = chunk;
+        const int64_t jchunk = chunk; // 1000*1000*8 = 8 MBytes
+        MatrixPatchKey key(world.unique_obj_id(), 0); // every process makes the same calls
+        std::vector< Future< Tensor<T> > > blocks;
+        std::vector< std::vector<Slice> > where;
         for (int64_t ilo=0; ilo<n; ilo+=ichunk) {
             int64_t ihi = std::min(ilo + ichunk, n);
-            std::vector< Function<T,NDIM> > ivec(f.begin()+ilo, f.begin()+ihi);
-            for (int64_t jlo=0; jlo<m; jlo+=jchunk) {
+            std::vector<const FunctionImpl<T,NDIM>*> ivec(left.begin()+ilo, left.begin()+ihi);
+            for (int64_t jlo=(sym ? ilo : 0); jlo<m; jlo+=jchunk) {
                 int64_t jhi = std::min(jlo + jchunk, m);
-                std::vector< Function<T,NDIM> > jvec(g.begin()+jlo, g.begin()+jhi);
-
-                Tensor<T> P = matrix_inner(A.get_world(),ivec,jvec);
-                A.copy_from_replicated_patch(ilo, ihi-1, jlo, jhi-1, P);
+                Tensor<T> P;
+                if (sym && jlo == ilo) {
+                    P = FunctionImpl<T,NDIM>::inner_local(ivec, ivec, true);
+                }
+                else {
+                    std::vector<const FunctionImpl<T,NDIM>*> jvec(right.begin()+jlo, right.begin()+jhi);
+                    P = FunctionImpl<T,NDIM>::inner_local(ivec, jvec, false);
+                }
+                reduce_matrix_patch(A, ilo, jlo, P, key, blocks, where);
+                if (sym && jlo != ilo)
+                    reduce_matrix_patch(A, jlo, ilo, transpose(P).conj(), key, blocks, where);
             }
         }
+
+        for (std::size_t b=0; b<blocks.size(); ++b)
+            A.data()(where[b]) += blocks[b].get();
+        world.gop.fence();
+
         return A;
     }
 
@@ -847,9 +980,30 @@ namespace madness {
         reconstruct(world, f);
         nonstandard(world, ncf);
 
-        std::vector< Function<TENSOR_RESULT_TYPE(T,R), NDIM> > result(f.size());
-        for (unsigned int i=0; i<f.size(); ++i) {
-            result[i] = apply_only(op, f[i], false);
+        typedef TENSOR_RESULT_TYPE(T,R) resultT;
+        std::vector< Function<resultT, NDIM> > result(f.size());
+
+        // In 3D the coefficients of all functions at the same node are
+        // applied together if the functions have the same process map
+        bool batch = (NDIM <= 3) && !f.empty();
+        for (unsigned int i=1; batch && i<f.size(); ++i) batch = (f[i].get_pmap() == f[0].get_pmap());
+
+        if (batch) {
+            std::vector<const FunctionImpl<R,NDIM>*> fimpl(f.size());
+            std::vector<FunctionImpl<resultT,NDIM>*> rimpl(f.size());
+            for (unsigned int i=0; i<f.size(); ++i) {
+                result[i].set_impl(f[i], true);
+                fimpl[i] = f[i].get_impl().get();
+                rimpl[i] = result[i].get_impl().get();
+            }
+            // tasks carry the ids of all results, which must exist everywhere
+            world.gop.fence();
+            rimpl[0]->apply_batch(op, fimpl, rimpl, false);
+        }
+        else {
+            for (unsigned int i=0; i<f.size(); ++i) {
+                result[i] = apply_only(op, f[i], false);
+            }
         }
 
         world.gop.fence();
@@ -221,6 +221,11 @@ extern "C"
             	 real8 *a, integer *lda, real8 *tau,
             	 real8 *work, integer *lwork, integer *infoOUT);
 
+extern "C"
+	void zgeqrf_(integer *m, integer *n,
+            	 complex_real8 *a, integer *lda, complex_real8 *tau,
+            	 complex_real8 *work, integer *lwork, integer *infoOUT);
+
 //    	dgeqp3(M, N, A, LDA, JPVT, TAU, WORK, LWORK, INFO );
 
 // PURPOSE
@@ -103,6 +103,10 @@
  * - addition of slices
  *   as of now we can add slices only using append()
  *
+ * - addition of tensor trains (TT_TENSORTRAIN)
+ *   the cores are concatenated, which increases the TT ranks; add_SVD() and
+ *   reduce_rank() round the ranks again using TensorTrain::truncate()
+ *
  * - addition in full rank form
  *   at times it might be sensible to accumulate your result in a full rank tensor,
  *   and after collecting all the contribution you can transform it into a low
@@ -127,21 +131,27 @@ namespace madness {
 	struct TensorArgs {
 		double thresh;
 		TensorType tt;
-        TensorArgs() : thresh(-1.0), tt(TT_NONE) {}
-		TensorArgs(const double& thresh1, const TensorType& tt1)
+		RankReduceType rr;
+        TensorArgs() : thresh(-1.0), tt(TT_NONE), rr(RR_SVD) {}
+		TensorArgs(const double& thresh1, const TensorType& tt1,
+				const RankReduceType& rr1=RR_SVD)
 			: thresh(thresh1)
-			, tt(tt1) {
+			, tt(tt1)
+			, rr(rr1) {
 		}
 		static std::string what_am_i(const TensorType& tt) {
 			if (tt==TT_2D) return "TT_2D";
 			if (tt==TT_FULL) return "TT_FULL";
+			if (tt==TT_TENSORTRAIN) return "TT_TENSORTRAIN";
 			return "unknown tensor type";
 		}
 		template <typename Archive>
 		void serialize(const Archive& ar) {
 		    int i=int(tt);
-		    ar & thresh & i;
+		    int j=int(rr);
+		    ar & thresh & i & j;
 		    tt=TensorType(i);
+		    rr=RankReduceType(j);
 		}
 	};
 
@@ -191,12 +201,17 @@ namespace madness {
 		size_t real_size() const {return this->size();}
 
         void reduce_rank(const double& eps) {return;};
+        void reduce_rank(const TensorArgs& targs) {return;};
         void normalize() {return;}
 
         std::string what_am_i() const {return "GenTensor, aliased to Tensor";};
 		TensorType tensor_type() const {return TT_FULL;}
 
 		void add_SVD(const GenTensor<T>& rhs, const double& eps) {*this+=rhs;}
+		void add_SVD(const GenTensor<T>& rhs, const TensorArgs& targs) {*this+=rhs;}
+		void append(GenTensor<T>& rhs, const T fac=1.0) const {rhs+=(*this)*fac;}
+		void reserve(const long r) {return;}
+		void clear_terms() {this->clear();}
 
 		SRConf<T> config() const {MADNESS_EXCEPTION("no SRConf in complex GenTensor",1);}
         SRConf<T> get_configs(const int& start, const int& end) const {MADNESS_EXCEPTION("no SRConf in complex GenTensor",1);}
@@ -303,10 +318,15 @@ namespace madness {
 		typedef Tensor<T> tensorT;
 		typedef GenTensor<T> gentensorT;
 		typedef std::shared_ptr<configT> sr_ptr;
+		typedef TensorTrain<T> ttT;
+		typedef std::shared_ptr<ttT> tt_ptr;
 
 		/// pointer to the low rank tensor
 		sr_ptr _ptr;
 
+		/// pointer to the tensor train, iff this is TT_TENSORTRAIN
+		tt_ptr _tt;
+
 		/// the machine precision
 		static double machinePrecision() {return 1.e-14;}
 
@@ -316,13 +336,16 @@ namespace madness {
 	public:
 
 		/// empty ctor
-		GenTensor() : _ptr() {
+		GenTensor() : _ptr(), _tt() {
 		}
 
 		/// copy ctor, shallow
 //		GenTensor(const GenTensor<T>& rhs) : _ptr(rhs._ptr) { // DON'T DO THIS: USE_COUNT BLOWS UP
-		GenTensor(const GenTensor<T>& rhs) : _ptr() {
-			if (rhs.has_data()) _ptr=rhs._ptr;
+		GenTensor(const GenTensor<T>& rhs) : _ptr(), _tt() {
+			if (rhs.has_data()) {
+				_ptr=rhs._ptr;
+				_tt=rhs._tt;
+			}
 		};
 
 		/// ctor with dimensions
@@ -335,7 +358,8 @@ namespace madness {
     			MADNESS_ASSERT(maxk==dim[0]);
     		}
 
-   			_ptr=sr_ptr(new configT(dim.size(),dim[0],tt));
+    		if (tt==TT_TENSORTRAIN) _tt=tt_ptr(new ttT(dim));
+    		else _ptr=sr_ptr(new configT(dim.size(),dim[0],tt));
 
 		}
 
@@ -349,13 +373,15 @@ namespace madness {
     			MADNESS_ASSERT(maxk==dim[0]);
     		}
 
-   			_ptr=sr_ptr(new configT(dim.size(),dim[0],targs.tt));
+    		if (targs.tt==TT_TENSORTRAIN) _tt=tt_ptr(new ttT(dim));
+    		else _ptr=sr_ptr(new configT(dim.size(),dim[0],targs.tt));
 
 		}
 
 		/// ctor with dimensions
 		GenTensor(const TensorType& tt, const unsigned int& k, const unsigned int& dim) {
-   			_ptr=sr_ptr(new configT(dim,k,tt));
+			if (tt==TT_TENSORTRAIN) _tt=tt_ptr(new ttT(std::vector<long>(dim,k)));
+			else _ptr=sr_ptr(new configT(dim,k,tt));
 		}
 
 		/// ctor with a regular Tensor and arguments, deep
@@ -372,6 +398,12 @@ namespace madness {
 			    MADNESS_ASSERT(rhs.dim(0)==rhs.dim(idim));
 			}
 
+			// tensor trains are decomposed directly
+			if (targs.tt==TT_TENSORTRAIN) {
+				_tt=tt_ptr(new ttT(rhs,targs.thresh*facReduce()));
+				return;
+			}
+
 			_ptr=sr_ptr(new configT(rhs.ndim(),rhs.dim(0),targs.tt));
 
 			// direct reduction on the polynomial values on the Tensor
@@ -434,7 +466,7 @@ namespace madness {
 		}
 
 		/// ctor with a SliceGenTensor, deep
-		GenTensor(const SliceGenTensor<T>& rhs) : _ptr() {
+		GenTensor(const SliceGenTensor<T>& rhs) : _ptr(), _tt() {
 			*this=rhs;
 		}
 
@@ -445,7 +477,10 @@ namespace madness {
 
 		/// shallow assignment operator: g0 = g1
 		gentensorT& operator=(const gentensorT& rhs) {
-			if (this != &rhs) _ptr=rhs._ptr;
+			if (this != &rhs) {
+				_ptr=rhs._ptr;
+				_tt=rhs._tt;
+			}
 			return *this;
 		}
 
@@ -458,6 +493,7 @@ namespace madness {
 		/// deep copy of rhs by deep copying rhs.configs
 		friend gentensorT copy(const gentensorT& rhs) {
 			if (rhs._ptr) return gentensorT(copy(*rhs._ptr));
+			if (rhs._tt) return gentensorT(copy(*rhs._tt));
 			return gentensorT();
 		}
 
@@ -472,6 +508,7 @@ namespace madness {
 		/// return some of the terms of the SRConf (start,..,end), inclusively
 		/// shallow copy
 		const GenTensor get_configs(const int& start, const int& end) const {
+			MADNESS_ASSERT(tensor_type()!=TT_TENSORTRAIN);
 			return gentensorT(config().get_configs(start,end));
 		}
 
@@ -498,7 +535,11 @@ namespace madness {
 	public:
 
 		/// ctor w/ configs, shallow (indirectly, via vector_)
-		explicit GenTensor(const SRConf<T>& config) : _ptr(new configT(config)) {
+		explicit GenTensor(const SRConf<T>& config) : _ptr(new configT(config)), _tt() {
+		}
+
+		/// ctor w/ a tensor train, shallow
+		explicit GenTensor(const TensorTrain<T>& tt) : _ptr(), _tt(new ttT(tt)) {
 		}
 
 	private:
@@ -521,6 +562,9 @@ namespace madness {
 				return gentensorT(configT(a));
 			}
 
+			// tensor trains slice their cores
+			if (tensor_type()==TT_TENSORTRAIN) return gentensorT(_tt->copy_slice(s));
+
 			MADNESS_ASSERT(_ptr->has_structure());
 //			_ptr->make_structure();
 
@@ -621,14 +665,14 @@ namespace madness {
 		/// inplace addition
 		gentensorT& operator+=(const SliceGenTensor<T>& rhs) {
 			const std::vector<Slice> s(this->ndim(),Slice(0,get_k()-1,1));
-			this->_ptr->inplace_add(*rhs._refGT._ptr,s,rhs._s,1.0,1.0);
+			this->inplace_add(rhs._refGT,s,rhs._s,1.0,1.0);
 			return *this;
 		}
 
 		/// inplace subtraction
 		gentensorT& operator-=(const SliceGenTensor<T>& rhs) {
 			const std::vector<Slice> s(this->ndim(),Slice(0,get_k()-1,1));
-			this->_ptr->inplace_add(*rhs._refGT._ptr,s,rhs._s,1.0,-1.0);
+			this->inplace_add(rhs._refGT,s,rhs._s,1.0,-1.0);
 			return *this;
 		}
 
@@ -648,6 +692,10 @@ namespace madness {
                 full_tensor().gaxpy(alpha,rhs.full_tensor(),beta);
                 return *this;
             }
+	    	if (tensor_type()==TT_TENSORTRAIN) {
+	    		_tt->gaxpy(alpha,*rhs._tt,beta);
+	    		return *this;
+	    	}
 	    	if (not (alpha==1.0)) this->scale(alpha);
 	    	rhs.append(*this,beta);
 	    	return *this;
@@ -656,6 +704,10 @@ namespace madness {
 		/// multiply with a scalar
 	    template<typename Q>
 	    GenTensor<TENSOR_RESULT_TYPE(T,Q)>& scale(const Q& dfac) {
+			if (_tt) {
+				_tt->scale(dfac);
+				return *this;
+			}
 			if (!_ptr) return *this;
 			if (tensor_type()==TT_FULL) {
 				full_tensor().scale(dfac);
@@ -671,64 +723,79 @@ namespace madness {
 		};
 
 		void fillrandom(const int r=1) {
+			if (tensor_type()==TT_TENSORTRAIN) {
+				MADNESS_EXCEPTION("no fillrandom for TT_TENSORTRAIN",1);
+			}
 			if (tensor_type()==TT_FULL) full_tensor().fillrandom();
 			else _ptr->fillWithRandom(r);
 		}
 
 		/// do we have data? note difference to SRConf::has_data() !
 		bool has_data() const {
-		    if (_ptr) return true;
+		    if (_ptr or _tt) return true;
 		    return false;
 		}
 
 		/// do we have data?
 		bool has_no_data() const {return (!has_data());}
 
-		/// return the separation rank
+		/// return the separation rank, or the largest TT rank for tensor trains
 		long rank() const {
 			if (_ptr) return _ptr->rank();
+			if (_tt) return _tt->max_rank();
 			else return 0;
 		};
 
 		/// return the dimension
-		unsigned int dim() const {return _ptr->dim();};
+		unsigned int dim() const {
+			if (_tt) return _tt->ndim();
+			return _ptr->dim();
+		};
 
 		/// returns the dimensions
-		long dim(const int& i) const {return _ptr->get_k();};
+		long dim(const int& i) const {return get_k();};
 
 		/// returns the number of dimensions
 		long ndim() const {
 			if (_ptr) return _ptr->dim();
+			if (_tt) return _tt->ndim();
 			return -1;
 		};
 
 		/// return the polynomial order
-		unsigned int get_k() const {return _ptr->get_k();};
+		unsigned int get_k() const {
+			if (_tt) return _tt->dim(0);
+			return _ptr->get_k();
+		};
 
 		/// returns the TensorType of this
 		TensorType tensor_type() const {
 			if (_ptr) return _ptr->type();
+			if (_tt) return TT_TENSORTRAIN;
 			return TT_NONE;
 		};
 
         /// return the type of the derived class for me
-        std::string what_am_i() const {return TensorArgs::what_am_i(_ptr->type());};
+        std::string what_am_i() const {return TensorArgs::what_am_i(tensor_type());};
 
 		/// returns the number of coefficients (might return zero, although tensor exists)
 		size_t size() const {
 			if (_ptr) return _ptr->nCoeff();
+			if (_tt) return _tt->size();
 			return 0;
 		};
 
 		/// returns the number of coefficients (might return zero, although tensor exists)
 		size_t real_size() const {
 			if (_ptr) return _ptr->real_size()+sizeof(*this);
+			if (_tt) return _tt->real_size()+sizeof(*this);
 			return 0;
 		};
 
 		/// returns the Frobenius norm
 		double normf() const {
 			if (has_no_data()) return 0.0;
+			if (_tt) return _tt->normf();
 			return config().normf();
 		};
 
@@ -736,9 +803,16 @@ namespace madness {
         double svd_normf() const {
             if (has_no_data()) return 0.0;
             if (tensor_type()==TT_2D) return config().svd_normf();
+            if (tensor_type()==TT_TENSORTRAIN) return _tt->normf();
             return config().normf();
         };
 
+		/// return a reference to the tensor train
+		const TensorTrain<T>& get_tensortrain() const {
+			MADNESS_ASSERT(tensor_type()==TT_TENSORTRAIN);
+			return *_tt;
+		}
+
         /// returns the trace of <this|rhs>
 		T trace(const GenTensor<T>& rhs) const {
 			return this->trace_conj(rhs);
@@ -757,6 +831,7 @@ namespace madness {
 			MADNESS_ASSERT(compatible(*this,rhs));
 			MADNESS_ASSERT(this->tensor_type()==rhs.tensor_type());
 
+			if (this->tensor_type()==TT_TENSORTRAIN) return _tt->trace(rhs.get_tensortrain());
 			return overlap(*(this->_ptr),*rhs._ptr);
 		}
 
@@ -789,6 +864,7 @@ namespace madness {
 			const TensorType tt=tensor_type();
 			if (tt==TT_NONE) return Tensor<T>();
 			else if (tt==TT_2D) return this->reconstruct_tensor();
+			else if (tt==TT_TENSORTRAIN) return _tt->reconstruct();
 			else if (tt==TT_FULL) {
 				return copy(full_tensor());
 			} else {
@@ -807,12 +883,27 @@ namespace madness {
 				return;
 			} else if (this->tensor_type()==TT_2D) {
 				config().divide_and_conquer_reduce(eps*facReduce());
+			} else if (this->tensor_type()==TT_TENSORTRAIN) {
+				_tt->truncate(eps*facReduce());
+				return;
 			} else {
 				MADNESS_EXCEPTION("unknown tensor type in GenTensor::reduceRank()",0);
 			}
 			MADNESS_ASSERT(this->_ptr->has_structure() or this->rank()==0);
 		}
 
+		/// reduce the rank of this, using the algorithm given by targs.rr
+		void reduce_rank(const TensorArgs& targs) {
+
+			if (rank()==0) return;
+			if (targs.rr==RR_RANDOMIZED and tensor_type()==TT_2D) {
+				config().randomized_reduce(targs.thresh*facReduce());
+				MADNESS_ASSERT(this->_ptr->has_structure() or this->rank()==0);
+			} else {
+				reduce_rank(targs.thresh);
+			}
+		}
+
 		/// print this' coefficients
 		void printCoeff(const std::string title) const {
 			print("printing SepRep",title);
@@ -925,7 +1016,19 @@ namespace madness {
 
 		/// append this to rhs, shape must conform
 		void append(gentensorT& rhs, const T fac=1.0) const {
-			rhs.config().append(*this->_ptr,fac);
+			if (tensor_type()==TT_TENSORTRAIN) rhs._tt->gaxpy(T(1.0),*_tt,fac);
+			else rhs.config().append(*this->_ptr,fac);
+		}
+
+		/// preallocate memory for at least r terms, so that append does not reallocate
+		void reserve(const long r) {
+			if (tensor_type()==TT_2D) config().reserve(std::max(r,rank()));
+		}
+
+		/// remove all terms, but keep the memory for subsequent appends
+		void clear_terms() {
+			if (tensor_type()==TT_2D) config().clear_terms();
+			else clear();
 		}
 
 		/// add SVD
@@ -939,9 +1042,28 @@ namespace madness {
 				this->full_tensor()+=rhs.full_tensor();
 				return;
 			}
+			if (tensor_type()==TT_TENSORTRAIN) {
+				*_tt+=rhs.get_tensortrain();
+				_tt->truncate(thresh*facReduce());
+				return;
+			}
 			config().add_SVD(rhs.config(),thresh*facReduce());
 		}
 
+		/// add SVD, using the algorithm given by targs.rr
+
+		/// the randomized algorithm concatenates the terms and reduces the
+		/// rank of the sum in one go, so rhs need not be orthonormal
+		void add_SVD(const gentensorT& rhs, const TensorArgs& targs) {
+			if (targs.rr==RR_RANDOMIZED and tensor_type()==TT_2D
+					and has_data() and rhs.has_data()) {
+				rhs.append(*this,1.0);
+				config().randomized_reduce(targs.thresh*facReduce());
+			} else {
+				add_SVD(rhs,targs.thresh);
+			}
+		}
+
 	    /// check compatibility
 		friend bool compatible(const gentensorT& rhs, const gentensorT& lhs) {
 			return ((rhs.tensor_type()==lhs.tensor_type()) and (rhs.get_k()==lhs.get_k())
@@ -952,6 +1074,7 @@ namespace madness {
 		gentensorT transform(const Tensor<T> c) const {
 //			_ptr->make_structure();
 		    if (has_no_data()) return gentensorT();
+		    if (_tt) return gentensorT(_tt->transform(c));
 			MADNESS_ASSERT(_ptr->has_structure());
 			return gentensorT (this->_ptr->transform(c));
 		}
@@ -961,6 +1084,7 @@ namespace madness {
 		gentensorT general_transform(const Tensor<Q> c[]) const {
 //		    this->_ptr->make_structure();
 		    if (has_no_data()) return gentensorT();
+		    if (_tt) return gentensorT(_tt->general_transform(c));
             MADNESS_ASSERT(_ptr->has_structure());
 			return gentensorT (this->config().general_transform(c));
 		}
@@ -968,15 +1092,22 @@ namespace madness {
 		/// inner product
 		gentensorT transform_dir(const Tensor<T>& c, const int& axis) const {
 //            this->_ptr->make_structure();
+            if (_tt) return GenTensor<T>(_tt->transform_dir(c,axis));
             MADNESS_ASSERT(_ptr->has_structure());
             return GenTensor<T>(this->_ptr->transform_dir(c,axis));
 		}
 
-		/// return a reference to the SRConf
-		const SRConf<T>& config() const {return *_ptr;}
+		/// return a reference to the SRConf; tensor trains have none
+		const SRConf<T>& config() const {
+			MADNESS_ASSERT(tensor_type()!=TT_TENSORTRAIN);
+			return *_ptr;
+		}
 
-		/// return a reference to the SRConf
-		SRConf<T>& config() {return *_ptr;}
+		/// return a reference to the SRConf; tensor trains have none
+		SRConf<T>& config() {
+			MADNESS_ASSERT(tensor_type()!=TT_TENSORTRAIN);
+			return *_ptr;
+		}
 
 		/// return the additional safety for rank reduction
 		static double fac_reduce() {return facReduce();};
@@ -984,7 +1115,10 @@ namespace madness {
 	private:
 
 		/// release memory
-		void clear() {_ptr.reset();};
+		void clear() {
+			_ptr.reset();
+			_tt.reset();
+		};
 
 		/// same as operator+=, but handles non-conforming vectors (i.e. slices)
 		void inplace_add(const gentensorT& rhs, const std::vector<Slice>& lhs_s,
@@ -1005,6 +1139,8 @@ namespace madness {
 
 			if (tensor_type()==TT_FULL) {
 				full_tensor()(lhs_s).gaxpy(alpha,rhs.full_tensor()(rhs_s),beta);
+			} else if (tensor_type()==TT_TENSORTRAIN) {
+				_tt->gaxpy(lhs_s,alpha,rhs.get_tensortrain(),rhs_s,beta);
 			} else {
 //				rhs._ptr->make_structure();
 //				_ptr->make_structure();
@@ -1108,7 +1244,7 @@ namespace madness {
 
 		/// inplace addition
 		SliceGenTensor<T>& operator+=(const SliceGenTensor<T>& rhs) {
-			_refGT.inplace_add(GenTensor<T>(*rhs._refGT._ptr),this->_s,rhs._s,1.0,1.0);
+			_refGT.inplace_add(rhs._refGT,this->_s,rhs._s,1.0,1.0);
 			return *this;
 		}
 
@@ -1229,12 +1365,68 @@ namespace madness {
             s << str.c_str() ;
         } else {
             str="GenTensor has data";
-            s << str.c_str() << g.config();
+            if (g.tensor_type()==TT_TENSORTRAIN) s << str.c_str() << " TT ranks " << g.get_tensortrain().ranks();
+            else s << str.c_str() << g.config();
         }
         return s;
     }
 
     namespace archive {
+
+    	/// Marks a GenTensor archive that carries a version and the tensor type
+
+    	/// Archives written before tensor trains hold the SRConf straight
+    	/// after the existence flag, and its leading dimension is never
+    	/// this large, so the loader can tell the two layouts apart.
+    	static const unsigned int GENTENSOR_ARCHIVE_COOKIE = 0x47544e53;
+
+    	/// Version of the GenTensor archive layout that follows the cookie
+    	static const int GENTENSOR_ARCHIVE_VERSION = 1;
+
+    	/// What follows the existence flag in a GenTensor archive
+
+    	/// This is stored as one object, like the SRConf of the old layout,
+    	/// so that typed archives find the same preamble in front of both.
+    	template <typename T>
+    	struct GenTensorArchiveHeader {
+    		int version;		///< layout version, 0 for the old layout
+    		TensorType type;	///< the representation of the data that follows
+    		SRConf<T> conf;		///< all of the data of an old archive
+
+    		GenTensorArchiveHeader() : version(GENTENSOR_ARCHIVE_VERSION), type(TT_FULL) {}
+    	};
+
+    	/// Stores the header of a GenTensor archive
+    	template <class Archive, typename T>
+    	struct ArchiveStoreImpl< Archive, GenTensorArchiveHeader<T> > {
+    		static void store(const Archive& ar, const GenTensorArchiveHeader<T>& h) {
+    			int i=int(h.type);
+    			ar & GENTENSOR_ARCHIVE_COOKIE & h.version & i;
+    		};
+    	};
+
+    	/// Loads the header of a GenTensor archive, or all of an old one
+    	template <class Archive, typename T>
+    	struct ArchiveLoadImpl< Archive, GenTensorArchiveHeader<T> > {
+    		static void load(const Archive& ar, GenTensorArchiveHeader<T>& h) {
+    			unsigned int cookie=0;
+    			ar & cookie;
+    			if (cookie!=GENTENSOR_ARCHIVE_COOKIE) {
+    				// old layout: the cookie was the dimension of an SRConf
+    				h.version=0;
+    				h.conf.load_after_dim(ar,cookie);
+    				h.type=h.conf.type();
+    				return;
+    			}
+    			int i=0;
+    			ar & h.version & i;
+    			if (h.version!=GENTENSOR_ARCHIVE_VERSION) {
+    				MADNESS_EXCEPTION("unknown version of a GenTensor archive",h.version);
+    			}
+    			h.type=TensorType(i);
+    		};
+    	};
+
         /// Serialize a tensor
         template <class Archive, typename T>
 		struct ArchiveStoreImpl< Archive, GenTensor<T> > {
@@ -1244,7 +1436,13 @@ namespace madness {
 			static void store(const Archive& ar, const GenTensor<T>& t) {
 				bool exist=t.has_data();
 				ar & exist;
-				if (exist) ar & t.config();
+				if (exist) {
+					GenTensorArchiveHeader<T> h;
+					h.type=t.tensor_type();
+					ar & h;
+					if (t.tensor_type()==TT_TENSORTRAIN) ar & t.get_tensortrain();
+					else ar & t.config();
+				}
 			};
 		};
 
@@ -1260,10 +1458,20 @@ namespace madness {
 				bool exist=false;
 				ar & exist;
 				if (exist) {
-					SRConf<T> conf;
-					ar & conf;
-					//t.config()=conf;
-					t=GenTensor<T>(conf);
+					GenTensorArchiveHeader<T> h;
+					ar & h;
+					if (h.version==0) {
+						t=GenTensor<T>(h.conf);
+					} else if (h.type==TT_TENSORTRAIN) {
+						TensorTrain<T> tt;
+						ar & tt;
+						t=GenTensor<T>(tt);
+					} else {
+						SRConf<T> conf;
+						ar & conf;
+						//t.config()=conf;
+						t=GenTensor<T>(conf);
+					}
 				}
 			};
 		};
@@ -1302,6 +1510,15 @@ namespace madness {
  		return coeff;
      }
 
+     /// A low rank tensor is sent as it is ... its data sits in an SRConf, not a Tensor of its own
+
+     /// Lets callers hand over a coeffT whether or not it is aliased to a
+     /// Tensor (see \c HandoverTensor)
+     template <class T>
+     const GenTensor<T>& handover(const GenTensor<T>& t) {
+     	return t;
+     }
+
     #endif /* HAVE_GENTENSOR */
 
     /// change representation to targ.tt
@@ -1314,15 +1531,17 @@ namespace madness {
         if (t.has_no_data()) return;
 
         // for now
-        MADNESS_ASSERT(targs.tt==TT_FULL or targs.tt==TT_2D);
-        MADNESS_ASSERT(current_type==TT_FULL or current_type==TT_2D);
+        MADNESS_ASSERT(targs.tt==TT_FULL or targs.tt==TT_2D or targs.tt==TT_TENSORTRAIN);
+        MADNESS_ASSERT(current_type==TT_FULL or current_type==TT_2D or current_type==TT_TENSORTRAIN);
 
         GenTensor<T> result;
         if (targs.tt==TT_FULL) {
             result=GenTensor<T>(t.full_tensor_copy(),targs);
         } else if (targs.tt==TT_2D) {
-            MADNESS_ASSERT(current_type==TT_FULL);
-            result=GenTensor<T>(t.full_tensor(),targs);
+            MADNESS_ASSERT(current_type==TT_FULL or current_type==TT_TENSORTRAIN);
+            result=GenTensor<T>(t.full_tensor_copy(),targs);
+        } else if (targs.tt==TT_TENSORTRAIN) {
+            result=GenTensor<T>(t.full_tensor_copy(),targs);
         }
 
         t=result;
@@ -238,6 +238,15 @@ STATIC void dorgqr_(integer *m, integer *n, integer *k,
 	zungqr_(m, n, k, a, m, tau, work, lwork, info);
 }
 
+/// These oddly-named wrappers enable the generic geqrf iterface to get
+/// the correct LAPACK routine based upon the argument type.  Internal
+/// use only.
+STATIC void dgeqrf_(integer *m, integer *n,
+		 complex_real8 *a, integer *lda, complex_real8 *tau,
+		 complex_real8 *work, integer *lwork, integer *info) {
+	zgeqrf_(m, n, a, lda, tau, work, lwork, info);
+}
+
 namespace madness {
 
     static void mask_info(integer& info) {
@@ -1040,6 +1049,9 @@ namespace madness {
     template
     void lq(Tensor<double>& A, Tensor<double>& L);
 
+    template
+    void lq(Tensor<double_complex>& A, Tensor<double_complex>& L);
+
 
     template
     void geqp3(Tensor<double>& A, Tensor<double>& tau, Tensor<integer>& jpvt);
@@ -35,6 +35,139 @@
 #include <madness/tensor/mtxmq.h>
 #include <madness/world/worldprofile.h>
 
+#ifdef MADNESS_MTXMQ_DISPATCH
+#include <cpuid.h>
+#include <cstdlib>
+#include <cstring>
+
+namespace madness {
+    namespace mtxmq_simd {
+        // in mtxmq_avx2.cc and mtxmq_avx512.cc ... complex operands are passed as interleaved doubles
+        void mtxmq_avx2_real(long dimi, long dimj, long dimk, double* c, const double* a, const double* b);
+        void mtxmq_avx2_cplx(long dimi, long dimj, long dimk, double* c, const double* a, const double* b);
+        void mtxmq_avx2_cplx_real(long dimi, long dimj, long dimk, double* c, const double* a, const double* b);
+        void mtxmq_avx512_real(long dimi, long dimj, long dimk, double* c, const double* a, const double* b);
+        void mtxmq_avx512_cplx(long dimi, long dimj, long dimk, double* c, const double* a, const double* b);
+        void mtxmq_avx512_cplx_real(long dimi, long dimj, long dimk, double* c, const double* a, const double* b);
+        bool fused_transform_avx2(long ndim, long k, double* r, const double* t, const double* c, double* work);
+        bool fused_transform_avx512(long ndim, long k, double* r, const double* t, const double* c, double* work);
+    }
+
+    namespace {
+        /// The reference loop, used if MTXMQ_GENERIC is selected
+        template <typename aT, typename bT, typename cT>
+        void mtxmq_generic(long dimi, long dimj, long dimk,
+                           cT* restrict c, const aT* a, const bT* b) {
+            for (long i=0; i<dimi; ++i,c+=dimj,++a) {
+                for (long j=0; j<dimj; ++j) c[j] = 0.0;
+                const aT *aik_ptr = a;
+                for (long k=0; k<dimk; ++k,aik_ptr+=dimi) {
+                    aT aki = *aik_ptr;
+                    for (long j=0; j<dimj; ++j) {
+                        c[j] += aki*b[k*dimj+j];
+                    }
+                }
+            }
+        }
+
+        /// Return XCR0, which says what vector state the OS saves on a context switch
+        unsigned long long xgetbv0() {
+            unsigned int lo, hi;
+            __asm__ __volatile__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+            return (static_cast<unsigned long long>(hi) << 32) | lo;
+        }
+
+        MTxmqISA detect_isa() {
+            unsigned int eax, ebx, ecx, edx;
+            if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return MTXMQ_SSE;
+
+            const bool osxsave = ecx & (1u<<27);
+            const bool avx = ecx & (1u<<28);
+            const bool fma = ecx & (1u<<12);
+            if (!(osxsave && avx)) return MTXMQ_SSE;
+
+            const unsigned long long xcr0 = xgetbv0();
+            if ((xcr0 & 0x6) != 0x6) return MTXMQ_SSE;    // XMM and YMM state
+
+            if (__get_cpuid_max(0, 0) < 7) return MTXMQ_SSE;
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            const bool avx2 = ebx & (1u<<5);
+            const bool avx512f = ebx & (1u<<16);
+
+            if (avx512f && (xcr0 & 0xe6) == 0xe6) return MTXMQ_AVX512; // plus opmask and ZMM state
+            if (avx2 && fma) return MTXMQ_AVX2;
+            return MTXMQ_SSE;
+        }
+
+        MTxmqISA initial_isa() {
+            MTxmqISA isa = mtxmq_cpu_isa();
+            const char* env = std::getenv("MAD_MTXMQ_ISA");
+            if (env) {
+                for (int i=MTXMQ_GENERIC; i<=MTXMQ_AVX512; ++i) {
+                    if (std::strcmp(env, mtxmq_isa_name(MTxmqISA(i))) == 0) {
+                        if (i < isa) isa = MTxmqISA(i);
+                    }
+                }
+            }
+            return isa;
+        }
+
+        MTxmqISA& selected_isa() {
+            static MTxmqISA isa = initial_isa();
+            return isa;
+        }
+    }
+
+    MTxmqISA mtxmq_cpu_isa() {
+        static const MTxmqISA isa = detect_isa();
+        return isa;
+    }
+
+    MTxmqISA mtxmq_isa() {
+        return selected_isa();
+    }
+
+    MTxmqISA mtxmq_set_isa(MTxmqISA isa) {
+        selected_isa() = (isa < mtxmq_cpu_isa()) ? isa : mtxmq_cpu_isa();
+        return selected_isa();
+    }
+
+    const char* mtxmq_isa_name(MTxmqISA isa) {
+        static const char* names[] = {"generic", "sse", "avx2", "avx512"};
+        return names[isa];
+    }
+
+    bool fused_transform(long ndim, long k, double* result, const double* t, const double* c, double* work) {
+        if (ndim != 3 && ndim != 6) return false;
+        switch (mtxmq_isa()) {
+        case MTXMQ_AVX512:
+            return mtxmq_simd::fused_transform_avx512(ndim, k, result, t, c, work);
+        case MTXMQ_AVX2:
+            return mtxmq_simd::fused_transform_avx2(ndim, k, result, t, c, work);
+        default:
+            return false;
+        }
+    }
+}
+
+#define MTXMQ_DISPATCH(kernel) \
+    switch (mtxmq_isa()) { \
+    case MTXMQ_AVX512: \
+        mtxmq_simd::mtxmq_avx512_##kernel(dimi, dimj, dimk, (double*)(c), (const double*)(a), (const double*)(b)); \
+        return; \
+    case MTXMQ_AVX2: \
+        mtxmq_simd::mtxmq_avx2_##kernel(dimi, dimj, dimk, (double*)(c), (const double*)(a), (const double*)(b)); \
+        return; \
+    case MTXMQ_GENERIC: \
+        mtxmq_generic(dimi, dimj, dimk, c, a, b); \
+        return; \
+    case MTXMQ_SSE: \
+        break; \
+    }
+#else
+#define MTXMQ_DISPATCH(kernel)
+#endif // MADNESS_MTXMQ_DISPATCH
+
 // For x86-32/64 have assembly versions for double precision
 // For x86-64 have assembly versions for complex double precision
 
@@ -129,6 +262,7 @@ namespace madness {
         //PROFILE_BLOCK(mTxmq_double_asm);
         //std::cout << "IN DOUBLE ASM VERSION " << dimi << " " << dimj << " " << dimk << "\n";
 
+        MTXMQ_DISPATCH(real);
 
         if (IS_ODD(dimi) || IS_ODD(dimj) || IS_ODD(dimk) ||
             IS_UNALIGNED(a) || IS_UNALIGNED(b) || IS_UNALIGNED(c)) {
@@ -326,6 +460,8 @@ namespace madness {
                double_complex* restrict c, const double_complex* a, const double_complex* b) {
 
         //PROFILE_BLOCK(mTxmq_complex_asm);
+        MTXMQ_DISPATCH(cplx);
+
         const long dimi16 = dimi<<4;
         const long dimj16 = dimj<<4;
 
@@ -773,6 +909,8 @@ namespace madness {
     void mTxmq(const long dimi, const long dimj, const long dimk,
                double_complex* restrict c, const double_complex* a, const double* b)
     {
+      MTXMQ_DISPATCH(cplx_real);
+
       const long itile = 14;
       for (long ilo = 0; ilo < dimi; ilo += itile, a+=itile, c+=itile*dimj)
       {
@@ -1446,6 +1584,24 @@ namespace madness {
       }
     }
 #endif // __INTEL_COMPILER
+
+#ifdef MADNESS_MTXMQ_DISPATCH
+    template <>
+    void mTxmq(const long dimi, const long dimj, const long dimk,
+               double_complex* restrict c, const double* a, const double_complex* b) {
+        // with a real, c and b are real matrices with twice the number of columns
+        switch (mtxmq_isa()) {
+        case MTXMQ_AVX512:
+            mtxmq_simd::mtxmq_avx512_real(dimi, 2*dimj, dimk, (double*)(c), a, (const double*)(b));
+            return;
+        case MTXMQ_AVX2:
+            mtxmq_simd::mtxmq_avx2_real(dimi, 2*dimj, dimk, (double*)(c), a, (const double*)(b));
+            return;
+        default:
+            mtxmq_generic(dimi, dimj, dimk, c, a, b);
+        }
+    }
+#endif // MADNESS_MTXMQ_DISPATCH
 }
 #endif // defined(X86_64)  && !defined(DISABLE_SSE3)
 
@@ -34,10 +34,48 @@
 #define MADNESS_TENSOR_MTXMQ_H__INCLUDED
 
 #include <madness/madness_config.h>
+#include <complex>
+#include <cstdlib>
+#include <cstring>
 
 typedef std::complex<double> double_complex;
 
+// On x86-64 the SSE kernels are complemented by AVX2 and AVX-512 kernels
+// that are compiled into every binary and chosen at run time
+#if defined(X86_64) && !defined(DISABLE_SSE3) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define MADNESS_MTXMQ_DISPATCH 1
+#endif
+
 namespace madness {
+
+#ifdef MADNESS_MTXMQ_DISPATCH
+    /// Instruction sets for which mTxmq has kernels on x86-64
+    enum MTxmqISA {
+        MTXMQ_GENERIC,  ///< The reference loop in mtxmq.h
+        MTXMQ_SSE,      ///< SSE kernels in mtxmq_asm.S and mtxmq.cc
+        MTXMQ_AVX2,     ///< AVX2 and FMA kernels in mtxmq_avx2.cc
+        MTXMQ_AVX512    ///< AVX-512F kernels in mtxmq_avx512.cc
+    };
+
+    /// Return the best instruction set supported by this CPU and OS (from CPUID)
+    MTxmqISA mtxmq_cpu_isa();
+
+    /// Return the instruction set used by mTxmq
+
+    /// This is mtxmq_cpu_isa() unless lowered by mtxmq_set_isa() or by
+    /// the environment variable MAD_MTXMQ_ISA (generic, sse, avx2 or avx512).
+    MTxmqISA mtxmq_isa();
+
+    /// Select the instruction set used by mTxmq, limited to what the CPU supports
+
+    /// Not thread safe ... intended for testing and benchmarking.
+    /// Returns the instruction set actually selected.
+    MTxmqISA mtxmq_set_isa(MTxmqISA isa);
+
+    /// Return the name of an instruction set
+    const char* mtxmq_isa_name(MTxmqISA isa);
+#endif
+
     /// Matrix = Matrix transpose * matrix ... reference implementation
     /// Does \c C=AT*B whereas mTxm does C=C+AT*B.  It also supposed
     /// to be fast which it achieves thru restrictions
@@ -186,12 +224,41 @@ namespace madness {
                double_complex* restrict c, const double_complex* a, const double* b);
 #endif
 
+#ifdef MADNESS_MTXMQ_DISPATCH
+    template <>
+    void mTxmq(long dimi, long dimj, long dimk,
+               double_complex* restrict c, const double* a, const double_complex* b);
+#endif
+
 #elif defined(X86_32)
     template <>
     void mTxmq(long dimi, long dimj, long dimk,
                double* restrict c, const double* a, const double* b);
 #endif
 
+    /// Fused transform of all dimensions of a cube, used by fast_transform()
+
+    /// \code
+    ///    result(i,j,k,...) <-- sum(i',j',k',...) t(i',j',k',...) c(i',i) c(j',j) c(k',k) ...
+    /// \endcode
+    /// for ndim 3 or 6 with all dimensions equal to k and c a k*k matrix.
+    /// Rather than making ndim passes of mTxmq over the whole tensor,
+    /// each cube is transformed by kernels specialized for k at
+    /// compile time, with the intermediates held in a small per-thread
+    /// buffer.  For ndim=6 the tensor is read and written only twice.
+    /// work must hold k^ndim elements and result must differ from t.
+    ///
+    /// Returns false, having done nothing, if there is no fused kernel
+    /// for these types, ndim, k or the selected instruction set.
+    template <typename T, typename Q, typename R>
+    inline bool fused_transform(long ndim, long k, R* result, const T* t, const Q* c, R* work) {
+        return false;
+    }
+
+#ifdef MADNESS_MTXMQ_DISPATCH
+    bool fused_transform(long ndim, long k, double* result, const double* t, const double* c, double* work);
+#endif
+
 }
 
 #endif // MADNESS_TENSOR_MTXMQ_H__INCLUDED
@@ -0,0 +1,110 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+/// \file mtxmq_avx2.cc
+/// \brief mTxmq kernels for AVX2 with FMA, selected at run time
+
+#include <madness/madness_config.h>
+#include <madness/tensor/mtxmq.h>
+
+#ifdef MADNESS_MTXMQ_DISPATCH
+
+#include <immintrin.h>
+#include <algorithm>
+
+#define MADNESS_MTXMQ_TARGET __attribute__((target("avx2,fma")))
+#include <madness/tensor/mtxmq_simd.h>
+
+namespace madness {
+    namespace mtxmq_simd {
+
+        /// AVX2 vectors of 4 doubles
+        struct AVX2 {
+            typedef __m256d vec;
+            typedef __m256i mask;
+
+            static const int width = 4;
+            static const int mi_real = 4, nv_real = 3;
+            static const int mi_cplx = 2, nv_cplx = 3;
+
+            MADNESS_MTXMQ_TARGET static mask make_mask(int n) {
+                static const long long bits[8] = {-1,-1,-1,-1,0,0,0,0};
+                return _mm256_loadu_si256((const __m256i*)(bits+4-n));
+            }
+            MADNESS_MTXMQ_TARGET static vec zero() {return _mm256_setzero_pd();}
+            MADNESS_MTXMQ_TARGET static vec load(const double* p) {return _mm256_loadu_pd(p);}
+            MADNESS_MTXMQ_TARGET static void store(double* p, vec v) {_mm256_storeu_pd(p,v);}
+            MADNESS_MTXMQ_TARGET static void store(double* p, vec v, mask m) {_mm256_maskstore_pd(p,m,v);}
+            MADNESS_MTXMQ_TARGET static vec bcast(const double* p) {return _mm256_broadcast_sd(p);}
+            MADNESS_MTXMQ_TARGET static vec bcast_pair(const double* p) {
+                return _mm256_broadcast_pd((const __m128d*)p);
+            }
+            MADNESS_MTXMQ_TARGET static vec load_dup(const double* p) {
+                return _mm256_permute4x64_pd(_mm256_castpd128_pd256(_mm_loadu_pd(p)), 0x50);
+            }
+            MADNESS_MTXMQ_TARGET static vec swap_neg(vec v) {
+                const vec sign = _mm256_set_pd(0.0, -0.0, 0.0, -0.0);
+                return _mm256_xor_pd(_mm256_permute_pd(v, 0x5), sign);
+            }
+            MADNESS_MTXMQ_TARGET static vec fma(vec a, vec b, vec c) {return _mm256_fmadd_pd(a,b,c);}
+        };
+
+        MADNESS_MTXMQ_TARGET
+        void mtxmq_avx2_real(long dimi, long dimj, long dimk,
+                             double* c, const double* a, const double* b) {
+            mtxmq<AVX2,REAL,AVX2::mi_real,AVX2::nv_real>(dimi, dimj, dimk, c, a, b);
+        }
+
+        MADNESS_MTXMQ_TARGET
+        void mtxmq_avx2_cplx(long dimi, long dimj, long dimk,
+                             double* c, const double* a, const double* b) {
+            mtxmq<AVX2,CPLX,AVX2::mi_cplx,AVX2::nv_cplx>(dimi, dimj, dimk, c, a, b);
+        }
+
+        MADNESS_MTXMQ_TARGET
+        void mtxmq_avx2_cplx_real(long dimi, long dimj, long dimk,
+                                  double* c, const double* a, const double* b) {
+            mtxmq<AVX2,CPLX_REAL,AVX2::mi_cplx,AVX2::nv_cplx>(dimi, dimj, dimk, c, a, b);
+        }
+
+        MADNESS_MTXMQ_TARGET
+        bool fused_transform_avx2(long ndim, long k, double* r, const double* t, const double* c, double* work) {
+            // With 16 registers the 6-d kernel is slower than mTxmq passes (see test_transform)
+            if (ndim != 3) return false;
+            return fused_transform_k<AVX2,AVX2::width*AVX2::nv_real>(ndim, k, r, t, c, work);
+        }
+
+    }
+}
+
+#endif // MADNESS_MTXMQ_DISPATCH
@@ -0,0 +1,113 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+/// \file mtxmq_avx512.cc
+/// \brief mTxmq kernels for AVX-512, selected at run time
+
+#include <madness/madness_config.h>
+#include <madness/tensor/mtxmq.h>
+
+#ifdef MADNESS_MTXMQ_DISPATCH
+
+#include <immintrin.h>
+#include <algorithm>
+
+// GCC's AVX-512 intrinsics pass an undefined vector as the unused source
+// of unmasked operations, which -Wall reports as uninitialized
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#define MADNESS_MTXMQ_TARGET __attribute__((target("avx512f")))
+#include <madness/tensor/mtxmq_simd.h>
+
+namespace madness {
+    namespace mtxmq_simd {
+
+        /// AVX-512 vectors of 8 doubles, using only AVX512F
+        struct AVX512 {
+            typedef __m512d vec;
+            typedef __mmask8 mask;
+
+            static const int width = 8;
+            static const int mi_real = 8, nv_real = 3;
+            static const int mi_cplx = 4, nv_cplx = 3;
+
+            MADNESS_MTXMQ_TARGET static mask make_mask(int n) {return mask((1u<<n)-1);}
+            MADNESS_MTXMQ_TARGET static vec zero() {return _mm512_setzero_pd();}
+            MADNESS_MTXMQ_TARGET static vec load(const double* p) {return _mm512_loadu_pd(p);}
+            MADNESS_MTXMQ_TARGET static void store(double* p, vec v) {_mm512_storeu_pd(p,v);}
+            MADNESS_MTXMQ_TARGET static void store(double* p, vec v, mask m) {_mm512_mask_storeu_pd(p,m,v);}
+            MADNESS_MTXMQ_TARGET static vec bcast(const double* p) {return _mm512_set1_pd(*p);}
+            MADNESS_MTXMQ_TARGET static vec bcast_pair(const double* p) {
+                return _mm512_castps_pd(_mm512_broadcast_f32x4(_mm_castpd_ps(_mm_loadu_pd(p))));
+            }
+            MADNESS_MTXMQ_TARGET static vec load_dup(const double* p) {
+                const __m512i idx = _mm512_set_epi64(3,3,2,2,1,1,0,0);
+                return _mm512_permutexvar_pd(idx, _mm512_castpd256_pd512(_mm256_loadu_pd(p)));
+            }
+            MADNESS_MTXMQ_TARGET static vec swap_neg(vec v) {
+                const __m512i sign = _mm512_set_epi64(0, 0x8000000000000000LL, 0, 0x8000000000000000LL,
+                                                      0, 0x8000000000000000LL, 0, 0x8000000000000000LL);
+                return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(_mm512_permute_pd(v, 0x55)), sign));
+            }
+            MADNESS_MTXMQ_TARGET static vec fma(vec a, vec b, vec c) {return _mm512_fmadd_pd(a,b,c);}
+        };
+
+        MADNESS_MTXMQ_TARGET
+        void mtxmq_avx512_real(long dimi, long dimj, long dimk,
+                               double* c, const double* a, const double* b) {
+            mtxmq<AVX512,REAL,AVX512::mi_real,AVX512::nv_real>(dimi, dimj, dimk, c, a, b);
+        }
+
+        MADNESS_MTXMQ_TARGET
+        void mtxmq_avx512_cplx(long dimi, long dimj, long dimk,
+                               double* c, const double* a, const double* b) {
+            mtxmq<AVX512,CPLX,AVX512::mi_cplx,AVX512::nv_cplx>(dimi, dimj, dimk, c, a, b);
+        }
+
+        MADNESS_MTXMQ_TARGET
+        void mtxmq_avx512_cplx_real(long dimi, long dimj, long dimk,
+                                    double* c, const double* a, const double* b) {
+            mtxmq<AVX512,CPLX_REAL,AVX512::mi_cplx,AVX512::nv_cplx>(dimi, dimj, dimk, c, a, b);
+        }
+
+        MADNESS_MTXMQ_TARGET
+        bool fused_transform_avx512(long ndim, long k, double* r, const double* t, const double* c, double* work) {
+            return fused_transform_k<AVX512,AVX512::width*AVX512::nv_real>(ndim, k, r, t, c, work);
+        }
+
+    }
+}
+
+#endif // MADNESS_MTXMQ_DISPATCH
@@ -0,0 +1,458 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+#ifndef MADNESS_TENSOR_MTXMQ_SIMD_H__INCLUDED
+#define MADNESS_TENSOR_MTXMQ_SIMD_H__INCLUDED
+
+/*!
+  \file tensor/mtxmq_simd.h
+  \brief Vector-length agnostic mTxmq kernels, instantiated per instruction set
+
+  Computes c(i,j) = sum(k) a(k,i)*b(k,j) for real, complex and mixed
+  real/complex operands.  The j index is vectorized and a block of
+  MI rows of c times NV vectors is held in registers while looping
+  over k.  Rows of b are padded to whole vectors when necessary and
+  the last vector of a row of c is stored with a mask, so any
+  dimension and any alignment are handled.
+
+  The instruction set is supplied by a traits class V, see
+  mtxmq_avx2.cc and mtxmq_avx512.cc, that provides
+
+  \code
+  typedef ... vec;                         // a vector of width doubles
+  typedef ... mask;                        // selects the first n doubles of a vec
+  static const int width;                  // doubles per vector
+  static const int mi_real, nv_real;       // register block for the real kernel
+  static const int mi_cplx, nv_cplx;       // ... and for the complex kernels
+  static mask make_mask(int n);
+  static vec zero();
+  static vec load(const double* p);
+  static void store(double* p, vec v);
+  static void store(double* p, vec v, mask m);
+  static vec bcast(const double* p);       // (p0,p0,p0,...)
+  static vec bcast_pair(const double* p);  // (p0,p1,p0,p1,...)
+  static vec load_dup(const double* p);    // (p0,p0,p1,p1,...) from width/2 doubles
+  static vec swap_neg(vec v);              // (-v1,v0,-v3,v2,...)
+  static vec fma(vec a, vec b, vec c);     // a*b+c
+  \endcode
+
+  Every function must be compiled for the instruction set of V, so this
+  header is included by each kernel file after defining
+  MADNESS_MTXMQ_TARGET.
+*/
+
+#ifndef MADNESS_MTXMQ_TARGET
+#error "mtxmq_simd.h: define MADNESS_MTXMQ_TARGET before including"
+#endif
+
+#include <madness/tensor/tensor_arena.h>
+#include <algorithm>
+
+namespace madness {
+    namespace mtxmq_simd {
+
+        /// Real kernel for one block of MI rows and NV vectors
+
+        /// c, a and b point at c(i0,j0), a(0,i0) and b(0,j0).  All
+        /// strides are in doubles and b holds NV whole vectors per row.
+        template <class V, int MI, int NV, bool MASK>
+        MADNESS_MTXMQ_TARGET
+        inline void real_block(long dimk, long sa, long sb, long sc,
+                               double* c, const double* a, const double* b,
+                               typename V::mask m) {
+            typename V::vec acc[MI][NV];
+            for (int ii=0; ii<MI; ++ii)
+                for (int jj=0; jj<NV; ++jj) acc[ii][jj] = V::zero();
+
+            for (long k=0; k<dimk; ++k, a+=sa, b+=sb) {
+                typename V::vec bv[NV];
+                for (int jj=0; jj<NV; ++jj) {
+                    bv[jj] = V::load(b+jj*V::width);
+                }
+                for (int ii=0; ii<MI; ++ii) {
+                    const typename V::vec ak = V::bcast(a+ii);
+                    for (int jj=0; jj<NV; ++jj) acc[ii][jj] = V::fma(ak, bv[jj], acc[ii][jj]);
+                }
+            }
+
+            for (int ii=0; ii<MI; ++ii, c+=sc) {
+                for (int jj=0; jj<NV; ++jj) {
+                    if (MASK && jj==NV-1) V::store(c+jj*V::width, acc[ii][jj], m);
+                    else V::store(c+jj*V::width, acc[ii][jj]);
+                }
+            }
+        }
+
+        /// Complex kernel for one block, operands are interleaved (re,im) doubles
+
+        /// c, a and b point at c(i0,j0), a(0,i0) and b(0,j0).  Strides
+        /// are in doubles.
+        template <class V, int MI, int NV, bool MASK>
+        MADNESS_MTXMQ_TARGET
+        inline void cplx_block(long dimk, long sa, long sb, long sc,
+                               double* c, const double* a, const double* b,
+                               typename V::mask m) {
+            typename V::vec acc[MI][NV];
+            for (int ii=0; ii<MI; ++ii)
+                for (int jj=0; jj<NV; ++jj) acc[ii][jj] = V::zero();
+
+            for (long k=0; k<dimk; ++k, a+=sa, b+=sb) {
+                typename V::vec bv[NV], bs[NV];
+                for (int jj=0; jj<NV; ++jj) {
+                    bv[jj] = V::load(b+jj*V::width);
+                    bs[jj] = V::swap_neg(bv[jj]);
+                }
+                for (int ii=0; ii<MI; ++ii) {
+                    const typename V::vec ar = V::bcast(a+2*ii);
+                    const typename V::vec ai = V::bcast(a+2*ii+1);
+                    for (int jj=0; jj<NV; ++jj) {
+                        acc[ii][jj] = V::fma(ar, bv[jj], acc[ii][jj]);
+                        acc[ii][jj] = V::fma(ai, bs[jj], acc[ii][jj]);
+                    }
+                }
+            }
+
+            for (int ii=0; ii<MI; ++ii, c+=sc) {
+                for (int jj=0; jj<NV; ++jj) {
+                    if (MASK && jj==NV-1) V::store(c+jj*V::width, acc[ii][jj], m);
+                    else V::store(c+jj*V::width, acc[ii][jj]);
+                }
+            }
+        }
+
+        /// Complex times real kernel for one block
+
+        /// a and c are interleaved complex, b is real.  Each vector of c
+        /// covers width/2 columns, so b advances by half a vector.
+        template <class V, int MI, int NV, bool MASK>
+        MADNESS_MTXMQ_TARGET
+        inline void cplx_real_block(long dimk, long sa, long sb, long sc,
+                                    double* c, const double* a, const double* b,
+                                    typename V::mask m) {
+            const int half = V::width/2;
+            typename V::vec acc[MI][NV];
+            for (int ii=0; ii<MI; ++ii)
+                for (int jj=0; jj<NV; ++jj) acc[ii][jj] = V::zero();
+
+            for (long k=0; k<dimk; ++k, a+=sa, b+=sb) {
+                typename V::vec bv[NV];
+                for (int jj=0; jj<NV; ++jj) {
+                    bv[jj] = V::load_dup(b+jj*half);
+                }
+                for (int ii=0; ii<MI; ++ii) {
+                    const typename V::vec ak = V::bcast_pair(a+2*ii);
+                    for (int jj=0; jj<NV; ++jj) acc[ii][jj] = V::fma(ak, bv[jj], acc[ii][jj]);
+                }
+            }
+
+            for (int ii=0; ii<MI; ++ii, c+=sc) {
+                for (int jj=0; jj<NV; ++jj) {
+                    if (MASK && jj==NV-1) V::store(c+jj*V::width, acc[ii][jj], m);
+                    else V::store(c+jj*V::width, acc[ii][jj]);
+                }
+            }
+        }
+
+        /// Kinds of operands
+        enum Kind {REAL, CPLX, CPLX_REAL};
+
+        /// Calls the block kernel of the given kind for a run-time number of vectors
+        template <class V, Kind K, int MI, int NV>
+        MADNESS_MTXMQ_TARGET
+        inline void block(int nv, bool masked, long dimk, long sa, long sb, long sc,
+                          double* c, const double* a, const double* b,
+                          typename V::mask m) {
+            if (nv < NV) {
+                block<V,K,MI,(NV>1 ? NV-1 : 1)>(nv, masked, dimk, sa, sb, sc, c, a, b, m);
+            }
+            else if (K == REAL) {
+                if (masked) real_block<V,MI,NV,true>(dimk, sa, sb, sc, c, a, b, m);
+                else real_block<V,MI,NV,false>(dimk, sa, sb, sc, c, a, b, m);
+            }
+            else if (K == CPLX) {
+                if (masked) cplx_block<V,MI,NV,true>(dimk, sa, sb, sc, c, a, b, m);
+                else cplx_block<V,MI,NV,false>(dimk, sa, sb, sc, c, a, b, m);
+            }
+            else {
+                if (masked) cplx_real_block<V,MI,NV,true>(dimk, sa, sb, sc, c, a, b, m);
+                else cplx_real_block<V,MI,NV,false>(dimk, sa, sb, sc, c, a, b, m);
+            }
+        }
+
+        /// c(i,j) = sum(k) a(k,i)*b(k,j) with the operand kind K
+
+        /// For complex operands dimi and dimj count complex numbers and
+        /// the pointers address the interleaved doubles.
+        template <class V, Kind K, int MI, int NVMAX>
+        MADNESS_MTXMQ_TARGET
+        void mtxmq(long dimi, long dimj, long dimk, double* c, const double* a, const double* b) {
+            // a(k,i) and c(i,j) in doubles, j in doubles of c
+            const long ea = (K == REAL) ? 1 : 2;
+            const long ec = (K == REAL) ? 1 : 2;
+            const long eb = (K == CPLX) ? 2 : 1;
+            const long sa = ea*dimi, sc = ec*dimj;
+            const long ncol = sc;                       // doubles in a row of c
+            const long tile = long(V::width)*NVMAX;
+
+            // Loads of b that straddle cache lines are slow, so unless the
+            // rows of b are aligned to the vectors loaded from it, b is
+            // copied into an aligned buffer with padded rows.  b is
+            // the small operand in MRA (k*k or 2k*2k) so this is cheap.
+            const long bw = (K == CPLX_REAL) ? V::width/2 : V::width;
+            long sb = eb*dimj;
+            TensorArena::Scope scope;
+            if (sb%bw || reinterpret_cast<std::size_t>(b)%(bw*sizeof(double))) {
+                const long ldb = (sb + bw - 1)/bw*bw;
+                double* restrict bpad = TensorArena::instance().allocate<double>(dimk*ldb);
+                for (long k=0; k<dimk; ++k) {
+                    for (long j=0; j<sb; ++j) bpad[k*ldb+j] = b[k*sb+j];
+                    for (long j=sb; j<ldb; ++j) bpad[k*ldb+j] = 0.0;
+                }
+                b = bpad;
+                sb = ldb;
+            }
+
+            for (long j0=0; j0<ncol; j0+=tile) {
+                const long nj = std::min(tile, ncol-j0);
+                const int nv = int((nj + V::width - 1)/V::width);
+                const int nlast = int(nj - long(nv-1)*V::width);
+                const bool masked = (nlast != V::width);
+                const typename V::mask m = V::make_mask(nlast);
+
+                double* cj = c + j0;
+                const double* bj = b + (K == CPLX_REAL ? j0/2 : j0);
+                long i=0;
+                for (; i+MI<=dimi; i+=MI) {
+                    block<V,K,MI,NVMAX>(nv, masked, dimk, sa, sb, sc, cj+i*sc, a+ea*i, bj, m);
+                }
+                for (; i<dimi; ++i) {
+                    block<V,K,1,NVMAX>(nv, masked, dimk, sa, sb, sc, cj+i*sc, a+ea*i, bj, m);
+                }
+            }
+        }
+
+        /// One pass of the fused transform, out(i,j) = sum(k) in(k,i)*c(k,j)
+
+        /// in is K x DIMI and out is DIMI x K, both contiguous.  c is K x K
+        /// with rows padded to whole vectors.  All dimensions are known at
+        /// compile time, so the loops are fully specialized and the
+        /// remaining rows are done by a single smaller block.
+        template <class V, int K, int DIMI>
+        MADNESS_MTXMQ_TARGET
+        inline void transform_pass(double* restrict out, const double* restrict in, const double* restrict c) {
+            enum {NV = (K + V::width - 1)/V::width,
+                  LDC = NV*V::width,
+                  MI = V::mi_real,
+                  MREM = DIMI%MI};
+            const bool MASK = (K%V::width != 0);
+            const typename V::mask m = V::make_mask(K - (NV-1)*V::width);
+
+            long i=0;
+            for (; i+MI<=DIMI; i+=MI) {
+                real_block<V,MI,NV,MASK>(K, DIMI, LDC, K, out+i*K, in+i, c, m);
+            }
+            if (MREM != 0) {
+                real_block<V,(MREM > 0 ? MREM : 1),NV,MASK>(K, DIMI, LDC, K, out+i*K, in+i, c, m);
+            }
+        }
+
+        /// Transform all three dimensions of a K^3 cube
+
+        /// r(i,j,k) = sum(i',j',k') t(i',j',k') c(i',i) c(j',j) c(k',k).
+        /// Each pass transforms the first dimension and moves it to the
+        /// end, so after three passes the order is restored.  The two
+        /// intermediates go through w (2*K^3 doubles), which for the
+        /// sizes used in MRA stays in L1.
+        template <class V, int K>
+        MADNESS_MTXMQ_TARGET
+        inline void transform3(double* restrict r, const double* restrict t,
+                               const double* restrict c, double* restrict w) {
+            double* restrict w0 = w;
+            double* restrict w1 = w + K*K*K;
+            transform_pass<V,K,K*K>(w0, t, c);
+            transform_pass<V,K,K*K>(w1, w0, c);
+            transform_pass<V,K,K*K>(r, w1, c);
+        }
+
+        /// Block of a transform of vectors, out(m,n) = sum(k) c(k,n)*in(k,m) with vector elements
+
+        /// in(k,m) is at in+k*si+m*sr, out(m,n) at out+m*sor+n*soi and
+        /// c(k,n) at c+k*ldc+n.  Each element is one vector, so this
+        /// transforms V::width independent columns at once.
+        template <class V, int MR, int NI>
+        MADNESS_MTXMQ_TARGET
+        inline void vec_block(long dimk, double* out, long sor, long soi,
+                              const double* in, long si, long sr, const double* c, long ldc) {
+            typename V::vec acc[MR][NI];
+            for (int m=0; m<MR; ++m)
+                for (int n=0; n<NI; ++n) acc[m][n] = V::zero();
+
+            for (long k=0; k<dimk; ++k, in+=si, c+=ldc) {
+                typename V::vec x[MR];
+                for (int m=0; m<MR; ++m) x[m] = V::load(in+m*sr);
+                for (int n=0; n<NI; ++n) {
+                    const typename V::vec cn = V::bcast(c+n);
+                    for (int m=0; m<MR; ++m) acc[m][n] = V::fma(cn, x[m], acc[m][n]);
+                }
+            }
+
+            for (int m=0; m<MR; ++m)
+                for (int n=0; n<NI; ++n) V::store(out+m*sor+n*soi, acc[m][n]);
+        }
+
+        /// One pass of the vector transform, out(r,i) = sum(i') in(i',r) c(i',i) for r < K*K
+
+        /// Elements of in are sin doubles apart and those of out sout
+        /// doubles apart.  As in transform_pass the transformed index
+        /// moves to the end.
+        template <class V, int K>
+        MADNESS_MTXMQ_TARGET
+        inline void vec_pass(double* restrict out, long sout,
+                             const double* restrict in, long sin, const double* restrict c) {
+            enum {R = K*K,
+                  ACC = V::mi_real*V::nv_real,
+                  NI = (K < ACC ? K : ACC),
+                  MR = ACC/NI,
+                  NREM = K%NI,
+                  MREM = R%MR};
+
+            long r=0;
+            for (; r+MR<=R; r+=MR) {
+                long i=0;
+                for (; i+NI<=K; i+=NI)
+                    vec_block<V,MR,NI>(K, out+(r*K+i)*sout, K*sout, sout, in+r*sin, R*sin, sin, c+i, K);
+                if (NREM != 0)
+                    vec_block<V,MR,(NREM > 0 ? NREM : 1)>(K, out+(r*K+i)*sout, K*sout, sout, in+r*sin, R*sin, sin, c+i, K);
+            }
+            if (MREM != 0) {
+                long i=0;
+                for (; i+NI<=K; i+=NI)
+                    vec_block<V,(MREM > 0 ? MREM : 1),NI>(K, out+(r*K+i)*sout, K*sout, sout, in+r*sin, R*sin, sin, c+i, K);
+                if (NREM != 0)
+                    vec_block<V,(MREM > 0 ? MREM : 1),(NREM > 0 ? NREM : 1)>(K, out+(r*K+i)*sout, K*sout, sout, in+r*sin, R*sin, sin, c+i, K);
+            }
+        }
+
+        /// Number of columns handled at a time by transform6_outer, about 256 KB of input
+        template <class V, int K>
+        struct transform6_chunk {
+            enum {value = (32768/(K*K*K) > V::width) ? (32768/(K*K*K))/V::width*V::width : V::width};
+        };
+
+        /// Transform the first three dimensions of a K^6 tensor
+
+        /// out(A,B) = sum(A') in(A',B) c(i',i) c(j',j) c(k',k) where A=(i,j,k)
+        /// and B are triples of indices.  A chunk of columns B is copied
+        /// into g and transformed a vector at a time into h, which is
+        /// copied into out, so that in is read once and out written
+        /// once.  The last chunk is padded with zeros.  w holds the
+        /// intermediates (2*width*K^3 doubles) and g and h
+        /// transform6_chunk*K^3 doubles each.
+        template <class V, int K>
+        MADNESS_MTXMQ_TARGET
+        void transform6_outer(double* restrict out, const double* restrict in, const double* restrict c,
+                              double* restrict w, double* restrict g, double* restrict h) {
+            const long K3 = K*K*K;
+            const long W = V::width;
+            const long CH = transform6_chunk<V,K>::value;
+            double* restrict w0 = w;
+            double* restrict w1 = w + W*K3;
+
+            for (long b0=0; b0<K3; b0+=CH) {
+                const long nb = std::min(CH, K3-b0);
+                for (long a=0; a<K3; ++a) {
+                    const double* restrict p = in + a*K3 + b0;
+                    double* restrict q = g + a*CH;
+                    for (long b=0; b<nb; ++b) q[b] = p[b];
+                    for (long b=nb; b<CH; ++b) q[b] = 0.0;
+                }
+                for (long v=0; v<nb; v+=W) {
+                    vec_pass<V,K>(w0, W, g+v, CH, c);
+                    vec_pass<V,K>(w1, W, w0, W, c);
+                    vec_pass<V,K>(h+v, CH, w1, W, c);
+                }
+                for (long a=0; a<K3; ++a) {
+                    const double* restrict p = h + a*CH;
+                    double* restrict q = out + a*K3 + b0;
+                    for (long b=0; b<nb; ++b) q[b] = p[b];
+                }
+            }
+        }
+
+        /// The fused transform for one value of k, see madness::fused_transform()
+        template <class V, int K>
+        MADNESS_MTXMQ_TARGET
+        void fused_transform(long ndim, double* r, const double* t, const double* c, double* work) {
+            enum {LDC = ((K + V::width - 1)/V::width)*V::width};
+            const long K3 = K*K*K;
+
+            TensorArena::Scope scope;
+            TensorArena& arena = TensorArena::instance();
+            double* restrict cpad = arena.allocate<double>(K*LDC);
+            for (long i=0; i<K; ++i) {
+                for (long j=0; j<K; ++j) cpad[i*LDC+j] = c[i*K+j];
+                for (long j=K; j<LDC; ++j) cpad[i*LDC+j] = 0.0;
+            }
+            if (ndim == 3) {
+                double* restrict w = arena.allocate<double>(2*K3);
+                transform3<V,K>(r, t, cpad, w);
+            }
+            else {
+                // The first three dimensions, then the cubes of the last three
+                double* restrict w = arena.allocate<double>(2*V::width*K3);
+                double* restrict g = arena.allocate<double>(transform6_chunk<V,K>::value*K3);
+                double* restrict h = arena.allocate<double>(transform6_chunk<V,K>::value*K3);
+                transform6_outer<V,K>(work, t, c, w, g, h);
+                for (long a=0; a<K3; ++a) {
+                    transform3<V,K>(r+a*K3, work+a*K3, cpad, w);
+                }
+            }
+        }
+
+        /// Calls fused_transform<V,K> for a run-time k <= KMAX, returns false if k is out of range
+        template <class V, int KMAX>
+        MADNESS_MTXMQ_TARGET
+        inline bool fused_transform_k(long ndim, long k, double* r, const double* t, const double* c, double* work) {
+            if (k < KMAX) {
+                return (KMAX > 1) && fused_transform_k<V,(KMAX>1 ? KMAX-1 : 1)>(ndim, k, r, t, c, work);
+            }
+            else if (k == KMAX) {
+                fused_transform<V,KMAX>(ndim, r, t, c, work);
+                return true;
+            }
+            return false;
+        }
+
+    }
+}
+
+#endif // MADNESS_TENSOR_MTXMQ_SIMD_H__INCLUDED
@@ -582,6 +582,126 @@ template <class T> void Test8() {
     // test complex only operations and type restrictions
 }
 
+template <class T> void Test9() {
+    // test the thread-local scratch arena and TensorView
+    TensorArena& arena = TensorArena::instance();
+    const std::size_t used0 = arena.used();
+
+    try {
+        TensorView<T> a(3,4);
+        error("test9: allocation outside of a scope was not detected",1);
+    }
+    catch (const TensorException&) {
+    }
+
+    {
+        TensorArena::Scope scope;
+        TensorView<T> a(5,7);
+        if (a.ndim()!=2 || a.dim(0)!=5 || a.dim(1)!=7 || a.size()!=35) error("test9: failed",2);
+        if (a.normf()!=0.0) error("test9: view was not zeroed",3);
+        if (std::size_t(a.ptr())%TensorArena::alignment) error("test9: view is not aligned",4);
+        a.fillrandom();
+        Tensor<T> b = copy(a);
+        if ((b-a).normf()!=0.0) error("test9: failed",5);
+
+        {
+            TensorArena::Scope inner;
+            TensorView<T> c(std::vector<long>(3,10),false);
+            c = 1.0;
+            if (arena.used() < used0 + sizeof(T)*(35+1000)) error("test9: failed",6);
+        }
+        // a must be untouched by the inner scope
+        if ((b-a).normf()!=0.0) error("test9: inner scope overwrote outer view",7);
+
+        // a view of memory owned by somebody else
+        T buf[6];
+        const long d[2]={2,3};
+        TensorView<T> v(2,d,buf);
+        v = 2.0;
+        for (int i=0; i<6; ++i) if (buf[i]!=T(2.0)) error("test9: failed",8);
+    }
+    if (arena.used()!=used0) error("test9: scope did not release memory",9);
+
+    // repeating the same work must not go to the heap again
+    const long n=8;
+    Tensor<T> x(n,n,n), c(n,n);
+    x.fillrandom();
+    c.fillrandom();
+    Tensor<T> y = transform(x,c);
+    const std::size_t nalloc = arena.nalloc();
+    for (int i=0; i<10; ++i) {
+        Tensor<T> z = transform(x,c);
+        if ((z-y).normf() > 1e-6*y.normf()) error("test9: failed",10);
+    }
+    if (arena.nalloc()!=nalloc) error("test9: arena allocated in steady state",11);
+    if (arena.high_water() < sizeof(T)*n*n*n) error("test9: high-water mark too small",12);
+
+    std::cout << "Test9<" << tensor_type_names[TensorTypeData<T>::id] << "> OK\n";
+}
+
+void Test10() {
+    // test the pool for tensor storage
+    TensorPool::clear();
+    const TensorPool::Stats s0 = TensorPool::stats();
+
+    std::size_t nbytes = 1000;
+    void* p = TensorPool::allocate(nbytes);
+    if (nbytes < 1000 || nbytes%TensorPool::alignment) error("test10: size not rounded",1);
+    if (std::size_t(p)%TensorPool::alignment) error("test10: buffer not aligned",2);
+    TensorPool::deallocate(p, nbytes);
+
+    std::size_t nbytes2 = 1000;
+    void* q = TensorPool::allocate(nbytes2);
+    if (q != p || nbytes2 != nbytes) error("test10: buffer not reused",3);
+    TensorPool::deallocate(q, nbytes2);
+
+    TensorPool::Stats s1 = TensorPool::stats();
+    if (s1.num_hits != s0.num_hits+1 || s1.num_misses != s0.num_misses+1) error("test10: wrong hit count",4);
+    if (s1.cur_cached_bytes != s0.cur_cached_bytes+nbytes) error("test10: wrong cached bytes",5);
+
+    // very large buffers are not cached
+    std::size_t big = TensorPool::max_block_bytes+1;
+    p = TensorPool::allocate(big);
+    TensorPool::deallocate(p, big);
+    if (TensorPool::stats().cur_cached_bytes != s1.cur_cached_bytes) error("test10: large buffer cached",6);
+
+#ifdef MADNESS_TENSOR_POOL
+    for (int i=0; i<10; ++i) {
+        Tensor<double> t(8,8,8);
+        if (std::size_t(t.ptr())%TensorPool::alignment) error("test10: tensor not aligned",7);
+        if (t.normf() != 0.0) error("test10: tensor not zeroed",8);
+        t.fillrandom();
+    }
+    s1 = TensorPool::stats();
+    TensorPool::print_stats(std::cout);
+    if (s1.num_hits < s0.num_hits+10) error("test10: tensors not served from the pool",9);
+#endif
+
+    // a fence keeps a small cache
+    s1 = TensorPool::stats();
+    TensorPool::trim();
+    if (TensorPool::stats().cur_cached_bytes != s1.cur_cached_bytes) error("test10: small cache trimmed",11);
+
+    // sizes seen only once do not keep a recurring size out of the cache
+    TensorPool::clear();
+    for (int i=0; i<2*TensorPool::max_classes; ++i) {
+        std::size_t once = (std::size_t(1)<<20) + i*TensorPool::alignment;
+        TensorPool::deallocate(TensorPool::allocate(once), once);
+    }
+    s1 = TensorPool::stats();
+    nbytes = nbytes2 = 3000;
+    p = TensorPool::allocate(nbytes);
+    TensorPool::deallocate(p, nbytes);
+    q = TensorPool::allocate(nbytes2);
+    TensorPool::deallocate(q, nbytes2);
+    if (q != p || TensorPool::stats().num_hits != s1.num_hits+1) error("test10: recurring size not cached",12);
+
+    TensorPool::clear();
+    if (TensorPool::stats().cur_cached_bytes != 0) error("test10: clear failed",10);
+
+    std::cout << "Test10 OK\n";
+}
+
 int main() {
 
     std::cout << "bounds checking enabled = " << Tensor<double>::bounds_checking()
@@ -663,6 +783,14 @@ int main() {
     Test7<double_complex>();
     std::cout << std::endl;
 
+    Test9<double>();
+    Test9<double_complex>();
+    TensorArena::print_stats(std::cout);
+    std::cout << std::endl;
+
+    Test10();
+    std::cout << std::endl;
+
     std::cout << "\n after tests count=" <<
               Tensor<long>().get_instance_count() << std::endl;
 
@@ -40,6 +40,8 @@
 //#define BENCH 0
 
 #include <madness/world/print.h>
+#include <madness/world/atomicint.h>
+#include <madness/constants.h>
 #include <madness/tensor/tensor.h>
 #include <madness/tensor/clapack.h>
 #include <madness/tensor/tensor_lapack.h>
@@ -85,6 +87,9 @@ namespace madness {
 		/// check orthonormality at low rank additions
 		static const bool check_orthonormality=false;
 
+		/// number of rank reductions done by ortho_randomized(), for debug and testing
+		static AtomicInt nrandomized;
+
 		/// the number of dimensions (the order of the tensor)
 		unsigned int dim_;
 
@@ -313,13 +318,31 @@ namespace madness {
 
         template <typename Archive>
         void serialize(Archive& ar) {
+              	ar & dim_;
+              	serialize_after_dim(ar);
+        }
+
+        /// Loads all but the dimension, which the caller has read already
+
+        /// Lets the GenTensor loader read old archives, where the
+        /// dimension was the first thing after the existence flag
+        template <typename Archive>
+        void load_after_dim(Archive& ar, unsigned int dim) {
+              	dim_=dim;
+              	serialize_after_dim(ar);
+        }
+
+    private:
+        template <typename Archive>
+        void serialize_after_dim(Archive& ar) {
               	int i=int(tensortype_);
-              	ar & dim_ & weights_ & vector_ & rank_ & maxk_ & i;
+              	ar & weights_ & vector_ & rank_ & maxk_ & i;
               	tensortype_=TensorType(i);
               	make_slices();
                 MADNESS_ASSERT(has_structure());
         }
 
+    public:
 		/// return the tensor type
 		TensorType type() const {return tensortype_;};
 
@@ -347,8 +370,9 @@ namespace madness {
 			// already large enuff?
 			if (this->vector_[0].dim(0)>=r) return;
 
-			// to avoid incremental increase of the rank
-			r+=3;
+			// to avoid incremental increase of the rank grow geometrically,
+			// so that repeated appends are amortized
+			r=std::max(r+3,2*this->capacity());
 
 			// for convenience
 			const long rank=this->rank();
@@ -375,6 +399,19 @@ namespace madness {
 
 		}
 
+		/// return the number of configurations that fit into the allocated memory
+		long capacity() const {
+			if (vector_.size()==0 or weights_.size()==0) return 0;
+			return weights_.dim(0);
+		}
+
+		/// remove all configurations, but keep the allocated memory for reuse
+		void clear_terms() {
+			MADNESS_ASSERT(type()==TT_2D);
+			rank_=0;
+			make_structure(true);
+		}
+
 		/// return a Slice that corresponds the that part of vector_ that holds coefficients
 		const std::vector<Slice>& c0() const {
 			MADNESS_ASSERT(s_.size()>0);
@@ -411,6 +448,43 @@ namespace madness {
 		}
 
 	public:
+		/// reduce the rank using a randomized range finder
+
+		/// falls back to orthonormalize() if the sketch does not pay off,
+		/// i.e. if the numerical rank is not much smaller than the current rank
+		void randomized_reduce(const double& thresh) {
+
+			if (type()==TT_FULL) return;
+			if (has_no_data()) return;
+			if (rank()==1) {
+				normalize();
+				return;
+			}
+#ifdef BENCH
+			double cpu0=wall_time();
+#endif
+			normalize();
+			weights_=weights_(Slice(0,rank()-1));
+			tensorT v0=flat_vector(0);
+			tensorT v1=flat_vector(1);
+			if (ortho_randomized(v0,v1,weights_,thresh)) {
+				nrandomized++;
+			} else {
+				ortho3(v0,v1,weights_,thresh);
+			}
+			std::swap(vector_[0],v0);
+			std::swap(vector_[1],v1);
+			rank_=weights_.size();
+			MADNESS_ASSERT(rank_>=0);
+			this->make_structure();
+			make_slices();
+			MADNESS_ASSERT(has_structure());
+#ifdef BENCH
+			double cpu1=wall_time();
+			SRConf<T>::time(26)+=cpu1-cpu0;
+#endif
+		}
+
 		/// orthonormalize this
 		void orthonormalize(const double& thresh) {
 
@@ -470,9 +544,14 @@ namespace madness {
 			// fast return if possible
 			if (rhs.has_no_data()) return;
 			if (this->has_no_data()) {
-				*this=copy(rhs);
-				this->scale(fac);
-				return;
+				// reuse previously allocated memory, if any
+				if (this->capacity()>=rhs.rank()) {
+					make_structure(true);
+				} else {
+					*this=copy(rhs);
+					this->scale(fac);
+					return;
+				}
 			}
 
 			const long newRank=this->rank()+rhs.rank();
@@ -1441,6 +1520,157 @@ namespace madness {
 		return;
 	}
 
+	/// fill a tensor with normally distributed random numbers (Box-Muller)
+	template<typename T>
+	void fill_gaussian(Tensor<T>& t) {
+		Tensor<double> u(2*t.size());
+		u.fillrandom();
+		const double twopi=2.0*constants::pi;
+		T* p=t.ptr();
+		for (long i=0; i<t.size(); ++i) {
+			const double u1=1.0-u(2*i);		// in (0,1]
+			p[i]=T(std::sqrt(-2.0*std::log(u1))*std::cos(twopi*u(2*i+1)));
+		}
+	}
+
+	/// randomized version of ortho3
+
+	/// reduces the rank of x^T diag(w) y using an adaptive randomized range
+	/// finder (Halko, Martinsson, Tropp, SIAM Rev. 53, 217 (2011)):
+	///  - sketch the range of the matrix with blocks of Gaussian test vectors
+	///  - estimate the residual from the projected sketch and stop if converged
+	///  - SVD of the small projected matrix Q^T A
+	/// operation count is O(kr l + k l^2) with l the numerical rank, compared
+	/// to O(kr^2 + r^3) for ortho3. Half of the threshold is spent on the range
+	/// finder, half on the final truncation.
+	/// If the numerical rank turns out to be comparable to the input rank the
+	/// sketch does not pay off, and the input is left untouched.
+	///
+	/// @param[in,out]	x normalized left subspace
+	/// @param[in,out]	y normalize right subspace
+	/// @param[in,out]	weights weights
+	/// @param[in]		thresh	truncation threshold
+	/// @return	true if the rank has been reduced, false if the caller should use ortho3
+	template<typename T>
+	bool ortho_randomized(Tensor<T>& x, Tensor<T>& y, Tensor<double>& weights,
+			const double& thresh) {
+
+#ifdef BENCH
+		double cpu0=wall_time();
+#endif
+		typedef Tensor<T> tensorT;
+
+		// no complex SRConfs
+		if (TensorTypeData<T>::iscomplex) return false;
+
+		// number of test vectors per block
+		const long blocksize=8;
+
+		const long rank=x.dim(0);
+		const long kx=x.dim(1);
+		const long ky=y.dim(1);
+
+		// sampling the range of the matrix beyond this rank won't pay off
+		const long maxrank=std::min(std::min(kx,ky),rank/2);
+		if (maxrank<blocksize) return false;
+
+		const double range_thresh=thresh*std::sqrt(0.5);
+
+		// the orthonormal basis of the range, in rows
+		tensorT Q(maxrank,kx);
+		long nq=0;
+
+		bool converged=false;
+		while (nq+blocksize<=maxrank) {
+
+			// sketch the range: Y = Omega^T y^T diag(w) x
+			tensorT omega(blocksize,ky);
+			fill_gaussian(omega);
+			tensorT Z=inner(omega,y,1,1);
+			for (long r=0; r<rank; ++r) Z(_,r)*=weights(r);
+			tensorT Y=inner(Z,x,1,0);
+
+			// project out the current basis, twice for numerical stability
+			if (nq>0) {
+				const tensorT Qc=Q(Slice(0,nq-1),_);
+				for (int i=0; i<2; ++i) {
+					tensorT C=inner(Y,Qc,1,1);
+					Y-=inner(C,Qc,1,0);
+				}
+			}
+
+			// each Gaussian sample is an estimate for the squared residual
+			// || (1 - QQ^T) A ||^2_F of the current basis
+			double residual=0.0;
+			for (long i=0; i<blocksize; ++i) {
+				const double n=Y(i,_).normf();
+				residual=std::max(residual,n*n);
+			}
+			if (std::sqrt(residual)<range_thresh) {
+				converged=true;
+				break;
+			}
+
+			// extend the basis by the orthonormalized samples (modified Gram-Schmidt),
+			// samples without new information are dropped
+			const long nq0=nq;
+			for (long i=0; i<blocksize; ++i) {
+				tensorT yi=Y(i,_);
+				for (long j=nq0; j<nq; ++j) yi-=Q(j,_)*yi.trace(Q(j,_));
+				const double n=yi.normf();
+				if (n<1.e-10*std::sqrt(residual)) continue;
+				Q(nq,_)=yi*(1.0/n);
+				nq++;
+			}
+		}
+#ifdef BENCH
+		double cpu1=wall_time();
+		SRConf<T>::time(27)+=cpu1-cpu0;
+#endif
+		if (not converged) return false;
+
+		// all terms are below the threshold
+		if (nq==0) {
+			x.clear();
+			y.clear();
+			weights.clear();
+			return true;
+		}
+
+		// project the matrix onto the range: B = Q x^T diag(w) y
+		const tensorT Qc=Q(Slice(0,nq-1),_);
+		tensorT W=inner(Qc,x,1,1);
+		for (long r=0; r<rank; ++r) W(_,r)*=weights(r);
+		tensorT B=inner(W,y,1,0);
+
+		tensorT U,VT;
+		Tensor<double> s;
+		svd(B,U,s,VT);
+#ifdef BENCH
+		double cpu2=wall_time();
+		SRConf<T>::time(28)+=cpu2-cpu1;
+#endif
+
+		const long i=SRConf<T>::max_sigma(range_thresh,s.dim(0),s);
+		if (i>=0) {
+			x=inner(U(_,Slice(0,i)),Qc,0,0);
+			y=copy(VT(Slice(0,i),_));
+			weights=copy(s(Slice(0,i)));
+		} else {
+			x.clear();
+			y.clear();
+			weights.clear();
+		}
+#ifdef BENCH
+		double cpu3=wall_time();
+		SRConf<T>::time(29)+=cpu3-cpu2;
+#endif
+		return true;
+	}
+
+	template<typename T>
+	AtomicInt SRConf<T>::nrandomized;
+
 	template<typename T>
 	static inline
 	std::ostream& operator<<(std::ostream& s, const SRConf<T>& sr) {
@@ -43,6 +43,7 @@
 #include <cstdlib>
 
 #include <madness/world/archive.h>
+#include <madness/world/buffer_archive.h>
 // #include <madness/world/print.h>
 //
 // typedef std::complex<float> float_complex;
@@ -59,6 +60,8 @@
 #include <madness/tensor/mtxmq.h>
 #include <madness/tensor/tensorexcept.h>
 #include <madness/tensor/tensoriter.h>
+#include <madness/tensor/tensor_arena.h>
+#include <madness/tensor/tensor_pool.h>
 
 #ifdef USE_GENTENSOR
 #define HAVE_GENTENSOR 1
@@ -269,7 +272,14 @@ namespace madness {
 
 
     /// low rank representations of tensors (see gentensor.h)
-	enum TensorType {TT_NONE, TT_FULL, TT_2D};
+	enum TensorType {TT_NONE, TT_FULL, TT_2D, TT_TENSORTRAIN};
+
+	/// algorithms for reducing the rank of low rank tensors (see gentensor.h)
+
+	/// RR_SVD: deterministic orthonormalization and SVD of all terms (ortho3, ortho5)
+	/// RR_RANDOMIZED: adaptive randomized range finder, pays off if the
+	///                numerical rank is much smaller than the accumulated rank
+	enum RankReduceType {RR_SVD, RR_RANDOMIZED};
 
     static
     inline
@@ -325,6 +335,10 @@ namespace madness {
 #ifdef WORLD_GATHER_MEM_STATS
                     _p = new T[size];
                     _shptr = std::shared_ptr<T>(_p);
+#elif defined(MADNESS_TENSOR_POOL)
+                    std::size_t nbytes = sizeof(T)*_size;
+                    _p = static_cast<T*>(TensorPool::allocate(nbytes));
+                    _shptr.reset(_p, TensorPool::Deleter(nbytes));
 #else
                     if (posix_memalign((void **) &_p, TENSOR_ALIGNMENT, sizeof(T)*_size)) throw 1;
                     _shptr.reset(_p, &free);
@@ -1832,6 +1846,35 @@ namespace madness {
     std::ostream& operator << (std::ostream& out, const Tensor<T>& t);
 
 
+    /// A tensor whose data the sender hands over to an active message or remote task
+
+    /// A plain \c Tensor is copied into the message, so the sender may change
+    /// or free it as soon as the send returns.  Wrapped by \c handover(), a
+    /// tensor of at least \c am_attach_min() bytes that owns its storage is
+    /// instead sent beside the message straight from its own memory.  The
+    /// message shares the data until it has been sent, so the sender must not
+    /// modify it after handing it over.  Elsewhere, e.g. in a local task, this
+    /// is just the tensor.
+    template <class T>
+    class HandoverTensor : public Tensor<T> {
+    public:
+        HandoverTensor() {}
+
+        explicit HandoverTensor(const Tensor<T>& t) : Tensor<T>(t) {}
+
+        /// True if the data is contiguous and starts a buffer that this tensor shares
+        bool owns_storage() const {
+            return this->_shptr && this->_p == this->_shptr.get() && this->iscontiguous();
+        }
+    };
+
+    /// Hands the data of \c t over to the message that it is sent with (see \c HandoverTensor)
+    template <class T>
+    HandoverTensor<T> handover(const Tensor<T>& t) {
+        return HandoverTensor<T>(t);
+    }
+
+
     namespace archive {
         /// Serialize a tensor
         template <class Archive, typename T>
@@ -1868,6 +1911,90 @@ namespace madness {
             };
         };
 
+
+        /// Serialize a tensor into a buffer
+
+        /// The data is always copied into the buffer ... see \c HandoverTensor
+        /// for sending it beside an active message instead.  The index of the
+        /// attachment is stored as -1.
+        template <typename T>
+        struct ArchiveStoreImpl< BufferOutputArchive, Tensor<T> > {
+            static void store(const BufferOutputArchive& s, const Tensor<T>& t) {
+                if (t.iscontiguous()) {
+                    s & t.size() & t.id();
+                    if (t.size()) s & t.ndim() & wrap(t.dims(),TENSOR_MAXDIM) & -1l & wrap(t.ptr(),t.size());
+                }
+                else {
+                    s & copy(t);
+                }
+            };
+        };
+
+
+        /// Serialize a handed over tensor ... just the tensor in most archives
+        template <class Archive, typename T>
+        struct ArchiveStoreImpl< Archive, HandoverTensor<T> > {
+            static void store(const Archive& s, const HandoverTensor<T>& t) {
+                ArchiveStoreImpl< Archive, Tensor<T> >::store(s, t);
+            };
+        };
+
+
+        /// Deserialize a handed over tensor ... it arrives as a tensor
+        template <class Archive, typename T>
+        struct ArchiveLoadImpl< Archive, HandoverTensor<T> > {
+            static void load(const Archive& s, HandoverTensor<T>& t) {
+                ArchiveLoadImpl< Archive, Tensor<T> >::load(s, t);
+            };
+        };
+
+
+        /// Serialize a handed over tensor into a buffer ... large data is attached rather than copied
+
+        /// The buffer archives carry active messages, so a tensor that owns
+        /// its storage and is big enough for \c BufferOutputArchive::attach()
+        /// is sent beside the message straight from its own memory, which the
+        /// archive keeps alive with a shallow copy of the tensor.  It is
+        /// received directly into the new tensor.  Other tensors are copied.
+        template <typename T>
+        struct ArchiveStoreImpl< BufferOutputArchive, HandoverTensor<T> > {
+            static void store(const BufferOutputArchive& s, const HandoverTensor<T>& t) {
+                if (!t.owns_storage() || !t.size()) {
+                    ArchiveStoreImpl< BufferOutputArchive, Tensor<T> >::store(s, t);
+                    return;
+                }
+                const Tensor<T>& owner = t;
+                s & t.size() & t.id() & t.ndim() & wrap(t.dims(),TENSOR_MAXDIM);
+                const long k = s.attach(t.ptr(), t.size()*sizeof(T), owner);
+                s & k;
+                if (k < 0) s & wrap(t.ptr(),t.size());
+            };
+        };
+
+
+        /// Deserialize a tensor from a buffer ... existing tensor is replaced
+        template <typename T>
+        struct ArchiveLoadImpl< BufferInputArchive, Tensor<T> > {
+            static void load(const BufferInputArchive& s, Tensor<T>& t) {
+                long sz = 0l, id = 0l;
+                s & sz & id;
+                if (id != t.id()) throw "type mismatch deserializing a tensor";
+                if (sz) {
+                    long _ndim = 0l, _dim[TENSOR_MAXDIM], k = -1l;
+                    s & _ndim & wrap(_dim,TENSOR_MAXDIM) & k;
+                    t = Tensor<T>(_ndim, _dim, false);
+                    if (sz != t.size()) throw "size mismatch deserializing a tensor";
+                    if (k < 0)
+                        s & wrap(t.ptr(), t.size());
+                    else
+                        s.load_attachment(k, t.ptr(), t.size()*sizeof(T));
+                }
+                else {
+                    t = Tensor<T>();
+                }
+            };
+        };
+
     }
 
     /// The class defines tensor op scalar ... here define scalar op tensor.
@@ -1953,6 +2080,61 @@ namespace madness {
         return conj(t.swapdim(0,1));
     }
 
+    /// A tensor that refers to memory it does not own
+
+    /// \ingroup tensor
+    /// A TensorView behaves like any other tensor, but its data is
+    /// either provided by the caller or taken from the calling
+    /// thread's TensorArena.  No heap allocation is involved, which
+    /// makes it suitable for the workspace of kernels that are called
+    /// very often.  Shallow copies refer to the same memory, so neither
+    /// the view nor any copy of it may be used after the memory is
+    /// gone, i.e. after the end of the enclosing TensorArena::Scope.
+    template <class T> class TensorView : public Tensor<T> {
+    private:
+        TensorView<T>();
+
+        void make_view(long nd, const long d[], T* p, bool dozero) {
+            TENSOR_ASSERT(nd>0 && nd <= TENSOR_MAXDIM,"invalid ndim in new tensor", nd, 0);
+            this->set_dims_and_size(nd, d);
+            this->_p = (this->_size) ? p : 0;
+            if (dozero && this->_size) aligned_zero(this->_size, this->_p);
+        }
+
+        void make_view(long nd, const long d[], bool dozero) {
+            long size=1;
+            for (long i=0; i<nd; ++i) size*=d[i];
+            make_view(nd, d, TensorArena::instance().allocate<T>(size), dozero);
+        }
+
+    public:
+        using Tensor<T>::operator=;
+
+        /// Make a view of the memory at p, which must hold at least prod(d) elements
+        TensorView(long nd, const long d[], T* p) {
+            make_view(nd, d, p, false);
+        }
+
+        /// Make a tensor in the calling thread's arena, which must be inside a TensorArena::Scope
+        TensorView(long nd, const long d[], bool dozero=true) {
+            make_view(nd, d, dozero);
+        }
+
+        /// Make a tensor in the calling thread's arena, which must be inside a TensorArena::Scope
+        explicit TensorView(const std::vector<long>& d, bool dozero=true) {
+            make_view(d.size(), d.size() ? &(d[0]) : 0, dozero);
+        }
+
+        /// Make a matrix in the calling thread's arena, which must be inside a TensorArena::Scope
+        TensorView(long d0, long d1, bool dozero=true) {
+            const long d[2]={d0,d1};
+            make_view(2, d, dozero);
+        }
+
+        virtual ~TensorView() {}
+    };
+
+
     /// Indexing a non-constant tensor with slices returns a SliceTensor
 
     /// \ingroup tensor
@@ -2286,8 +2468,9 @@ namespace madness {
         typedef TENSOR_RESULT_TYPE(T,Q) resultT;
         TENSOR_ASSERT(c.ndim() == 2,"second argument must be a matrix",c.ndim(),&c);
         if (c.dim(0)==c.dim(1) && t.iscontiguous() && c.iscontiguous()) {
+            TensorArena::Scope scope;
             Tensor<resultT> result(t.ndim(),t.dims(),false);
-            Tensor<resultT> work(t.ndim(),t.dims(),false);
+            TensorView<resultT> work(t.ndim(),t.dims(),false);
             return fast_transform(t, c, result, work);
         }
         else {
@@ -2351,6 +2534,8 @@ namespace madness {
             Tensor< TENSOR_RESULT_TYPE(T,Q) >& workspace) {
         typedef  TENSOR_RESULT_TYPE(T,Q) resultT;
         const Q *pc=c.ptr();
+        if (fused_transform(t.ndim(), c.dim(1), result.ptr(), t.ptr(), pc, workspace.ptr())) return result;
+
         resultT *t0=workspace.ptr(), *t1=result.ptr();
         if (t.ndim()&1) {
             t0 = result.ptr();
@@ -0,0 +1,172 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+/// \file tensor_arena.cc
+/// \brief Implements TensorArena
+
+#include <madness/tensor/tensor_arena.h>
+#include <madness/tensor/tensorexcept.h>
+#include <madness/world/posixmem.h>
+#include <madness/world/worldmutex.h>
+#include <madness/world/topology.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+
+namespace madness {
+
+    namespace {
+
+        /// Bookkeeping of all arenas for reporting
+        struct ArenaRegistry {
+            Mutex mutex;
+            std::list<const TensorArena*> arenas;
+            std::vector<std::size_t> retired;   ///< high-water marks of exited threads
+        };
+
+        ArenaRegistry& registry() {
+            static ArenaRegistry r;
+            return r;
+        }
+
+        std::size_t round_up(std::size_t nbytes) {
+            return (nbytes + TensorArena::alignment - 1) & ~(TensorArena::alignment - 1);
+        }
+    }
+
+    TensorArena::TensorArena() : depth_(0), high_water_(0), nalloc_(0) {
+        top_.block=top_.offset=top_.used=0;
+        ArenaRegistry& r=registry();
+        ScopedMutex<Mutex> lock(r.mutex);
+        r.arenas.push_back(this);
+    }
+
+    TensorArena::~TensorArena() {
+        {
+            ArenaRegistry& r=registry();
+            ScopedMutex<Mutex> lock(r.mutex);
+            r.arenas.remove(this);
+            r.retired.push_back(high_water_);
+        }
+        for (std::size_t i=0; i<blocks_.size(); ++i) free(blocks_[i].p);
+    }
+
+    TensorArena& TensorArena::instance() {
+        static thread_local TensorArena arena;
+        return arena;
+    }
+
+    void* TensorArena::allocate(std::size_t nbytes) {
+        TENSOR_ASSERT(depth_>0, "TensorArena::allocate outside of a TensorArena::Scope", depth_, 0);
+        nbytes=round_up(nbytes);
+
+        if (blocks_.empty() or top_.offset+nbytes > blocks_[top_.block].size) grow(nbytes);
+
+        void* p=blocks_[top_.block].p + top_.offset;
+        top_.offset+=nbytes;
+        top_.used+=nbytes;
+        high_water_=std::max(high_water_,top_.used);
+        return p;
+    }
+
+    void TensorArena::grow(std::size_t nbytes) {
+        // leave the current block; its remainder is not used until released
+        if (not blocks_.empty()) {
+            ++top_.block;
+            top_.offset=0;
+        }
+
+        // use the next block if it is large enough, otherwise insert a new one
+        if (top_.block<blocks_.size() and blocks_[top_.block].size>=nbytes) return;
+
+        Block b;
+        b.size=round_up(std::max(nbytes,std::max(capacity(),std::size_t(1)<<16)));
+        if (posix_memalign((void **) &b.p, alignment, b.size)) {
+            TENSOR_EXCEPTION("TensorArena: new block failed",b.size,0);
+        }
+        Topology::instance().place_local(b.p,b.size); // the arena is only used by this thread
+        ++nalloc_;
+        blocks_.insert(blocks_.begin()+top_.block,b);
+    }
+
+    void TensorArena::consolidate() {
+        const std::size_t size=round_up(high_water_);
+        for (std::size_t i=0; i<blocks_.size(); ++i) free(blocks_[i].p);
+        blocks_.clear();
+
+        Block b;
+        b.size=size;
+        if (posix_memalign((void **) &b.p, alignment, b.size)) {
+            TENSOR_EXCEPTION("TensorArena: new block failed",b.size,0);
+        }
+        Topology::instance().place_local(b.p,b.size); // the arena is only used by this thread
+        ++nalloc_;
+        blocks_.push_back(b);
+    }
+
+    void TensorArena::release(const Mark& m) {
+        top_=m;
+        if (top_.used==0 and blocks_.size()>1) consolidate();
+    }
+
+    std::size_t TensorArena::capacity() const {
+        std::size_t c=0;
+        for (std::size_t i=0; i<blocks_.size(); ++i) c+=blocks_[i].size;
+        return c;
+    }
+
+    std::vector<std::size_t> TensorArena::high_water_marks() {
+        ArenaRegistry& r=registry();
+        ScopedMutex<Mutex> lock(r.mutex);
+        std::vector<std::size_t> result(r.retired);
+        for (std::list<const TensorArena*>::const_iterator it=r.arenas.begin(); it!=r.arenas.end(); ++it) {
+            result.push_back((*it)->high_water());
+        }
+        return result;
+    }
+
+    void TensorArena::print_stats(std::ostream& s) {
+        const std::vector<std::size_t> hw=high_water_marks();
+        std::size_t total=0, largest=0;
+        for (std::size_t i=0; i<hw.size(); ++i) {
+            total+=hw[i];
+            largest=std::max(largest,hw[i]);
+        }
+        s << "TensorArena: " << hw.size() << " threads, high-water mark per thread (bytes):";
+        for (std::size_t i=0; i<hw.size(); ++i) s << " " << hw[i];
+        s << std::endl;
+        s << "TensorArena: largest " << largest << " total " << total << std::endl;
+    }
+
+}
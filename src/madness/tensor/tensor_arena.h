@@ -0,0 +1,169 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+#ifndef MADNESS_TENSOR_TENSOR_ARENA_H__INCLUDED
+#define MADNESS_TENSOR_TENSOR_ARENA_H__INCLUDED
+
+/*!
+  \file tensor/tensor_arena.h
+  \brief Thread-local scratch memory for the workspace of tensor kernels
+
+  Kernels such as SeparatedConvolution::apply need a handful of
+  temporary tensors on every call.  Instead of going to the heap each
+  time, the workspace is taken from a per-thread arena that hands out
+  memory stack-like and is rewound at the end of a TensorArena::Scope.
+  Once the arena has grown to its high-water mark no further heap
+  allocations are made.
+
+  \code
+  {
+      TensorArena::Scope scope;
+      TensorView<double> work(v2k,false);   // memory from this thread's arena
+      ...
+  }                                         // work must not be used after here
+  \endcode
+*/
+
+#include <madness/madness_config.h>
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+
+namespace madness {
+
+    /// Per-thread stack-like allocator for temporary tensors
+
+    /// Memory is kept in a list of blocks that live as long as the
+    /// thread.  Allocations are only permitted inside a Scope, at the
+    /// end of which everything allocated within it is released.  When
+    /// the outermost scope ends and more than one block was needed, the
+    /// blocks are merged into one so that subsequent calls are served
+    /// from a single block.
+    class TensorArena {
+    public:
+        /// All allocations are aligned to this many bytes
+        static const std::size_t alignment=64;
+
+        /// A position in the arena, see mark() and release()
+        struct Mark {
+            std::size_t block;      ///< index of the current block
+            std::size_t offset;     ///< first free byte in the current block
+            std::size_t used;       ///< total number of bytes handed out
+        };
+
+        /// Memory allocated from this thread's arena within a scope is released at its end
+        class Scope {
+            TensorArena& arena;
+            const Mark m;
+
+            Scope(const Scope&);
+            Scope& operator=(const Scope&);
+
+        public:
+            Scope() : arena(TensorArena::instance()), m(arena.mark()) {
+                ++arena.depth_;
+            }
+
+            ~Scope() {
+                --arena.depth_;
+                arena.release(m);
+            }
+        };
+
+    private:
+        struct Block {
+            char* p;
+            std::size_t size;
+        };
+
+        std::vector<Block> blocks_;
+        Mark top_;                  ///< current top of the stack
+        int depth_;                 ///< number of active scopes
+        std::size_t high_water_;    ///< max number of bytes in use at any time
+        std::size_t nalloc_;        ///< number of heap allocations of blocks
+
+        TensorArena();
+        ~TensorArena();
+        TensorArena(const TensorArena&);
+        TensorArena& operator=(const TensorArena&);
+
+        /// Move on to a block that can hold at least nbytes, allocating it if necessary
+        void grow(std::size_t nbytes);
+
+        /// Replace all blocks by a single one that holds the high-water mark
+        void consolidate();
+
+    public:
+        /// Return the arena of the calling thread
+        static TensorArena& instance();
+
+        /// Return nbytes of memory aligned to TensorArena::alignment
+
+        /// Throws if called outside of a Scope
+        void* allocate(std::size_t nbytes);
+
+        /// Return memory for n elements of type T
+        template <typename T>
+        T* allocate(long n) {
+            return static_cast<T*>(allocate(n*sizeof(T)));
+        }
+
+        /// Current top of the stack
+        Mark mark() const {return top_;}
+
+        /// Release everything allocated after mark m
+        void release(const Mark& m);
+
+        /// Number of bytes currently handed out
+        std::size_t used() const {return top_.used;}
+
+        /// Maximum number of bytes handed out at any time by this thread
+        std::size_t high_water() const {return high_water_;}
+
+        /// Number of bytes held by this thread
+        std::size_t capacity() const;
+
+        /// Number of times this thread had to go to the heap
+        std::size_t nalloc() const {return nalloc_;}
+
+        /// Return the high-water marks of all threads that used an arena
+
+        /// Threads that have exited are included
+        static std::vector<std::size_t> high_water_marks();
+
+        /// Print the high-water marks of all threads that used an arena
+        static void print_stats(std::ostream& s);
+    };
+
+}
+
+#endif // MADNESS_TENSOR_TENSOR_ARENA_H__INCLUDED
@@ -0,0 +1,295 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+/// \file tensor_pool.cc
+/// \brief Implements TensorPool
+
+#include <madness/tensor/tensor_pool.h>
+#include <madness/world/posixmem.h>
+#include <madness/world/worldmem.h>
+#include <madness/world/worldmutex.h>
+#include <madness/world/topology.h>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <new>
+#include <vector>
+
+namespace madness {
+
+    namespace {
+
+        const std::memory_order relaxed = std::memory_order_relaxed;
+
+        /// Bytes held in the caches of all threads
+        std::atomic<std::size_t> total_cached_bytes(0);
+
+        /// Advanced by clear(); a cache emptied before the last advance is emptied on its next use
+        std::atomic<unsigned long> clear_epoch(0);
+
+        /// Add n to a counter that only the thread owning it modifies
+
+        /// stats() reads the counters from other threads, hence they are
+        /// atomic, but with a single writer a relaxed load and store suffice.
+        template <typename T, typename U>
+        inline void bump(std::atomic<T>& a, U n) {a.store(a.load(relaxed)+n, relaxed);}
+
+        /// Free buffers of one size
+        struct SizeClass {
+            std::size_t nbytes;
+            unsigned long last_use;     ///< value of ThreadCache::tick when last looked up
+            std::vector<void*> free;
+        };
+
+        /// The cache of free buffers of one thread
+        struct ThreadCache {
+            SizeClass classes[TensorPool::max_classes];
+            int nclass;
+            unsigned long tick;         ///< number of lookups, orders the classes by use
+            unsigned long epoch;        ///< value of clear_epoch when last emptied
+            std::atomic<std::size_t> cached_bytes;
+            std::atomic<std::size_t> max_cached_bytes;
+            std::atomic<unsigned long> num_hits;
+            std::atomic<unsigned long> num_misses;
+            std::atomic<unsigned long> num_frees;
+
+            ThreadCache();
+            ~ThreadCache();
+
+            /// Return the class for nbytes, making one if needed
+
+            /// If all classes are taken, the one used least recently is
+            /// emptied and given to nbytes, so that sizes seen only once
+            /// do not keep the recurring ones out of the cache.
+            SizeClass* find(std::size_t nbytes) {
+                ++tick;
+                for (int i=0; i<nclass; ++i) {
+                    if (classes[i].nbytes == nbytes) {
+                        classes[i].last_use = tick;
+                        return classes+i;
+                    }
+                }
+                SizeClass* s = classes + nclass;
+                if (nclass == TensorPool::max_classes) {
+                    s = classes;
+                    for (int i=1; i<nclass; ++i) {
+                        if (classes[i].last_use < s->last_use) s = classes+i;
+                    }
+                    release(*s);
+                }
+                else {
+                    ++nclass;
+                }
+                s->nbytes = nbytes;
+                s->last_use = tick;
+                return s;
+            }
+
+            /// Return the buffers of one class to the heap
+            void release(SizeClass& s) {
+                const std::size_t nbytes = s.nbytes*s.free.size();
+                bump(num_frees, s.free.size());
+                for (std::size_t j=0; j<s.free.size(); ++j) free(s.free[j]);
+                s.free.clear();
+                cached_bytes.store(cached_bytes.load(relaxed) - nbytes, relaxed);
+                total_cached_bytes.fetch_sub(nbytes, relaxed);
+            }
+
+            void clear() {
+                for (int i=0; i<nclass; ++i) release(classes[i]);
+                nclass = 0;
+            }
+        };
+
+        /// Bookkeeping of all caches for reporting
+        struct PoolRegistry {
+            Mutex mutex;
+            std::list<const ThreadCache*> caches;
+            TensorPool::Stats retired;  ///< statistics of exited threads
+
+            PoolRegistry() {
+                retired.num_hits = retired.num_misses = retired.num_frees = 0;
+                retired.cur_cached_bytes = retired.max_cached_bytes = 0;
+            }
+        };
+
+        PoolRegistry& registry() {
+            static PoolRegistry r;
+            return r;
+        }
+
+        /// Set when the cache of this thread has been destroyed at thread exit
+
+        /// Tensors held in static objects are freed after that and must
+        /// go straight back to the heap.
+        thread_local bool cache_destroyed = false;
+
+        ThreadCache::ThreadCache()
+            : nclass(0), tick(0), epoch(clear_epoch.load(relaxed)), cached_bytes(0), max_cached_bytes(0)
+            , num_hits(0), num_misses(0), num_frees(0)
+        {
+            PoolRegistry& r=registry();
+            ScopedMutex<Mutex> lock(r.mutex);
+            r.caches.push_back(this);
+        }
+
+        ThreadCache::~ThreadCache() {
+            clear();
+            cache_destroyed = true;
+            PoolRegistry& r=registry();
+            ScopedMutex<Mutex> lock(r.mutex);
+            r.caches.remove(this);
+            r.retired.num_hits += num_hits.load(relaxed);
+            r.retired.num_misses += num_misses.load(relaxed);
+            r.retired.num_frees += num_frees.load(relaxed);
+            r.retired.max_cached_bytes += max_cached_bytes.load(relaxed);
+        }
+
+        /// The cache of the calling thread, emptied first if clear() was called since its last use
+        ThreadCache& thread_cache() {
+            static thread_local ThreadCache cache;
+            const unsigned long e = clear_epoch.load(relaxed);
+            if (cache.epoch != e) {
+                cache.clear();
+                cache.epoch = e;
+            }
+            return cache;
+        }
+
+        void* heap_allocate(std::size_t nbytes) {
+            void* p;
+            if (posix_memalign(&p, TensorPool::alignment, nbytes)) throw std::bad_alloc();
+            // Large buffers get their pages in the NUMA domain of the
+            // allocating thread even if another thread touches them first
+            if (nbytes >= (std::size_t(1)<<16)) Topology::instance().place_local(p, nbytes);
+            return p;
+        }
+    }
+
+    void* TensorPool::allocate(std::size_t& nbytes) {
+        nbytes = (nbytes + alignment - 1) & ~(alignment - 1);
+        if (nbytes > max_block_bytes || cache_destroyed) return heap_allocate(nbytes);
+
+        ThreadCache& c = thread_cache();
+        SizeClass* s = c.find(nbytes);
+        if (s && !s->free.empty()) {
+            void* p = s->free.back();
+            s->free.pop_back();
+            c.cached_bytes.store(c.cached_bytes.load(relaxed) - nbytes, relaxed);
+            total_cached_bytes.fetch_sub(nbytes, relaxed);
+            bump(c.num_hits, 1);
+            return p;
+        }
+        bump(c.num_misses, 1);
+        return heap_allocate(nbytes);
+    }
+
+    void TensorPool::deallocate(void* p, std::size_t nbytes) {
+        if (nbytes > max_block_bytes || cache_destroyed) {
+            free(p);
+            return;
+        }
+
+        ThreadCache& c = thread_cache();
+        SizeClass* s = c.find(nbytes);
+        const std::size_t cached = c.cached_bytes.load(relaxed) + nbytes;
+        bool keep = s && cached <= TensorPool::max_cached_bytes;
+        if (keep && total_cached_bytes.fetch_add(nbytes, relaxed) + nbytes > max_total_cached_bytes) {
+            total_cached_bytes.fetch_sub(nbytes, relaxed);
+            keep = false;
+        }
+        if (!keep) {
+            bump(c.num_frees, 1);
+            free(p);
+            return;
+        }
+        s->free.push_back(p);
+        c.cached_bytes.store(cached, relaxed);
+        if (cached > c.max_cached_bytes.load(relaxed)) c.max_cached_bytes.store(cached, relaxed);
+    }
+
+    void TensorPool::clear() {
+        clear_epoch.fetch_add(1, relaxed);
+        if (!cache_destroyed) thread_cache(); // empties the cache of this thread
+    }
+
+    void TensorPool::trim() {
+        if (total_cached_bytes.load(relaxed) > trim_cached_bytes) clear();
+    }
+
+    TensorPool::Stats TensorPool::stats() {
+        PoolRegistry& r=registry();
+        ScopedMutex<Mutex> lock(r.mutex);
+        Stats s = r.retired;
+        for (std::list<const ThreadCache*>::const_iterator it=r.caches.begin(); it!=r.caches.end(); ++it) {
+            const ThreadCache& c = **it;
+            s.num_hits += c.num_hits.load(relaxed);
+            s.num_misses += c.num_misses.load(relaxed);
+            s.num_frees += c.num_frees.load(relaxed);
+            s.cur_cached_bytes += c.cached_bytes.load(relaxed);
+            s.max_cached_bytes += c.max_cached_bytes.load(relaxed);
+        }
+        return s;
+    }
+
+    void TensorPool::update_mem_info(WorldMemInfo* m) {
+        const Stats s = stats();
+        m->pool_num_hits = s.num_hits;
+        m->pool_num_misses = s.num_misses;
+        m->pool_num_frees = s.num_frees;
+        m->pool_cur_bytes = s.cur_cached_bytes;
+        m->pool_max_bytes = s.max_cached_bytes;
+    }
+
+    void TensorPool::print_stats(std::ostream& s) {
+        const Stats st = stats();
+        s << "TensorPool: hits " << st.num_hits << " misses " << st.num_misses
+          << " frees " << st.num_frees << std::endl;
+        s << "TensorPool: cur and max bytes cached " << st.cur_cached_bytes
+          << " " << st.max_cached_bytes << std::endl;
+    }
+
+#ifdef MADNESS_TENSOR_POOL
+    namespace {
+        /// Installs the hooks through which WorldMemInfo::print() fetches the statistics and fence trims the caches
+        struct PoolStatsHook {
+            PoolStatsHook() {
+                world_mem_info()->update_pool_stats = &TensorPool::update_mem_info;
+                world_mem_info()->trim_pool = &TensorPool::trim;
+            }
+        } pool_stats_hook;
+    }
+#endif
+
+}
@@ -0,0 +1,138 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+#ifndef MADNESS_TENSOR_TENSOR_POOL_H__INCLUDED
+#define MADNESS_TENSOR_TENSOR_POOL_H__INCLUDED
+
+/*!
+  \file tensor/tensor_pool.h
+  \brief Per-thread size-class pool for the storage of tensors
+
+  In MRA nearly all tensors have one of a few shapes, (k)^NDIM and
+  (2k)^NDIM, so the same few buffer sizes are allocated and freed over
+  and over.  With \c --enable-tensor-pool the storage of Tensor is
+  taken from a per-thread cache of free buffers, one free list per
+  distinct size.  A buffer is returned to the cache of the thread that
+  frees it, so neither allocation nor deallocation takes a lock.
+
+  The bytes cached by a thread and by the whole process are both
+  bounded.  clear() empties the cache of the calling thread at once and
+  those of the other threads when they next use the pool.  A global
+  fence does the same only if the caches hold more than
+  trim_cached_bytes, so that buffers are reused from one fence-delimited
+  operation to the next.  If a thread sees more distinct sizes than it
+  has classes, the class used least recently is emptied and reused.
+
+  Statistics are summed over all threads and reported through
+  WorldMemInfo (see world_mem_info()->print()).
+*/
+
+#include <madness/madness_config.h>
+#include <cstddef>
+#include <iosfwd>
+
+namespace madness {
+
+    class WorldMemInfo;
+
+    /// Per-thread cache of 64-byte aligned buffers of recurring sizes
+    class TensorPool {
+    public:
+        /// All buffers are aligned to this many bytes
+        static const std::size_t alignment=64;
+
+        /// Maximum number of distinct sizes cached by a thread
+        static const int max_classes=64;
+
+        /// Buffers larger than this are never cached
+        static const std::size_t max_block_bytes=std::size_t(1)<<26;
+
+        /// Maximum number of bytes held in the cache of a thread
+        static const std::size_t max_cached_bytes=std::size_t(1)<<28;
+
+        /// Maximum number of bytes held in the caches of all threads together
+        static const std::size_t max_total_cached_bytes=std::size_t(1)<<30;
+
+        /// trim() empties the caches if all threads together hold more bytes than this
+        static const std::size_t trim_cached_bytes=max_total_cached_bytes/4*3;
+
+        /// Statistics summed over all threads
+        struct Stats {
+            unsigned long num_hits;         ///< allocations served from a cache
+            unsigned long num_misses;       ///< allocations that went to the heap
+            unsigned long num_frees;        ///< buffers returned to the heap
+            unsigned long cur_cached_bytes; ///< bytes currently held in caches
+            unsigned long max_cached_bytes; ///< sum over threads of the maximum bytes held
+        };
+
+        /// Deleter for std::shared_ptr that returns a buffer to the pool
+        struct Deleter {
+            std::size_t nbytes;
+            explicit Deleter(std::size_t nbytes) : nbytes(nbytes) {}
+            void operator()(void* p) const {TensorPool::deallocate(p,nbytes);}
+        };
+
+        /// Return an aligned buffer of at least nbytes
+
+        /// The value returned in nbytes must be passed to deallocate()
+        static void* allocate(std::size_t& nbytes);
+
+        /// Return a buffer obtained from allocate() to the pool of the calling thread
+        static void deallocate(void* p, std::size_t nbytes);
+
+        /// Return the buffers cached by all threads to the heap
+
+        /// The cache of the calling thread is emptied now, those of the
+        /// other threads the next time they allocate or free a tensor.
+        static void clear();
+
+        /// Call clear() if the caches hold more than trim_cached_bytes
+
+        /// Called by each global fence.
+        static void trim();
+
+        /// Statistics summed over all threads, including those that have exited
+        static Stats stats();
+
+        /// Copy the statistics into m
+        static void update_mem_info(WorldMemInfo* m);
+
+        /// Print the statistics
+        static void print_stats(std::ostream& s);
+
+    private:
+        TensorPool();
+    };
+
+}
+
+#endif // MADNESS_TENSOR_TENSOR_POOL_H__INCLUDED
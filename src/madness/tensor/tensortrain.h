@@ -76,6 +76,28 @@ namespace madness {
 
 	public:
 
+		/// empty ctor
+		TensorTrain() : core(), zero_rank(true) {}
+
+		/// ctor for a TensorTrain with zero rank
+
+		/// @param[in]	dims	the number of entries in each dimension
+		TensorTrain(const std::vector<long>& dims)
+			: core(), zero_rank(true) {
+			make_zero_rank(dims);
+		}
+
+		/// ctor for a TensorTrain from its core tensors, shallow
+
+		/// @param[in]	cores	core tensors of shape (k,r1) (r1,k,r2) .. (rn-1,k)
+		TensorTrain(const std::vector<Tensor<T> >& cores)
+			: core(cores), zero_rank(false) {
+			MADNESS_ASSERT(core.size()>1);
+			for (std::size_t i=0; i<core.size()-1; ++i) {
+				if (core[i].dim(core[i].ndim()-1)==0) zero_rank=true;
+			}
+		}
+
 		/// ctor for a TensorTrain, with the tolerance eps
 
 		/// The tensor train will represent the input tensor with
@@ -263,7 +285,7 @@ namespace madness {
 			MADNESS_ASSERT(this->ndim()==rhs.ndim());
 
 			if (this->zero_rank) {
-				*this=rhs;
+				*this=copy(rhs);
 			} else if (rhs.zero_rank) {
 				;
 			} else {
@@ -311,6 +333,196 @@ namespace madness {
 			return *this;
 		}
 
+		/// Inplace generalized saxpy ... this = this*alpha + rhs*beta
+
+		/// the ranks of this and rhs add up, call truncate() to reduce them
+		TensorTrain<T>& gaxpy(const T alpha, const TensorTrain<T>& rhs, const T beta) {
+			if (alpha!=T(1.0)) this->scale(alpha);
+			if (rhs.zero_rank) return *this;
+			TensorTrain<T> tmp=copy(rhs);
+			tmp.scale(beta);
+			return (*this)+=tmp;
+		}
+
+		/// Inplace generalized saxpy with slices ... this(s1) = this(s1)*alpha + rhs(s2)*beta
+
+		/// the slices refer to the physical indices of the core tensors
+		TensorTrain<T>& gaxpy(const std::vector<Slice>& s1, const T alpha,
+				const TensorTrain<T>& rhs, const std::vector<Slice>& s2, const T beta) {
+
+			MADNESS_ASSERT(s1.size()==std::size_t(ndim()) and s2.size()==std::size_t(rhs.ndim()));
+
+			// scale this(s1) by alpha: subtract (1-alpha) * this(s1)
+			if (alpha!=T(1.0)) {
+				TensorTrain<T> piece=this->copy_slice(s1);
+				this->gaxpy(s1,T(1.0),piece,std::vector<Slice>(ndim(),Slice(_)),alpha-T(1.0));
+			}
+			if (rhs.zero_rank) return *this;
+
+			// zero-pad the slice of rhs to the dimensions of this, then add
+			TensorTrain<T> piece=rhs.copy_slice(s2);
+			std::vector<Tensor<T> > cores(piece.core.size());
+			const long nd=ndim();
+			{
+				Tensor<T> c(dim(0),piece.core[0].dim(1));
+				c(s1[0],_)=piece.core[0];
+				cores[0]=c;
+			}
+			for (long d=1; d<nd-1; ++d) {
+				Tensor<T> c(piece.core[d].dim(0),dim(d),piece.core[d].dim(2));
+				c(_,s1[d],_)=piece.core[d];
+				cores[d]=c;
+			}
+			{
+				Tensor<T> c(piece.core[nd-1].dim(0),dim(nd-1));
+				c(_,s1[nd-1])=piece.core[nd-1];
+				cores[nd-1]=c;
+			}
+			TensorTrain<T> padded(cores);
+			padded.scale(beta);
+			return (*this)+=padded;
+		}
+
+		/// return a deep copy of a slice of this
+
+		/// @param[in]	s	the slices of the physical indices, one per dimension
+		TensorTrain<T> copy_slice(const std::vector<Slice>& s) const {
+			MADNESS_ASSERT(s.size()==std::size_t(ndim()));
+			const long nd=ndim();
+
+			if (zero_rank) {
+				std::vector<long> dims(nd);
+				for (long d=0; d<nd; ++d) dims[d]=Tensor<T>(dim(d))(s[d]).dim(0);
+				return TensorTrain<T>(dims);
+			}
+
+			std::vector<Tensor<T> > cores(nd);
+			cores[0]=copy(core[0](s[0],_));
+			for (long d=1; d<nd-1; ++d) cores[d]=copy(core[d](_,s[d],_));
+			cores[nd-1]=copy(core[nd-1](_,s[nd-1]));
+			return TensorTrain<T>(cores);
+		}
+
+		/// deep copy of the core tensors
+		friend TensorTrain<T> copy(const TensorTrain<T>& rhs) {
+			// copy() of an empty tensor does not preserve its dimensions
+			if (rhs.zero_rank and rhs.ndim()>0) {
+				std::vector<long> dims(rhs.ndim());
+				for (long d=0; d<rhs.ndim(); ++d) dims[d]=rhs.dim(d);
+				return TensorTrain<T>(dims);
+			}
+			TensorTrain<T> result;
+			result.zero_rank=rhs.zero_rank;
+			result.core.resize(rhs.core.size());
+			for (std::size_t i=0; i<rhs.core.size(); ++i) result.core[i]=copy(rhs.core[i]);
+			return result;
+		}
+
+		/// inplace scaling with a number
+		template<typename Q>
+		TensorTrain<T>& scale(const Q& fac) {
+			if (not zero_rank) core[0].scale(fac);
+			return *this;
+		}
+
+		/// transform all dimensions of this with the matrix c
+
+		/// \code
+		///  result(i,j,k...) <-- sum(i',j', k',...) t(i',j',k',...) c(i',i) c(j',j) c(k',k) ...
+		/// \endcode
+		/// Each core tensor is transformed separately, the ranks do not change.
+		template<typename Q>
+		TensorTrain<TENSOR_RESULT_TYPE(T,Q)> transform(const Tensor<Q>& c) const {
+			std::vector<Tensor<Q> > cc(ndim(),c);
+			return general_transform(&cc[0]);
+		}
+
+		/// transform each dimension d of this with its own matrix c[d]
+
+		/// an empty matrix c[d] leaves dimension d unchanged
+		template<typename Q>
+		TensorTrain<TENSOR_RESULT_TYPE(T,Q)> general_transform(const Tensor<Q> c[]) const {
+			typedef TENSOR_RESULT_TYPE(T,Q) resultT;
+			const long nd=ndim();
+			if (zero_rank) {
+				std::vector<long> dims(nd);
+				for (long d=0; d<nd; ++d) dims[d]=(c[d].size()==0) ? dim(d) : c[d].dim(1);
+				return TensorTrain<resultT>(dims);
+			}
+			std::vector<Tensor<resultT> > cores(nd);
+			for (long d=0; d<nd; ++d) {
+				if (c[d].size()==0) cores[d]=copy(core[d]);
+				else cores[d]=transform_core(d,c[d]);
+			}
+			return TensorTrain<resultT>(cores);
+		}
+
+		/// transform only dimension axis of this with the matrix c
+
+		/// \code
+		/// transform_dir(c,1) = r(i,j,k,...) = sum(j') t(i,j',k,...) * c(j',j)
+		/// \endcode
+		template<typename Q>
+		TensorTrain<TENSOR_RESULT_TYPE(T,Q)> transform_dir(const Tensor<Q>& c, const int axis) const {
+			typedef TENSOR_RESULT_TYPE(T,Q) resultT;
+			const long nd=ndim();
+			MADNESS_ASSERT(axis>=0 and axis<nd);
+			if (zero_rank) {
+				std::vector<long> dims(nd);
+				for (long d=0; d<nd; ++d) dims[d]=(d==axis) ? c.dim(1) : dim(d);
+				return TensorTrain<resultT>(dims);
+			}
+			std::vector<Tensor<resultT> > cores(nd);
+			for (long d=0; d<nd; ++d) {
+				if (d==axis) cores[d]=transform_core(d,c);
+				else cores[d]=copy(core[d]);
+			}
+			return TensorTrain<resultT>(cores);
+		}
+
+		/// return the inner product <this | rhs>, no complex conjugation
+
+		/// The cores are contracted from left to right, the cost is linear
+		/// in the number of dimensions and never reconstructs the full tensors.
+		template<typename Q>
+		TENSOR_RESULT_TYPE(T,Q) trace(const TensorTrain<Q>& rhs) const {
+			typedef TENSOR_RESULT_TYPE(T,Q) resultT;
+			MADNESS_ASSERT(ndim()==rhs.ndim());
+			if (zero_rank or rhs.is_zero_rank()) return resultT(0.0);
+
+			const long nd=ndim();
+
+			// M(r_this,r_rhs)
+			Tensor<resultT> M=inner(core[0],rhs.get_core(0),0,0);
+			for (long d=1; d<nd-1; ++d) {
+				// (r_this,r_rhs) * (r_this,k,r_this') -> (r_rhs,k,r_this')
+				Tensor<resultT> tmp=inner(M,core[d],0,0);
+				const long rthis=core[d].dim(2);
+				const long rrhs=rhs.get_core(d).dim(2);
+				tmp=tmp.reshape(tmp.size()/rthis,rthis);
+				const Tensor<Q> c=rhs.get_core(d).reshape(tmp.dim(0),rrhs);
+				M=inner(tmp,c,0,0);
+			}
+			// (r_this,r_rhs) * (r_this,k) -> (r_rhs,k)
+			Tensor<resultT> tmp=inner(M,core[nd-1],0,0);
+			return tmp.trace(Tensor<resultT>(rhs.get_core(nd-1)));
+		}
+
+		/// return the Frobenius norm of this
+
+		/// note that the norm is computed as sqrt(<this|this>), which is
+		/// inaccurate for norms close to the machine precision
+		double normf() const {
+			if (TensorTypeData<T>::iscomplex) MADNESS_EXCEPTION("no complex normf in TensorTrain, sorry",1);
+			if (zero_rank) return 0.0;
+			return std::sqrt(std::abs(this->trace(*this)));
+		}
+
+		template <typename Archive>
+		void serialize(Archive& ar) {
+			ar & core & zero_rank;
+		}
+
 		/// merge two dimensions into one
 
 		/// merge dimension i and i+1 into new dimension i
@@ -401,6 +613,7 @@ namespace madness {
       /// this in recompressed TT form with optimal rank
 		/// @param[in]	eps	the truncation threshold
 		void truncate(double eps) {
+			if (zero_rank) return;
 			eps=eps/sqrt(this->ndim());
 
 			// right-to-left orthogonalization (line 4)
@@ -416,8 +629,9 @@ namespace madness {
 				const long r0=core[d].dim(0);
 				core[d]=core[d].reshape(r0,core[d].size()/r0);
 
-				// decompose the core tensor (line 5)
+				// decompose the core tensor (line 5); the rank shrinks if r0 > k*r1
 				lq(core[d],R);
+				dims[0]=core[d].dim(0);
 				core[d]=core[d].reshape(ndim,dims);
 
 				// multiply to the left (line 6)
@@ -444,6 +658,12 @@ namespace madness {
 
 				// truncate the SVD
 				int r_truncate=SRConf<T>::max_sigma(eps,rmax,s)+1;
+				if (r_truncate==0) {
+					std::vector<long> dd(this->ndim());
+					for (int i=0; i<this->ndim(); ++i) dd[i]=this->dim(i);
+					make_zero_rank(dd);
+					return;
+				}
 				U=copy(U(_,Slice(0,r_truncate-1)));
 				VT=copy(VT(Slice(0,r_truncate-1),_));
 
@@ -453,7 +673,7 @@ namespace madness {
 
 				for (int i=0; i<VT.dim(0); ++i) {
 					for (int j=0; j<VT.dim(1); ++j) {
-						VT(i,j)*=s(j);
+						VT(i,j)*=s(i);
 					}
 				}
 
@@ -493,14 +713,44 @@ namespace madness {
 		/// if rank is zero
 		bool is_zero_rank() const {return zero_rank;}
 
+		/// return the core tensor of dimension i
+		const Tensor<T>& get_core(const int i) const {return core[i];}
+
 		/// return the TT ranks
 		std::vector<long> ranks() const {
-			if (zero_rank) return std::vector<long>(0,core.size()-1);
+			if (zero_rank) return std::vector<long>(core.size()-1,0);
 			std::vector<long> r(core.size()-1);
 			for (std::size_t i=0; i<r.size(); ++i) r[i]=core[i+1].dim(0);
 			return r;
 		}
 
+		/// return the largest TT rank
+		long max_rank() const {
+			if (zero_rank) return 0;
+			std::vector<long> r=ranks();
+			return *std::max_element(r.begin(),r.end());
+		}
+
+	private:
+
+		/// set this to zero rank with cores (k,0) (0,k,0) .. (0,k)
+		void make_zero_rank(const std::vector<long>& dims) {
+			MADNESS_ASSERT(dims.size()>1);
+			zero_rank=true;
+			core.resize(dims.size());
+			core[0]=Tensor<T>(dims[0],long(0));
+			for (std::size_t d=1; d<dims.size()-1; ++d) core[d]=Tensor<T>(long(0),dims[d],long(0));
+			core[dims.size()-1]=Tensor<T>(long(0),dims[dims.size()-1]);
+		}
+
+		/// transform the physical index of core d with the matrix c
+		template<typename Q>
+		Tensor<TENSOR_RESULT_TYPE(T,Q)> transform_core(const long d, const Tensor<Q>& c) const {
+			// the physical index is the first one for the first core, the second one otherwise
+			const int axis=(d==0) ? 0 : 1;
+			return madness::transform_dir(core[d],c,axis);
+		}
+
 	};
 
 
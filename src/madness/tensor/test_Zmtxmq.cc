@@ -62,6 +62,10 @@ void mTxm_dgemm(long ni, long nj, long nk, double_complex* c, const double_compl
   madness::cblas::gemm(madness::cblas::NoTrans,madness::cblas::Trans,nj,ni,nk,one,b,nj,a,ni,zer,c,nj);
 }
 
+// BLAS has no mixed real/complex gemm
+template <typename aT, typename bT>
+void mTxm_dgemm(long ni, long nj, long nk, double_complex* c, const aT* a, const bT*b ) {}
+
 #endif
 
 double_complex ran()
@@ -80,8 +84,13 @@ void ran_fill(int n, double_complex *a) {
     while (n--) *a++ = ran();
 }
 
+void ran_fill(int n, double *a) {
+    while (n--) *a++ = ran().real();
+}
+
+template <typename aT, typename bT>
 void mTxm(long dimi, long dimj, long dimk,
-          double_complex* c, const double_complex* a, const double_complex* b) {
+          double_complex* c, const aT* a, const bT* b) {
     int i, j, k;
     for (k=0; k<dimk; ++k) {
         for (j=0; j<dimj; ++j) {
@@ -96,56 +105,90 @@ void crap(double rate, double fastest, double start) {
     if (rate == 0) printf("darn compiler bug %e %e %lf\n",rate,fastest,start);
 }
 
+// The kernels selectable at run time, each is timed and tested
+#ifdef MADNESS_MTXMQ_DISPATCH
+int nisa() {return mtxmq_cpu_isa()+1;}
+void set_isa(int isa) {mtxmq_set_isa(MTxmqISA(isa));}
+const char* isa_name(int isa) {return mtxmq_isa_name(MTxmqISA(isa));}
+#else
+int nisa() {return 1;}
+void set_isa(int isa) {}
+const char* isa_name(int isa) {return "LOOP";}
+#endif
+
+// Real flops in one multiply-add of a times b
+inline double flops(double_complex, double_complex) {return 8.0;}
+inline double flops(double_complex, double) {return 4.0;}
+inline double flops(double, double_complex) {return 4.0;}
 
-void timer(const char* s, long ni, long nj, long nk, double_complex *a, double_complex *b, double_complex *c) {
-  double fastest=0.0, fastest_dgemm=0.0;
+template <typename aT, typename bT>
+void timer(const char* s, long ni, long nj, long nk, aT *a, bT *b, double_complex *c) {
+  double fastest_dgemm=0.0;
 
-  double nflop = 2.0*ni*nj*nk;
+  double nflop = flops(aT(),bT())*ni*nj*nk;
   long loop;
-  for (int t=0; t<100/nk; t++) {
-    double rate;
-    double start = SafeMPI::Wtime();
-    for (loop=0; loop<100; ++loop) {
-      mTxmq(ni,nj,nk,c,a,b);
+  printf("%20s %3ld %3ld %3ld",s, ni,nj,nk);
+  for (int isa=0; isa<nisa(); ++isa) {
+    double fastest=0.0;
+    set_isa(isa);
+    for (int t=0; t<100/nk; t++) {
+      double rate;
+      double start = SafeMPI::Wtime();
+      for (loop=0; loop<100; ++loop) {
+        mTxmq(ni,nj,nk,c,a,b);
+      }
+      start = SafeMPI::Wtime() - start;
+      rate = 1.e-9*nflop/(start/100.0);
+      crap(rate,fastest,start);
+      if (rate > fastest) fastest = rate;
     }
-    start = SafeMPI::Wtime() - start;
-    rate = 1.e-9*nflop/(start/100.0);
-    crap(rate,fastest,start);
-    if (rate > fastest) fastest = rate;
+    printf(" %8.2f", fastest);
   }
 #ifdef TIME_DGEMM
-  for (int t=0; t<100/nk; t++) {
-    double rate;
-    double start = SafeMPI::Wtime();
-    for (loop=0; loop<100; ++loop) {
-      mTxm_dgemm(ni,nj,nk,c,a,b);
+  if (flops(aT(),bT()) == 8.0) {
+    for (int t=0; t<100/nk; t++) {
+      double rate;
+      double start = SafeMPI::Wtime();
+      for (loop=0; loop<100; ++loop) {
+        mTxm_dgemm(ni,nj,nk,c,a,b);
+      }
+      start = SafeMPI::Wtime() - start;
+      rate = 1.e-9*nflop/(start/100.0);
+      crap(rate,fastest_dgemm,start);
+      if (rate > fastest_dgemm) fastest_dgemm = rate;
     }
-    start = SafeMPI::Wtime() - start;
-    rate = 1.e-9*nflop/(start/100.0);
-    crap(rate,fastest_dgemm,start);
-    if (rate > fastest_dgemm) fastest_dgemm = rate;
+    printf(" %8.2f", fastest_dgemm);
+  }
+  else {
+    printf(" %8s", "-");
   }
 #endif
-  printf("%20s %3ld %3ld %3ld %8.2f %8.2f\n",s, ni,nj,nk, fastest, fastest_dgemm);
+  printf("\n");
 }
 
 void trantimer(const char* s, long ni, long nj, long nk, double_complex *a, double_complex *b, double_complex *c) {
-  double fastest=0.0, fastest_dgemm=0.0;
+  double fastest_dgemm=0.0;
 
-  double nflop = 3.0*2.0*ni*nj*nk;
+  double nflop = 3.0*8.0*ni*nj*nk;
   long loop;
-  for (int t=0; t<100/nk; t++) {
-    double rate;
-    double start = SafeMPI::Wtime();
-    for (loop=0; loop<100; ++loop) {
-      mTxmq(ni,nj,nk,c,a,b);
-      mTxmq(ni,nj,nk,a,c,b);
-      mTxmq(ni,nj,nk,c,a,b);
+  printf("%20s %3ld %3ld %3ld",s, ni,nj,nk);
+  for (int isa=0; isa<nisa(); ++isa) {
+    double fastest=0.0;
+    set_isa(isa);
+    for (int t=0; t<100/nk; t++) {
+      double rate;
+      double start = SafeMPI::Wtime();
+      for (loop=0; loop<100; ++loop) {
+        mTxmq(ni,nj,nk,c,a,b);
+        mTxmq(ni,nj,nk,a,c,b);
+        mTxmq(ni,nj,nk,c,a,b);
+      }
+      start = SafeMPI::Wtime() - start;
+      rate = 1.e-9*nflop/(start/100.0);
+      crap(rate,fastest,start);
+      if (rate > fastest) fastest = rate;
     }
-    start = SafeMPI::Wtime() - start;
-    rate = 1.e-9*nflop/(start/100.0);
-    crap(rate,fastest,start);
-    if (rate > fastest) fastest = rate;
+    printf(" %8.2f", fastest);
   }
 #ifdef TIME_DGEMM
   for (int t=0; t<100/nk; t++) {
@@ -161,16 +204,46 @@ void trantimer(const char* s, long ni, long nj, long nk, double_complex *a, doub
     crap(rate,fastest_dgemm,start);
     if (rate > fastest_dgemm) fastest_dgemm = rate;
   }
+  printf(" %8.2f", fastest_dgemm);
 #endif
-  printf("%20s %3ld %3ld %3ld %8.2f %8.2f\n",s, ni,nj,nk, fastest, fastest_dgemm);
+  printf("\n");
+}
+
+/// Compare mTxmq with the reference for all small dimensions, return false on error
+template <typename aT, typename bT>
+bool test(const char* s, const aT* a, const bT* b, double_complex* c, double_complex* d) {
+    for (long ni=1; ni<12; ni+=1) {
+        for (long nj=1; nj<12; nj+=1) {
+            for (long nk=1; nk<12; nk+=1) {
+                for (long i=0; i<ni*nj; ++i) d[i] = c[i] = 0.0;
+                mTxm (ni,nj,nk,c,a,b);
+                mTxmq(ni,nj,nk,d,a,b);
+                for (long i=0; i<ni*nj; ++i) {
+                    double err = std::abs(d[i]-c[i]);
+                    /* This test is sensitive to the compilation options.
+                       Be sure to have the reference code above compiled
+                       -msse2 -fpmath=sse if using GCC.  Otherwise, to
+                       pass the test you may need to change the threshold
+                       to circa 1e-13.
+                    */
+                    if (err > 2e-14) {
+                        printf("test_mtxmq: error %s %ld %ld %ld %e\n",s,ni,nj,nk,err);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
 }
 
 int main(int argc, char * argv[]) {
     const long nimax=30*30;
     const long njmax=100;
     const long nkmax=100;
-    long ni, nj, nk, i, m;
+    long ni, m;
     double_complex *a, *b, *c, *d;
+    double *ar, *br;
 
     SafeMPI::Init_thread(argc, argv, MPI_THREAD_SINGLE);
 
@@ -178,9 +251,13 @@ int main(int argc, char * argv[]) {
     posix_memalign((void **) &b, 16, nkmax*njmax*sizeof(double_complex));
     posix_memalign((void **) &c, 16, nimax*njmax*sizeof(double_complex));
     posix_memalign((void **) &d, 16, nimax*njmax*sizeof(double_complex));
+    posix_memalign((void **) &ar, 16, nkmax*nimax*sizeof(double));
+    posix_memalign((void **) &br, 16, nkmax*njmax*sizeof(double));
 
     ran_fill(nkmax*nimax, a);
     ran_fill(nkmax*njmax, b);
+    ran_fill(nkmax*nimax, ar);
+    ran_fill(nkmax*njmax, br);
 
 
 /*     ni = nj = nk = 2; */
@@ -195,36 +272,28 @@ int main(int argc, char * argv[]) {
 /*     } */
 /*     return 0; */
 
-    printf("Starting to test ... \n");
-    for (ni=1; ni<12; ni+=1) {
-        for (nj=1; nj<12; nj+=1) {
-            for (nk=1; nk<12; nk+=1) {
-                for (i=0; i<ni*nj; ++i) d[i] = c[i] = 0.0;
-                mTxm (ni,nj,nk,c,a,b);
-                mTxmq(ni,nj,nk,d,a,b);
-                for (i=0; i<ni*nj; ++i) {
-                    double err = std::abs(d[i]-c[i]);
-                    /* This test is sensitive to the compilation options.
-                       Be sure to have the reference code above compiled
-                       -msse2 -fpmath=sse if using GCC.  Otherwise, to
-                       pass the test you may need to change the threshold
-                       to circa 1e-13.
-                    */
-                    if (err > 2e-14) {
-                        printf("test_mtxmq: error %ld %ld %ld %e\n",ni,nj,nk,err);
-                        exit(1);
-                    }
-                }
-            }
-        }
+    for (int isa=0; isa<nisa(); ++isa) {
+        set_isa(isa);
+        printf("Starting to test %s ... \n", isa_name(isa));
+        if (!test("complex*complex", a, b, c, d)) exit(1);
+        if (!test("complex*real", a, br, c, d)) exit(1);
+        if (!test("real*complex", ar, b, c, d)) exit(1);
+        printf("... OK!\n");
     }
-    printf("... OK!\n");
 
-    printf("%20s %3s %3s %3s %8s %8s (GF/s)\n", "type", "M", "N", "K", "LOOP", "BLAS");
+    printf("%20s %3s %3s %3s", "type", "M", "N", "K");
+    for (int isa=0; isa<nisa(); ++isa) printf(" %8s", isa_name(isa));
+#ifdef TIME_DGEMM
+    printf(" %8s", "BLAS");
+#endif
+    printf(" (GF/s)\n");
     for (ni=2; ni<60; ni+=2) timer("(m*m)T*(m*m)", ni,ni,ni,a,b,c);
     for (m=1; m<=30; m+=1) timer("(m*m,m)T*(m*m)", m*m,m,m,a,b,c);
     for (m=1; m<=30; m+=1) trantimer("tran(m,m,m)", m*m,m,m,a,b,c);
     for (m=1; m<=20; m+=1) timer("(20*20,20)T*(20,m)", 20*20,m,20,a,b,c);
+    for (m=2; m<=30; m+=2) timer("z(m*m,m)T*d(m*m)", m*m,m,m,a,br,c);
+    for (m=2; m<=30; m+=2) timer("d(m*m,m)T*z(m*m)", m*m,m,m,ar,b,c);
+    set_isa(nisa()-1);
 
     SafeMPI::Finalize();
 
@@ -33,14 +33,6 @@
 
 #include <madness/madness_config.h>
 
-// Disable for now to facilitate CI 
-#if !(defined(X86_32X) || defined(X86_64X))
-
-#include <iostream>
-int main() {std::cout << "x86 only\n"; return 0;}
-
-#else
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -93,22 +85,39 @@ void crap(double rate, double fastest, double start) {
     if (rate == 0) printf("darn compiler bug %e %e %lf\n",rate,fastest,start);
 }
 
+// The kernels selectable at run time, each is timed and tested
+#ifdef MADNESS_MTXMQ_DISPATCH
+int nisa() {return mtxmq_cpu_isa()+1;}
+void set_isa(int isa) {mtxmq_set_isa(MTxmqISA(isa));}
+const char* isa_name(int isa) {return mtxmq_isa_name(MTxmqISA(isa));}
+#else
+int nisa() {return 1;}
+void set_isa(int isa) {}
+const char* isa_name(int isa) {return "LOOP";}
+#endif
+
 
 void timer(const char* s, long ni, long nj, long nk, double *a, double *b, double *c) {
-  double fastest=0.0, fastest_dgemm=0.0;
+  double fastest_dgemm=0.0;
 
   double nflop = 2.0*ni*nj*nk;
   long loop;
-  for (int t=0; t<100; t++) {
-    double rate;
-    double start = SafeMPI::Wtime();
-    for (loop=0; loop<100; ++loop) {
-      mTxmq(ni,nj,nk,c,a,b);
+  printf("%20s %3ld %3ld %3ld",s, ni,nj,nk);
+  for (int isa=0; isa<nisa(); ++isa) {
+    double fastest=0.0;
+    set_isa(isa);
+    for (int t=0; t<100; t++) {
+      double rate;
+      double start = SafeMPI::Wtime();
+      for (loop=0; loop<100; ++loop) {
+        mTxmq(ni,nj,nk,c,a,b);
+      }
+      start = SafeMPI::Wtime() - start;
+      rate = 1.e-9*nflop/(start/100.0);
+      crap(rate,fastest,start);
+      if (rate > fastest) fastest = rate;
     }
-    start = SafeMPI::Wtime() - start;
-    rate = 1.e-9*nflop/(start/100.0);
-    crap(rate,fastest,start);
-    if (rate > fastest) fastest = rate;
+    printf(" %8.2f", fastest);
   }
 #ifdef TIME_DGEMM
   for (int t=0; t<100; t++) {
@@ -122,27 +131,34 @@ void timer(const char* s, long ni, long nj, long nk, double *a, double *b, doubl
     crap(rate,fastest_dgemm,start);
     if (rate > fastest_dgemm) fastest_dgemm = rate;
   }
+  printf(" %8.2f", fastest_dgemm);
 #endif
-  printf("%20s %3ld %3ld %3ld %8.2f %8.2f\n",s, ni,nj,nk, fastest, fastest_dgemm);
+  printf("\n");
 }
 
 void trantimer(const char* s, long ni, long nj, long nk, double *a, double *b, double *c) {
-  double fastest=0.0, fastest_dgemm=0.0;
+  double fastest_dgemm=0.0;
 
   double nflop = 3.0*2.0*ni*nj*nk;
   long loop;
-  for (int t=0; t<100; t++) {
-    double rate;
-    double start = SafeMPI::Wtime();
-    for (loop=0; loop<100; ++loop) {
-      mTxmq(ni,nj,nk,c,a,b);
-      mTxmq(ni,nj,nk,a,c,b);
-      mTxmq(ni,nj,nk,c,a,b);
+  printf("%20s %3ld %3ld %3ld",s, ni,nj,nk);
+  for (int isa=0; isa<nisa(); ++isa) {
+    double fastest=0.0;
+    set_isa(isa);
+    for (int t=0; t<100; t++) {
+      double rate;
+      double start = SafeMPI::Wtime();
+      for (loop=0; loop<100; ++loop) {
+        mTxmq(ni,nj,nk,c,a,b);
+        mTxmq(ni,nj,nk,a,c,b);
+        mTxmq(ni,nj,nk,c,a,b);
+      }
+      start = SafeMPI::Wtime() - start;
+      rate = 1.e-9*nflop/(start/100.0);
+      crap(rate,fastest,start);
+      if (rate > fastest) fastest = rate;
     }
-    start = SafeMPI::Wtime() - start;
-    rate = 1.e-9*nflop/(start/100.0);
-    crap(rate,fastest,start);
-    if (rate > fastest) fastest = rate;
+    printf(" %8.2f", fastest);
   }
 #ifdef TIME_DGEMM
   for (int t=0; t<100; t++) {
@@ -158,8 +174,9 @@ void trantimer(const char* s, long ni, long nj, long nk, double *a, double *b, d
     crap(rate,fastest_dgemm,start);
     if (rate > fastest_dgemm) fastest_dgemm = rate;
   }
+  printf(" %8.2f", fastest_dgemm);
 #endif
-  printf("%20s %3ld %3ld %3ld %8.2f %8.2f\n",s, ni,nj,nk, fastest, fastest_dgemm);
+  printf("\n");
 }
 
 int main(int argc, char * argv[]) {
@@ -192,40 +209,48 @@ int main(int argc, char * argv[]) {
 /*     } */
 /*     return 0; */
 
-    printf("Starting to test ... \n");
-    for (ni=2; ni<60; ni+=2) {
-        for (nj=2; nj<100; nj+=6) {
-            for (nk=2; nk<100; nk+=6) {
-                for (i=0; i<ni*nj; ++i) d[i] = c[i] = 0.0;
-                mTxm (ni,nj,nk,c,a,b);
-                mTxmq(ni,nj,nk,d,a,b);
-                for (i=0; i<ni*nj; ++i) {
-                    double err = std::abs(d[i]-c[i]);
-                    /* This test is sensitive to the compilation options.
-                       Be sure to have the reference code above compiled
-                       -msse2 -fpmath=sse if using GCC.  Otherwise, to
-                       pass the test you may need to change the threshold
-                       to circa 1e-13.
-                    */
-                    if (err > 1e-15) {
-                        printf("test_mtxmq: error %ld %ld %ld %e\n",ni,nj,nk,err);
-                        exit(1);
+    for (int isa=0; isa<nisa(); ++isa) {
+        set_isa(isa);
+        printf("Starting to test %s ... \n", isa_name(isa));
+        for (ni=2; ni<60; ni+=2) {
+            for (nj=2; nj<100; nj+=6) {
+                for (nk=2; nk<100; nk+=6) {
+                    for (i=0; i<ni*nj; ++i) d[i] = c[i] = 0.0;
+                    mTxm (ni,nj,nk,c,a,b);
+                    mTxmq(ni,nj,nk,d,a,b);
+                    for (i=0; i<ni*nj; ++i) {
+                        double err = std::abs(d[i]-c[i]);
+                        /* The kernels sum in different orders, and some use
+                           fused multiply-add, so the result is tested against
+                           the rounding error accumulated over nk terms (all
+                           terms are positive).
+                        */
+                        double tol = nk*2.3e-16*std::abs(c[i]);
+                        if (err > tol) {
+                            printf("test_mtxmq: error %s %ld %ld %ld %e\n",isa_name(isa),ni,nj,nk,err);
+                            exit(1);
+                        }
                     }
                 }
             }
         }
+        printf("... OK!\n");
     }
-    printf("... OK!\n");
 
-    printf("%20s %3s %3s %3s %8s %8s (GF/s)\n", "type", "M", "N", "K", "LOOP", "BLAS");
+    printf("%20s %3s %3s %3s", "type", "M", "N", "K");
+    for (int isa=0; isa<nisa(); ++isa) printf(" %8s", isa_name(isa));
+#ifdef TIME_DGEMM
+    printf(" %8s", "BLAS");
+#endif
+    printf(" (GF/s)\n");
     for (ni=2; ni<60; ni+=2) timer("(m*m)T*(m*m)", ni,ni,ni,a,b,c);
     for (m=2; m<=30; m+=2) timer("(m*m,m)T*(m*m)", m*m,m,m,a,b,c);
     for (m=2; m<=30; m+=2) trantimer("tran(m,m,m)", m*m,m,m,a,b,c);
+    for (m=2; m<=12; m+=2) timer("(m*m*m,m)T*(m*m)", m*m*m,m,m,a,b,c);
     for (m=2; m<=20; m+=2) timer("(20*20,20)T*(20,m)", 20*20,m,20,a,b,c);
+    set_isa(nisa()-1);
 
     SafeMPI::Finalize();
 
     return 0;
 }
-
-#endif
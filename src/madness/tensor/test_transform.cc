@@ -0,0 +1,157 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+/// \file tensor/test_transform.cc
+/// \brief Tests the fused transform against ndim passes of mTxmq and times both
+
+#include <madness/madness_config.h>
+
+#include <stdio.h>
+#include <algorithm>
+
+#include <madness/world/safempi.h>
+#include <madness/tensor/tensor.h>
+#include <madness/tensor/mtxmq.h>
+
+using namespace madness;
+
+#ifndef MADNESS_MTXMQ_DISPATCH
+
+int main() {printf("no fused transform on this platform\n"); return 0;}
+
+#else
+
+/// What fast_transform did before the fused kernel ... ndim passes of mTxmq
+bool mtxmq_passes(long ndim, long k, double* result, const double* t, const double* c, double* work) {
+    double *t0=work, *t1=result;
+    if (ndim&1) std::swap(t0,t1);
+    long dimi = 1;
+    for (long n=1; n<ndim; ++n) dimi *= k;
+
+    mTxmq(dimi, k, k, t0, t, c);
+    for (long n=1; n<ndim; ++n) {
+        mTxmq(dimi, k, k, t1, t0, c);
+        std::swap(t0,t1);
+    }
+    return true;
+}
+
+/// Return the shape of a tensor with ndim dimensions of size k
+std::vector<long> cube(long ndim, long k) {
+    return std::vector<long>(ndim, k);
+}
+
+/// Compare the fused transform with mTxmq passes for all k it supports, returns number of failures
+int test(long ndim, long kmax) {
+    int nfail = 0;
+    for (long k=1; k<=kmax; ++k) {
+        Tensor<double> t(cube(ndim,k)), c(k,k), r0(cube(ndim,k)), r1(cube(ndim,k)), w(cube(ndim,k));
+        t.fillrandom();
+        c.fillrandom();
+        t -= 0.5;
+        c -= 0.5;
+        mtxmq_passes(ndim, k, r0.ptr(), t.ptr(), c.ptr(), w.ptr());
+        if (!fused_transform(ndim, k, r1.ptr(), t.ptr(), c.ptr(), w.ptr())) break;
+
+        const double err = (r0-r1).normf()/r0.normf();
+        if (err > 1e-14) {
+            printf("    ndim=%ld k=%ld error %.2e\n", ndim, k, err);
+            ++nfail;
+        }
+    }
+    return nfail;
+}
+
+/// Best GFLOP/s over a few trials, zero if op is not available
+template <typename opT>
+double rate(long ndim, long k, opT op) {
+    Tensor<double> t(cube(ndim,k)), c(k,k), r(cube(ndim,k)), w(cube(ndim,k));
+    t.fillrandom();
+    c.fillrandom();
+    const double nflop = 2.0*ndim*t.size()*k;
+    const long nloop = std::max(1L, long(2e7/nflop));
+    if (!op(ndim, k, r.ptr(), t.ptr(), c.ptr(), w.ptr())) return 0.0;
+
+    double fastest = 0.0;
+    for (int trial=0; trial<30; ++trial) {
+        double start = SafeMPI::Wtime();
+        for (long loop=0; loop<nloop; ++loop) op(ndim, k, r.ptr(), t.ptr(), c.ptr(), w.ptr());
+        start = SafeMPI::Wtime() - start;
+        fastest = std::max(fastest, 1e-9*nflop*nloop/start);
+    }
+    return fastest;
+}
+
+bool fused(long ndim, long k, double* r, const double* t, const double* c, double* w) {
+    return fused_transform(ndim, k, r, t, c, w);
+}
+
+void print_rate(double rate) {
+    if (rate > 0.0) printf(" %8.2f", rate);
+    else printf(" %8s", "-");
+}
+
+int main(int argc, char** argv) {
+    SafeMPI::Init_thread(argc, argv, MPI_THREAD_SINGLE);
+
+    int nfail = 0;
+    for (int isa=MTXMQ_AVX2; isa<=mtxmq_cpu_isa(); ++isa) {
+        mtxmq_set_isa(MTxmqISA(isa));
+        printf("testing %s\n", mtxmq_isa_name(mtxmq_isa()));
+        nfail += test(3, 24);
+        nfail += test(6, 12);
+    }
+
+    printf("\n GFLOP/s of ndim passes of mTxmq and of the fused transform\n\n");
+    printf("   isa   k   3-d passes    fused   6-d passes    fused\n");
+    for (int isa=MTXMQ_AVX2; isa<=mtxmq_cpu_isa(); ++isa) {
+        mtxmq_set_isa(MTxmqISA(isa));
+        for (long k=6; k<=12; ++k) {
+            printf("%6s %3ld    ", mtxmq_isa_name(mtxmq_isa()), k);
+            print_rate(rate(3, k, mtxmq_passes));
+            print_rate(rate(3, k, fused));
+            printf("    ");
+            print_rate(rate(6, k, mtxmq_passes));
+            print_rate(rate(6, k, fused));
+            printf("\n");
+        }
+    }
+
+    if (nfail) printf("\n%d tests failed\n", nfail);
+    else printf("\nall tests passed\n");
+
+    SafeMPI::Finalize();
+    return nfail;
+}
+
+#endif
@@ -5,6 +5,7 @@
 //#define WORLD_INSTANTIATE_STATIC_TEMPLATES
 
 #include <madness/tensor/gentensor.h>
+#include <madness/world/vector_archive.h>
 
 using namespace madness;
 
@@ -634,6 +635,199 @@ int testGenTensor_reduce(const long& k, const long& dim, const double& eps, cons
 
 }
 
+/// test the randomized rank reduction and compare with the deterministic one
+int testGenTensor_randomized(const long& k, const long& dim, const double& eps) {
+
+	print("entering randomized rank reduction");
+	int nerror=0;
+
+	// set up a tensor with an accumulated rank much larger than its numerical rank;
+	// the numerical rank must exceed the block size of the range finder (8), or the
+	// randomized reduction falls back to ortho3
+	long kvec=1;
+	for (long i=0; i<dim/2; ++i) kvec*=k;
+	const long nbasis=16;
+	const long rank=120;
+	Tensor<double> bx(nbasis,kvec), by(nbasis,kvec);
+	Tensor<double> cx(rank,nbasis), cy(rank,nbasis);
+	bx.fillrandom();
+	by.fillrandom();
+	cx.fillrandom();
+	cy.fillrandom();
+	Tensor<double> weights(rank);
+	weights=1.0;
+	GenTensor<double> g0(SRConf<double>(weights,inner(cx,bx),inner(cy,by),dim,k));
+	g0.normalize();
+	const double fac=1.0/g0.normf();
+	g0.scale(fac);
+	const Tensor<double> t0=g0.full_tensor_copy();
+
+	const RankReduceType rr[2]={RR_SVD,RR_RANDOMIZED};
+	const char* name[2]={"RR_SVD       ","RR_RANDOMIZED"};
+
+	// reduce_rank
+	for (int i=0; i<2; ++i) {
+		GenTensor<double> g=copy(g0);
+		const int nrandomized=SRConf<double>::nrandomized;
+		double cpu0=wall_time();
+		g.reduce_rank(TensorArgs(eps,TT_2D,rr[i]));
+		double cpu1=wall_time();
+		double norm=(g.full_tensor_copy()-t0).normf();
+		print(ok(is_small(norm,eps)),"reduce_rank",name[i],norm,"rank",g.rank(),"time",cpu1-cpu0);
+		if (!is_small(norm,eps)) nerror++;
+		const bool randomized=(SRConf<double>::nrandomized-nrandomized==1);
+		print(ok(randomized==(rr[i]==RR_RANDOMIZED)),"reduce_rank",name[i],"randomized",randomized);
+		if (randomized!=(rr[i]==RR_RANDOMIZED)) nerror++;
+	}
+
+	// add_SVD of an accumulated tensor to an optimal one; the SVD algorithm
+	// needs orthonormal terms on both sides
+	for (int i=0; i<2; ++i) {
+		GenTensor<double> g1=copy(g0);
+		GenTensor<double> g2=copy(g0);
+		g1.reduce_rank(eps);
+		if (rr[i]==RR_SVD) g2.reduce_rank(eps);
+		const int nrandomized=SRConf<double>::nrandomized;
+		double cpu0=wall_time();
+		g1.add_SVD(g2,TensorArgs(eps,TT_2D,rr[i]));
+		double cpu1=wall_time();
+		double norm=(g1.full_tensor_copy()-2.0*t0).normf();
+		print(ok(is_small(norm,eps)),"add_SVD    ",name[i],norm,"rank",g1.rank(),"time",cpu1-cpu0);
+		if (!is_small(norm,eps)) nerror++;
+		const bool randomized=(SRConf<double>::nrandomized-nrandomized==1);
+		print(ok(randomized==(rr[i]==RR_RANDOMIZED)),"add_SVD    ",name[i],"randomized",randomized);
+		if (randomized!=(rr[i]==RR_RANDOMIZED)) nerror++;
+	}
+
+#ifdef BENCH
+	print("ortho3              ",SRConf<double>::time(0));
+	print("orthonormalize      ",SRConf<double>::time(20));
+	print("randomized_reduce   ",SRConf<double>::time(26));
+	print("  range finder      ",SRConf<double>::time(27));
+	print("  projection, SVD   ",SRConf<double>::time(28));
+	print("  truncation        ",SRConf<double>::time(29));
+#endif
+
+	print("all done\n");
+	return nerror;
+}
+
+/// test appending many terms to a preallocated buffer, reducing it in one go
+int testGenTensor_staging(const long& k, const long& dim, const double& eps) {
+
+	print("entering staging buffer");
+	int nerror=0;
+
+	std::vector<long> d(dim,k);
+	const long nterm=20;
+	std::vector<GenTensor<double> > terms(nterm);
+	Tensor<double> tsum(d);
+	for (long i=0; i<nterm; ++i) {
+		Tensor<double> t(d);
+		t.fillrandom();
+		t.scale(1.0/(i+1));
+		tsum+=t;
+		terms[i]=GenTensor<double>(t,eps,TT_2D);
+	}
+
+	// collect all terms, reuse the memory after clear_terms
+	GenTensor<double> buffer=copy(terms[0]);
+	buffer.reserve(nterm*terms[0].rank());
+	for (int iround=0; iround<2; ++iround) {
+		if (iround>0) {
+			buffer.clear_terms();
+			terms[0].append(buffer,1.0);
+		}
+		for (long i=1; i<nterm; ++i) terms[i].append(buffer,1.0);
+
+		GenTensor<double> staged=copy(buffer.get_configs(0,buffer.rank()-1));
+		staged.reduce_rank(eps);
+		double norm=(staged.full_tensor_copy()-tsum).normf();
+		print(ok(is_small(norm,eps)),"staged reduction, round",iround,norm,"rank",staged.rank());
+		if (!is_small(norm,eps)) nerror++;
+	}
+
+	print("all done\n");
+	return nerror;
+}
+
+/// test the operations of GenTensor that are specific to TT_TENSORTRAIN
+int testGenTensor_tensortrain(const long& k, const long& dim, const double& eps) {
+
+	print("entering tensor train");
+	int nerror=0;
+
+	std::vector<long> d(dim,k);
+	Tensor<double> t0(d), t1(d);
+	t0.fillindex();
+	t0.scale(1.0/t0.normf());
+	t1.fillrandom();
+
+	GenTensor<double> g0(t0,eps,TT_TENSORTRAIN);
+	GenTensor<double> g1(t1,eps,TT_TENSORTRAIN);
+
+	// inner product and norm without reconstruction
+	double norm=std::abs(g0.trace(g1)-t0.trace(t1));
+	print(ok(is_small(norm,eps)),"trace      ",g0.what_am_i(),norm);
+	if (!is_small(norm,eps)) nerror++;
+
+	norm=std::abs(g1.normf()-t1.normf());
+	print(ok(is_small(norm,eps)),"normf      ",g1.what_am_i(),norm);
+	if (!is_small(norm,eps)) nerror++;
+
+	// addition with rank rounding
+	{
+		GenTensor<double> g2=copy(g0);
+		g2+=g0;
+		const long rank_sum=g2.rank();
+		g2.reduce_rank(eps);
+		norm=(g2.full_tensor_copy()-2.0*t0).normf();
+		bool success=is_small(norm,eps) and (g2.rank()<rank_sum);
+		print(ok(success),"reduce_rank",g2.what_am_i(),norm,"rank",rank_sum,g2.rank());
+		if (!success) nerror++;
+
+		GenTensor<double> g3=copy(g0);
+		g3.add_SVD(g0,eps);
+		norm=(g3.full_tensor_copy()-2.0*t0).normf();
+		success=is_small(norm,eps) and (g3.rank()==g0.rank());
+		print(ok(success),"add_SVD    ",g3.what_am_i(),norm,"rank",g0.rank(),g3.rank());
+		if (!success) nerror++;
+	}
+
+	// serialization
+	{
+		std::vector<unsigned char> v;
+		archive::VectorOutputArchive oar(v);
+		oar & g1;
+		archive::VectorInputArchive iar(v);
+		GenTensor<double> g2;
+		iar & g2;
+		norm=(g2.full_tensor_copy()-t1).normf();
+		bool success=is_small(norm,eps) and (g2.tensor_type()==TT_TENSORTRAIN);
+		print(ok(success),"serialize  ",g2.what_am_i(),norm);
+		if (!success) nerror++;
+	}
+
+	// archives from before the version field hold the SRConf after the flag
+	{
+		GenTensor<double> g0(t1,eps,TT_2D);
+		std::vector<unsigned char> v;
+		archive::VectorOutputArchive oar(v);
+		archive::ArchivePrePostImpl<archive::VectorOutputArchive,GenTensor<double> >::preamble_store(oar);
+		oar & true & g0.config();
+		archive::VectorInputArchive iar(v);
+		GenTensor<double> g2;
+		iar & g2;
+		norm=(g2.full_tensor_copy()-g0.full_tensor_copy()).normf();
+		bool success=is_small(norm,eps) and (g2.tensor_type()==TT_2D);
+		print(ok(success),"old archive",g2.what_am_i(),norm);
+		if (!success) nerror++;
+	}
+
+	print("all done\n");
+	return nerror;
+}
+
 /// test the tensor train representation
 int testTensorTrain(const long k, const long dim, const TensorArgs targs) {
 
@@ -784,14 +978,17 @@ int main(int argc, char**argv) {
     error+=testGenTensor_ctor(k,dim,eps,TT_FULL);
 //    error+=testGenTensor_ctor(k,dim,eps,TT_3D);
     error+=testGenTensor_ctor(k,dim,eps,TT_2D);
+    error+=testGenTensor_ctor(k,dim,eps,TT_TENSORTRAIN);
 
     error+=testGenTensor_assignment(k,dim,eps,TT_FULL);
 //    error+=testGenTensor_assignment(k,dim,eps,TT_3D);
     error+=testGenTensor_assignment(k,dim,eps,TT_2D);
+    error+=testGenTensor_assignment(k,dim,eps,TT_TENSORTRAIN);
 
     error+=testGenTensor_algebra(k,dim,eps,TT_FULL);
 //    error+=testGenTensor_algebra(k,dim,eps,TT_3D);
     error+=testGenTensor_algebra(k,dim,eps,TT_2D);
+    error+=testGenTensor_algebra(k,dim,eps,TT_TENSORTRAIN);
 
     error+=testGenTensor_rankreduce(k,dim,eps,TT_FULL);
 //    error+=testGenTensor_rankreduce(k,dim,eps,TT_3D);
@@ -800,16 +997,22 @@ int main(int argc, char**argv) {
     error+=testGenTensor_transform(k,dim,eps,TT_FULL);
 //    error+=testGenTensor_transform(k,dim,eps,TT_3D);
     error+=testGenTensor_transform(k,dim,eps,TT_2D);
+    error+=testGenTensor_transform(k,dim,eps,TT_TENSORTRAIN);
 
     error+=testGenTensor_reconstruct(k,dim,eps,TT_FULL);
 //    error+=testGenTensor_reconstruct(k,dim,eps,TT_3D);
     error+=testGenTensor_reconstruct(k,dim,eps,TT_2D);
+    error+=testGenTensor_reconstruct(k,dim,eps,TT_TENSORTRAIN);
 
     error+=testGenTensor_deepcopy(k,dim,eps,TT_FULL);
 //    error+=testGenTensor_deepcopy(k,dim,eps,TT_3D);
     error+=testGenTensor_deepcopy(k,dim,eps,TT_2D);
+    error+=testGenTensor_deepcopy(k,dim,eps,TT_TENSORTRAIN);
 
     error+=testGenTensor_reduce(k,dim,eps,TT_2D);
+    error+=testGenTensor_randomized(k,dim,eps);
+    error+=testGenTensor_staging(k,dim,eps);
+    error+=testGenTensor_tensortrain(k,dim,eps);
 
     print(ok(error==0),error,"finished test suite\n");
 #endif
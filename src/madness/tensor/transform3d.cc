@@ -76,7 +76,8 @@ Tensor<T> transform3d(const Tensor<T>& t, const Tensor<T>& c) {
 #ifdef IBMXLC
     TENSOR_ASSERT(c.dim[0] < 36,"hard dimension failure",c.dim[0],&c);
 #endif
-    T* tmp = new T[d0_cubed];
+    TensorArena::Scope scope;
+    T* tmp = TensorArena::instance().allocate<T>(d0_cubed);
 
     T* restrict r_p = result.ptr();
     T* restrict t_p = t.ptr();
@@ -100,7 +101,6 @@ Tensor<T> transform3d(const Tensor<T>& t, const Tensor<T>& c) {
     // result gets "result"
     mTxm(d0_squared, d0, d0, r_p, tmp_p, c_p);
 
-    delete[] tmp;
     return result;
 }
 
@@ -261,7 +261,8 @@ Tensor<T> transform3d_3c(const Tensor<T>& t,
 #ifdef IBMXLC
     TENSOR_ASSERT(c0.dim[0] < 36,"hard dimension failure",c0.dim[0],&c0);
 #endif
-    T* tmp = new T[d0_cubed];
+    TensorArena::Scope scope;
+    T* tmp = TensorArena::instance().allocate<T>(d0_cubed);
 
     T* restrict r_p = result.ptr();
     T* restrict t_p = t.ptr();
@@ -287,7 +288,6 @@ Tensor<T> transform3d_3c(const Tensor<T>& t,
     // result gets "result"
     mTxm(d0_squared, d0, d0, r_p, tmp_p, c2_p);
 
-    delete[] tmp;
     return result;
 }
 
@@ -42,6 +42,8 @@
 #include <madness/world/archive.h>
 #include <madness/world/print.h>
 #include <cstring>
+#include <memory>
+#include <vector>
 
 namespace madness {
     namespace archive {
@@ -49,6 +51,13 @@ namespace madness {
         /// \addtogroup serialization
         /// @{
 
+        /// Data that is sent beside a buffer instead of being copied into it.
+        struct BufferAttachment {
+            std::shared_ptr<const void> owner; ///< Keeps the data alive until it has been sent.
+            const void* ptr; ///< The data.
+            std::size_t nbyte; ///< Size of the data in bytes.
+        };
+
         /// Wraps an archive around a memory buffer for output.
 
         /// \note Type checking is disabled for efficiency.
@@ -56,24 +65,72 @@ namespace madness {
         /// \throw madness::MadnessException in case of buffer overflow.
         ///
         /// The default constructor can also be used to count stuff.
+        ///
+        /// Types that hold large contiguous arrays may call \c attach() so
+        /// that an array is sent beside the buffer rather than copied into
+        /// it.  This is only possible if the archive was constructed with a
+        /// list for the attachments.
         class BufferOutputArchive : public BaseOutputArchive {
         private:
             unsigned char * const ptr; ///< The memory buffer.
             const std::size_t nbyte; ///< Buffer size.
             mutable std::size_t i; /// Current output location.
             bool countonly; ///< If true just count, don't copy.
+            std::vector<BufferAttachment>* attachments; ///< Where to put attachments.
+            const std::size_t attach_min; ///< Min. size of an attachment ... zero for none.
+            mutable long nattach; ///< No. of attachments made (counted).
 
         public:
             /// Default constructor; the buffer will only count data.
             BufferOutputArchive()
-                    : ptr(nullptr), nbyte(0), i(0), countonly(true) {}
+                    : ptr(nullptr), nbyte(0), i(0), countonly(true)
+                    , attachments(nullptr), attach_min(0), nattach(0) {}
+
+            /// Constructor that only counts data and attachments.
+
+            /// \param[in] attach_min Min. size in bytes of an attachment, zero for none.
+            explicit BufferOutputArchive(std::size_t attach_min)
+                    : ptr(nullptr), nbyte(0), i(0), countonly(true)
+                    , attachments(nullptr), attach_min(attach_min), nattach(0) {}
 
             /// Constructor that assigns a buffer.
 
             /// \param[in] ptr Pointer to the buffer.
             /// \param[in] nbyte Size of the buffer.
             BufferOutputArchive(void* ptr, std::size_t nbyte)
-                    : ptr((unsigned char *) ptr), nbyte(nbyte), i(0), countonly(false) {}
+                    : ptr((unsigned char *) ptr), nbyte(nbyte), i(0), countonly(false)
+                    , attachments(nullptr), attach_min(0), nattach(0) {}
+
+            /// Constructor that assigns a buffer and a list for attachments.
+
+            /// \param[in] ptr Pointer to the buffer.
+            /// \param[in] nbyte Size of the buffer.
+            /// \param[in] attachments Where to put attachments, or \c nullptr for none.
+            /// \param[in] attach_min Min. size in bytes of an attachment.
+            BufferOutputArchive(void* ptr, std::size_t nbyte,
+                    std::vector<BufferAttachment>* attachments, std::size_t attach_min)
+                    : ptr((unsigned char *) ptr), nbyte(nbyte), i(0), countonly(false)
+                    , attachments(attachments), attach_min(attachments ? attach_min : 0), nattach(0) {}
+
+            /// Attaches data to be sent beside the buffer.
+
+            /// The data is not copied, so it must not be modified until it
+            /// has been sent.
+            /// \tparam ownerT Type of an object that keeps the data alive (it is copied).
+            /// \param[in] t Pointer to the data.
+            /// \param[in] n Size of the data in bytes.
+            /// \param[in] owner Keeps the data alive.
+            /// \return The index of the attachment, or -1 if the data must be stored in the buffer.
+            template <typename ownerT>
+            long attach(const void* t, std::size_t n, const ownerT& owner) const {
+                if (!attach_min || n < attach_min) return -1;
+                if (!countonly)
+                    attachments->push_back(BufferAttachment{std::make_shared<ownerT>(owner), t, n});
+                return nattach++;
+            }
+
+            /// Return the number of attachments made (counted).
+            long num_attachments() const { return nattach; }
 
             /// Stores (counts) data into the memory buffer.
 
@@ -129,10 +186,16 @@ namespace madness {
         ///
         /// \throw madness::MadnessException in case of buffer overrun.
         class BufferInputArchive : public BaseInputArchive {
+        public:
+            /// Type of a function that reads attachment \c k of \c nbyte bytes into \c ptr.
+            typedef void (*attachment_loaderT)(const void* context, long k, void* ptr, std::size_t nbyte);
+
         private:
             const unsigned char* const ptr; ///< The memory buffer.
             const std::size_t nbyte; ///< Buffer size.
             mutable std::size_t i; ///< Current input location.
+            attachment_loaderT loader; ///< Reads attachments ... null if there are none.
+            const void* context; ///< Passed to the loader.
 
         public:
             /// Constructor that assigns a buffer.
@@ -140,7 +203,29 @@ namespace madness {
             /// \param[in] ptr Pointer to the buffer.
             /// \param[in] nbyte Size of the buffer.
             BufferInputArchive(const void* ptr, std::size_t nbyte)
-                    : ptr((const unsigned char *) ptr), nbyte(nbyte), i(0) {};
+                    : ptr((const unsigned char *) ptr), nbyte(nbyte), i(0)
+                    , loader(nullptr), context(nullptr) {};
+
+            /// Constructor that assigns a buffer and the source of its attachments.
+
+            /// \param[in] ptr Pointer to the buffer.
+            /// \param[in] nbyte Size of the buffer.
+            /// \param[in] loader Reads attachments.
+            /// \param[in] context Passed to the loader.
+            BufferInputArchive(const void* ptr, std::size_t nbyte,
+                    attachment_loaderT loader, const void* context)
+                    : ptr((const unsigned char *) ptr), nbyte(nbyte), i(0)
+                    , loader(loader), context(context) {};
+
+            /// Reads an attachment made by \c BufferOutputArchive::attach().
+
+            /// \param[in] k Index of the attachment.
+            /// \param[out] t Where to put the data.
+            /// \param[in] n Size of the data in bytes.
+            void load_attachment(long k, void* t, std::size_t n) const {
+                MADNESS_ASSERT(loader);
+                loader(context, k, t, n);
+            }
 
             /// Reads data from the memory buffer.
 
@@ -92,13 +92,17 @@ namespace SafeMPI {
     ///
     /// tags in [1024,4095] ... allocated round-robin by unique_tag
     ///
-    /// tags in [4096,MPI::TAG_UB] ... not used/managed by madness
+    /// tags in [4096,20479] ... arrays sent beside active messages (AM_ATTACH_TAG)
+    ///
+    /// tags in [20480,MPI::TAG_UB] ... not used/managed by madness
 
     static const int RMI_TAG = 1023;
     static const int RMI_HUGE_ACK_TAG = 1022;
     static const int RMI_HUGE_DAT_TAG = 1021;
     static const int MPIAR_TAG = 1001;
     static const int DEFAULT_SEND_RECV_TAG = 1000;
+    static const int AM_ATTACH_TAG = 4096; // First of AM_ATTACH_NTAG tags for arrays sent beside active messages
+    static const int AM_ATTACH_NTAG = 16384;
 
     // Forward declarations
     class Intracomm;
@@ -588,6 +592,14 @@ namespace SafeMPI {
             return request;
         }
 
+        Request Issend(const void* buf, const int count, const MPI_Datatype datatype, const int dest, const int tag) const {
+            MADNESS_ASSERT(pimpl);
+            SAFE_MPI_GLOBAL_MUTEX;
+            Request request;
+            MADNESS_MPI_TEST(MPI_Issend(const_cast<void*>(buf), count, datatype, dest,tag, pimpl->comm, request));
+            return request;
+        }
+
         Request Irecv(void* buf, const int count, const MPI_Datatype datatype, const int src, const int tag) const {
             MADNESS_ASSERT(pimpl);
             SAFE_MPI_GLOBAL_MUTEX;
@@ -640,6 +652,14 @@ namespace SafeMPI {
             SAFE_MPI_GLOBAL_MUTEX;
             MADNESS_MPI_TEST(MPI_Allreduce(const_cast<void*>(sendbuf), recvbuf, count, datatype, op, pimpl->comm));
         }
+
+        void Allgather(const void* sendbuf, const int sendcount, const MPI_Datatype sendtype,
+                void* recvbuf, const int recvcount, const MPI_Datatype recvtype) const {
+            MADNESS_ASSERT(pimpl);
+            SAFE_MPI_GLOBAL_MUTEX;
+            MADNESS_MPI_TEST(MPI_Allgather(const_cast<void*>(sendbuf), sendcount, sendtype, recvbuf, recvcount, recvtype, pimpl->comm));
+        }
+
         bool Get_attr(int key, void* value) const {
             MADNESS_ASSERT(pimpl);
             int flag = 0;
@@ -0,0 +1,238 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+/**
+ \file single_file_archive.cc
+ \brief Implements the file handling of \c SingleFileInputArchive and \c SingleFileOutputArchive.
+ \ingroup serialization
+*/
+
+#include <madness/world/single_file_archive.h>
+#include <madness/world/worldgop.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace madness {
+    namespace archive {
+
+        namespace {
+
+            /// Identifies the file ... includes the version of the format
+            const char file_cookie[] = "madness single file archive 2";
+
+            /// Marks the start of the entries of a container
+            const std::uint64_t entries_cookie = 0x6d61646e65737321ull;
+
+            /// Size of the header of the entries of a container
+            const std::size_t entries_header = 4*sizeof(std::uint64_t);
+
+            /// Write all n bytes at the given offset of the file
+            void write_at(int fd, const void* ptr, std::size_t n, std::uint64_t offset) {
+                const char* p = static_cast<const char*>(ptr);
+                while (n) {
+                    const ssize_t m = ::pwrite(fd, p, n, offset);
+                    if (m < 0) {
+                        if (errno == EINTR) continue;
+                        MADNESS_EXCEPTION("SingleFileOutputArchive: write failed", errno);
+                    }
+                    p += m;
+                    n -= m;
+                    offset += m;
+                }
+            }
+
+        } // namespace
+
+        void SingleFileOutputArchive::open(World& world, const char* filename) {
+            MADNESS_ASSERT(filename);
+            close();
+            this->world = &world;
+            pos = data_pos = data_end = index_pos = index_end = 0;
+            pending.clear();
+
+            // Process zero creates the file before the others open it
+            int status = 0;
+            if (world.rank() == 0) {
+                fd = ::open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+                if (fd < 0) status = errno;
+            }
+            world.gop.broadcast(status, 0);
+            if (status) MADNESS_EXCEPTION("SingleFileOutputArchive: cannot create file", status);
+            if (world.rank() != 0) {
+                fd = ::open(filename, O_WRONLY);
+                if (fd < 0) MADNESS_EXCEPTION("SingleFileOutputArchive: cannot open file", errno);
+            }
+
+            if (world.rank() == 0) pending.assign(file_cookie, file_cookie+sizeof(file_cookie));
+        }
+
+        void SingleFileOutputArchive::close() {
+            if (fd < 0) return;
+            if (world->rank() == 0 && !pending.empty()) {
+                write_at(fd, pending.data(), pending.size(), pos);
+                pos += pending.size();
+                pending.clear();
+            }
+            ::close(fd);
+            fd = -1;
+            world->gop.fence();
+        }
+
+        std::uint64_t SingleFileOutputArchive::begin_entries(std::uint64_t nbyte, std::uint64_t nentry,
+                                                             std::uint64_t nindex) const {
+            MADNESS_ASSERT(fd >= 0);
+            const ProcessID me = world->rank();
+
+            // Bytes of data, entries and bytes of index of all processes, and the pending data of process zero
+            std::uint64_t total[4] = {nbyte, nentry, nindex, (me == 0) ? pending.size() : 0};
+            world->gop.sum(total, 4);
+
+            // Bytes of data and of index of the preceding processes
+            std::uint64_t before[2] = {nbyte, nindex};
+            world->gop.exscan_sum(before, 2);
+
+            const std::uint64_t header = pos + total[3];
+            const std::uint64_t start = header + entries_header;
+            const std::uint64_t istart = start + total[0];
+
+            if (me == 0) {
+                const std::uint64_t head[4] = {entries_cookie, total[1], total[0], total[2]};
+                const std::size_t n = pending.size();
+                pending.resize(n + sizeof(head));
+                std::memcpy(pending.data()+n, head, sizeof(head));
+                write_at(fd, pending.data(), pending.size(), pos);
+                pending.clear();
+            }
+
+            data_pos = start + before[0];
+            data_end = data_pos + nbyte;
+            index_pos = istart + before[1];
+            index_end = index_pos + nindex;
+            pos = istart + total[2];
+            return before[0];
+        }
+
+        void SingleFileOutputArchive::store_values(const unsigned char* p, std::size_t n) const {
+            MADNESS_ASSERT(fd >= 0 && data_pos + n <= data_end);
+            write_at(fd, p, n, data_pos);
+            data_pos += n;
+        }
+
+        void SingleFileOutputArchive::store_index(const unsigned char* p, std::size_t n) const {
+            MADNESS_ASSERT(fd >= 0 && index_pos + n <= index_end);
+            write_at(fd, p, n, index_pos);
+            index_pos += n;
+        }
+
+        void SingleFileOutputArchive::end_entries() const {
+            MADNESS_ASSERT(data_pos == data_end && index_pos == index_end);
+        }
+
+        bool SingleFileOutputArchive::exists(World& world, const char* filename) {
+            bool status = false;
+            if (world.rank() == 0)
+                status = (access(filename, F_OK|R_OK) == 0);
+            world.gop.broadcast(status);
+            return status;
+        }
+
+        void SingleFileOutputArchive::remove(World& world, const char* filename) {
+            if (world.rank() == 0) ::remove(filename);
+        }
+
+        void SingleFileInputArchive::open(World& world, const char* filename) {
+            MADNESS_ASSERT(filename);
+            close();
+            this->world = &world;
+
+            const int fd = ::open(filename, O_RDONLY);
+            if (fd < 0) MADNESS_EXCEPTION("SingleFileInputArchive: cannot open file", errno);
+            struct stat st;
+            if (fstat(fd, &st)) {
+                const int err = errno;
+                ::close(fd);
+                MADNESS_EXCEPTION("SingleFileInputArchive: cannot stat file", err);
+            }
+            nbyte = st.st_size;
+            if (nbyte < sizeof(file_cookie)) {
+                ::close(fd);
+                MADNESS_EXCEPTION("SingleFileInputArchive: file is too short", nbyte);
+            }
+            void* p = mmap(nullptr, nbyte, PROT_READ, MAP_SHARED, fd, 0);
+            const int err = errno;
+            ::close(fd);
+            if (p == MAP_FAILED) MADNESS_EXCEPTION("SingleFileInputArchive: cannot map file", err);
+            map = static_cast<const unsigned char*>(p);
+
+            if (std::memcmp(map, file_cookie, sizeof(file_cookie))) {
+                close();
+                MADNESS_EXCEPTION("SingleFileInputArchive: not a single file archive", 0);
+            }
+            pos = sizeof(file_cookie);
+        }
+
+        void SingleFileInputArchive::close() {
+            if (!map) return;
+            munmap(const_cast<unsigned char*>(map), nbyte);
+            map = nullptr;
+            nbyte = 0;
+            pos = 0;
+        }
+
+        std::uint64_t SingleFileInputArchive::load_entries(const unsigned char*& data,
+                                                           const unsigned char*& index,
+                                                           std::size_t& nindex) const {
+            MADNESS_ASSERT(map);
+            std::uint64_t head[4];
+            MADNESS_ASSERT(pos + sizeof(head) <= nbyte);
+            std::memcpy(head, map+pos, sizeof(head));
+            if (head[0] != entries_cookie)
+                MADNESS_EXCEPTION("SingleFileInputArchive: expected the entries of a container", 0);
+            const std::uint64_t nentry = head[1], ndata = head[2];
+
+            data = map + pos + entries_header;
+            const std::size_t istart = pos + entries_header + ndata;
+            nindex = head[3];
+            MADNESS_ASSERT(istart + nindex <= nbyte);
+            index = map + istart;
+
+            pos = istart + nindex;
+            return nentry;
+        }
+
+    } // namespace archive
+} // namespace madness
@@ -0,0 +1,487 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+#ifndef MADNESS_WORLD_SINGLE_FILE_ARCHIVE_H__INCLUDED
+#define MADNESS_WORLD_SINGLE_FILE_ARCHIVE_H__INCLUDED
+
+/**
+ \file single_file_archive.h
+ \brief Implements \c SingleFileInputArchive and \c SingleFileOutputArchive for parallel serialization into one file.
+ \ingroup serialization
+*/
+
+#include <type_traits>
+#include <cstdint>
+#include <vector>
+#include <madness/world/archive.h>
+#include <madness/world/buffer_archive.h>
+#include <madness/world/parallel_archive.h>
+#include <madness/world/world.h>
+
+namespace madness {
+    namespace archive {
+
+        /// \addtogroup serialization
+        /// @{
+
+        /// An archive for storing local or parallel data in a single file written by all processes.
+
+        /// \note Writes of process-local objects only store the data from process zero.
+        ///
+        /// \note Writes of parallel containers (presently only \c WorldContainer) are collective.
+        ///
+        /// Every process counts the bytes of its own entries of a
+        /// container, and a prefix sum of the counts over the processes
+        /// gives it the offset at which it writes them, along with its part
+        /// of the index, directly into the shared file.  The values are
+        /// serialized and written in chunks of at most \c chunk_size bytes
+        /// (or one value if larger), so storing a container takes little
+        /// memory beyond the container itself.  A container is stored as
+        /// \verbatim
+        ///    header (marker, no. of entries, no. of bytes of data, no. of bytes of index)
+        ///    values of the entries of process 0, 1, ...
+        ///    index (key, offset from the start of the data and size of each value)
+        /// \endverbatim
+        /// and so the file does not depend on the number of processes
+        /// or the process map.  It is read with \c SingleFileInputArchive
+        /// by any number of processes.
+        ///
+        /// The file system must be shared by all processes, and the
+        /// archive must be closed (collectively) before the file is read.
+        class SingleFileOutputArchive : public BaseOutputArchive {
+            World* world; ///< The world.
+            int fd; ///< The file descriptor ... -1 if not open.
+            bool do_fence; ///< If true (default), a write of parallel objects fences before and after I/O.
+            mutable std::uint64_t pos; ///< End of the data written by all processes.
+            mutable std::vector<unsigned char> pending; ///< Data of process zero not yet written.
+            mutable std::uint64_t data_pos; ///< Where the next values of this process go.
+            mutable std::uint64_t data_end; ///< End of the values of this process.
+            mutable std::uint64_t index_pos; ///< Where the next part of the index of this process goes.
+            mutable std::uint64_t index_end; ///< End of the index of this process.
+
+            SingleFileOutputArchive(const SingleFileOutputArchive&) = delete;
+            SingleFileOutputArchive& operator=(const SingleFileOutputArchive&) = delete;
+
+        public:
+            static const bool is_parallel_archive = true; ///< Mark this class as a parallel archive.
+
+            /// Values of a container are written in chunks of at most this many bytes.
+            static const std::size_t chunk_size = std::size_t(1)<<22;
+
+            /// Default constructor.
+            SingleFileOutputArchive()
+                : world(nullptr), fd(-1), do_fence(true), pos(0)
+                , data_pos(0), data_end(0), index_pos(0), index_end(0) {}
+
+            /// Creates the archive, collective.
+
+            /// \param[in] world The world.
+            /// \param[in] filename Name of the file.
+            SingleFileOutputArchive(World& world, const char* filename)
+                : world(nullptr), fd(-1), do_fence(true), pos(0)
+                , data_pos(0), data_end(0), index_pos(0), index_end(0)
+            {
+                open(world, filename);
+            }
+
+            /// Closes the archive if it is open, collective.
+            ~SingleFileOutputArchive() {
+                close();
+            }
+
+            /// Creates (truncates) the file, collective.
+
+            /// \param[in] world The world.
+            /// \param[in] filename Name of the file.
+            void open(World& world, const char* filename);
+
+            /// Writes the remaining data and closes the file, collective.
+            void close();
+
+            /// Returns a pointer to the world.
+
+            /// \return A pointer to the world.
+            World* get_world() const {
+                MADNESS_ASSERT(world);
+                return world;
+            }
+
+            /// Stores a process-local object from process zero.
+
+            /// \tparam T The type of the object.
+            /// \param[in] t The object.
+            template <typename T>
+            void store_local(const T& t) const {
+                if (get_world()->rank() != 0) return;
+                BufferOutputArchive count;
+                count & t;
+                const std::size_t n = pending.size();
+                pending.resize(n + count.size());
+                BufferOutputArchive ar(pending.data()+n, count.size());
+                ar & t;
+            }
+
+            /// Starts the entries of a container, collective.
+
+            /// Makes room for the values and the index of every process,
+            /// which this process then writes with store_values() and
+            /// store_index().
+            /// \param[in] nbyte Bytes of the serialized values of this process.
+            /// \param[in] nentry Number of entries of this process.
+            /// \param[in] nindex Bytes of the serialized (key, offset, size) of
+            ///     each value of this process.
+            /// \return The offset of the values of this process from the start of all values.
+            std::uint64_t begin_entries(std::uint64_t nbyte, std::uint64_t nentry,
+                                        std::uint64_t nindex) const;
+
+            /// Writes the next n bytes of the values of this process.
+
+            /// \param[in] p The serialized values.
+            /// \param[in] n The number of bytes.
+            void store_values(const unsigned char* p, std::size_t n) const;
+
+            /// Writes the next n bytes of the index of this process.
+
+            /// \param[in] p The serialized (key, offset, size) of values.
+            /// \param[in] n The number of bytes.
+            void store_index(const unsigned char* p, std::size_t n) const;
+
+            /// Checks that all values and the whole index of this process were written.
+            void end_entries() const;
+
+            /// Check if we should fence around a write operation.
+
+            /// \return True if we should fence; false otherwise.
+            bool dofence() const {
+                return do_fence;
+            }
+
+            /// Set the flag for fencing around a write operation.
+
+            /// \param[in] dofence True if we should fence; false otherwise.
+            void set_dofence(bool dofence) {
+                do_fence = dofence;
+            }
+
+            /// Returns true if the named archive exists on disk with read access, collective.
+
+            /// \param[in] world The world.
+            /// \param[in] filename Name of the file.
+            /// \return True if the archive exists and is readable.
+            static bool exists(World& world, const char* filename);
+
+            /// Deletes the file of the archive.
+
+            /// Process zero does the deleting.
+            /// \param[in] world The world.
+            /// \param[in] filename Name of the file.
+            static void remove(World& world, const char* filename);
+        };
+
+        /// An archive for loading local or parallel data from a file written by \c SingleFileOutputArchive.
+
+        /// \note Reads of process-local objects are made by every process
+        /// from the file, so nothing is broadcast.
+        ///
+        /// \note Reads of parallel containers load on each process only
+        /// the entries that it owns in the process map of the container
+        /// being read into.
+        ///
+        /// Every process maps the file into memory, so only the pages of
+        /// the index and of its own values are read from disk.
+        /// Any number of processes can read the archive.
+        class SingleFileInputArchive : public BaseInputArchive {
+            World* world; ///< The world.
+            const unsigned char* map; ///< The mapped file ... null if not open.
+            std::size_t nbyte; ///< Size of the file.
+            bool do_fence; ///< If true (default), a read of parallel objects fences before and after I/O.
+            mutable std::size_t pos; ///< Current input location.
+
+            SingleFileInputArchive(const SingleFileInputArchive&) = delete;
+            SingleFileInputArchive& operator=(const SingleFileInputArchive&) = delete;
+
+        public:
+            static const bool is_parallel_archive = true; ///< Mark this class as a parallel archive.
+
+            /// Default constructor.
+            SingleFileInputArchive()
+                : world(nullptr), map(nullptr), nbyte(0), do_fence(true), pos(0) {}
+
+            /// Opens the archive for input.
+
+            /// \param[in] world The world.
+            /// \param[in] filename Name of the file.
+            SingleFileInputArchive(World& world, const char* filename)
+                : world(nullptr), map(nullptr), nbyte(0), do_fence(true), pos(0)
+            {
+                open(world, filename);
+            }
+
+            /// Closes the archive if it is open.
+            ~SingleFileInputArchive() {
+                close();
+            }
+
+            /// Maps the file into memory and checks its header.
+
+            /// \param[in] world The world.
+            /// \param[in] filename Name of the file.
+            void open(World& world, const char* filename);
+
+            /// Unmaps the file.
+            void close();
+
+            /// Returns a pointer to the world.
+
+            /// \return A pointer to the world.
+            World* get_world() const {
+                MADNESS_ASSERT(world);
+                return world;
+            }
+
+            /// Loads a process-local object.
+
+            /// \tparam T The type of the object.
+            /// \param[out] t Where to put the object.
+            template <typename T>
+            void load_local(const T& t) const {
+                MADNESS_ASSERT(map);
+                BufferInputArchive ar(map+pos, nbyte-pos);
+                ar & t;
+                pos = nbyte - ar.nbyte_avail();
+            }
+
+            /// Locates the entries of the next container and moves past them.
+
+            /// \param[out] data The serialized values.
+            /// \param[out] index The serialized (key, offset in \c data, size) of each value.
+            /// \param[out] nindex The size of \c index.
+            /// \return The number of entries.
+            std::uint64_t load_entries(const unsigned char*& data, const unsigned char*& index,
+                                       std::size_t& nindex) const;
+
+            /// Check if we should fence around a read operation.
+
+            /// \return True if we should fence; false otherwise.
+            bool dofence() const {
+                return do_fence;
+            }
+
+            /// Set the flag for fencing around a read operation.
+
+            /// \param[in] dofence True if we should fence; false otherwise.
+            void set_dofence(bool dofence) {
+                do_fence = dofence;
+            }
+
+            /// Returns true if the named archive exists on disk with read access, collective.
+
+            /// \param[in] world The world.
+            /// \param[in] filename Name of the file.
+            /// \return True if the archive exists and is readable.
+            static bool exists(World& world, const char* filename) {
+                return SingleFileOutputArchive::exists(world, filename);
+            }
+
+            /// Deletes the file of the archive.
+
+            /// \param[in] world The world.
+            /// \param[in] filename Name of the file.
+            static void remove(World& world, const char* filename) {
+                SingleFileOutputArchive::remove(world, filename);
+            }
+        };
+
+        /// Disable type info for single file output archives.
+
+        /// \tparam T The data type.
+        template <class T>
+        struct ArchivePrePostImpl<SingleFileOutputArchive,T> {
+            /// Store the preamble for this data type in the archive.
+            static inline void preamble_store(const SingleFileOutputArchive& ar) {}
+
+            /// Store the postamble for this data type in the archive.
+            static inline void postamble_store(const SingleFileOutputArchive& ar) {}
+        };
+
+        /// Disable type info for single file input archives.
+
+        /// \tparam T The data type.
+        template <class T>
+        struct ArchivePrePostImpl<SingleFileInputArchive,T> {
+            /// Load the preamble for this data type from the archive.
+            static inline void preamble_load(const SingleFileInputArchive& ar) {}
+
+            /// Load the postamble for this data type from the archive.
+            static inline void postamble_load(const SingleFileInputArchive& ar) {}
+        };
+
+        /// Specialization of \c ArchiveImpl for single file output archives.
+
+        /// \attention No type-checking is performed.
+        /// \tparam T The data type.
+        template <class T>
+        struct ArchiveImpl<SingleFileOutputArchive, T> {
+            /// Parallel objects are forwarded to their implementation of parallel store.
+
+            /// \tparam Q The data type.
+            /// \param[in] ar The archive.
+            /// \param[in] t The parallel object to store.
+            /// \return The archive.
+            template <typename Q>
+            static inline
+            typename std::enable_if<std::is_base_of<ParallelSerializableObject, Q>::value, const SingleFileOutputArchive&>::type
+            wrap_store(const SingleFileOutputArchive& ar, const Q& t) {
+                ArchiveStoreImpl<SingleFileOutputArchive,T>::store(ar,t);
+                return ar;
+            }
+
+            /// Serial objects write only from process 0.
+
+            /// \tparam Q The data type.
+            /// \param[in] ar The archive.
+            /// \param[in] t The serial data.
+            /// \return The archive.
+            template <typename Q>
+            static inline
+            typename std::enable_if<!std::is_base_of<ParallelSerializableObject, Q>::value, const SingleFileOutputArchive&>::type
+            wrap_store(const SingleFileOutputArchive& ar, const Q& t) {
+                ar.store_local(t);
+                return ar;
+            }
+        };
+
+        /// Specialization of \c ArchiveImpl for single file input archives.
+
+        /// \attention No type-checking is performed.
+        /// \tparam T The data type.
+        template <class T>
+        struct ArchiveImpl<SingleFileInputArchive, T> {
+            /// Parallel objects are forwarded to their implementation of parallel load.
+
+            /// \tparam Q The data type.
+            /// \param[in] ar The archive.
+            /// \param[out] t Where to put the loaded parallel object.
+            /// \return The archive.
+            template <typename Q>
+            static inline
+            typename std::enable_if<std::is_base_of<ParallelSerializableObject, Q>::value, const SingleFileInputArchive&>::type
+            wrap_load(const SingleFileInputArchive& ar, const Q& t) {
+                ArchiveLoadImpl<SingleFileInputArchive,T>::load(ar,const_cast<T&>(t));
+                return ar;
+            }
+
+            /// Serial objects are read by every process.
+
+            /// \tparam Q The data type.
+            /// \param[in] ar The archive.
+            /// \param[out] t Where to put the loaded data.
+            /// \return The archive.
+            template <typename Q>
+            static inline
+            typename std::enable_if<!std::is_base_of<ParallelSerializableObject, Q>::value, const SingleFileInputArchive&>::type
+            wrap_load(const SingleFileInputArchive& ar, const Q& t) {
+                ar.load_local(t);
+                return ar;
+            }
+        };
+
+        /// Write the archive array only from process zero.
+
+        /// \tparam T The array data type.
+        template <class T>
+        struct ArchiveImpl< SingleFileOutputArchive, archive_array<T> > {
+            /// Store the \c archive_array in the archive.
+
+            /// \param[in] ar The archive.
+            /// \param[in] t The array to store.
+            /// \return The archive.
+            static inline const SingleFileOutputArchive& wrap_store(const SingleFileOutputArchive& ar, const archive_array<T>& t) {
+                ar.store_local(t);
+                return ar;
+            }
+        };
+
+        /// Read the archive array on every process.
+
+        /// \tparam T The array data type.
+        template <class T>
+        struct ArchiveImpl< SingleFileInputArchive, archive_array<T> > {
+            /// Load the \c archive_array from the archive.
+
+            /// \param[in] ar The archive.
+            /// \param[out] t Where to put the loaded array.
+            /// \return The archive.
+            static inline const SingleFileInputArchive& wrap_load(const SingleFileInputArchive& ar, const archive_array<T>& t) {
+                ar.load_local(t);
+                return ar;
+            }
+        };
+
+        /// Forward a fixed-size array to \c archive_array.
+
+        /// \tparam T The array data type.
+        /// \tparam n The number of items in the array.
+        template <class T, std::size_t n>
+        struct ArchiveImpl<SingleFileOutputArchive, T[n]> {
+            /// Store the array in the archive.
+
+            /// \param[in] ar The archive.
+            /// \param[in] t The array to store.
+            /// \return The archive.
+            static inline const SingleFileOutputArchive& wrap_store(const SingleFileOutputArchive& ar, const T(&t)[n]) {
+                ar << wrap(&t[0],n);
+                return ar;
+            }
+        };
+
+        /// Forward a fixed-size array to \c archive_array.
+
+        /// \tparam T The array data type.
+        /// \tparam n The number of items in the array.
+        template <class T, std::size_t n>
+        struct ArchiveImpl<SingleFileInputArchive, T[n]> {
+            /// Load the array from the archive.
+
+            /// \param[in] ar The archive.
+            /// \param[out] t Where to put the loaded array.
+            /// \return The archive.
+            static inline const SingleFileInputArchive& wrap_load(const SingleFileInputArchive& ar, const T(&t)[n]) {
+                ar >> wrap(&t[0],n);
+                return ar;
+            }
+        };
+
+        /// @}
+    }
+}
+
+#endif // MADNESS_WORLD_SINGLE_FILE_ARCHIVE_H__INCLUDED
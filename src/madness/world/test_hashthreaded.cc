@@ -384,6 +384,60 @@ void test_accessors() {
     if (a[1] != 20000000.0) MADNESS_EXCEPTION("Ooops", int(a[1]));
 }
 
+class Reader : public madness::ThreadBase {
+private:
+    const ConcurrentHashMap<int,double>& a; // Better would be a shared pointer
+    const int nkey;
+
+public:
+    Reader(const ConcurrentHashMap<int,double>& a, int nkey)
+            : ThreadBase(), a(a), nkey(nkey) {
+        start();
+    }
+
+    void run() {
+        for (int i=0; i<2000000; ++i) {
+            int key = i%nkey;
+            ConcurrentHashMap<int,double>::const_iterator it = a.find(key);
+            if (it != a.end() && (it->first != key || it->second != key))
+                MADNESS_EXCEPTION("lock-free find returned the wrong entry", key);
+        }
+
+        ndone++;
+    }
+};
+
+
+void test_growth() {
+    // Start from the smallest table so that insertion has to grow it
+    // many times while other threads are reading without locks
+    ConcurrentHashMap<int,double> a(1);
+    typedef ConcurrentHashMap<int,double>::datumT datumT;
+    typedef ConcurrentHashMap<int,double>::iterator iteratorT;
+    const int nkey = 200000;
+
+    ndone = 0;
+    Reader r1(a,nkey), r2(a,nkey);
+    for (int i=0; i<nkey; ++i) a.insert(datumT(i,i));
+    for (int i=1; i<nkey; i+=2) a.erase(i);
+    while (ndone != 2) sched_yield();
+
+    if (a.size() != size_t(nkey/2)) cout << "growth: size should have been " << nkey/2 << " " << a.size() << endl;
+    for (int i=0; i<nkey; ++i) {
+        iteratorT it = a.find(i);
+        if ((i%2 == 0) != (it != a.end())) cout << "growth: wrong presence of key " << i << endl;
+    }
+
+    // Inserting while an iterator from begin() is alive must not move
+    // entries underneath it
+    iteratorT it = a.begin();
+    for (int i=1; i<nkey; i+=2) a.insert(datumT(i,i));
+    size_t count = 0;
+    for (; it!=a.end(); ++it) count++;
+    if (count < size_t(nkey/2) || count > size_t(nkey)) cout << "growth: iteration saw " << count << endl;
+    if (a.size() != size_t(nkey)) cout << "growth: size should have been " << nkey << " " << a.size() << endl;
+}
+
 void test_integer_range() {
     int start(12), end(start+30);
 
@@ -403,6 +457,7 @@ int main(int argc, char** argv) {
         test_time();
         test_thread();
         test_accessors();
+        test_growth();
         test_integer_range();
 
         cout << "Things seem to be working!\n";
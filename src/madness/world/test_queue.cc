@@ -1,6 +1,14 @@
 #include <madness/world/MADworld.h>
+#include <madness/world/dqueue.h>
+#include <madness/world/wsdeque.h>
+#include <algorithm>
+#include <iomanip>
+#include <vector>
 
-// This program is used to do a simple test of the task queue.
+// This program is used to do a simple test of the task queue.  It also
+// reports the rate of running tasks, first for the queues underneath the
+// thread pool versus the number of threads, then for the thread pool
+// itself (set MAD_NUM_THREADS to vary the number of threads in the pool).
 
 const int NGEN=100;
 const int NTASK=100000;
@@ -62,10 +70,107 @@ public:
     static bool finished() {return total_count==(NGEN*NTASK);}
 };
 
+// Each task of the queue benchmark generates two more until a binary tree
+// of NTREE tasks has been run.  The value of a task is its height in the tree.
+const int TREE_HEIGHT=20;
+const int NTREE=(1<<TREE_HEIGHT) - 1;
+
+struct QueueBench {
+    int nthread;
+    madness::DQueue<long> shared;
+    madness::WSDeque<long>* deques;
+    madness::AtomicInt nrun;
+};
+
+struct QueueBenchThread {
+    QueueBench* bench;
+    int me;
+};
+
+// All threads share one queue
+void* shared_queue_main(void* arg) {
+    QueueBench& b = *static_cast<QueueBenchThread*>(arg)->bench;
+    while (b.nrun < NTREE) {
+        std::pair<long,bool> t = b.shared.pop_front(false);
+        if (!t.second) continue;
+        if (t.first > 1) {
+            b.shared.push_back(t.first-1);
+            b.shared.push_back(t.first-1);
+        }
+        b.nrun++;
+    }
+    return nullptr;
+}
+
+// Each thread has its own deque and steals from a random victim when it is empty
+void* stealing_queue_main(void* arg) {
+    QueueBench& b = *static_cast<QueueBenchThread*>(arg)->bench;
+    const int me = static_cast<QueueBenchThread*>(arg)->me;
+    madness::WSDeque<long>& mine = b.deques[me];
+    unsigned int seed = 2463534242u + me;
+    while (b.nrun < NTREE) {
+        long t;
+        if (!mine.pop(t)) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            const int victim = seed % b.nthread;
+            if (victim == me || !b.deques[victim].steal(t)) continue;
+        }
+        if (t > 1) {
+            mine.push(t-1);
+            mine.push(t-1);
+        }
+        b.nrun++;
+    }
+    return nullptr;
+}
+
+// Returns the number of tasks run per second
+double run_queue_bench(int nthread, bool stealing) {
+    QueueBench b;
+    b.nthread = nthread;
+    b.deques = new madness::WSDeque<long>[nthread];
+    b.nrun = 0;
+    if (stealing)
+        b.deques[0].push(TREE_HEIGHT);
+    else
+        b.shared.push_back(TREE_HEIGHT);
+
+    std::vector<QueueBenchThread> args(nthread);
+    std::vector<pthread_t> ids(nthread);
+    const double start = madness::wall_time();
+    for (int i=0; i<nthread; ++i) {
+        args[i].bench = &b;
+        args[i].me = i;
+        pthread_create(&ids[i], nullptr, stealing ? stealing_queue_main : shared_queue_main, &args[i]);
+    }
+    for (int i=0; i<nthread; ++i) pthread_join(ids[i], nullptr);
+    const double used = madness::wall_time() - start;
+
+    // Every task must have been run exactly once
+    MADNESS_ASSERT(b.nrun == NTREE);
+    MADNESS_ASSERT(b.shared.empty());
+    for (int i=0; i<nthread; ++i) MADNESS_ASSERT(b.deques[i].empty());
+
+    delete [] b.deques;
+    return NTREE/used;
+}
+
 int main(int argc, char** argv) {
     madness::initialize(argc, argv);
     madness::World world(SafeMPI::COMM_WORLD);
 
+    const int maxthread = std::min(std::max(madness::ThreadBase::num_hw_processors(), 2), 64);
+    std::cout << "Queue tasks per second\n   threads     shared   stealing\n";
+    for (int nthread = 1; nthread <= maxthread; nthread *= 2) {
+        const double shared = run_queue_bench(nthread, false);
+        const double stealing = run_queue_bench(nthread, true);
+        std::cout << std::setw(10) << nthread << std::scientific << std::setprecision(2)
+                  << std::setw(11) << shared << std::setw(11) << stealing << "\n";
+    }
+    std::cout.unsetf(std::ios::floatfield);
+
     total_count = 0;
     init_tls(madness::ThreadPool::size() + 1);
 
@@ -85,7 +190,8 @@ int main(int argc, char** argv) {
 
     std::cout << "Total tasks = " << total_count
             << "\nTotal runtime = " << finish - start
-            << " (s)\nTasks per thread:\n";
+            << " (s)\nTasks per second = " << total_count/(finish - start)
+            << "\nTasks per thread:\n";
     for (unsigned long i = 0; i < (madness::ThreadPool::size() + 1); ++i)
         std::cout << i << " " << thread_counters[i] << "\n";
 
@@ -0,0 +1,104 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+
+/// \file world/test_rmi.cc
+/// \brief Tests that ordered active messages arrive in order whatever their size
+
+/// Every process sends a sequence of ordered messages to every other
+/// process, mixing small ones, ones of several pages and huge ones (larger
+/// than an RMI receive buffer), which take different routes through RMI.
+/// Run it on several processes, e.g. by test_rmi.sh.
+
+#include <madness/world/MADworld.h>
+#include <vector>
+
+using namespace madness;
+
+namespace {
+
+    const int nmsg = 200;               // Messages to each process
+    std::vector<int> next_seq;          // Next message expected from each process
+    bool ok = true;
+
+    // Payload of message seq ... small, of several pages, or huge
+    std::size_t payload_size(int seq) {
+        if (seq%50 == 7) return 2*RMI::max_msg_len();
+        if (seq%5 == 3) return 40000;
+        return seq%17;
+    }
+
+    // Runs in the RMI server thread, one message at a time
+    void handler(const AmArg& arg) {
+        ProcessID src;
+        int seq;
+        std::vector<unsigned char> payload;
+        arg & src & seq & payload;
+        if (seq != next_seq[src]) {
+            print("test_rmi: from", src, "got message", seq, "expected", next_seq[src]);
+            ok = false;
+        }
+        if (payload.size() != payload_size(seq)) ok = false;
+        for (std::size_t i=0; i<payload.size(); ++i)
+            if (payload[i] != static_cast<unsigned char>(seq + src)) ok = false;
+        ++next_seq[src];
+    }
+
+}
+
+int main(int argc, char** argv) {
+    World& world = initialize(argc, argv);
+    const ProcessID me = world.rank();
+    const int nproc = world.size();
+    next_seq.assign(nproc, 0);
+
+    for (int seq=0; seq<nmsg; ++seq) {
+        const std::vector<unsigned char> payload(payload_size(seq), static_cast<unsigned char>(seq + me));
+        for (ProcessID p=0; p<nproc; ++p) {
+            if (p != me) world.am.send(p, handler, new_am_arg(me, seq, payload));
+        }
+    }
+    world.gop.fence();
+
+    for (ProcessID p=0; p<nproc; ++p) {
+        if (p != me && next_seq[p] != nmsg) {
+            print("test_rmi: got", next_seq[p], "of", nmsg, "messages from", p);
+            ok = false;
+        }
+    }
+    int nfail = ok ? 0 : 1;
+    world.gop.sum(nfail);
+    if (me == 0) print("test_rmi: nproc", nproc, "shm messages", RMI::get_stats().nmsg_shm_recv,
+                       nfail ? "FAILED" : "OK");
+
+    finalize();
+    return nfail ? 1 : 0;
+}
@@ -0,0 +1,23 @@
+#! /bin/sh
+
+# Runs test_rmi.mpi on four processes, with all messages sent by MPI and
+# with messages between processes on this host sent through shared memory.
+# MPIEXEC (default mpiexec) and MPIEXEC_FLAGS select how to launch it.
+# Handlers are sent as addresses, so address space randomization is turned
+# off where setarch can do so.
+
+set -e
+
+MPIEXEC=${MPIEXEC:-mpiexec}
+NORANDOM=
+if setarch `uname -m` -R true > /dev/null 2>&1; then
+    NORANDOM="setarch `uname -m` -R"
+fi
+
+run() {
+    echo "Running test_rmi.mpi with $*"
+    env "$@" $MPIEXEC $MPIEXEC_FLAGS -n 4 $NORANDOM ./test_rmi.mpi
+}
+
+run MAD_SHM_SIZE=0
+run MAD_SHM_SIZE=256KB
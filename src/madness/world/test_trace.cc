@@ -0,0 +1,193 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+/// \file test_trace.cc
+/// \brief Checks the Chrome trace written with MAD_TASKPROFILER_FORMAT=chrome
+
+/// Each line of the trace must be one JSON object of the array, and every
+/// event must carry the trace thread id of the thread that recorded it,
+/// even when another thread writes it out, as the main thread does for the
+/// RMI server.  Without --enable-task-profiler there is nothing to check.
+
+#include <madness/world/MADworld.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+
+using namespace madness;
+
+#ifdef MADNESS_TASK_PROFILING
+
+namespace {
+
+    int nfail = 0;
+
+    void check(bool ok, const std::string& what) {
+        if (!ok) {
+            ++nfail;
+            std::cout << "FAILED: " << what << std::endl;
+        }
+    }
+
+    const char* const main_name = "recorded_by_main_thread";
+    const char* const other_name = "recorded_by_other_thread";
+    const int nrecord = 3;
+
+    /// Events of a thread outside the pool, which the main thread writes out
+    profiling::TaskProfiler other_profiler;
+    AtomicInt other_done;
+
+    void record(profiling::TaskProfiler& profiler, const char* name) {
+        profiling::TaskEventList* list = profiler.new_list(nrecord);
+        for (int i=0; i<nrecord; ++i) {
+            profiling::TaskEvent* event = list->event();
+            event->start(std::make_pair((void*)(name), (unsigned short)(2)), 1, wall_time());
+            event->stop();
+        }
+    }
+
+    void* record_other(void*) {
+        record(other_profiler, other_name);
+        other_done = 1;
+        return 0;
+    }
+
+    double work(int i) {
+        double sum = 0.0;
+        for (int j=0; j<10000; ++j) sum += std::sin(i + j*0.001);
+        return sum;
+    }
+
+    /// The integer value of key in a JSON object on one line, or -1 if absent
+    long field(const std::string& line, const std::string& key) {
+        const std::string pattern = "\"" + key + "\":";
+        const std::size_t pos = line.find(pattern);
+        if (pos == std::string::npos) return -1;
+        return std::strtol(line.c_str() + pos + pattern.size(), 0, 10);
+    }
+
+    /// True if the quotes and braces of a JSON object on one line match
+    bool balanced(const std::string& line) {
+        int depth = 0;
+        bool quoted = false;
+        for (std::size_t i=0; i<line.size(); ++i) {
+            const char c = line[i];
+            if (quoted) {
+                if (c == '\\') ++i;
+                else if (c == '"') quoted = false;
+            }
+            else if (c == '"') quoted = true;
+            else if (c == '{') ++depth;
+            else if (c == '}' && --depth < 0) return false;
+        }
+        return depth == 0 && !quoted;
+    }
+
+}
+
+int main(int argc, char** argv) {
+    setenv("MAD_TASKPROFILER_NAME", "test_trace", 1);
+    setenv("MAD_TASKPROFILER_FORMAT", "chrome", 1);
+    World& world = initialize(argc, argv);
+    const long rank = world.rank();
+    const long nthread = ThreadPool::size();
+    const std::string file_name = profiling::TaskProfiler::file_name();
+
+    // Tasks for the pool threads
+    const int ntask = 100;
+    for (int i=0; i<ntask; ++i) world.taskq.add(work, i);
+    world.gop.fence();
+
+    // Events recorded by the main thread and by another thread, both
+    // written out by the main thread
+    profiling::TaskProfiler main_profiler;
+    record(main_profiler, main_name);
+    main_profiler.write_to_file();
+
+    Thread other(record_other);
+    while (!other_done) myusleep(1000);
+    other_profiler.write_to_file();
+
+    finalize();
+
+    std::ifstream file(file_name.c_str());
+    check(file.good(), "trace " + file_name + " not written");
+    std::string line, last;
+    std::getline(file, line);
+    check(line == "[", "trace does not open a JSON array");
+
+    int nthread_name = 0, nmain = 0, nother = 0, ntask_event = 0;
+    while (std::getline(file, line) && line != "]") {
+        if (!last.empty()) check(last[last.size()-1] == ',', "event not followed by a comma: " + last);
+        last = line;
+        check(line[0] == '{' && balanced(line), "event is not a JSON object: " + line);
+        check(field(line, "pid") == rank, "event of another process: " + line);
+        check(line.find("\"ph\":\"") != std::string::npos, "event without a phase: " + line);
+
+        const long tid = field(line, "tid");
+        if (line.find("\"process_name\"") != std::string::npos) continue;
+        check(tid >= 0 && tid <= nthread+1, "event of an unknown thread: " + line);
+
+        if (line.find("\"thread_name\"") != std::string::npos) ++nthread_name;
+        if (line.find("\"cat\":\"task\"") != std::string::npos) ++ntask_event;
+        if (line.find(main_name) != std::string::npos) {
+            ++nmain;
+            check(tid == 0, "event of the main thread on another thread: " + line);
+        }
+        if (line.find(other_name) != std::string::npos) {
+            ++nother;
+            check(tid == nthread+1, "event of another thread written with the id of the main thread: " + line);
+        }
+    }
+    check(line == "]", "trace does not close the JSON array");
+    check(!last.empty() && last[last.size()-1] == '}', "last event followed by a comma");
+    check(nthread_name == nthread+2, "not every thread is named");
+    check(nmain == nrecord && nother == nrecord, "recorded events missing");
+    check(ntask_event >= ntask + 2*nrecord, "task events missing");
+    file.close();
+    std::remove(file_name.c_str());
+
+    if (nfail == 0) std::cout << "test_trace: OK" << std::endl;
+    return nfail ? 1 : 0;
+}
+
+#else
+
+int main() {
+    std::cout << "test_trace: configure with --enable-task-profiler to check the trace" << std::endl;
+    return 0;
+}
+
+#endif // MADNESS_TASK_PROFILING
@@ -33,6 +33,8 @@
 #include <madness/world/MADworld.h>
 #include <madness/world/world_object.h>
 #include <madness/world/worlddc.h>
+#include <madness/world/topology.h>
+#include <algorithm>
 
 #if MADNESS_CATCH_SIGNALS
 # include <csignal>
@@ -742,6 +744,51 @@ void test10(World& world) {
     if (me == 0) print("test10 (messaging to world container items) OK");
 }
 
+void test10a(World& world) {
+    PROFILE_FUNC;
+    // test topology discovery and tasks carrying a NUMA domain
+    ProcessID me = world.rank();
+    int nproc = world.size();
+
+    const Topology& topo = Topology::instance();
+    MADNESS_ASSERT(topo.num_cpus() >= 1);
+    MADNESS_ASSERT(topo.num_cores() >= 1 && topo.num_cores() <= topo.num_cpus());
+    MADNESS_ASSERT(topo.num_sockets() >= 1 && topo.num_nodes() >= 1);
+
+    // Compact binding order is a permutation of the usable CPUs
+    std::vector<int> ids;
+    for (std::size_t i=0; i<topo.cpus().size(); ++i) {
+        const Topology::CPU& cpu = topo.cpus()[i];
+        MADNESS_ASSERT(topo.node_of_cpu(cpu.id) == cpu.node);
+        MADNESS_ASSERT(cpu.node >= 0 && cpu.node < topo.num_nodes());
+        ids.push_back(cpu.id);
+    }
+    std::vector<int> order(topo.compact());
+    std::sort(order.begin(), order.end());
+    MADNESS_ASSERT(order == ids);
+
+    TaskAttributes attr = TaskAttributes::hipri();
+    MADNESS_ASSERT(attr.get_numa_node() == -1);
+    attr.set_numa_node(3);
+    MADNESS_ASSERT(attr.get_numa_node() == 3 && attr.is_high_priority() && attr.get_nthread() == 1);
+    attr.set_numa_node(-1);
+    MADNESS_ASSERT(attr.get_numa_node() == -1 && attr.is_high_priority());
+
+    // Tasks of a container with NUMA affinity all run
+    WorldContainer<int,Mary> m(world);
+    m.set_numa_affinity(true);
+    MADNESS_ASSERT(m.get_numa_affinity());
+    for (int i=me; i<100; i+=nproc) m.replace(i,Mary());
+    world.gop.fence();
+    for (int i=0; i<100; ++i) m.task(i, &Mary::add, 1);
+    world.gop.fence();
+    for (int i=0; i<100; ++i)
+        MADNESS_ASSERT(m.find(i).get()->second.get() == uint64_t(nproc));
+    world.gop.fence();
+
+    if (me == 0) print("test10a (topology and NUMA affinity) OK");
+}
+
 
 struct Key {
     typedef unsigned long ulong;
@@ -1041,6 +1088,297 @@ void test13(World& world) {
     world.gop.fence();
 }
 
+void test14(World& world) {
+    PROFILE_FUNC;
+    const ProcessID me = world.rank();
+    const long nproc = world.size();
+
+    // Long enough to need several segments (and odd so the last one is short)
+    const std::size_t n = 300001;
+    std::vector<double> a(n);
+    for (std::size_t i=0; i<n; ++i) a[i] = double(me + i);
+    world.gop.sum(a.data(), n);
+    for (std::size_t i=0; i<n; ++i)
+        MADNESS_ASSERT(a[i] == double(nproc*(nproc-1)/2 + nproc*i));
+
+    std::vector<long> b(n);
+    const ProcessID root = nproc - 1;
+    for (std::size_t i=0; i<n; ++i) b[i] = (me == root) ? long(3*i+1) : 0;
+    world.gop.broadcast(b.data(), n, root);
+    for (std::size_t i=0; i<n; ++i) MADNESS_ASSERT(b[i] == long(3*i+1));
+
+    std::string s;
+    if (me == 0) s.assign(2000000, 'x');
+    world.gop.broadcast_serializable(s, 0);
+    MADNESS_ASSERT(s.size() == 2000000 && s[1999999] == 'x');
+    world.gop.fence();
+
+    // Nonblocking versions overlap with other work
+    for (std::size_t i=0; i<n; ++i) a[i] = double(me + i);
+    Future< std::vector<double> > sum = world.gop.sum_array(14, a.data(), n);
+    Future< std::vector<double> > max = world.gop.all_reduce_array(15, a.data(), n, WorldMaxOp<double>());
+    Future< std::vector<long> > bcast = world.gop.bcast_array(16, b.data(), n, 0);
+    std::fill(a.begin(), a.end(), 0.0); // inputs were copied
+    Future<double> more = world.taskq.add(&wall_time);
+    MADNESS_ASSERT(sum.get().size() == n && max.get().size() == n && bcast.get().size() == n);
+    for (std::size_t i=0; i<n; ++i) {
+        MADNESS_ASSERT(sum.get()[i] == double(nproc*(nproc-1)/2 + nproc*i));
+        MADNESS_ASSERT(max.get()[i] == double(nproc - 1 + i));
+        MADNESS_ASSERT(bcast.get()[i] == long(3*i+1));
+    }
+    more.get();
+    world.gop.fence();
+
+    print("test14 (segmented reductions and broadcasts) OK");
+}
+
+/// Puts key k on process (k+1)%nproc, unlike the default map
+class ShiftedPmap : public WorldDCPmapInterface<int> {
+    const int nproc;
+public:
+    ShiftedPmap(World& world) : nproc(world.size()) {}
+    ProcessID owner(const int& key) const {
+        return (key+1)%nproc;
+    }
+};
+
+void test15(World& world) {
+    PROFILE_FUNC;
+    const ProcessID me = world.rank();
+    const int nproc = world.size();
+
+    WorldContainer<int,double> d(world);
+    // Process p has 10*(p+1) entries so the blocks differ in size
+    for (int i=0; i<10*(me+1); ++i) {
+        const int key = 1000*me + i;
+        d.replace(key, double(key));
+    }
+    // Values below, around and beyond the size of a chunk
+    WorldContainer<int,std::vector<double> > e(world);
+    for (int i=0; i<4; ++i) {
+        const int key = 1000*me + i;
+        e.replace(key, std::vector<double>(archive::SingleFileOutputArchive::chunk_size/sizeof(double)/8 << (2*i), key));
+    }
+    world.gop.fence();
+
+    std::vector<int> v(7, 3*me); // different on every process but only zero's is stored
+    {
+        archive::SingleFileOutputArchive fout(world, "fred.sfa");
+        fout & 1.0 & "hello" & v & d & e & 42;
+    }
+    MADNESS_ASSERT(archive::SingleFileInputArchive::exists(world, "fred.sfa"));
+
+    // Read into a container with another map ... every process takes only its own entries
+    WorldContainer<int,double> c(world, std::shared_ptr< WorldDCPmapInterface<int> >(new ShiftedPmap(world)));
+    double x;
+    char s[6];
+    int last;
+    archive::SingleFileInputArchive fin(world, "fred.sfa");
+    WorldContainer<int,std::vector<double> > f(world, std::shared_ptr< WorldDCPmapInterface<int> >(new ShiftedPmap(world)));
+    fin & x & s & v & c & f & last;
+    fin.close();
+    MADNESS_ASSERT(x == 1.0 && std::strcmp(s, "hello") == 0 && last == 42);
+    MADNESS_ASSERT(v.size() == 7 && v[6] == 0);
+
+    std::size_t nlocal = 0;
+    for (int p=0; p<nproc; ++p) {
+        for (int i=0; i<10*(p+1); ++i) {
+            const int key = 1000*p + i;
+            if (c.owner(key) == me) {
+                WorldContainer<int,double>::const_iterator it = c.find(key).get();
+                MADNESS_ASSERT(it != c.end() && it->second == key);
+                ++nlocal;
+            }
+        }
+    }
+    MADNESS_ASSERT(c.size() == nlocal);
+
+    nlocal = 0;
+    for (int p=0; p<nproc; ++p) {
+        for (int i=0; i<4; ++i) {
+            const int key = 1000*p + i;
+            if (f.owner(key) == me) {
+                WorldContainer<int,std::vector<double> >::const_iterator it = f.find(key).get();
+                MADNESS_ASSERT(it != f.end());
+                MADNESS_ASSERT(it->second.size() == archive::SingleFileOutputArchive::chunk_size/sizeof(double)/8 << (2*i));
+                MADNESS_ASSERT(it->second.front() == key && it->second.back() == key);
+                ++nlocal;
+            }
+        }
+    }
+    MADNESS_ASSERT(f.size() == nlocal);
+    world.gop.fence();
+    archive::SingleFileOutputArchive::remove(world, "fred.sfa");
+
+    print("test15 (single file archive) OK");
+}
+
+int nam_recv = 0; // AMs run by am_counter ... only touched by the RMI server thread
+
+void am_counter(const AmArg& arg) {
+    int i;
+    arg & i;
+    ++nam_recv;
+}
+
+// Sum over the handlers in a table of RMIStats
+RMIHandlerStats handler_total(const RMIHandlerStats* table) {
+    RMIHandlerStats total = {0, 0, 0, 0};
+    for (int i=0; i<RMIStats::NHANDLER; ++i) {
+        total.nmsg += table[i].nmsg;
+        total.nmsg_batched += table[i].nmsg_batched;
+        total.nmsg_shm += table[i].nmsg_shm;
+    }
+    return total;
+}
+
+void test16(World& world) {
+    PROFILE_FUNC;
+    const ProcessID me = world.rank();
+    const int nproc = world.size();
+    const int n = 1000;
+    if (nproc == 1) return; // RMI only runs with several processes
+
+    // Taken before the fence, since a neighbour may send as soon as it has left it
+    nam_recv = 0;
+    const RMIStats before = RMI::get_stats();
+    const AmStats am_before = world.am.get_stats();
+    world.gop.fence();
+    for (int i=0; i<n; ++i) world.am.send((me+1)%nproc, am_counter, new_am_arg(i));
+    world.gop.fence();
+    // Nothing is sent to this process until it is in the next fence
+    const RMIStats after = RMI::get_stats();
+    const AmStats am_after = world.am.get_stats();
+    MADNESS_ASSERT(nam_recv == n);
+
+    // Exactly these AMs went with am_counter
+    MADNESS_ASSERT(am_after.sent(am_counter).nmsg - am_before.sent(am_counter).nmsg == uint64_t(n));
+    MADNESS_ASSERT(am_after.recv(am_counter).nmsg - am_before.recv(am_counter).nmsg == uint64_t(n));
+
+    // The AMs all went with one RMI handler
+    bool sent = false, recv = false;
+    for (int i=0; i<RMIStats::NHANDLER; ++i) {
+        const rmi_handlerT func = after.handler_sent[i].func;
+        if (func && after.sent(func).nmsg - before.sent(func).nmsg >= uint64_t(n)) sent = true;
+    }
+    for (int i=0; i<RMIStats::NHANDLER; ++i) {
+        const rmi_handlerT func = after.handler_recv[i].func;
+        if (func && after.recv(func).nmsg - before.recv(func).nmsg >= uint64_t(n)) recv = true;
+    }
+    MADNESS_ASSERT(sent && recv);
+
+    // Every message, batched or not, was counted for its handler
+    const RMIHandlerStats tsent = handler_total(after.handler_sent);
+    MADNESS_ASSERT(tsent.nmsg == after.nmsg_sent + after.nmsg_batched_sent);
+    MADNESS_ASSERT(tsent.nmsg_batched == after.nmsg_batched_sent);
+    MADNESS_ASSERT(tsent.nmsg_shm == after.nmsg_shm_sent);
+    const RMIHandlerStats trecv = handler_total(after.handler_recv);
+    MADNESS_ASSERT(trecv.nmsg == after.nmsg_recv + after.nmsg_batched_recv);
+    MADNESS_ASSERT(trecv.nmsg_batched == after.nmsg_batched_recv);
+    MADNESS_ASSERT(trecv.nmsg_shm == after.nmsg_shm_recv);
+    world.gop.fence();
+
+    print("test16 (RMI and AM counts by handler) OK");
+}
+
+/// An array that is sent beside an active message once it is big enough, like a Tensor
+struct AttachedArray {
+    std::shared_ptr< std::vector<double> > v;
+
+    AttachedArray() : v(new std::vector<double>) {}
+
+    explicit AttachedArray(std::size_t n) : v(new std::vector<double>(n)) {}
+};
+
+namespace madness {
+    namespace archive {
+        template <>
+        struct ArchiveStoreImpl< BufferOutputArchive, AttachedArray > {
+            static void store(const BufferOutputArchive& s, const AttachedArray& a) {
+                const std::size_t n = a.v->size();
+                const long k = s.attach(a.v->data(), n*sizeof(double), a.v);
+                s & n & k;
+                if (k < 0) s & wrap(a.v->data(), n);
+            }
+        };
+
+        template <>
+        struct ArchiveLoadImpl< BufferInputArchive, AttachedArray > {
+            static void load(const BufferInputArchive& s, AttachedArray& a) {
+                std::size_t n = 0;
+                long k = -1;
+                s & n & k;
+                a.v->resize(n);
+                if (k < 0)
+                    s & wrap(a.v->data(), n);
+                else
+                    s.load_attachment(k, a.v->data(), n*sizeof(double));
+            }
+        };
+    }
+}
+
+int nattached_recv = 0; // AMs run by am_attached ... only touched by the RMI server thread
+int nattached_bad = 0;  // ... of which had wrong values
+
+void am_attached(const AmArg& arg) {
+    ProcessID src;
+    std::size_t n;
+    AttachedArray a;
+    arg & src & n & a;
+    bool ok = (a.v->size() == n);
+    for (std::size_t i=0; ok && i<n; ++i) ok = ((*a.v)[i] == src + 0.5*i);
+    if (!ok) ++nattached_bad;
+    ++nattached_recv;
+}
+
+void test17(World& world) {
+    PROFILE_FUNC;
+    const ProcessID me = world.rank();
+    const int nproc = world.size();
+    if (nproc == 1) return; // RMI only runs with several processes
+
+    // Below, at and well above the size that is sent beside the message
+    const std::size_t nmin = (am_attach_min() ? am_attach_min() : 128*1024)/sizeof(double);
+    const std::size_t sizes[] = {nmin/2, nmin, 4*nmin+3};
+
+    nattached_recv = nattached_bad = 0;
+    world.gop.fence();
+    for (ProcessID p=0; p<nproc; ++p) {
+        if (p == me) continue;
+        for (std::size_t n : sizes) {
+            AttachedArray a(n);
+            for (std::size_t i=0; i<n; ++i) (*a.v)[i] = me + 0.5*i;
+            AmArg* arg = new_am_arg(me, n, a);
+            // An attached array is not copied into the message
+            if (am_attach_min() && n*sizeof(double) >= am_attach_min())
+                MADNESS_ASSERT(arg->size() < am_attach_min());
+            else
+                MADNESS_ASSERT(arg->size() >= n*sizeof(double));
+            world.am.send(p, am_attached, arg); // the message keeps the data alive
+        }
+    }
+    world.gop.fence();
+    MADNESS_ASSERT(nattached_recv == 3*(nproc-1) && nattached_bad == 0);
+
+    // More attachments to one process than there are tags ... a tag is
+    // only used again once the receiver has matched its last message
+    if (am_attach_min() && am_attach_min() <= 4096) {
+        const int nmsg = SafeMPI::AM_ATTACH_NTAG + 100;
+        nattached_recv = nattached_bad = 0;
+        world.gop.fence();
+        for (int m=0; m<nmsg; ++m) {
+            AttachedArray a(nmin);
+            for (std::size_t i=0; i<nmin; ++i) (*a.v)[i] = me + 0.5*i;
+            world.am.send((me+1)%nproc, am_attached, new_am_arg(me, nmin, a));
+        }
+        world.gop.fence();
+        MADNESS_ASSERT(nattached_recv == nmsg && nattached_bad == 0);
+    }
+
+    print("test17 (arrays sent beside active messages) OK");
+}
+
 inline bool is_odd(int i) {
     return i & 0x1;
 }
@@ -1170,9 +1508,14 @@ int main(int argc, char** argv) {
         test8(world);
         test9(world);
         test10(world);
+        test10a(world);
         //test11(world);
         test12(world);
         test13(world);
+        test14(world);
+        test15(world);
+        test16(world);
+        test17(world);
 
         for (int i=0; i<10; ++i) {
           print("REPETITION",i);
@@ -0,0 +1,19 @@
+#! /bin/sh
+
+# Runs test_world.mpi on three processes, with messages aggregated into
+# batches and sent through shared memory, and arrays of 1KB or more sent
+# beside active messages.
+# MPIEXEC (default mpiexec) and MPIEXEC_FLAGS select how to launch it.
+# Handlers are sent as addresses, so address space randomization is turned
+# off where setarch can do so.
+
+set -e
+
+MPIEXEC=${MPIEXEC:-mpiexec}
+NORANDOM=
+if setarch `uname -m` -R true > /dev/null 2>&1; then
+    NORANDOM="setarch `uname -m` -R"
+fi
+
+echo "Running test_world.mpi on 3 processes"
+env MAD_BATCH_SIZE=64KB MAD_SHM_SIZE=256KB MAD_AM_ATTACH_MIN=1024 $MPIEXEC $MPIEXEC_FLAGS -n 3 $NORANDOM ./test_world.mpi
@@ -36,14 +36,19 @@
 */
 
 #include <madness/world/thread.h>
+#include <madness/world/topology.h>
 #include <madness/world/worldprofile.h>
 #include <madness/world/madness_exception.h>
 #include <madness/world/print.h>
 #include <madness/world/worldpapi.h>
 #include <madness/world/safempi.h>
 #include <madness/world/atomicint.h>
+#include <madness/world/posixmem.h>
 #include <cstring>
 #include <fstream>
+#ifdef MADNESS_TASK_PROFILING
+#include <sys/time.h>
+#endif // MADNESS_TASK_PROFILING
 
 #if defined(HAVE_IBMBGQ) and defined(HPM)
 extern "C" unsigned int HPM_Prof_init_thread(void);
@@ -70,16 +75,23 @@ namespace madness {
     int ThreadBase::cpulo[3];
     int ThreadBase::cpuhi[3];
     bool ThreadBase::bind[3];
+    bool ThreadBase::compact = false;
     pthread_key_t ThreadBase::thread_key;
 
     ThreadPool* ThreadPool::instance_ptr = 0;
     double ThreadPool::await_timeout = 900.0;
+    int ThreadPool::nspin = 1000;
 #if HAVE_INTEL_TBB
     tbb::task_scheduler_init* ThreadPool::tbb_scheduler = 0;
 #endif
 #ifdef MADNESS_TASK_PROFILING
     Mutex profiling::TaskProfiler::output_mutex_;
     const char* profiling::TaskProfiler::output_file_name_;
+    bool profiling::TaskProfiler::chrome_trace_ = false;
+    Mutex profiling::TraceEvents::mutex_;
+    std::vector<profiling::TraceEvents::Event> profiling::TraceEvents::events_;
+    bool profiling::TraceEvents::closed_ = false;
+    double profiling::TraceEvents::time_offset_ = 0.0;
 #endif // MADNESS_TASK_PROFILING
 #if defined(HAVE_IBMBGQ) and defined(HPM)
     unsigned int ThreadPool::main_hpmctx;
@@ -219,13 +231,22 @@ namespace madness {
         }
     }
 
-    void ThreadBase::set_affinity(int logical_id, int ind) {
+    // Bind threads compactly following the topology of the host
+    void ThreadBase::set_affinity_compact() {
+        compact = true;
+        for (int i=0; i<3; ++i) {
+            bind[i] = (i != 1);
+            cpulo[i] = cpuhi[i] = 0;
+        }
+    }
+
+    int ThreadBase::set_affinity(int logical_id, int ind) {
         if (logical_id < 0 || logical_id > 2) {
             std::cout << "ThreadBase: set_affinity: logical_id bad?" << std::endl;
-            return;
+            return -1;
         }
 
-        if (!bind[logical_id]) return;
+        if (!bind[logical_id]) return -1;
 
         // If binding the main or rmi threads the cpu id is a specific cpu.
         //
@@ -236,11 +257,16 @@ namespace madness {
 
         int lo=cpulo[logical_id], hi=cpuhi[logical_id];
 
-        if (logical_id == 2) {
-            if (ind < 0) {
-                std::cout << "ThreadBase: set_affinity: pool thread index bad?" << std::endl;
-                return;
-            }
+        if (logical_id == 2 && ind < 0) {
+            std::cout << "ThreadBase: set_affinity: pool thread index bad?" << std::endl;
+            return -1;
+        }
+
+        if (compact) {
+            const std::vector<int>& order = Topology::instance().compact();
+            lo = hi = order[(logical_id == 2 ? ind+1 : 0) % order.size()];
+        }
+        else if (logical_id == 2) {
             if (bind[2]) {
                 int nnn = hi-lo+1;
                 lo += (ind % nnn);
@@ -255,11 +281,13 @@ namespace madness {
         if (sched_setaffinity(0, sizeof(mask), &mask) == -1) {
             perror("system error message");
             std::cout << "ThreadBase: set_affinity: Could not set cpu Affinity" << std::endl;
+            return -1;
         }
         //else {
         //    printf("managed to set affinity\n");
         //}
 #endif
+        return (lo == hi) ? lo : -1;
     }
 
 #if defined(HAVE_IBMBGQ) and defined(HPM)
@@ -282,27 +310,83 @@ namespace madness {
 
     namespace profiling {
 
+        int trace_thread_id() {
+            const ThreadBase* thread = ThreadBase::this_thread();
+            if(thread && thread->get_pool_thread_index() >= 0)
+                return thread->get_pool_thread_index() + 1;
+            if(dynamic_cast<const ThreadPoolThread*>(thread))
+                return 0;
+            return ThreadPool::size() + 1;
+        }
+
+        void print_trace_event(std::ostream& os, const std::string& name,
+                const char* cat, const char ph, const int tid,
+                const double start, const double stop,
+                const char* key0, const double val0,
+                const char* key1, const double val1)
+        {
+            // Escape the name, which may hold anything a demangler returns
+            os << "{\"name\":\"";
+            for(std::string::const_iterator it = name.begin(); it != name.end(); ++it) {
+                if(*it == '"' || *it == '\\') os << '\\' << *it;
+                else if(static_cast<unsigned char>(*it) >= 0x20) os << *it;
+            }
+
+            // Times in microseconds to the nearest nanosecond
+            const std::ios_base::fmtflags flags = os.flags();
+            const std::streamsize precision = os.precision();
+            os.precision(3);
+            os << std::fixed << "\",\"cat\":\"" << cat << "\",\"ph\":\"" << ph
+                    << "\",\"pid\":" << SafeMPI::COMM_WORLD.Get_rank()
+                    << ",\"tid\":" << tid << ",\"ts\":" << 1e6*(start + TraceEvents::time_offset_);
+            if(ph == 'X')
+                os << ",\"dur\":" << 1e6*(stop - start);
+            else
+                os << ",\"s\":\"t\"";
+            os.flags(flags);
+
+            if(key0 || key1) {
+                os.precision(15);
+                os << ",\"args\":{";
+                if(key0) os << "\"" << key0 << "\":" << val0;
+                if(key0 && key1) os << ",";
+                if(key1) os << "\"" << key1 << "\":" << val1;
+                os << "}";
+            }
+            os << "},\n";
+            os.precision(precision);
+        }
+
+        std::string TaskProfiler::file_name() {
+            // Output filename: NAME_[rank]x[threads + 1], with .json for a trace
+            std::stringstream file_name;
+            file_name << output_file_name_ << "_"
+                    << SafeMPI::COMM_WORLD.Get_rank() << "x"
+                    << ThreadPool::size() + 1;
+            if(chrome_trace_) file_name << ".json";
+            return file_name.str();
+        }
+
         void TaskProfiler::write_to_file() {
-            // Get output filename: NAME_[rank]x[threads + 1]
             if(output_file_name_ != nullptr) {
                 // Construct the actual output filename
-                std::stringstream file_name;
-                file_name << output_file_name_ << "_"
-                        << SafeMPI::COMM_WORLD.Get_rank() << "x"
-                        << ThreadPool::size() + 1;
+                const std::string file_name = TaskProfiler::file_name();
 
                 // Lock file for output
                 ScopedMutex<Mutex> locker(TaskProfiler::output_mutex_);
 
                 // Open the file for output
-                std::ofstream file(file_name.str().c_str(), std::ios_base::out | std::ios_base::app);
+                std::ofstream file(file_name.c_str(), std::ios_base::out | std::ios_base::app);
                 if(! file.fail()) {
                     // Print the task profile data
                     // and delete the data since it is not needed anymore
                     const TaskEventListBase* next = nullptr;
                     while(head_ != nullptr) {
                         next = head_->next();
-                        file << *head_;
+                        if(chrome_trace_)
+                            head_->print_trace_events(file);
+                        else
+                            file << *head_;
                         delete head_;
                         head_ = const_cast<TaskEventListBase*>(next);
                     }
@@ -310,7 +394,7 @@ namespace madness {
                     tail_ = nullptr;
                 } else {
                     std::cerr << "!!! ERROR: TaskProfiler cannot open file: "
-                            << file_name.str() << "\n";
+                            << file_name << "\n";
                 }
 
                 // close the file
@@ -328,6 +412,64 @@ namespace madness {
             }
         }
 
+        void TraceEvents::add(const Event& event) {
+            ScopedMutex<Mutex> locker(mutex_);
+            if(! closed_) events_.push_back(event);
+        }
+
+        void TraceEvents::begin() {
+            // Times are written from the epoch so the traces of all
+            // processes can be viewed together
+            struct timeval tv;
+            gettimeofday(&tv, 0);
+            time_offset_ = (tv.tv_sec + 1e-6*tv.tv_usec) - wall_time();
+
+            const std::string file_name = TaskProfiler::file_name();
+            std::ofstream file(file_name.c_str(), std::ios_base::out | std::ios_base::trunc);
+
+            // Name the process and threads in the viewer
+            const int rank = SafeMPI::COMM_WORLD.Get_rank();
+            const int nthread = ThreadPool::size();
+            file << "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << rank
+                    << ",\"args\":{\"name\":\"rank " << rank << "\"}},\n";
+            for(int tid = 0; tid <= nthread + 1; ++tid) {
+                file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << rank
+                        << ",\"tid\":" << tid << ",\"args\":{\"name\":\"";
+                if(tid == 0) file << "main";
+                else if(tid <= nthread) file << "pool " << tid - 1;
+                else file << "rmi server";
+                file << "\"}},\n";
+            }
+            file.close();
+        }
+
+        void TraceEvents::write_to_file() {
+            ScopedMutex<Mutex> locker(mutex_);
+            if(closed_ || ! enabled()) return;
+            closed_ = true;
+
+            const std::string file_name = TaskProfiler::file_name();
+            std::ofstream file(file_name.c_str(), std::ios_base::out | std::ios_base::app);
+            if(! file.fail()) {
+                for(std::size_t i = 0; i < events_.size(); ++i) {
+                    const Event& e = events_[i];
+                    print_trace_event(file, e.name, e.cat, e.ph, e.tid, e.start,
+                            e.stop, e.key0, e.val0, e.key1, e.val1);
+                }
+
+                // A final event without the trailing comma closes the array
+                file.precision(3);
+                file << "{\"name\":\"end\",\"cat\":\"world\",\"ph\":\"i\",\"s\":\"p\",\"pid\":"
+                        << SafeMPI::COMM_WORLD.Get_rank() << ",\"tid\":0,\"ts\":" << std::fixed
+                        << 1e6*(wall_time() + time_offset_) << "}\n]\n";
+            } else {
+                std::cerr << "!!! ERROR: TraceEvents cannot open file: "
+                        << file_name << "\n";
+            }
+            file.close();
+            std::vector<Event>().swap(events_);
+        }
+
 
     } // namespace profiling
 
@@ -335,9 +477,13 @@ namespace madness {
 
     // The constructor is private to enforce the singleton model
     ThreadPool::ThreadPool(int nthread) :
-            threads(nullptr), main_thread(), nthreads(nthread), finish(false)
+            threads(nullptr), main_thread(), rmi_thread(), rmi_base(nullptr),
+            nthreads(nthread), finish(false), node_queues(nullptr)
     {
         nfinished = 0;
+        nsleeping = 0;
+        nhipri = 0;
+        nnodes = 0;
         instance_ptr = this;
         if (nthreads < 0) nthreads = default_nthread();
         MADNESS_ASSERT(nthreads >= 0);
@@ -375,8 +521,21 @@ namespace madness {
             MADNESS_EXCEPTION("memory allocation failed", 0);
         }
 
+        // Route tasks by NUMA domain only if the threads stay in one
+        const int ntopo = Topology::instance().num_nodes();
+        if (ntopo > 1 && ThreadBase::binds_pool_threads()) {
+            // DQueue is cache-line aligned, which operator new[] does not honor
+            void* p;
+            if (posix_memalign(&p, 64, ntopo*sizeof(DQueue<PoolTaskInterface*>)))
+                MADNESS_EXCEPTION("memory allocation failed", 0);
+            node_queues = static_cast<DQueue<PoolTaskInterface*>*>(p);
+            for (int i=0; i<ntopo; ++i) new (node_queues+i) DQueue<PoolTaskInterface*>();
+            nnodes = ntopo;
+        }
+
         for (int i=0; i<nthreads; ++i) {
             threads[i].set_pool_thread_index(i);
+            threads[i].set_victim_seed((2463534242u + 2654435761u*(i+1)) | 1u);
             threads[i].start(pool_thread_main, (void *)(threads+i));
         }
 #endif
@@ -409,12 +568,20 @@ namespace madness {
 
     void ThreadPool::thread_main(ThreadPoolThread* const thread) {
         PROFILE_MEMBER_FUNC(ThreadPool);
-        thread->set_affinity(2, thread->get_pool_thread_index());
+        const int cpu = thread->set_affinity(2, thread->get_pool_thread_index());
+        thread->set_numa_node(Topology::instance().node_of_cpu(cpu));
 
 #define MULTITASK
 #ifdef  MULTITASK
+        // Look for work (including stealing) nspin times before blocking
+        // on the shared queue
         while (!finish) {
-            run_tasks(true, thread);
+            bool found = false;
+            for (int i=0; i<nspin && !found && !finish; ++i) {
+                found = run_tasks(false, thread);
+                if (!found) cpu_relax();
+            }
+            if (!found && !finish) run_tasks(true, thread);
         }
 #else
         while (!finish) {
@@ -441,6 +608,25 @@ namespace madness {
 
         ThreadBase::init_thread_key();
 
+        // Set before the threads start ... configured never to spin they
+        // block as soon as they run out of work
+#ifdef NEVER_SPIN
+        nspin = 0;
+#else
+        const char* mad_pool_spin = getenv("MAD_POOL_SPIN");
+        if(mad_pool_spin) {
+            std::stringstream ss(mad_pool_spin);
+            int n = -1;
+            if((ss >> n) && n >= 0) {
+                nspin = n;
+            }
+            else if(SafeMPI::COMM_WORLD.Get_rank() == 0) {
+                std::cout << "!!MADNESS WARNING: Invalid pool spin count.\n"
+                          << "!!MADNESS WARNING: MAD_POOL_SPIN = " << mad_pool_spin << "\n";
+            }
+        }
+#endif
+
         // Construct the thread pool singleton
         instance_ptr = new ThreadPool(nthread);
 
@@ -467,20 +653,21 @@ namespace madness {
         // Initialize the output file name for the task profiler.
         profiling::TaskProfiler::output_file_name_ =
                 getenv("MAD_TASKPROFILER_NAME");
+        const char* mad_taskprofiler_format = getenv("MAD_TASKPROFILER_FORMAT");
+        profiling::TaskProfiler::chrome_trace_ = mad_taskprofiler_format &&
+                (strcmp(mad_taskprofiler_format, "chrome") == 0);
         if(! profiling::TaskProfiler::output_file_name_) {
             if(SafeMPI::COMM_WORLD.Get_rank() == 0)
                 std::cerr
                     << "!!! WARNING: MAD_TASKPROFILER_NAME not set.\n"
                     << "!!! WARNING: There will be no task profile output.\n";
+        } else if(profiling::TaskProfiler::chrome_trace_) {
+            // Start the trace file
+            profiling::TraceEvents::begin();
         } else {
-            // Construct the actual output filename
-            std::stringstream file_name;
-            file_name << profiling::TaskProfiler::output_file_name_ << "_"
-                    << SafeMPI::COMM_WORLD.Get_rank() << "x"
-                    << ThreadPool::size() + 1;
-
             // Erase the profiler output file
-            std::ofstream file(file_name.str().c_str(), std::ios_base::out | std::ios_base::trunc);
+            std::ofstream file(profiling::TaskProfiler::file_name().c_str(),
+                    std::ios_base::out | std::ios_base::trunc);
             file.close();
         }
 #endif  // MADNESS_TASK_PROFILING
@@ -504,6 +691,8 @@ namespace madness {
 
 #ifdef MADNESS_TASK_PROFILING
         instance_ptr->main_thread.profiler().write_to_file();
+        instance_ptr->rmi_thread.profiler().write_to_file();
+        profiling::TraceEvents::write_to_file();
 #endif // MADNESS_TASK_PROFILING
 
         ThreadBase::delete_thread_key();
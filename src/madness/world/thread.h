@@ -39,8 +39,11 @@
 */
 
 #include <madness/world/dqueue.h>
+#include <madness/world/wsdeque.h>
 #include <madness/world/function_traits.h>
 #include <vector>
+#include <memory>
+#include <atomic>
 #include <cstddef>
 #include <cstdio>
 #include <pthread.h>
@@ -59,6 +62,8 @@ extern "C" {
 }
 #endif
 #include <sstream> // for std::istringstream
+#include <memory> // for std::unique_ptr
+#include <string>
 #include <cstring> // for strchr & strrchr
 #endif // MADNESS_TASK_PROFILING
 
@@ -99,6 +104,7 @@ namespace madness {
         static bool bind[3]; ///< \todo Brief description needed.
         static int cpulo[3]; ///< \todo Brief description needed.
         static int cpuhi[3]; ///< \todo Brief description needed.
+        static bool compact; ///< Bind threads in the order of Topology::compact().
         static pthread_key_t thread_key; ///< Thread id key.
 
         /// \todo Brief description needed.
@@ -192,12 +198,28 @@ namespace madness {
         /// \param[in] cpu Description needed.
         static void set_affinity_pattern(const bool bind[3], const int cpu[3]);
 
+        /// Bind threads compactly, following the host topology.
+
+        /// The main thread goes to the first CPU of Topology::compact()
+        /// and pool thread \c i to CPU <tt>i+1</tt> (modulo the number of
+        /// CPUs), so the pool fills the cores of one NUMA domain before the
+        /// next and uses SMT siblings last.  The RMI thread is not bound.
+        static void set_affinity_compact();
+
+        /// Test if pool threads are bound to CPUs.
+
+        /// \return True if each pool thread is bound to a single CPU.
+        static bool binds_pool_threads() {
+            return compact || bind[2];
+        }
+
         /// \todo Brief description needed.
 
         /// \todo Descriptions needed.
         /// \param[in] logical_id Description needed.
         /// \param[in] ind Description needed.
-        static void set_affinity(int logical_id, int ind=-1);
+        /// \return The CPU the thread is bound to, or -1 if it may run on several.
+        static int set_affinity(int logical_id, int ind=-1);
 
         /// \todo Brief description needed.
 
@@ -269,6 +291,8 @@ namespace madness {
     /// - \c nthread : indicates number of threads. 0 threads is interpreted
     ///   as 1 thread for backward compatibility and ease of specifying
     ///   defaults. The default value is 0 (==1).
+    /// - \c numa_node : the NUMA domain whose threads should preferably
+    ///   run the task. The default value is -1 (any).
     class TaskAttributes {
         unsigned long flags; ///< Byte-string storing the specified attributes.
 
@@ -277,6 +301,7 @@ namespace madness {
         static const unsigned long GENERATOR = 1ul<<8; ///< Mask for generator bit.
         static const unsigned long STEALABLE = GENERATOR<<1; ///< Mask for stealable bit.
         static const unsigned long HIGHPRIORITY = GENERATOR<<2; ///< Mask for priority bit.
+        static const unsigned long NUMANODE = 0xfful<<11; ///< Mask for NUMA domain byte (domain+1).
 
         /// Sets the attributes to the desired values.
 
@@ -372,6 +397,21 @@ namespace madness {
         	return n;
         }
 
+        /// Sets the NUMA domain whose threads should preferably run the task.
+
+        /// \param[in] node The domain, or -1 for any.
+        void set_numa_node(int node) {
+            MADNESS_ASSERT(node>=-1 && node<255);
+            flags = (flags & (~NUMANODE)) | ((unsigned long)(node+1) << 11);
+        }
+
+        /// Get the NUMA domain whose threads should preferably run the task.
+
+        /// \return The domain, or -1 for any.
+        int get_numa_node() const {
+            return int((flags & NUMANODE) >> 11) - 1;
+        }
+
         /// Serializes the attributes for I/O.
 
         /// tparam Archive The archive type.
@@ -472,6 +512,38 @@ namespace madness {
 
     namespace profiling {
 
+        /// Get the id of the calling thread in the trace output.
+
+        /// The main thread is 0, pool thread \c i is \c i+1, and any other
+        /// thread, i.e., the RMI server thread, is \c ThreadPool::size()+1.
+        /// \return The trace thread id.
+        int trace_thread_id();
+
+        /// Output one event in the Chrome trace-event JSON format.
+
+        /// The event is followed by a comma and a newline, so the events of
+        /// a process form a JSON array that is closed by \c TraceEvents::write_to_file.
+        /// Times are given in seconds, as from \c wall_time(), and written
+        /// in microseconds since the epoch. An argument is omitted if its key
+        /// is NULL.
+        /// \param[in,out] os The output stream.
+        /// \param[in] name The event name.
+        /// \param[in] cat The event category.
+        /// \param[in] ph The event phase: 'X' for a complete event or 'i'
+        ///     for an instant event, in which case \c stop is ignored.
+        /// \param[in] tid The trace thread id.
+        /// \param[in] start The start time.
+        /// \param[in] stop The stop time.
+        /// \param[in] key0 The name of the first argument.
+        /// \param[in] val0 The value of the first argument.
+        /// \param[in] key1 The name of the second argument.
+        /// \param[in] val1 The value of the second argument.
+        void print_trace_event(std::ostream& os, const std::string& name,
+                const char* cat, const char ph, const int tid,
+                const double start, const double stop,
+                const char* key0 = nullptr, const double val0 = 0.0,
+                const char* key1 = nullptr, const double val1 = 0.0);
+
         /// Task event class.
 
         /// This class is used to record the task trace information, including
@@ -482,15 +554,13 @@ namespace madness {
             std::pair<void*, unsigned short> id_; ///< Task identification information.
             unsigned short threads_; ///< Number of threads used by the task.
 
-            /// Print demangled symbol name.
+            /// Demangle a symbol name.
 
-            /// Add the demangled symbol name to \c os. If demangling fails,
-            /// the unmodified symbol name is used instead. If symbol is NULL,
-            /// "UNKNOWN" is used instead. A tab character is added after the
-            /// symbol name.
-            /// \param[in,out] os The output stream.
-            /// \param[in] symbol The symbol to add to the stream.
-            static void print_demangled(std::ostream& os, const char* symbol) {
+            /// If demangling fails, the unmodified symbol name is returned
+            /// instead. If symbol is NULL, "UNKNOWN" is returned instead.
+            /// \param[in] symbol The symbol to demangle.
+            /// \return The demangled symbol name.
+            static std::string demangle(const char* symbol) {
                 // Get the demagled symbol name
                 if(symbol) {
                     int status = 0;
@@ -499,15 +569,15 @@ namespace madness {
 #else
 		    char* name = cplus_demangle(symbol, DMGL_NO_OPTS);
 #endif
-                    // Append the demangled symbol name to the output stream
-                    if(status == 0) {
-                        os << name << "\t";
+                    if(status == 0 && name) {
+                        const std::string result(name);
                         free((void*)name);
+                        return result;
                     } else {
-                        os << symbol << "\t";
+                        return symbol;
                     }
                 } else {
-                    os << "UNKNOWN\t";
+                    return "UNKNOWN";
                 }
             }
 
@@ -539,8 +609,9 @@ namespace madness {
                 if(first) {
                     ++first;
                     const char* last = strrchr(first,'+');
-                    if(last)
-                        mangled_name.assign(first, (last - first) - 1);
+                    // The name is empty for symbols that are not exported
+                    if(last && last > first)
+                        mangled_name.assign(first, last - first);
                 }
 #endif // ON_A_MAC
 
@@ -550,6 +621,24 @@ namespace madness {
                 return mangled_name;
             }
 
+            /// Get the demangled name of the task function, member function, or object type.
+
+            /// \return The name, or "UNKNOWN" if it cannot be determined.
+            std::string function_name() const {
+                switch(id_.second) {
+                    case 1:
+                        {
+                            const std::string mangled_name = get_name();
+                            if(! mangled_name.empty())
+                                return demangle(mangled_name.c_str());
+                        }
+                        break;
+                    case 2:
+                        return demangle(static_cast<const char*>(id_.first));
+                }
+                return "UNKNOWN";
+            }
+
         public:
 
             // Only default constructors are needed.
@@ -594,24 +683,7 @@ namespace madness {
                         std::dec << std::noshowbase << "\t";
 
                 // Print the name
-                switch(te.id_.second) {
-                    case 1:
-                        {
-                            const std::string mangled_name = te.get_name();
-
-                            // Print the demangled name
-                            if(! mangled_name.empty())
-                                print_demangled(os, mangled_name.c_str());
-                            else
-                                os << "UNKNOWN\t";
-                        }
-                        break;
-                    case 2:
-                        print_demangled(os, static_cast<const char*>(te.id_.first));
-                        break;
-                    default:
-                        os << "UNKNOWN\t";
-                }
+                os << te.function_name() << "\t";
 
                 // Print:
                 // # of threads, submit time, start time, stop time
@@ -624,12 +696,27 @@ namespace madness {
                 return os;
             }
 
+            /// Output the task data as a Chrome trace event.
+
+            /// The event spans the run of the task; the time it waited in
+            /// the queue, from submit to start, and the number of threads
+            /// are given as arguments.
+            /// \param[in,out] os The output stream.
+            /// \param[in] tid The trace thread id (see \c trace_thread_id).
+            void print_trace(std::ostream& os, const int tid) const {
+                print_trace_event(os, function_name(), "task", 'X', tid,
+                        times_[1], times_[2], "wait_us", 1e6*(times_[1] - times_[0]),
+                        "threads", threads_);
+            }
+
         }; // class TaskEvent
 
         /// Task event list base class.
 
         /// This base class allows the data to be stored in a linked list.
         class TaskEventListBase {
+            friend class TaskProfiler;
+
         private:
             TaskEventListBase* next_; ///< The next task event in the list.
 
@@ -675,15 +762,22 @@ namespace madness {
             /// Print the events.
             virtual std::ostream& print_events(std::ostream&) const = 0;
 
+            /// Print the events as Chrome trace events.
+            virtual std::ostream& print_trace_events(std::ostream&) const = 0;
+
         }; // class TaskEventList
 
         /// A list of task events.
 
-        /// This object is used by the thread pool to record task data.
+        /// This object is used by the thread pool to record task data. The
+        /// ids of the thread that recorded the events are kept with them,
+        /// since the list may be written out by another thread.
         class TaskEventList : public TaskEventListBase {
         private:
             unsigned int n_; ///< The number of events recorded.
             std::unique_ptr<TaskEvent[]> events_; ///< The event array.
+            const int thread_id_; ///< The pool thread index of the recording thread.
+            const int tid_; ///< The trace thread id of the recording thread.
 
             TaskEventList(const TaskEventList&) = delete;
             TaskEventList& operator=(const TaskEventList&) = delete;
@@ -693,10 +787,14 @@ namespace madness {
             /// Default constructor.
 
             /// \param[in] nmax The maximum number of task events.
+            /// \param[in] thread_id The pool thread index of the recording thread.
+            /// \param[in] tid The trace thread id of the recording thread
+            ///     (see \c trace_thread_id).
             /// \todo Should nmax be stored? I think it used to be a template
             ///    parameter (N), which is no longer present.
-            TaskEventList(const unsigned int nmax) :
-                TaskEventListBase(), n_(0ul), events_(new TaskEvent[nmax])
+            TaskEventList(const unsigned int nmax, const int thread_id, const int tid) :
+                TaskEventListBase(), n_(0ul), events_(new TaskEvent[nmax]),
+                thread_id_(thread_id), tid_(tid)
             { }
 
             /// Virtual destructor.
@@ -719,9 +817,18 @@ namespace madness {
             /// \param[in,out] os The output stream.
             /// \return The modified output stream.
             virtual std::ostream& print_events(std::ostream& os) const {
-                const int thread_id = ThreadBase::this_thread()->get_pool_thread_index();
                 for(std::size_t i = 0; i < n_; ++i)
-                    os << thread_id << "\t" << events_[i] << std::endl;
+                    os << thread_id_ << "\t" << events_[i] << std::endl;
+                return os;
+            }
+
+            /// Print events recorded in this list as Chrome trace events.
+
+            /// \param[in,out] os The output stream.
+            /// \return The modified output stream.
+            virtual std::ostream& print_trace_events(std::ostream& os) const {
+                for(std::size_t i = 0; i < n_; ++i)
+                    events_[i].print_trace(os, tid_);
                 return os;
             }
 
@@ -750,6 +857,22 @@ namespace madness {
             /// `MAD_TASKPROFILER_NAME`.
             static const char* output_file_name_;
 
+            /// True if the output is a Chrome trace rather than a text table.
+
+            /// This variable is initialized by \c ThreadPool::begin and is
+            /// true if the environment variable `MAD_TASKPROFILER_FORMAT` is
+            /// `chrome`. The trace of each process is written to
+            /// `NAME_[rank]x[threads + 1].json` and can be loaded into
+            /// chrome://tracing or Perfetto; besides the tasks it holds the
+            /// fences and the active messages sent and handled (see
+            /// \c TraceEvents).
+            static bool chrome_trace_;
+
+            /// The name of the output file of this process.
+
+            /// \return The file name.
+            static std::string file_name();
+
         public:
             /// Default constructor.
             TaskProfiler()
@@ -769,12 +892,16 @@ namespace madness {
 
             /// Create a new task event list.
 
+            /// The list is stamped with the ids of the calling thread, which
+            /// records the events in it.
             /// \param[in] nmax The maximum number of elements that the list
             ///     can contain.
             /// \return A new task event list.
             TaskEventList* new_list(const std::size_t nmax) {
                 // Create a new event list
-                TaskEventList* list = new TaskEventList(nmax);
+                const ThreadBase* thread = ThreadBase::this_thread();
+                TaskEventList* list = new TaskEventList(nmax,
+                        thread ? thread->get_pool_thread_index() : -1, trace_thread_id());
 
                 // Append the list to the tail of the linked list
                 if(head_ != nullptr) {
@@ -793,13 +920,107 @@ namespace madness {
             /// function may be called more than once.
             ///
             /// \warning This function should only be called from the thread
-            /// that owns it, otherwise data will likely be corrupted.
+            /// that owns it, or once that thread has stopped recording,
+            /// otherwise data will likely be corrupted.
             ///
             /// \note This function is thread safe, in that it may be called by
             /// different objects in different threads simultaneously.
             void write_to_file();
         }; // class TaskProfiler
 
+        /// Runtime events for the Chrome trace.
+
+        /// Fences and active messages are recorded here, beside the task
+        /// events of \c TaskProfiler. Unlike tasks, they are recorded by any
+        /// thread, including the RMI server thread, so they are kept in one
+        /// list under a mutex. Nothing is recorded unless the trace output
+        /// was selected (see \c TaskProfiler::chrome_trace_).
+        class TraceEvents {
+            friend void print_trace_event(std::ostream&, const std::string&,
+                    const char*, const char, const int, const double, const double,
+                    const char*, const double, const char*, const double);
+
+        private:
+            /// A recorded event.
+            struct Event {
+                const char* name; ///< The event name.
+                const char* cat; ///< The event category.
+                char ph; ///< The event phase ('X' or 'i').
+                int tid; ///< The trace thread id.
+                double start; ///< The start time.
+                double stop; ///< The stop time.
+                const char* key0; ///< The name of the first argument.
+                double val0; ///< The value of the first argument.
+                const char* key1; ///< The name of the second argument.
+                double val1; ///< The value of the second argument.
+            };
+
+            static Mutex mutex_; ///< Mutex used to lock the event list.
+            static std::vector<Event> events_; ///< The recorded events.
+            static bool closed_; ///< True once the trace has been written.
+            static double time_offset_; ///< Epoch time minus \c wall_time().
+
+            /// Add an event to the list.
+            static void add(const Event& event);
+
+        public:
+            /// True if events are to be recorded.
+            static bool enabled() {
+                return TaskProfiler::chrome_trace_
+                        && TaskProfiler::output_file_name_ != nullptr;
+            }
+
+            /// Record an event that spans an interval of the calling thread.
+
+            /// \param[in] name The event name, which must be a literal.
+            /// \param[in] cat The event category, which must be a literal.
+            /// \param[in] start The start time.
+            /// \param[in] stop The stop time.
+            /// \param[in] key0 The name of the first argument or NULL.
+            /// \param[in] val0 The value of the first argument.
+            /// \param[in] key1 The name of the second argument or NULL.
+            /// \param[in] val1 The value of the second argument.
+            static void record(const char* name, const char* cat,
+                    const double start, const double stop,
+                    const char* key0 = nullptr, const double val0 = 0.0,
+                    const char* key1 = nullptr, const double val1 = 0.0)
+            {
+                if(enabled())
+                    add(Event{name, cat, 'X', trace_thread_id(), start, stop,
+                            key0, val0, key1, val1});
+            }
+
+            /// Record an instant event of the calling thread.
+
+            /// \param[in] name The event name, which must be a literal.
+            /// \param[in] cat The event category, which must be a literal.
+            /// \param[in] time The time of the event.
+            /// \param[in] key0 The name of the first argument or NULL.
+            /// \param[in] val0 The value of the first argument.
+            /// \param[in] key1 The name of the second argument or NULL.
+            /// \param[in] val1 The value of the second argument.
+            static void instant(const char* name, const char* cat,
+                    const double time,
+                    const char* key0 = nullptr, const double val0 = 0.0,
+                    const char* key1 = nullptr, const double val1 = 0.0)
+            {
+                if(enabled())
+                    add(Event{name, cat, 'i', trace_thread_id(), time, time,
+                            key0, val0, key1, val1});
+            }
+
+            /// Start the trace file of this process.
+
+            /// Truncates the file and writes the process and thread names.
+            static void begin();
+
+            /// Write the recorded events and close the trace file.
+
+            /// This is called by \c ThreadPool::end after the task events
+            /// of all threads have been written; later events are dropped.
+            static void write_to_file();
+        }; // class TraceEvents
+
     } // namespace profiling
 
 #endif // MADNESS_TASK_PROFILING
@@ -1089,11 +1310,59 @@ namespace madness {
 #ifdef MADNESS_TASK_PROFILING
         profiling::TaskProfiler profiler_; ///< \todo Description needed.
 #endif // MADNESS_TASK_PROFILING
+        WSDeque<PoolTaskInterface*> deque_; ///< Tasks submitted by this thread.
+        unsigned int seed_; ///< State of the generator for steal victims.
+        int numa_node_; ///< NUMA domain the thread is bound to, or -1.
 
     public:
-        ThreadPoolThread() : Thread() { }
+        ThreadPoolThread() : Thread(), deque_(1024), seed_(2463534242u), numa_node_(-1) { }
         virtual ~ThreadPoolThread() = default;
 
+        /// The NUMA domain the thread is bound to.
+
+        /// \return The domain, or -1 if the thread is not bound to one.
+        int numa_node() const {
+            return numa_node_;
+        }
+
+        /// Record the NUMA domain the thread is bound to.
+
+        /// \param[in] node The domain, or -1.
+        void set_numa_node(int node) {
+            numa_node_ = node;
+        }
+
+        /// Tasks submitted by this thread.
+
+        /// Only this thread may push and pop; other threads steal.
+        /// \return The deque of this thread.
+        WSDeque<PoolTaskInterface*>& deque() {
+            return deque_;
+        }
+
+        /// Seed the generator for steal victims.
+
+        /// \param[in] seed The seed, which must not be zero.
+        void set_victim_seed(unsigned int seed) {
+            seed_ = seed;
+        }
+
+        /// Random index in [0,n) of a thread to steal from (xorshift).
+
+        /// Threads outside the pool share the placeholder of the main
+        /// thread, so they keep the state of the generator in thread
+        /// local storage rather than in \c seed_.
+        /// \param[in] n The number of threads.
+        /// \return The index.
+        int random_victim(int n) {
+            static thread_local unsigned int local_seed = 2463534242u;
+            unsigned int& seed = (get_pool_thread_index() >= 0) ? seed_ : local_seed;
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            return seed % n;
+        }
+
 #ifdef MADNESS_TASK_PROFILING
         /// Task profiler accessor.
 
@@ -1107,6 +1376,23 @@ namespace madness {
 
     /// A singleton pool of threads for dynamic execution of tasks.
 
+    /// Each pool thread keeps the single-threaded tasks that it submits in
+    /// its own work-stealing deque and runs the most recent first.  Tasks
+    /// submitted by other threads, high-priority tasks and multi-threaded
+    /// tasks go through the shared queue, as do all tasks while some pool
+    /// thread is asleep (so that it is woken).  A thread looks for work in
+    /// the shared queue if it holds a high-priority task, then in its own
+    /// deque, then in the shared queue, and finally steals the oldest task
+    /// of another thread, sweeping all threads from a random one.  A push
+    /// onto a deque or a domain queue that races with a thread going to
+    /// sleep wakes a sleeper with a null task on the shared queue.
+    ///
+    /// When the pool threads are bound on a host with several NUMA
+    /// domains, a task whose attributes name another domain than that of
+    /// the submitting thread waits in the queue of that domain.  Threads
+    /// look in the queue of their domain right after their own deque, and
+    /// steal from threads of their own domain first.
+    ///
     /// \attention You must instantiate the pool while running with just one
     /// thread.
     class ThreadPool {
@@ -1116,10 +1402,16 @@ namespace madness {
         // Thread pool data
         ThreadPoolThread *threads; ///< Array of threads.
         ThreadPoolThread main_thread; ///< Placeholder for main thread tls.
+        ThreadPoolThread rmi_thread; ///< Placeholder for the RMI server thread.
+        const ThreadBase* rmi_base; ///< The RMI server thread, if started.
         DQueue<PoolTaskInterface*> queue; ///< Queue of tasks.
         int nthreads; ///< Number of threads.
         volatile bool finish; ///< Set to true when time to stop.
         AtomicInt nfinished; ///< Thread pool exit counter.
+        AtomicInt nsleeping; ///< Number of threads blocked on the shared queue.
+        AtomicInt nhipri; ///< Number of high-priority tasks in the shared queue.
+        int nnodes; ///< Number of NUMA domains with a queue (0 if not used).
+        DQueue<PoolTaskInterface*>* node_queues; ///< Tasks meant for each NUMA domain (cache aligned).
 
         // Static data
         static ThreadPool* instance_ptr; ///< Singleton pointer.
@@ -1129,6 +1421,7 @@ namespace madness {
         // nmax WAS 100 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! DEBUG
         static const int nmax = 128; ///< \todo Description needed.
         static double await_timeout; ///< Waiter timeout.
+        static int nspin; ///< Tries to find work before an idle pool thread blocks (\c MAD_POOL_SPIN).
 
 #if defined(HAVE_IBMBGQ) and defined(HPM)
 	static unsigned int main_hpmctx; ///< HPM context for main thread.
@@ -1149,6 +1442,100 @@ namespace madness {
         /// \return The number of threads.
         int default_nthread();
 
+#if !HAVE_INTEL_TBB
+        /// Take up to \c nmax tasks off the front of the shared queue.
+
+        /// \param[in] nmax The maximum number of tasks.
+        /// \param[out] r Array of at least \c nmax tasks.
+        /// \param[in] wait Block until a task is available if true.
+        /// \return The number of tasks taken ... might be zero.
+        int pop_shared(int nmax, PoolTaskInterface** r, bool wait) {
+            const int ntask = queue.pop_front(nmax, r, wait);
+            for (int i=0; i<ntask; ++i) {
+                if (r[i] && r[i]->is_high_priority() && r[i]->get_nthread() == 1)
+                    nhipri--;
+            }
+            return ntask;
+        }
+
+        /// Take up to \c nmax tasks meant for a NUMA domain.
+
+        /// \param[in] node The domain, or -1 for the first domain with tasks.
+        /// \param[in] nmax The maximum number of tasks.
+        /// \param[out] r Array of at least \c nmax tasks.
+        /// \return The number of tasks taken ... might be zero.
+        int pop_node(int node, int nmax, PoolTaskInterface** r) {
+            for (int n=0; n<nnodes; ++n) {
+                if ((node < 0 || node == n) && !node_queues[n].empty()) {
+                    const int ntask = node_queues[n].pop_front(nmax, r, false);
+                    if (ntask) return ntask;
+                }
+            }
+            return 0;
+        }
+
+        /// Steal one task from another pool thread.
+
+        /// Every thread is tried once, starting from a randomly chosen
+        /// one, so a task is only missed if another thread takes it
+        /// first.  Threads in the NUMA domain of the thief are tried first.
+        /// \param[in,out] this_thread The calling thread.
+        /// \param[out] task The stolen task.
+        /// \return True if a task was stolen.
+        bool steal(ThreadPoolThread* const this_thread, PoolTaskInterface*& task) {
+            if (nthreads == 0) return false;
+            const int node = this_thread->numa_node();
+            const int start = this_thread->random_victim(nthreads);
+            for (int pass=((nnodes && node >= 0) ? 0 : 1); pass<2; ++pass) {
+                for (int i=0; i<nthreads; ++i) {
+                    ThreadPoolThread* const victim = threads + (start+i)%nthreads;
+                    if (victim == this_thread || (pass == 0 && victim->numa_node() != node))
+                        continue;
+                    if (victim->deque().steal(task)) return true;
+                }
+            }
+            return false;
+        }
+
+        /// Take the next tasks for this thread to run.
+
+        /// \param[in] nmax The maximum number of tasks.
+        /// \param[out] r Array of at least \c nmax tasks.
+        /// \param[in] wait Block on the shared queue if no task is found.
+        /// \param[in,out] this_thread The calling thread.
+        /// \return The number of tasks taken ... might be zero.
+        int pop_tasks(int nmax, PoolTaskInterface** r, bool wait, ThreadPoolThread* const this_thread) {
+            const bool pool_thread = (this_thread->get_pool_thread_index() >= 0);
+            if (nhipri > 0) {
+                const int ntask = pop_shared(nmax, r, false);
+                if (ntask) return ntask;
+            }
+            if (pool_thread && this_thread->deque().pop(*r)) return 1;
+            if (nnodes && pool_thread && this_thread->numa_node() >= 0) {
+                const int ntask = pop_node(this_thread->numa_node(), nmax, r);
+                if (ntask) return ntask;
+            }
+            if (!queue.empty()) {
+                const int ntask = pop_shared(nmax, r, false);
+                if (ntask) return ntask;
+            }
+            if (steal(this_thread, *r)) return 1;
+            if (nnodes) {
+                const int ntask = pop_node(-1, nmax, r);
+                if (ntask) return ntask;
+            }
+            if (!wait) return 0;
+
+            // Tasks are routed to the shared queue while we are counted
+            // as sleeping, so look once more before blocking on it
+            nsleeping++;
+            int ntask = steal(this_thread, *r) ? 1 : pop_node(-1, nmax, r);
+            if (!ntask) ntask = pop_shared(nmax, r, true);
+            nsleeping--;
+            return ntask;
+        }
+#endif // !HAVE_INTEL_TBB
+
         /// Run the next task.
 
         /// \todo Verify and complete this documentation.
@@ -1160,21 +1547,22 @@ namespace madness {
             MADNESS_EXCEPTION("run_task should not be called when using Intel TBB", 1);
 #else
 
-            if (!wait && queue.empty()) return false;
-            std::pair<PoolTaskInterface*,bool> t = queue.pop_front(wait);
+            PoolTaskInterface* task;
+            const int ntask = pop_tasks(1, &task, wait, this_thread);
 #ifdef MADNESS_TASK_PROFILING
+            // Idle passes must not leave empty lists behind
             profiling::TaskEventList* event_list =
-                    this_thread->profiler().new_list(1);
+                    (ntask && task) ? this_thread->profiler().new_list(1) : nullptr;
 #endif // MADNESS_TASK_PROFILING
             // Task pointer might be zero due to stealing
-            if (t.second && t.first) {
+            if (ntask && task) {
 #ifdef MADNESS_TASK_PROFILING
-                t.first->set_event(event_list->event());
+                task->set_event(event_list->event());
 #endif // MADNESS_TASK_PROFILING
-                if (t.first->run_multi_threaded())         // What we are here to do
-                    delete t.first;
+                if (task->run_multi_threaded())         // What we are here to do
+                    delete task;
             }
-            return t.second;
+            return ntask;
 #endif
         }
 
@@ -1200,10 +1588,11 @@ namespace madness {
 #else
 
             PoolTaskInterface* taskbuf[nmax];
-            int ntask = queue.pop_front(nmax, taskbuf, wait);
+            int ntask = pop_tasks(nmax, taskbuf, wait, this_thread);
 #ifdef MADNESS_TASK_PROFILING
+            // Idle passes must not leave empty lists behind
             profiling::TaskEventList* event_list =
-                    this_thread->profiler().new_list(ntask);
+                    (ntask > 0) ? this_thread->profiler().new_list(ntask) : nullptr;
 #endif // MADNESS_TASK_PROFILING
             for (int i=0; i<ntask; ++i) {
                 if (taskbuf[i]) { // Task pointer might be zero due to stealing
@@ -1278,20 +1667,44 @@ namespace madness {
             }
 #else
             if (!task) MADNESS_EXCEPTION("ThreadPool: inserting a NULL task pointer", 1);
+            ThreadPool* const pool = instance();
             int task_threads = task->get_nthread();
             // Currently multithreaded tasks must be shoved on the end of the q
             // to avoid a race condition as multithreaded task is starting up
             if (task->is_high_priority() && (task_threads == 1)) {
-                instance()->queue.push_front(task);
+                pool->nhipri++;
+                pool->queue.push_front(task);
+            }
+            else if (task_threads == 1 && pool->nsleeping == 0) {
+                ThreadPoolThread* const thread = static_cast<ThreadPoolThread*>(ThreadBase::this_thread());
+                const bool pool_thread = thread && thread->get_pool_thread_index() >= 0;
+                // A task meant for another NUMA domain than that of the
+                // submitter waits in the queue of that domain, also if
+                // submitted from outside the pool (e.g., by the RMI server)
+                const int node = pool->nnodes ? task->get_numa_node() : -1;
+                if (node >= 0 && !(pool_thread && node%pool->nnodes == thread->numa_node()))
+                    pool->node_queues[node%pool->nnodes].push_back(task);
+                else if (pool_thread)
+                    thread->deque().push(task);
+                else {
+                    pool->queue.push_back(task);
+                    return;
+                }
+
+                // A thread that went to sleep after nsleeping was read
+                // may have missed the task, so wake one
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (pool->nsleeping > 0) pool->queue.push_back(nullptr);
             }
             else {
-                instance()->queue.push_back(task, task_threads);
+                pool->queue.push_back(task, task_threads);
             }
 #endif // HAVE_INTEL_TBB
         }
 
         /// \todo Brief description needed.
 
+        /// Only the shared queue is scanned, not the deques of the threads.
         /// \todo Descriptions needed.
         /// \tparam opT Description needed.
         /// \param[in,out] op Description needed.
@@ -1336,16 +1749,27 @@ namespace madness {
             return false;
 #else
 
-#ifdef MADNESS_TASK_PROFILING
-            ThreadPoolThread* const thread = static_cast<ThreadPoolThread*>(ThreadBase::this_thread());
-#else
-            ThreadPoolThread* const thread = nullptr;
-#endif // MADNESS_TASK_PROFILING
-
-            return instance()->run_tasks(false, thread);
+            // The RMI server has its own placeholder; other threads
+            // outside the pool share that of the main thread
+            ThreadPool* const pool = instance();
+            ThreadBase* const base = ThreadBase::this_thread();
+            ThreadPoolThread* thread = &pool->main_thread;
+            if (base && base->get_pool_thread_index() >= 0)
+                thread = static_cast<ThreadPoolThread*>(base);
+            else if (base && base == pool->rmi_base)
+                thread = &pool->rmi_thread;
+
+            return pool->run_tasks(false, thread);
 #endif // HAVE_INTEL_TBB
         }
 
+        /// Record the RMI server thread, which gets its own placeholder.
+
+        /// \param[in] rmi The RMI server thread.
+        static void set_rmi_thread(const ThreadBase* rmi) {
+            instance()->rmi_base = rmi;
+        }
+
         /// Returns the number of threads in the pool.
 
         /// \return The number of threads in the pool.
@@ -1355,9 +1779,30 @@ namespace madness {
 
         /// Returns the number of tasks in the queue.
 
-        /// \return The number of tasks in the queue.
+        /// \return The number of tasks in the shared queue, in the
+        ///     deques of the pool threads and in the queues of the NUMA
+        ///     domains (approximate).
         static std::size_t queue_size() {
-            return instance()->queue.size();
+            const ThreadPool* const pool = instance();
+            std::size_t n = pool->queue.size();
+#if !HAVE_INTEL_TBB
+            for (int i=0; i<pool->nthreads; ++i)
+                n += pool->threads[i].deque().size();
+            for (int i=0; i<pool->nnodes; ++i)
+                n += pool->node_queues[i].size();
+#endif
+            return n;
+        }
+
+        /// Number of NUMA domains the pool routes tasks to.
+
+        /// Tasks carrying a NUMA domain (TaskAttributes::set_numa_node())
+        /// are only routed when pool threads are bound and the host has
+        /// more than one domain, and not while pool threads sleep on the
+        /// shared queue, since only that queue wakes them.
+        /// \return The number of domains, or 0 if tasks are not routed by domain.
+        static int numa_nodes() {
+            return instance()->nnodes;
         }
 
         /// Returns queue statistics.
@@ -0,0 +1,204 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+/**
+ \file topology.cc
+ \brief Implements Topology.
+ \ingroup threads
+*/
+
+#include <madness/world/topology.h>
+#include <madness/world/thread.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace madness {
+
+    namespace {
+
+        /// Parse a list of CPUs or nodes in the kernel format (e.g. "0-3,8,10-11")
+        std::vector<int> parse_list(const std::string& s) {
+            std::vector<int> result;
+            std::istringstream in(s);
+            std::string range;
+            while (std::getline(in, range, ',')) {
+                int lo, hi;
+                const std::size_t dash = range.find('-');
+                if (std::istringstream(range.substr(0,dash)) >> lo) {
+                    hi = lo;
+                    if (dash != std::string::npos) std::istringstream(range.substr(dash+1)) >> hi;
+                    for (int i=lo; i<=hi; ++i) result.push_back(i);
+                }
+            }
+            return result;
+        }
+
+        /// Read the first line of a file ... empty if it cannot be read
+        std::string read_line(const std::string& filename) {
+            std::ifstream f(filename.c_str());
+            std::string line;
+            if (f) std::getline(f, line);
+            return line;
+        }
+
+        /// Read an integer from a file ... dflt if it cannot be read
+        int read_int(const std::string& filename, int dflt) {
+            int value;
+            std::istringstream in(read_line(filename));
+            if (in >> value) return value;
+            return dflt;
+        }
+
+    } // namespace
+
+    Topology::Topology() : ncore(0), nsocket(0) {
+        const std::string sys = "/sys/devices/system/";
+
+        // The CPUs this process may run on
+        std::vector<int> ids;
+#if defined(__linux__)
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+            for (int i=0; i<CPU_SETSIZE; ++i)
+                if (CPU_ISSET(i, &mask)) ids.push_back(i);
+        }
+#endif
+        if (ids.empty()) {
+            const int ncpu = ThreadBase::num_hw_processors();
+            for (int i=0; i<ncpu; ++i) ids.push_back(i);
+        }
+
+        // NUMA domains ... the index of a domain is its rank among those
+        // with a usable CPU
+        std::vector<int> os_node(ids.back()+1, -1);
+        const std::vector<int> online = parse_list(read_line(sys + "node/online"));
+        for (std::size_t n=0; n<online.size(); ++n) {
+            std::ostringstream name;
+            name << sys << "node/node" << online[n] << "/cpulist";
+            const std::vector<int> list = parse_list(read_line(name.str()));
+            for (std::size_t i=0; i<list.size(); ++i)
+                if (list[i] < int(os_node.size())) os_node[list[i]] = online[n];
+        }
+
+        node_of_cpu_.assign(ids.back()+1, -1);
+        std::set< std::pair<int,int> > cores;
+        std::set<int> sockets;
+        for (std::size_t i=0; i<ids.size(); ++i) {
+            std::ostringstream dir;
+            dir << sys << "cpu/cpu" << ids[i] << "/topology/";
+
+            CPU cpu;
+            cpu.id = ids[i];
+            cpu.socket = std::max(0, read_int(dir.str() + "physical_package_id", 0));
+            cpu.core = read_int(dir.str() + "core_id", ids[i]);
+            const std::vector<int> siblings = parse_list(read_line(dir.str() + "thread_siblings_list"));
+            cpu.smt = std::max(0, int(std::find(siblings.begin(), siblings.end(), ids[i]) - siblings.begin()));
+            if (cpu.smt >= int(siblings.size())) cpu.smt = 0;
+
+            const int osnode = std::max(0, os_node[ids[i]]);
+            std::vector<int>::iterator it = std::find(node_ids_.begin(), node_ids_.end(), osnode);
+            cpu.node = it - node_ids_.begin();
+            if (it == node_ids_.end()) node_ids_.push_back(osnode);
+
+            node_of_cpu_[cpu.id] = cpu.node;
+            cores.insert(std::make_pair(cpu.socket, cpu.core));
+            sockets.insert(cpu.socket);
+            cpus_.push_back(cpu);
+        }
+        ncore = cores.size();
+        nsocket = sockets.size();
+
+        // Compact binding: first hardware thread of each core filling one
+        // domain after the other, then the SMT siblings
+        std::vector<CPU> order(cpus_);
+        std::stable_sort(order.begin(), order.end(), [](const CPU& a, const CPU& b) {
+            if (a.smt != b.smt) return a.smt < b.smt;
+            if (a.node != b.node) return a.node < b.node;
+            if (a.socket != b.socket) return a.socket < b.socket;
+            return a.core < b.core;
+        });
+        for (std::size_t i=0; i<order.size(); ++i) compact_.push_back(order[i].id);
+    }
+
+    const Topology& Topology::instance() {
+        static const Topology topology;
+        return topology;
+    }
+
+    int Topology::current_cpu() {
+#if defined(__linux__)
+        return sched_getcpu();
+#else
+        return -1;
+#endif
+    }
+
+    bool Topology::place_local(void* p, std::size_t nbytes) const {
+#if defined(__linux__) && defined(SYS_mbind)
+        if (num_nodes() <= 1) return false;
+        const int node = current_node();
+        if (node < 0) return false;
+
+        // Whole pages inside the buffer
+        const std::size_t page = sysconf(_SC_PAGESIZE);
+        const std::size_t lo = (reinterpret_cast<std::size_t>(p) + page - 1) & ~(page - 1);
+        const std::size_t hi = (reinterpret_cast<std::size_t>(p) + nbytes) & ~(page - 1);
+        if (hi <= lo) return false;
+
+        const int mpol_preferred = 1; // MPOL_PREFERRED from linux/mempolicy.h
+        unsigned long nodemask[4] = {0, 0, 0, 0};
+        const int osnode = node_ids_[node];
+        if (osnode >= int(8*sizeof(nodemask))) return false;
+        nodemask[osnode/(8*sizeof(unsigned long))] |= 1ul << (osnode%(8*sizeof(unsigned long)));
+        return syscall(SYS_mbind, lo, hi-lo, mpol_preferred, nodemask, 8*sizeof(nodemask), 0) == 0;
+#else
+        return false;
+#endif
+    }
+
+    void Topology::print(std::ostream& s) const {
+        s << num_cpus() << " cpus on " << num_cores() << " cores, " << num_sockets()
+          << " sockets and " << num_nodes() << " NUMA domains";
+    }
+
+} // namespace madness
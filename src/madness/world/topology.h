@@ -0,0 +1,161 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+#ifndef MADNESS_WORLD_TOPOLOGY_H__INCLUDED
+#define MADNESS_WORLD_TOPOLOGY_H__INCLUDED
+
+/**
+ \file topology.h
+ \brief Discovers the sockets, NUMA domains and SMT siblings of the host.
+ \ingroup threads
+*/
+
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+
+namespace madness {
+
+    /// \addtogroup threads
+    /// @{
+
+    /// Processor topology of the host as seen by this process.
+
+    /// Read once from `/sys/devices/system` and restricted to the CPUs in
+    /// the affinity mask of the process at the first call to instance()
+    /// (which initialize() makes before binding any thread), so binding by
+    /// the MPI launcher is respected.  Where `/sys` is not available every
+    /// CPU is taken to be a core of its own in one socket and NUMA domain.
+    class Topology {
+    public:
+        /// A hardware thread.
+        struct CPU {
+            int id;     ///< Operating system number of the CPU.
+            int socket; ///< Physical package.
+            int core;   ///< Core within the package.
+            int node;   ///< Index of the NUMA domain in [0,num_nodes()).
+            int smt;    ///< Position among the hardware threads of its core.
+        };
+
+    private:
+        std::vector<CPU> cpus_; ///< Usable CPUs ordered by id.
+        std::vector<int> node_ids_; ///< Operating system number of each NUMA domain.
+        std::vector<int> node_of_cpu_; ///< NUMA domain indexed by CPU id, -1 if unusable.
+        std::vector<int> compact_; ///< CPU ids in the order of compact binding.
+        int ncore; ///< Number of usable cores.
+        int nsocket; ///< Number of sockets with usable CPUs.
+
+        Topology();
+
+        Topology(const Topology&) = delete;
+        Topology& operator=(const Topology&) = delete;
+
+    public:
+        /// The topology of this host, discovered at the first call.
+
+        /// \return The topology.
+        static const Topology& instance();
+
+        /// The usable CPUs.
+
+        /// \return The CPUs ordered by id.
+        const std::vector<CPU>& cpus() const {
+            return cpus_;
+        }
+
+        /// \return The number of usable CPUs (hardware threads).
+        int num_cpus() const {
+            return cpus_.size();
+        }
+
+        /// \return The number of cores with a usable CPU.
+        int num_cores() const {
+            return ncore;
+        }
+
+        /// \return The number of sockets with a usable CPU.
+        int num_sockets() const {
+            return nsocket;
+        }
+
+        /// \return The number of NUMA domains with a usable CPU.
+        int num_nodes() const {
+            return node_ids_.size();
+        }
+
+        /// The NUMA domain of a CPU.
+
+        /// \param[in] cpu The operating system number of the CPU.
+        /// \return The index of its NUMA domain or -1 if the CPU is not usable.
+        int node_of_cpu(int cpu) const {
+            return (cpu >= 0 && cpu < int(node_of_cpu_.size())) ? node_of_cpu_[cpu] : -1;
+        }
+
+        /// CPUs in the order in which compact binding places threads.
+
+        /// One hardware thread of every core of the first NUMA domain, then
+        /// of the next domain, and so on; the remaining SMT siblings follow
+        /// in the same order.
+        /// \return The CPU ids.
+        const std::vector<int>& compact() const {
+            return compact_;
+        }
+
+        /// \return The CPU the calling thread is running on, or -1 if unknown.
+        static int current_cpu();
+
+        /// \return The NUMA domain the calling thread is running on, or -1 if unknown.
+        int current_node() const {
+            return node_of_cpu(current_cpu());
+        }
+
+        /// Ask that the pages of a buffer be placed in the NUMA domain of the caller.
+
+        /// Only whole pages inside the buffer are affected, and only pages
+        /// not yet touched are moved by the kernel's first-touch policy, so
+        /// call it right after allocation.  Does nothing on a host with a
+        /// single NUMA domain.
+        /// \param[in] p The buffer.
+        /// \param[in] nbytes Its size in bytes.
+        /// \return True if the placement was applied.
+        bool place_local(void* p, std::size_t nbytes) const;
+
+        /// Print a one line summary.
+
+        /// \param[in,out] s The output stream.
+        void print(std::ostream& s) const;
+    };
+
+    /// @}
+
+} // namespace madness
+
+#endif // MADNESS_WORLD_TOPOLOGY_H__INCLUDED
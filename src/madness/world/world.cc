@@ -41,6 +41,7 @@
 #include <madness/world/worldam.h>
 #include <madness/world/world_task_queue.h>
 #include <madness/world/worldgop.h>
+#include <madness/world/topology.h>
 #include <cstdlib>
 #include <sstream>
 
@@ -140,23 +141,31 @@ namespace madness {
         bool bind[3];
         int cpulo[3];
 
+        // Discover the topology while the affinity mask is still that of the process
+        const Topology& topology = Topology::instance();
+
         const char* sbind = getenv("MAD_BIND");
         if (!sbind) sbind = MAD_BIND_DEFAULT;
-        std::istringstream s(sbind);
-        for (int i=0; i<3; ++i) {
-            int t;
-            s >> t;
-            if (t < 0) {
-                bind[i] = false;
-                cpulo[i] = 0;
-            }
-            else {
-                bind[i] = true;
-                cpulo[i] = t;
-            }
+        if (std::string(sbind) == "compact") {
+            ThreadBase::set_affinity_compact();
         }
+        else {
+            std::istringstream s(sbind);
+            for (int i=0; i<3; ++i) {
+                int t;
+                s >> t;
+                if (t < 0) {
+                    bind[i] = false;
+                    cpulo[i] = 0;
+                }
+                else {
+                    bind[i] = true;
+                    cpulo[i] = t;
+                }
+            }
 
-        ThreadBase::set_affinity_pattern(bind, cpulo); // Decide how to locate threads before doing anything
+            ThreadBase::set_affinity_pattern(bind, cpulo); // Decide how to locate threads before doing anything
+        }
         ThreadBase::set_affinity(0);         // The main thread is logical thread 0
 
 #if defined(HAVE_IBMBGQ) and defined(HPM)
@@ -195,9 +204,15 @@ namespace madness {
         World::default_world = new World(comm);
 
         madness_initialized_ = true;
-        if(SafeMPI::COMM_WORLD.Get_rank() == 0)
+        if(SafeMPI::COMM_WORLD.Get_rank() == 0) {
             std::cout << "MADNESS runtime initialized with " << ThreadPool::size()
                 << " threads in the pool and affinity " << sbind << "\n";
+            if (ThreadPool::numa_nodes() || std::string(sbind) == "compact") {
+                std::cout << "MADNESS host topology: ";
+                topology.print(std::cout);
+                std::cout << "\n";
+            }
+        }
 
         return * World::default_world;
     }
@@ -205,6 +220,9 @@ namespace madness {
     void finalize() {
         World::default_world->gop.fence();
 
+        // Free hash map entries whose deletion was deferred for lock-free readers
+        Hash_private::Epoch::flush();
+
         // Destroy the default world
         delete World::default_world;
         World::default_world = nullptr;
@@ -243,6 +261,14 @@ namespace madness {
         world.gop.sum(nbyte_sent);
         world.gop.sum(nbyte_recv);
 
+        double nbatch_sent = rmi.nbatch_sent;
+        double nmsg_batched_sent = rmi.nmsg_batched_sent;
+        world.gop.sum(nbatch_sent);
+        world.gop.sum(nmsg_batched_sent);
+
+        double nmsg_shm_sent = rmi.nmsg_shm_sent;
+        world.gop.sum(nmsg_shm_sent);
+
         double max_nmsg_sent = rmi.nmsg_sent;
         double max_nmsg_recv = rmi.nmsg_recv;
         double max_nbyte_sent = rmi.nbyte_sent;
@@ -331,6 +357,12 @@ namespace madness {
                    min_nbyte_recv, nbyte_recv/world.size(), max_nbyte_recv);
             printf("        #msgs systemwide    %.2e\n", nmsg_sent);
             printf("       #bytes systemwide    %.2e\n", nbyte_sent);
+            if (nbatch_sent > 0) {
+                printf("     #batches systemwide    %.2e\n", nbatch_sent);
+                printf("  #msgs batched systemwide  %.2e\n", nmsg_batched_sent);
+            }
+            if (nmsg_shm_sent > 0)
+                printf("   #msgs via shm systemwide %.2e\n", nmsg_shm_sent);
             printf("\n");
             printf("  Thread pool statistics (min / avg / max)\n");
             printf("  ----------------------\n");
@@ -358,7 +390,7 @@ namespace madness {
             }
             printf("\n");
 #endif
-#ifdef WORLD_GATHER_MEM_STATS
+#if defined(WORLD_GATHER_MEM_STATS) || defined(MADNESS_TENSOR_POOL)
             world_mem_info()->print();
 #endif
 
@@ -32,10 +32,130 @@
 #include <madness/world/worldam.h>
 #include <madness/world/MADworld.h>
 #include <madness/world/worldmpi.h>
+#include <atomic>
 #include <sstream>
 
 namespace madness {
 
+    std::size_t am_attach_min() {
+        static const std::size_t nbyte = []() {
+            std::size_t n = 128*1024;
+            const char* mad_attach_min = getenv("MAD_AM_ATTACH_MIN");
+            if (mad_attach_min) {
+                // Only a plain count of bytes ... not e.g. "-1" or "1e6"
+                std::stringstream ss(mad_attach_min);
+                std::size_t value = 0;
+                char extra;
+                if ((ss >> std::ws).peek() != '-' && ss >> value && !(ss >> extra)) {
+                    n = value;
+                }
+                else if (SafeMPI::COMM_WORLD.Get_rank() == 0) {
+                    std::cerr << "!!! WARNING: Invalid MAD_AM_ATTACH_MIN = " << mad_attach_min << "\n"
+                              << "!!! WARNING: Using the default of " << n << " bytes.\n";
+                }
+            }
+            return n;
+        }();
+        return nbyte;
+    }
+
+    void AmArg::load_attachment(const void* context, long k, void* ptr, std::size_t nbyte) {
+        const AmArg* arg = static_cast<const AmArg*>(context);
+        MADNESS_ASSERT(k >= 0 && k < arg->nattach);
+        // In the pieces that the sender made
+        std::vector<SafeMPI::Request> req;
+        char* p = static_cast<char*>(ptr);
+        for (std::size_t nleft=nbyte; nleft;) {
+            const int n = attach_piece(nleft);
+            req.push_back(SafeMPI::COMM_WORLD.Irecv(p, n, MPI_BYTE,
+                    arg->attach_src, attach_mpi_tag(arg->attach_tag + k)));
+            p += n;
+            nleft -= n;
+        }
+        MutexWaiter waiter;
+        for (std::size_t i=0; i<req.size(); ++i)
+            while (!req[i].Test()) waiter.wait();
+    }
+
+    namespace {
+        /// Attachments in flight from this process, for all worlds
+        struct AmAttachSends {
+            Mutex mutex;
+            std::vector<unsigned int> next;         // Next tag index for each destination
+            std::vector< std::vector<bool> > busy;  // Tag indices in use for each destination
+            std::list<AmArg*> sent;                 // Messages whose attachments may still be in flight
+            std::atomic<long> nsent;                // Size of sent ... read without the mutex
+
+            AmAttachSends() : nsent(0) {}
+        };
+
+        AmAttachSends attach_sends;
+    }
+
+    int WorldAmInterface::reserve_attach_tags(ProcessID dest, int n) {
+        const int ntag = SafeMPI::AM_ATTACH_NTAG;
+        MADNESS_ASSERT(n > 0 && n <= ntag);
+        ScopedMutex<Mutex> safe(attach_sends.mutex);
+        if (attach_sends.busy.empty()) {
+            attach_sends.next.resize(SafeMPI::COMM_WORLD.Get_size(), 0);
+            attach_sends.busy.resize(SafeMPI::COMM_WORLD.Get_size());
+        }
+        std::vector<bool>& busy = attach_sends.busy[dest];
+        if (busy.empty()) busy.resize(ntag, false);
+        const unsigned int seq = attach_sends.next[dest];
+        for (int k=0; k<n; ++k)
+            if (busy[(seq + k) % ntag]) return -1;
+        for (int k=0; k<n; ++k)
+            busy[(seq + k) % ntag] = true;
+        attach_sends.next[dest] = (seq + n) % ntag;
+        return seq;
+    }
+
+    void WorldAmInterface::add_attach_send(AmArg* arg) {
+        ScopedMutex<Mutex> safe(attach_sends.mutex);
+        attach_sends.sent.push_back(arg);
+        ++attach_sends.nsent;
+    }
+
+    bool WorldAmInterface::free_attach_send(bool wait) {
+        if (attach_sends.nsent == 0) return true;
+        ScopedMutex<Mutex> safe(attach_sends.mutex);
+        for (std::list<AmArg*>::iterator it=attach_sends.sent.begin(); it!=attach_sends.sent.end();) {
+            detail::AmAttachments* a = (*it)->attachments;
+            bool done = true;
+            for (std::size_t k=0; k<a->req.size(); ++k) {
+                while (!a->req[k].Test()) {
+                    if (!wait) {
+                        done = false;
+                        break;
+                    }
+                    myusleep(100);
+                }
+                if (!done) break;
+            }
+            if (done) {
+                std::vector<bool>& busy = attach_sends.busy[a->dest];
+                for (int k=0; k<(*it)->nattach; ++k)
+                    busy[((*it)->attach_tag + k) % SafeMPI::AM_ATTACH_NTAG] = false;
+                free_am_arg(*it);
+                it = attach_sends.sent.erase(it);
+                --attach_sends.nsent;
+            }
+            else {
+                ++it;
+            }
+        }
+        return attach_sends.sent.empty();
+    }
+
+    void WorldAmInterface::discard_attach_send() {
+        ScopedMutex<Mutex> safe(attach_sends.mutex);
+        for (std::list<AmArg*>::iterator it=attach_sends.sent.begin(); it!=attach_sends.sent.end(); ++it)
+            free_am_arg(*it);
+        attach_sends.sent.clear();
+        attach_sends.nsent = 0;
+    }
+
 
 
     WorldAmInterface::WorldAmInterface(World& world)
@@ -89,6 +209,7 @@ namespace madness {
         if(SafeMPI::Is_finalized()) {
             for(int i=0; i < nsend; ++i)
                 free_managed_send_buf(i);
+            discard_attach_send();
         } else {
             for(int i=0; i < nsend; ++i) {
                 while (!send_req[i].Test()) {
@@ -96,6 +217,7 @@ namespace madness {
                 }
                 free_managed_send_buf(i);
             }
+            free_attach_send(true);
         }
     }
 
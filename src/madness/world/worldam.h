@@ -38,8 +38,11 @@
 #include <madness/world/buffer_archive.h>
 #include <madness/world/worldrmi.h>
 #include <madness/world/world.h>
+#include <algorithm>
 #include <vector>
+#include <list>
 #include <cstddef>
+#include <limits>
 #include <memory>
 
 namespace madness {
@@ -71,6 +74,22 @@ namespace madness {
 
     template <class Derived> class WorldObject;
 
+    namespace detail {
+        /// Large arrays sent beside an active message and the requests sending them
+        struct AmAttachments {
+            std::vector<archive::BufferAttachment> data;
+            std::vector<SafeMPI::Request> req;
+            ProcessID dest;     // Rank in COMM_WORLD of the process receiving them
+        };
+    }
+
+    /// Min. size in bytes of an array that is sent beside an active message
+
+    /// Set with the \c MAD_AM_ATTACH_MIN environment variable to a plain
+    /// number of bytes ... zero copies all arrays into the message.  Any
+    /// other value is ignored with a warning.
+    std::size_t am_attach_min();
+
     class AmArg;
     /// Type of AM handler functions
     typedef void (*am_handlerT)(const AmArg&);
@@ -82,6 +101,9 @@ namespace madness {
         template <class Derived> friend class WorldObject;
 
         friend AmArg* alloc_am_arg(std::size_t nbyte);
+        friend AmArg* copy_am_arg(const AmArg& arg);
+        friend void free_am_arg(AmArg* arg);
+        template <typename... argT> friend AmArg* new_am_arg(const argT&... args);
 
         unsigned char header[RMI::HEADER_LEN]; // !!!!!!!!!  MUST BE FIRST !!!!!!!!!!
         std::size_t nbyte;      // Size of user payload
@@ -89,9 +111,13 @@ namespace madness {
         am_handlerT func;       // User function to call
         ProcessID src;          // Rank of process sending the message
         unsigned int flags;     // Misc. bit flags
+        int nattach;            // No. of arrays sent beside the message
+        int attach_tag;         // Index of the MPI tag of the first of them (see attach_mpi_tag)
+        ProcessID attach_src;   // Rank in COMM_WORLD of the process sending them
+        detail::AmAttachments* attachments; // Arrays to send ... only valid in the sender
 
-        // On 32 bit machine AmArg is HEADER_LEN+4+4+4+4+4=84 bytes
-        // On 64 bit machine AmArg is HEADER_LEN+8+8+8+4+4=96 bytes
+        // On 32 bit machine AmArg is HEADER_LEN+4+4+4+4+4+4+4+4+4=100 bytes
+        // On 64 bit machine AmArg is HEADER_LEN+8+8+8+4+4+4+4+4+8=120 bytes
 
         // No copy constructor or assignment
         AmArg(const AmArg&);
@@ -117,11 +143,38 @@ namespace madness {
         am_handlerT get_func() const { return func; }
 
         archive::BufferInputArchive make_input_arch() const {
+            if (nattach)
+                return archive::BufferInputArchive(buf(),size(),&load_attachment,this);
             return archive::BufferInputArchive(buf(),size());
         }
 
         archive::BufferOutputArchive make_output_arch() const {
-            return archive::BufferOutputArchive(buf(),size());
+            return archive::BufferOutputArchive(buf(),size(),
+                    (attachments ? &attachments->data : nullptr), am_attach_min());
+        }
+
+        /// Receives an array sent beside this message
+        static void load_attachment(const void* arg, long k, void* ptr, std::size_t nbyte);
+
+        /// MPI tag of the attachment with tag index seq
+
+        /// The indices are taken in turn for each destination and are only
+        /// reused once the receiver has matched the last message with that
+        /// tag, so out of order receives cannot take each other's data.
+        static int attach_mpi_tag(long seq) {
+            return SafeMPI::AM_ATTACH_TAG + int(seq % SafeMPI::AM_ATTACH_NTAG);
+        }
+
+        /// Size of the next piece of an attachment with nleft bytes to go
+
+        /// The count of an MPI message is an int, so an attachment of 2GB
+        /// or more goes as several messages with the same tag, which MPI
+        /// keeps in order.
+        static int attach_piece(std::size_t nleft) {
+            const std::size_t nmax = std::size_t(std::numeric_limits<int>::max()) & ~std::size_t(RMI::ALIGNMENT-1);
+            const std::size_t n = std::min(nleft, nmax);
+            MADNESS_ASSERT(n > 0 && n <= std::size_t(std::numeric_limits<int>::max()));
+            return int(n);
         }
 
     public:
@@ -162,6 +215,8 @@ namespace madness {
         std::size_t narg = 1 + (nbyte+sizeof(AmArg)-1)/sizeof(AmArg);
         AmArg *arg = new AmArg[narg];
         arg->set_size(nbyte);
+        arg->nattach = 0;
+        arg->attachments = nullptr;
         return arg;
     }
 
@@ -169,11 +224,16 @@ namespace madness {
     inline AmArg* copy_am_arg(const AmArg& arg) {
         AmArg* r = alloc_am_arg(arg.size());
         memcpy(r, &arg, arg.size()+sizeof(AmArg));
+        if (arg.attachments) {
+            r->attachments = new detail::AmAttachments;
+            r->attachments->data = arg.attachments->data;
+        }
         return r;
     }
 
     /// Frees an AmArg allocated with alloc_am_arg
     inline void free_am_arg(AmArg* arg) {
+        delete arg->attachments;
         delete [] arg;
     }
 
@@ -188,19 +248,72 @@ namespace madness {
     }
 
     /// Convenience template for serializing arguments into a new AmArg
+
+    /// Arrays of at least \c am_attach_min() bytes that the arguments
+    /// attach (e.g., the data of a large \c Tensor) are not copied into
+    /// the message but are sent beside it straight from their own memory.
     template <typename... argT>
     inline AmArg* new_am_arg(const argT&... args) {
         // compute size
-        archive::BufferOutputArchive count;
+        archive::BufferOutputArchive count(am_attach_min());
         serialize_am_args(count, args...);
 
         // Serialize arguments
         AmArg* am_args = alloc_am_arg(count.size());
+        if (count.num_attachments()) {
+            am_args->attachments = new detail::AmAttachments;
+            am_args->nattach = count.num_attachments();
+        }
         serialize_am_args(*am_args, args...);
+        MADNESS_ASSERT(!am_args->attachments || long(am_args->attachments->data.size()) == am_args->nattach);
         return am_args;
     }
 
 
+    /// Message counts for one AM handler
+    struct AmHandlerStats {
+        am_handlerT func;           ///< The handler ... null if the slot is free
+        uint64_t nmsg;              ///< Messages for it
+    };
+
+    /// Counts of the active messages of one world by handler
+
+    /// All AMs reach RMI through one handler, so the RMI counts do
+    /// not tell them apart.
+    struct AmStats {
+        static const int NHANDLER = 64; ///< Handlers counted separately ... later ones are not
+        AmHandlerStats handler_sent[NHANDLER]; ///< Messages sent, by handler (under the AM lock)
+        AmHandlerStats handler_recv[NHANDLER]; ///< Messages received, by handler (by the server thread)
+
+        AmStats() : handler_sent(), handler_recv() {}
+
+        /// Counts of messages sent with handler \c func (zero if none were)
+        AmHandlerStats sent(am_handlerT func) const { return find(handler_sent, func); }
+
+        /// Counts of messages received with handler \c func (zero if none were)
+        AmHandlerStats recv(am_handlerT func) const { return find(handler_recv, func); }
+
+        /// Counts a message for \c func in \c table, taking a free slot if needed
+        static void count(AmHandlerStats* table, am_handlerT func) {
+            for (int i=0; i<NHANDLER; ++i) {
+                if (!table[i].func) table[i].func = func;
+                if (table[i].func == func) {
+                    ++(table[i].nmsg);
+                    return;
+                }
+            }
+        }
+
+    private:
+        static AmHandlerStats find(const AmHandlerStats* table, am_handlerT func) {
+            for (int i=0; i<NHANDLER && table[i].func; ++i)
+                if (table[i].func == func) return table[i];
+            AmHandlerStats none = {func, 0};
+            return none;
+        }
+    };
+
+
     /// Implements AM interface
     class WorldAmInterface : private SCALABLE_MUTEX_TYPE {
         friend class WorldGopInterface;
@@ -231,10 +344,34 @@ namespace madness {
 
         std::vector<int> map_to_comm_world; ///< Maps rank in current MPI communicator to SafeMPI::COMM_WORLD
 
+        AmStats stats; ///< Messages by handler
+
+        // Attachments use tags of COMM_WORLD, so their bookkeeping is
+        // shared by all worlds in the process (see worldam.cc)
+
+        /// Takes the tag indices of n attachments to dest ... -1 if one of them is still in use
+
+        /// \param[in] dest Rank in COMM_WORLD of the receiver
+        static int reserve_attach_tags(ProcessID dest, int n);
+
+        /// Takes over a sent message whose attachments may still be in flight
+        static void add_attach_send(AmArg* arg);
+
+        /// Frees messages whose attachments have been received and their tags ... true if none are left
+
+        /// \param[in] wait If true wait for all attachments to be received
+        static bool free_attach_send(bool wait=false);
+
+        /// Frees all messages with attachments without testing them ... once MPI is finalized
+        static void discard_attach_send();
+
         void free_managed_send_buf(int i) {
             // WE ASSUME WE ARE INSIDE A CRITICAL SECTION WHEN IN HERE
             if (managed_send_buf[i]) {
-                free_am_arg(managed_send_buf[i]);
+                if (managed_send_buf[i]->attachments)
+                    add_attach_send((AmArg*)(managed_send_buf[i]));
+                else
+                    free_am_arg(managed_send_buf[i]);
                 managed_send_buf[i] = 0;
             }
         }
@@ -245,11 +382,13 @@ namespace madness {
             // thread will invoke it ... however note that nrecv will
             // be read by the main thread during fence operations.
             AmArg* arg = static_cast<AmArg*>(buf);
+            arg->attachments = nullptr; // Was only valid in the sender
             am_handlerT func = arg->get_func();
             World* w = arg->get_world();
             MADNESS_ASSERT(arg->size() + sizeof(AmArg) == nbyte);
             MADNESS_ASSERT(w);
             MADNESS_ASSERT(func);
+            AmStats::count(w->am.stats.handler_recv, func);
             func(*arg);
             //world->am.nrecv++;  // Must be AFTER execution of the function
             w->am.nrecv++;  // Must be AFTER execution of the function
@@ -260,8 +399,13 @@ namespace madness {
 
         virtual ~WorldAmInterface();
 
-        /// Currently a noop
-        void fence() {}
+        /// Counts of the messages of this world by handler
+        const AmStats& get_stats() const { return stats; }
+
+        /// Sends messages still waiting to be aggregated by RMI
+        void fence() {
+            RMI::flush();
+        }
 
         /// Sends a managed non-blocking active message
         void send(ProcessID dest, am_handlerT op, const AmArg* arg,
@@ -282,8 +426,20 @@ namespace madness {
             // Map dest from world's communicator to comm_world
             dest = map_to_comm_world[dest];
 
+            // Wait for tags that no earlier attachment to dest still uses
+            if (arg->attachments) {
+                AmArg* argx = const_cast<AmArg*>(arg);
+                while ((argx->attach_tag = reserve_attach_tags(dest, arg->nattach)) < 0) {
+                    free_attach_send();
+                    myusleep(100);
+                }
+                argx->attach_src = SafeMPI::COMM_WORLD.Get_rank();
+                argx->attachments->dest = dest;
+            }
+
             lock();    // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
             nsent++;
+            AmStats::count(stats.handler_sent, op);
 
             // Wait for oldest request to complete
             while (!send_req[cur_msg].Test()) {
@@ -301,6 +457,25 @@ namespace madness {
 
             send_req[i] = RMI::isend(arg, arg->size()+sizeof(AmArg), dest, handler, attr);
             managed_send_buf[i] = (AmArg*)(arg);
+
+            // Send attached arrays from where they are ... the receiver
+            // posts the matching receives when it deserializes them.  The
+            // sends are synchronous so that a tag is free again only once
+            // the receiver has matched it.
+            if (arg->attachments) {
+                detail::AmAttachments* a = arg->attachments;
+                for (std::size_t k=0; k<a->data.size(); ++k) {
+                    const char* p = static_cast<const char*>(a->data[k].ptr);
+                    const int tag = AmArg::attach_mpi_tag(arg->attach_tag + k);
+                    for (std::size_t nleft=a->data[k].nbyte; nleft;) {
+                        const int n = AmArg::attach_piece(nleft);
+                        a->req.push_back(SafeMPI::COMM_WORLD.Issend(p, n, MPI_BYTE, dest, tag));
+                        p += n;
+                        nleft -= n;
+                    }
+                }
+            }
+            free_attach_send();
             unlock();  // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
         }
 
@@ -314,6 +489,7 @@ namespace madness {
                     free_managed_send_buf(ind[i]);
                 }
             }
+            free_attach_send();
             unlock(); // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
         }
 
@@ -41,6 +41,7 @@
 */
 
 #include <madness/world/parallel_archive.h>
+#include <madness/world/single_file_archive.h>
 #include <madness/world/worldhashmap.h>
 #include <madness/world/mpi_archive.h>
 #include <madness/world/world_object.h>
@@ -107,10 +108,12 @@ namespace madness {
 
         /// After invoking this routine all objects will be registered with the
         /// new map and no objects will be registered in the current map.
+        /// Redistributing to the current map does nothing but fence.
         /// @param[in] world The associated world
         /// @param[in] newpmap The new process map
         void redistribute(World& world, const std::shared_ptr< WorldDCPmapInterface<keyT> >& newpmap) {
             world.gop.fence();
+            if (newpmap.get() == this) return;
             for (typename std::set<ptrT>::iterator iter = ptrs.begin();
                  iter != ptrs.end();
                  ++iter) {
@@ -327,6 +330,7 @@ namespace madness {
         const ProcessID me;                      ///< My MPI rank
         internal_containerT local;               ///< Locally owned data
         std::vector<keyT>* move_list;            ///< Tempoary used to record data that needs redistributing
+        bool numa_affinity;                      ///< Run the tasks of a key in the NUMA domain of its hash
 
         /// Handles find request
         void find_handler(ProcessID requestor, const keyT& key, const RemoteReference< FutureImpl<iterator> >& ref) {
@@ -367,7 +371,8 @@ namespace madness {
                 : WorldObject< WorldContainerImpl<keyT, valueT, hashfunT> >(world)
                 , pmap(pm)
                 , me(world.mpi.rank())
-                , local(5011, hf) {
+                , local(5011, hf)
+                , numa_affinity(false) {
             pmap->register_callback(this);
         }
 
@@ -379,7 +384,24 @@ namespace madness {
             return pmap;
         }
 
-        hashfunT& get_hash() const { return local.get_hash(); }
+        const hashfunT& get_hash() const { return local.get_hash(); }
+
+        void set_numa_affinity(bool value) {
+            numa_affinity = value;
+        }
+
+        bool get_numa_affinity() const {
+            return numa_affinity;
+        }
+
+        /// Attributes of a task on key ... with its NUMA domain if requested
+        TaskAttributes task_attributes(const keyT& key, const TaskAttributes& attr) const {
+            const int nnodes = ThreadPool::numa_nodes();
+            if (!numa_affinity || nnodes == 0 || attr.get_numa_node() >= 0) return attr;
+            TaskAttributes result(attr);
+            result.set_numa_node(local.get_hash()(key) % nnodes);
+            return result;
+        }
 
         bool is_local(const keyT& key) const {
             return owner(key) == me;
@@ -889,11 +911,30 @@ namespace madness {
         }
 
         /// Returns a reference to the hashing functor
-        hashfunT& get_hash() const {
+        const hashfunT& get_hash() const {
             check_initialized();
             return p->get_hash();
         }
 
+        /// Run the tasks of each key on threads of one NUMA domain
+
+        /// When set, tasks made by task() carry the NUMA domain chosen by
+        /// the hash of the key (see TaskAttributes::set_numa_node()), so the
+        /// data those tasks make for a key (e.g., the coefficients of a
+        /// node) is allocated, and later used, in one domain.  It has no
+        /// effect unless the pool threads are bound on a host with several
+        /// NUMA domains (e.g., MAD_BIND=compact).
+        void set_numa_affinity(bool value) {
+            check_initialized();
+            p->set_numa_affinity(value);
+        }
+
+        /// Returns true if the tasks of each key run in one NUMA domain
+        bool get_numa_affinity() const {
+            check_initialized();
+            return p->get_numa_affinity();
+        }
+
         /// Process pending messages
 
         /// If the constructor was given \c do_pending=false then you
@@ -1147,7 +1188,7 @@ namespace madness {
         task(const keyT& key, memfunT memfun, const TaskAttributes& attr = TaskAttributes()) {
             check_initialized();
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT) = &implT:: template itemfun<memfunT>;
-            return p->task(owner(key), itemfun, key, memfun, attr);
+            return p->task(owner(key), itemfun, key, memfun, p->task_attributes(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T)" in process owning item (non-blocking comm if remote)
@@ -1166,7 +1207,7 @@ namespace madness {
             check_initialized();
             typedef REMFUTURE(arg1T) a1T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&) = &implT:: template itemfun<memfunT,a1T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, p->task_attributes(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T,arg2T)" in process owning item (non-blocking comm if remote)
@@ -1186,7 +1227,7 @@ namespace madness {
             typedef REMFUTURE(arg1T) a1T;
             typedef REMFUTURE(arg2T) a2T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&, const a2T&) = &implT:: template itemfun<memfunT,a1T,a2T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, p->task_attributes(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T,arg2T,arg3T)" in process owning item (non-blocking comm if remote)
@@ -1207,7 +1248,7 @@ namespace madness {
             typedef REMFUTURE(arg2T) a2T;
             typedef REMFUTURE(arg3T) a3T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&, const a2T&, const a3T&) = &implT:: template itemfun<memfunT,a1T,a2T,a3T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, p->task_attributes(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T,arg2T,arg3T,arg4T)" in process owning item (non-blocking comm if remote)
@@ -1229,7 +1270,7 @@ namespace madness {
             typedef REMFUTURE(arg3T) a3T;
             typedef REMFUTURE(arg4T) a4T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&, const a2T&, const a3T&, const a4T&) = &implT:: template itemfun<memfunT,a1T,a2T,a3T,a4T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, p->task_attributes(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T,arg2T,arg3T,arg4T,arg5T)" in process owning item (non-blocking comm if remote)
@@ -1252,7 +1293,7 @@ namespace madness {
             typedef REMFUTURE(arg4T) a4T;
             typedef REMFUTURE(arg5T) a5T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&, const a2T&, const a3T&, const a4T&, const a5T&) = &implT:: template itemfun<memfunT,a1T,a2T,a3T,a4T,a5T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, p->task_attributes(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T,arg2T,arg3T,arg4T,arg5T,arg6T)" in process owning item (non-blocking comm if remote)
@@ -1276,7 +1317,7 @@ namespace madness {
             typedef REMFUTURE(arg5T) a5T;
             typedef REMFUTURE(arg6T) a6T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&, const a2T&, const a3T&, const a4T&, const a5T&, const a6T&) = &implT:: template itemfun<memfunT,a1T,a2T,a3T,a4T,a5T,a6T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, arg6, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, arg6, p->task_attributes(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T,arg2T,arg3T,arg4T,arg5T,arg6T,arg7T)" in process owning item (non-blocking comm if remote)
@@ -1301,7 +1342,7 @@ namespace madness {
             typedef REMFUTURE(arg6T) a6T;
             typedef REMFUTURE(arg7T) a7T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&, const a2T&, const a3T&, const a4T&, const a5T&, const a6T&, const a7T&) = &implT:: template itemfun<memfunT,a1T,a2T,a3T,a4T,a5T,a6T,a7T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, arg6, arg7, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, arg6, arg7, p->task_attributes(key, attr));
         }
 
         /// Adds task "resultT memfun() const" in process owning item (non-blocking comm if remote)
@@ -1553,6 +1594,101 @@ namespace madness {
                 if (ar.dofence()) world->gop.fence();
             }
         };
+
+        /// Write container to a single file archive
+
+        /// \ingroup worlddc
+        /// Each process first counts the bytes of the values of its local
+        /// entries and of their (key, offset, size) in the index, which
+        /// gives it its place in the file.  It then serializes the values
+        /// in chunks of at most \c SingleFileOutputArchive::chunk_size
+        /// bytes, writing each chunk as it fills, and the index at the end.
+        template <class keyT, class valueT>
+        struct ArchiveStoreImpl< SingleFileOutputArchive, WorldContainer<keyT,valueT> > {
+            static void store(const SingleFileOutputArchive& ar, const WorldContainer<keyT,valueT>& t) {
+                typedef typename WorldContainer<keyT,valueT>::const_iterator iterator;
+                World* world = ar.get_world();
+                if (ar.dofence()) world->gop.fence();
+
+                // Bytes of each value, and of the index
+                std::vector<std::uint64_t> size;
+                std::uint64_t nbyte = 0;
+                BufferOutputArchive icount;
+                for (iterator it=t.begin(); it!=t.end(); ++it) {
+                    BufferOutputArchive count;
+                    count & it->second;
+                    size.push_back(count.size());
+                    nbyte += count.size();
+                    icount & it->first & nbyte & nbyte;
+                }
+
+                std::uint64_t offset = ar.begin_entries(nbyte, size.size(), icount.size());
+                std::vector<unsigned char> index(icount.size());
+                BufferOutputArchive ilocal(index.data(), index.size());
+                std::vector<unsigned char> chunk(std::min<std::uint64_t>(nbyte, SingleFileOutputArchive::chunk_size));
+                std::size_t nchunk = 0, i = 0;
+                for (iterator it=t.begin(); it!=t.end(); ++it, ++i) {
+                    ilocal & it->first & offset & size[i];
+                    offset += size[i];
+
+                    if (nchunk + size[i] > chunk.size()) {
+                        ar.store_values(chunk.data(), nchunk);
+                        nchunk = 0;
+                    }
+                    if (size[i] > chunk.size()) {
+                        // A value larger than a chunk goes out on its own
+                        std::vector<unsigned char> value(size[i]);
+                        BufferOutputArchive local(value.data(), value.size());
+                        local & it->second;
+                        ar.store_values(value.data(), value.size());
+                    }
+                    else {
+                        BufferOutputArchive local(chunk.data()+nchunk, size[i]);
+                        local & it->second;
+                        nchunk += size[i];
+                    }
+                }
+                ar.store_values(chunk.data(), nchunk);
+                ar.store_index(index.data(), index.size());
+                ar.end_entries();
+
+                if (ar.dofence()) world->gop.fence();
+            }
+        };
+
+        /// Read container from a single file archive
+
+        /// \ingroup worlddc
+        /// Every process scans the index of keys and deserializes the
+        /// values only of the keys it owns in the process map of \c t, so
+        /// any number of processes can read the archive and none touches
+        /// the values of the others.
+        template <class keyT, class valueT>
+        struct ArchiveLoadImpl< SingleFileInputArchive, WorldContainer<keyT,valueT> > {
+            static void load(const SingleFileInputArchive& ar, WorldContainer<keyT,valueT>& t) {
+                World* world = ar.get_world();
+                if (ar.dofence()) world->gop.fence();
+
+                const ProcessID me = world->rank();
+                const unsigned char* data;
+                const unsigned char* index;
+                std::size_t nindex;
+                const std::uint64_t nentry = ar.load_entries(data, index, nindex);
+                BufferInputArchive iar(index, nindex);
+                for (std::uint64_t i=0; i<nentry; ++i) {
+                    keyT key;
+                    std::uint64_t offset, size;
+                    iar & key & offset & size;
+                    if (t.owner(key) == me) {
+                        BufferInputArchive local(data+offset, size);
+                        valueT value;
+                        local & value;
+                        t.replace(key, value);
+                    }
+                }
+                if (ar.dofence()) world->gop.fence();
+            }
+        };
     }
 
 }
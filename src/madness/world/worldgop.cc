@@ -31,6 +31,7 @@
 
 #include <madness/world/worldgop.h>
 #include <madness/world/MADworld.h>
+#include <madness/world/worldmem.h>
 #ifdef MADNESS_HAS_GOOGLE_PERF_MINIMAL
 #include <gperftools/malloc_extension.h>
 #endif
@@ -55,6 +56,9 @@ namespace madness {
         Tag gfence_tag = world_.mpi.unique_tag();
         Tag bcast_tag = world_.mpi.unique_tag();
         int npass = 0;
+#ifdef MADNESS_TASK_PROFILING
+        const double fence_start = wall_time();
+#endif // MADNESS_TASK_PROFILING
 
         //double start = wall_time();
 
@@ -70,6 +74,7 @@ namespace madness {
             uint64_t ntask1, nsent1, nrecv1, ntask2, nsent2, nrecv2;
             do {
                 world_.taskq.fence();
+                world_.am.fence();
 
                 // Since the number of outstanding tasks and number of AM sent/recv
                 // don't share a critical section read each twice and ensure they
@@ -129,7 +134,11 @@ namespace madness {
 
         };
         world_.am.free_managed_buffers(); // free up communication buffers
+#ifdef MADNESS_TASK_PROFILING
+        profiling::TraceEvents::record("fence", "world", fence_start, wall_time(), "npass", npass);
+#endif // MADNESS_TASK_PROFILING
         deferred_->do_cleanup();
+        if (world_mem_info()->trim_pool) world_mem_info()->trim_pool(); // and cached tensor storage
 #ifdef MADNESS_HAS_GOOGLE_PERF_MINIMAL
         MallocExtension::instance()->ReleaseFreeMemory();
 //        print("clearing memory");
@@ -137,11 +146,14 @@ namespace madness {
     }
 
 
+    const std::size_t WorldGopInterface::max_segment_size;
+
     /// Broadcasts bytes from process root while still processing AM & tasks
 
-    /// Optimizations can be added for long messages
+    /// Long buffers are sent down the tree in segments, each passed on
+    /// as soon as it arrives, so the time grows with the length plus
+    /// the depth of the tree rather than their product.
     void WorldGopInterface::broadcast(void* buf, size_t nbyte, ProcessID root, bool dowork, Tag bcast_tag) {
-        SafeMPI::Request req0, req1;
         ProcessID parent, child0, child1;
         world_.mpi.binary_tree_info(root, parent, child0, child1);
         if(bcast_tag < 0)
@@ -149,16 +161,36 @@ namespace madness {
 
         //print("BCAST TAG", bcast_tag);
 
+        // A few receives are kept posted ahead of the segment being passed on
+        unsigned char* const p = static_cast<unsigned char*>(buf);
+        const size_t nseg = std::max<size_t>((nbyte + max_segment_size - 1)/max_segment_size, 1);
+        const size_t nahead = 4;
+        std::vector<SafeMPI::Request> recv(nseg), send;
+        send.reserve(2*nseg);
+
         if (parent != -1) {
-            req0 = world_.mpi.Irecv(buf, nbyte, MPI_BYTE, parent, bcast_tag);
-            World::await(req0, dowork);
+            for (size_t s=0; s<nahead && s<nseg; ++s) {
+                const size_t offset = s*max_segment_size;
+                recv[s] = world_.mpi.Irecv(p + offset, std::min(max_segment_size, nbyte - offset),
+                        MPI_BYTE, parent, bcast_tag);
+            }
         }
 
-        if (child0 != -1) req0 = world_.mpi.Isend(buf, nbyte, MPI_BYTE, child0, bcast_tag);
-        if (child1 != -1) req1 = world_.mpi.Isend(buf, nbyte, MPI_BYTE, child1, bcast_tag);
+        for (size_t s=0; s<nseg; ++s) {
+            const size_t offset = s*max_segment_size;
+            const size_t n = std::min(max_segment_size, nbyte - offset);
+            if (parent != -1) {
+                World::await(recv[s], dowork);
+                const size_t ahead = (s+nahead)*max_segment_size;
+                if (s+nahead < nseg)
+                    recv[s+nahead] = world_.mpi.Irecv(p + ahead, std::min(max_segment_size, nbyte - ahead),
+                            MPI_BYTE, parent, bcast_tag);
+            }
+            if (child0 != -1) send.push_back(world_.mpi.Isend(p + offset, n, MPI_BYTE, child0, bcast_tag));
+            if (child1 != -1) send.push_back(world_.mpi.Isend(p + offset, n, MPI_BYTE, child1, bcast_tag));
+        }
 
-        if (child0 != -1) World::await(req0, dowork);
-        if (child1 != -1) World::await(req1, dowork);
+        for (size_t i=0; i<send.size(); ++i) World::await(send[i], dowork);
     }
 
 } // namespace madness
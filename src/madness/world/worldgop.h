@@ -39,6 +39,9 @@
 /// the abbreviation.
 
 #include <type_traits>
+#include <algorithm>
+#include <memory>
+#include <vector>
 #include <madness/world/worldtypes.h>
 #include <madness/world/buffer_archive.h>
 #include <madness/world/world.h>
@@ -159,6 +162,9 @@ namespace madness {
         struct AllReduceTag { };
         struct GroupAllReduceTag { };
 
+        /// Largest message, in bytes, of the segmented reductions and broadcasts
+        static const std::size_t max_segment_size = 1ul << 17;
+
 
         /// Delayed send callback object
 
@@ -542,6 +548,89 @@ namespace madness {
             }
         }
 
+        /// Key of one segment of an array in all_reduce_array() and bcast_array()
+
+        /// \tparam keyT The key of the whole array
+        template <typename keyT>
+        class SegmentKey {
+        private:
+            keyT key_; ///< The key of the array
+            std::size_t segment_; ///< The index of the segment
+
+        public:
+            SegmentKey() : key_(), segment_(0) { }
+
+            SegmentKey(const keyT& key, const std::size_t segment) :
+                key_(key), segment_(segment)
+            { }
+
+            bool operator==(const SegmentKey<keyT>& other) const {
+                return (key_ == other.key_) && (segment_ == other.segment_);
+            }
+
+            bool operator!=(const SegmentKey<keyT>& other) const {
+                return (key_ != other.key_) || (segment_ != other.segment_);
+            }
+
+            template <typename Archive>
+            void serialize(const Archive& ar) {
+                ar & key_ & segment_;
+            }
+
+            friend hashT hash_value(const SegmentKey<keyT>& key) {
+                Hash<keyT> hasher;
+                hashT seed = hasher(key.key_);
+                madness::detail::combine_hash(seed, key.segment_);
+                return seed;
+            }
+        }; // class SegmentKey
+
+        /// Elementwise reduction of array segments with a binary operation such as WorldSumOp
+        template <typename T, typename opT>
+        class SegmentOp {
+        private:
+            opT op_;
+
+        public:
+            typedef std::vector<T> result_type;
+            typedef std::vector<T> argument_type;
+
+            SegmentOp(const opT& op) : op_(op) { }
+
+            result_type operator()() const {
+                return result_type();
+            }
+
+            void operator()(result_type& result, const argument_type& value) const {
+                if (result.empty()) {
+                    result = value;
+                }
+                else {
+                    MADNESS_ASSERT(result.size() == value.size());
+                    for (std::size_t i=0; i<value.size(); ++i)
+                        result[i] = op_(result[i], value[i]);
+                }
+            }
+        }; // class SegmentOp
+
+        /// Joins the segments of an array in order
+        template <typename T>
+        static std::vector<T> join_segments(const std::vector<Future<std::vector<T> > >& segments) {
+            std::size_t n = 0;
+            for (std::size_t s=0; s<segments.size(); ++s) n += segments[s].get().size();
+            std::vector<T> result;
+            result.reserve(n);
+            for (std::size_t s=0; s<segments.size(); ++s)
+                result.insert(result.end(), segments[s].get().begin(), segments[s].get().end());
+            return result;
+        }
+
+        /// Number of elements in each segment of an array of T
+        template <typename T>
+        static std::size_t segment_length() {
+            return std::max<std::size_t>(max_segment_size/sizeof(T), 1);
+        }
+
         template <typename valueT, typename opT>
         static typename detail::result_of<opT>::type
         reduce_task(const valueT& value, const opT& op) {
@@ -655,13 +744,13 @@ namespace madness {
 
         /// Broadcasts bytes from process root while still processing AM & tasks
 
-        /// Optimizations can be added for long messages
+        /// Long buffers are sent down the tree in segments, each passed on
+        /// as soon as it arrives, so the time grows with the length plus
+        /// the depth of the tree rather than their product.
         void broadcast(void* buf, size_t nbyte, ProcessID root, bool dowork = true, Tag bcast_tag = -1);
 
 
         /// Broadcasts typed contiguous data from process root while still processing AM & tasks
-
-        /// Optimizations can be added for long messages
         template <typename T>
         inline void broadcast(T* buf, size_t nelem, ProcessID root) {
             broadcast((void *) buf, nelem*sizeof(T), root);
@@ -681,8 +770,8 @@ namespace madness {
 
         /// Broadcast a serializable object
 
-        /// Current dumb version assumes object fits in 1MB
-        /// ... you are free to add intelligence.
+        /// The size of the serialized object is broadcast first, so there
+        /// is no limit on it.
         template <typename objT>
         void broadcast_serializable(objT& obj, ProcessID root) {
             size_t BUFLEN;
@@ -708,36 +797,49 @@ namespace madness {
 
         /// Inplace global reduction (like MPI all_reduce) while still processing AM & tasks
 
-        /// Optimizations can be added for long messages and to reduce the memory footprint
+        /// Long arrays go up the tree in segments.  Each segment is sent on
+        /// to the parent as soon as the children's contributions to it are
+        /// in, so all levels of the tree are busy at once, and only two
+        /// segments per child are buffered.
         template <typename T, class opT>
         void reduce(T* buf, size_t nelem, opT op) {
-            SafeMPI::Request req0, req1;
             ProcessID parent, child0, child1;
             world_.mpi.binary_tree_info(0, parent, child0, child1);
             Tag gsum_tag = world_.mpi.unique_tag();
 
-            T* buf0 = new T[nelem];
-            T* buf1 = new T[nelem];
-
-            if (child0 != -1) req0 = world_.mpi.Irecv(buf0, nelem*sizeof(T), MPI_BYTE, child0, gsum_tag);
-            if (child1 != -1) req1 = world_.mpi.Irecv(buf1, nelem*sizeof(T), MPI_BYTE, child1, gsum_tag);
-
-            if (child0 != -1) {
-                World::await(req0);
-                for (long i=0; i<(long)nelem; ++i) buf[i] = op(buf[i],buf0[i]);
-            }
-            if (child1 != -1) {
-                World::await(req1);
-                for (long i=0; i<(long)nelem; ++i) buf[i] = op(buf[i],buf1[i]);
+            const ProcessID child[2] = {child0, child1};
+            const size_t seglen = segment_length<T>();
+            const size_t nseg = (nelem + seglen - 1)/seglen;
+            const size_t nbuf = std::min(nelem, seglen);
+
+            // Receive buffer 2*c+s%2 holds segment s from child c
+            std::unique_ptr<T[]> recvbuf(new T[4*nbuf]);
+            SafeMPI::Request recv[2][2];
+            std::vector<SafeMPI::Request> send;
+            send.reserve(parent != -1 ? nseg : 0);
+            for (int c=0; c<2; ++c) {
+                if (child[c] == -1) continue;
+                for (size_t s=0; s<2 && s<nseg; ++s)
+                    recv[c][s] = world_.mpi.Irecv(recvbuf.get() + (2*c+s)*nbuf,
+                            std::min(seglen, nelem - s*seglen)*sizeof(T), MPI_BYTE, child[c], gsum_tag);
             }
 
-            delete [] buf0;
-            delete [] buf1;
-
-            if (parent != -1) {
-                req0 = world_.mpi.Isend(buf, nelem*sizeof(T), MPI_BYTE, parent, gsum_tag);
-                World::await(req0);
+            for (size_t s=0; s<nseg; ++s) {
+                T* const seg = buf + s*seglen;
+                const size_t n = std::min(seglen, nelem - s*seglen);
+                for (int c=0; c<2; ++c) {
+                    if (child[c] == -1) continue;
+                    T* const in = recvbuf.get() + (2*c + s%2)*nbuf;
+                    World::await(recv[c][s%2]);
+                    for (size_t i=0; i<n; ++i) seg[i] = op(seg[i],in[i]);
+                    if (s+2 < nseg)
+                        recv[c][s%2] = world_.mpi.Irecv(in, std::min(seglen, nelem - (s+2)*seglen)*sizeof(T),
+                                MPI_BYTE, child[c], gsum_tag);
+                }
+                if (parent != -1)
+                    send.push_back(world_.mpi.Isend(seg, n*sizeof(T), MPI_BYTE, parent, gsum_tag));
             }
+            for (size_t s=0; s<send.size(); ++s) World::await(send[s]);
 
             broadcast(buf, nelem, 0);
         }
@@ -803,6 +905,35 @@ namespace madness {
             reduce< T, WorldLogicOrOp<T> >(buf, nelem, WorldLogicOrOp<T>());
         }
 
+        /// Inplace exclusive prefix sum over processes (like MPI_Exscan) while still processing AM & tasks
+
+        /// On exit buf on process p holds the sum of the input on processes
+        /// 0 to p-1, and zero on process 0.  Takes log2(nproc) rounds of
+        /// recursive doubling.
+        template <typename T>
+        void exscan_sum(T* buf, size_t nelem) {
+            const ProcessID me = world_.rank();
+            const ProcessID nproc = world_.size();
+            Tag scan_tag = world_.mpi.unique_tag();
+
+            // Sums of the input on this and on the preceding processes
+            std::vector<T> incl(buf, buf+nelem), in(nelem);
+            for (size_t i=0; i<nelem; ++i) buf[i] = T(0);
+            for (ProcessID d=1; d<nproc; d*=2) {
+                SafeMPI::Request recv, send;
+                if (me >= d) recv = world_.mpi.Irecv(in.data(), nelem*sizeof(T), MPI_BYTE, me-d, scan_tag);
+                if (me+d < nproc) send = world_.mpi.Isend(incl.data(), nelem*sizeof(T), MPI_BYTE, me+d, scan_tag);
+                if (me+d < nproc) World::await(send);
+                if (me >= d) {
+                    World::await(recv);
+                    for (size_t i=0; i<nelem; ++i) {
+                        buf[i] += in[i];
+                        incl[i] += in[i];
+                    }
+                }
+            }
+        }
+
         /// Global sum of a scalar while still processing AM & tasks
         template <typename T>
         void sum(T& a) {
@@ -1279,6 +1410,87 @@ namespace madness {
 
             return reduce_result;
         }
+
+        /// Distributed all reduce of an array, elementwise and in segments
+
+        /// The array is cut into segments of at most 128 KB, each reduced by
+        /// all_reduce() with its own key, so the segments are rooted on
+        /// different processes and move through the tree at the same time.
+        /// Nothing blocks: the reduction proceeds as tasks and active
+        /// messages while the caller goes on submitting work.
+        /// \code
+        ///    Future< std::vector<double> > s = world.gop.all_reduce_array(key, t.ptr(), t.size(), WorldSumOp<double>());
+        ///    ... submit more tasks ...
+        ///    std::copy(s.get().begin(), s.get().end(), t.ptr());
+        /// \endcode
+        /// \tparam keyT The key type
+        /// \tparam T The element type, which must be serializable
+        /// \tparam opT The binary operation type, e.g. WorldSumOp<T>
+        /// \param key The key associated with this reduction
+        /// \param buf The local array, which is copied before this returns
+        /// \param nelem The number of elements, which must be the same on all processes
+        /// \param op The binary operation applied elementwise
+        /// \return A future to the reduced array on every process
+        /// \note It is the user's responsibility to ensure that \c key does not
+        /// conflict with other calls to \c all_reduce_array. Keys may be reused
+        /// after the associated operation has finished.
+        template <typename keyT, typename T, typename opT>
+        Future< std::vector<T> >
+        all_reduce_array(const keyT& key, const T* buf, const std::size_t nelem, const opT& op) {
+            const std::size_t seglen = segment_length<T>();
+            std::vector< Future< std::vector<T> > > segments;
+            segments.reserve((nelem + seglen - 1)/seglen);
+            for (std::size_t i=0; i<nelem; i+=seglen) {
+                const std::vector<T> segment(buf + i, buf + std::min(nelem, i+seglen));
+                segments.push_back(all_reduce(SegmentKey<keyT>(key, i/seglen), segment,
+                        SegmentOp<T,opT>(op)));
+            }
+            return world_.taskq.add(WorldGopInterface::template join_segments<T>, segments,
+                    TaskAttributes::hipri());
+        }
+
+        /// Distributed all reduce sum of an array
+
+        /// \see all_reduce_array()
+        template <typename keyT, typename T>
+        Future< std::vector<T> >
+        sum_array(const keyT& key, const T* buf, const std::size_t nelem) {
+            return all_reduce_array(key, buf, nelem, WorldSumOp<T>());
+        }
+
+        /// Broadcast of an array in segments
+
+        /// Each segment of at most 128 KB is broadcast by bcast() with its
+        /// own key, so they are pipelined through the tree, and nothing
+        /// blocks.
+        /// \tparam keyT The key type
+        /// \tparam T The element type, which must be serializable
+        /// \param key The key associated with this broadcast
+        /// \param buf The array on \c root, which is copied before this returns;
+        /// ignored elsewhere
+        /// \param nelem The number of elements, which must be the same on all processes
+        /// \param root The process that owns the data to be broadcast
+        /// \return A future to the array on every process
+        /// \note It is the user's responsibility to ensure that \c key does not
+        /// conflict with other calls to \c bcast_array. Keys may be reused
+        /// after the associated operation has finished.
+        template <typename keyT, typename T>
+        Future< std::vector<T> >
+        bcast_array(const keyT& key, const T* buf, const std::size_t nelem, const ProcessID root) {
+            MADNESS_ASSERT((root >= 0) && (root < world_.size()));
+            const std::size_t seglen = segment_length<T>();
+            std::vector< Future< std::vector<T> > > segments;
+            segments.reserve((nelem + seglen - 1)/seglen);
+            for (std::size_t i=0; i<nelem; i+=seglen) {
+                Future< std::vector<T> > segment;
+                if (world_.rank() == root)
+                    segment.set(std::vector<T>(buf + i, buf + std::min(nelem, i+seglen)));
+                bcast(SegmentKey<keyT>(key, i/seglen), segment, root);
+                segments.push_back(segment);
+            }
+            return world_.taskq.add(WorldGopInterface::template join_segments<T>, segments,
+                    TaskAttributes::hipri());
+        }
     }; // class WorldGopInterface
 
 } // namespace madness
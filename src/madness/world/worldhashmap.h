@@ -47,6 +47,10 @@
 #include <madness/world/madness_exception.h>
 #include <madness/world/worldhash.h>
 #include <new>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
 #include <stdio.h>
 #include <map>
 
@@ -62,6 +66,176 @@ namespace madness {
         // A hashtable is an array of nbin bins.
         // Each bin is a linked list of entries protected by a spinlock.
         // Each entry holds a key+value pair, a read-write mutex, and a link to the next entry.
+        //
+        // Writers modify a bin only while holding its spinlock.  Readers
+        // that do not need an entry lock (find returning an iterator)
+        // traverse the list without any lock.  To make that safe, memory
+        // unlinked by a writer (deleted entries, replaced bin arrays) is
+        // not freed immediately but retired to the Epoch below, which
+        // frees it once no reader can still be looking at it.
+
+        /// Epoch-based reclamation of memory unlinked from hash maps
+
+        /// Every thread that touches a hash map owns a slot in which, while
+        /// inside a critical section (see Epoch::Guard), it announces the
+        /// global epoch it observed on entry.  The global epoch advances only
+        /// once every active slot has announced the current epoch.  Memory
+        /// unlinked inside a critical section announcing epoch e is
+        /// therefore unreachable by every reader once the global epoch
+        /// reaches e+3, at which point the thread that retired it frees it.
+        class Epoch {
+        private:
+            struct Retired {
+                void* p;
+                void (*destroy)(void*);
+                unsigned long epoch;        // Free once the global epoch reaches this+2
+            };
+
+            struct Slot {
+                char pad0[64];
+                std::atomic<unsigned long> state; // (epoch<<1)|1 inside a critical section, else 0
+                char pad1[64];
+                std::atomic<bool> inuse;    // Owned by a live thread
+                Slot* next;                 // Slots form a list that only ever grows
+                int depth;                  // Nesting of critical sections
+                bool reclaiming;            // Destructors of retired memory are running
+                std::vector<Retired> retired;
+
+                Slot() : state(0), inuse(true), next(0), depth(0), reclaiming(false) {}
+            };
+
+            struct Domain {
+                std::atomic<unsigned long> epoch;
+                std::atomic<Slot*> slots;
+
+                Domain() : epoch(1), slots(0) {}
+            };
+
+            /// Releases the slot of a thread when it exits
+            struct Owner {
+                Slot* slot;
+                Owner() : slot(acquire()) {}
+                ~Owner() { slot->inuse.store(false, std::memory_order_release); }
+            };
+
+            static Domain& domain() {
+                static Domain d;
+                return d;
+            }
+
+            /// Claims a free slot or appends a new one to the list
+            static Slot* acquire() {
+                Domain& d = domain();
+                for (Slot* s=d.slots.load(std::memory_order_acquire); s; s=s->next) {
+                    bool expected = false;
+                    if (!s->inuse.load(std::memory_order_relaxed) &&
+                        s->inuse.compare_exchange_strong(expected, true)) return s;
+                }
+                Slot* s = new Slot;
+                Slot* head = d.slots.load(std::memory_order_relaxed);
+                do {
+                    s->next = head;
+                } while (!d.slots.compare_exchange_weak(head, s));
+                return s;
+            }
+
+            static Slot* slot() {
+                static thread_local Owner owner;
+                return owner.slot;
+            }
+
+            template <typename T>
+            static void destroy(void* p) {
+                delete static_cast<T*>(p);
+            }
+
+            /// Advances the global epoch if every active slot has seen it
+            static bool try_advance() {
+                Domain& d = domain();
+                unsigned long e = d.epoch.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                for (Slot* s=d.slots.load(std::memory_order_acquire); s; s=s->next) {
+                    unsigned long state = s->state.load(std::memory_order_relaxed);
+                    if ((state & 1) && (state >> 1) != e) return false;
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return d.epoch.compare_exchange_strong(e, e+1);
+            }
+
+            /// Frees the retired memory of this slot that can no longer be reached
+
+            /// Called on leaving the outermost critical section.  Since
+            /// destructors may themselves use hash maps, the expired items are
+            /// removed from the list before any is destroyed.
+            static void reclaim(Slot* s) {
+                s->reclaiming = true;
+                std::vector<Retired> expired;
+                for (int attempt=0; attempt<3 && expired.empty(); ++attempt) {
+                    try_advance();
+                    const unsigned long e = domain().epoch.load(std::memory_order_acquire);
+                    std::size_t n = 0;
+                    for (std::size_t i=0; i<s->retired.size(); ++i) {
+                        if (s->retired[i].epoch+2 <= e) expired.push_back(s->retired[i]);
+                        else s->retired[n++] = s->retired[i];
+                    }
+                    s->retired.resize(n);
+                }
+                for (std::size_t i=0; i<expired.size(); ++i)
+                    expired[i].destroy(expired[i].p);
+                s->reclaiming = false;
+            }
+
+        public:
+            /// Scoped critical section in which unlinked memory stays valid
+
+            /// Never wait on another thread while holding a guard since that
+            /// stalls reclamation for every thread.
+            class Guard : private NO_DEFAULTS {
+                Slot* s;
+            public:
+                Guard() : s(slot()) {
+                    if (s->depth++ == 0) {
+                        const unsigned long e = domain().epoch.load(std::memory_order_relaxed);
+                        s->state.store((e << 1) | 1, std::memory_order_relaxed);
+                        std::atomic_thread_fence(std::memory_order_seq_cst);
+                    }
+                }
+
+                ~Guard() {
+                    if (--s->depth == 0) {
+                        s->state.store(0, std::memory_order_release);
+                        if (!s->retired.empty() && !s->reclaiming) reclaim(s);
+                    }
+                }
+            };
+
+            /// Hands memory just unlinked from a shared structure over for deferred deletion
+
+            /// Must be called inside a critical section.
+            template <typename T>
+            static void retire(T* p) {
+                Slot* s = slot();
+                MADNESS_ASSERT(s->depth > 0);
+                const unsigned long e = s->state.load(std::memory_order_relaxed) >> 1;
+                Retired r = {p, &destroy<T>, e+1};
+                s->retired.push_back(r);
+            }
+
+            /// Frees all retired memory of all threads
+
+            /// Only to be called when no other thread can be using a hash map
+            /// (e.g., in finalize after the last fence) so that memory
+            /// retired by now idle threads does not outlive the runtime.
+            static void flush() {
+                for (Slot* s=domain().slots.load(std::memory_order_acquire); s; s=s->next) {
+                    if (s->state.load(std::memory_order_acquire)) continue;
+                    std::vector<Retired> expired;
+                    expired.swap(s->retired);
+                    for (std::size_t i=0; i<expired.size(); ++i)
+                        expired[i].destroy(expired[i].p);
+                }
+            }
+        };
 
         template <typename keyT, typename valueT>
         class entry : public madness::MutexReaderWriter {
@@ -87,70 +261,53 @@ namespace madness {
             entryT* volatile p;
             int volatile ninbin;
 
+            using madness::Spinlock::lock;
+            using madness::Spinlock::unlock;
+
             bin() : p(0),ninbin(0) {}
 
+            /// Deletes the entries immediately ... only when nobody else can see the bin
             ~bin() {
-                clear();
-            }
-
-            void clear() {
-                lock();             // BEGIN CRITICAL SECTION
                 while (p) {
                     entryT* n=p->next;
                     delete p;
                     p=n;
-                    ninbin--;
                 }
-                MADNESS_ASSERT(ninbin == 0);
-                unlock();           // END CRITICAL SECTION
             }
 
-            entryT* find(const keyT& key, const int lockmode) const {
-                bool gotlock;
-                entryT* result;
-                madness::MutexWaiter waiter;
-                do {
-                    lock();             // BEGIN CRITICAL SECTION
-                    result = match(key);
-                    if (result) {
-                        gotlock = result->try_lock(lockmode);
-                    }
-                    else {
-                        gotlock = true;
-                    }
-                    unlock();           // END CRITICAL SECTION
-                    if (!gotlock) waiter.wait(); //cpu_relax();
-                }
-                while (!gotlock);
+            /// Returns the entry matching key or null
 
-                return result;
+            /// Safe without the lock inside an Epoch::Guard since writers
+            /// only publish fully constructed entries and unlinked entries
+            /// keep their link to the rest of the list.
+            entryT* match(const keyT& key) const {
+                entryT* t;
+                for (t=p; t; t=t->next)
+                    if (t->datum.first == key) break;
+                return t;
             }
 
-            std::pair<entryT*,bool> insert(const datumT& datum, int lockmode) {
-                bool gotlock;
-                entryT* result;
-                bool notfound;
-                madness::MutexWaiter waiter;
-                do {
-                    lock();             // BEGIN CRITICAL SECTION
-                    result = match(datum.first);
-                    notfound = !result;
-                    if (notfound) {
-                        result = p = new entryT(datum,p);
-                        ++ninbin;
-                    }
-                    gotlock = result->try_lock(lockmode);
-                    unlock();           // END CRITICAL SECTION
-                    if (!gotlock) waiter.wait(); //cpu_relax();
-                }
-                while (!gotlock);
+            /// Adds a new entry at the head of the list ... caller holds the lock
+            entryT* push(const datumT& datum) {
+                entryT* t = new entryT(datum,p);
+                std::atomic_thread_fence(std::memory_order_release);
+                p = t;
+                ++ninbin;
+                return t;
+            }
 
-                return std::pair<entryT*,bool>(result,notfound);
+            /// Adds an existing entry at the head of the list ... caller holds the lock
+            void relink(entryT* t) {
+                t->next = p;
+                std::atomic_thread_fence(std::memory_order_release);
+                p = t;
+                ++ninbin;
             }
 
-            bool del(const keyT& key, int lockmode) {
-                bool status = false;
-                lock();             // BEGIN CRITICAL SECTION
+            /// Removes the entry matching key from the list and returns it (or null) ... caller holds the lock
+
+            /// The entry is not deleted and still points into the list.
+            entryT* unlink(const keyT& key) {
                 for (entryT *t=p,*prev=0; t; prev=t,t=t->next) {
                     if (t->datum.first == key) {
                         if (prev) {
@@ -159,32 +316,31 @@ namespace madness {
                         else {
                             p = t->next;
                         }
-                        t->unlock(lockmode);
-                        delete t;
                         --ninbin;
-                        status = true;
-                        break;
+                        return t;
                     }
                 }
-                unlock();           // END CRITICAL SECTION
-                return status;
+                return 0;
             }
 
-            std::size_t size() const {
-                return ninbin;
-            };
-
-        private:
-            entryT* match(const keyT& key) const {
-                entryT* t;
-                for (t=p; t; t=t->next)
-                    if (t->datum.first == key) break;
+            /// Removes all entries and returns the former head ... caller holds the lock
+            entryT* detach() {
+                entryT* t = p;
+                p = 0;
+                ninbin = 0;
                 return t;
             }
 
+            std::size_t size() const {
+                return ninbin;
+            };
         };
 
         /// iterator for hash
+
+        /// Iterators made by begin() hold off growth of the table until
+        /// they are destroyed, so they must not outlive the table.  An
+        /// iterator returned by find may only be dereferenced.
         template <class hashT> class HashIterator {
         public:
             typedef typename std::conditional<std::is_const<hashT>::value,
@@ -203,6 +359,7 @@ namespace madness {
             hashT* h;               // Associated hash table
             int bin;                // Current bin
             entryT* entry;          // Current entry in bin ... zero means at end
+            bool pinned;            // True if holding off growth of the table
 
             template <class otherHashT>
             friend class HashIterator;
@@ -211,33 +368,46 @@ namespace madness {
             void next_non_null_entry() {
                 while (!entry) {
                     ++bin;
-                    if ((unsigned) bin == h->nbins) {
+                    if ((unsigned) bin == h->nbins()) {
                         entry = 0;
                         return;
                     }
-                    entry = h->bins[bin].p;
+                    entry = h->bins()[bin].p;
                 }
                 return;
             }
 
+            void pin() {
+                if (pinned) h->pin_table();
+            }
+
+            void unpin() {
+                if (pinned) h->unpin_table();
+            }
+
         public:
 
             /// Makes invalid iterator
-            HashIterator() : h(0), bin(-1), entry(0) {}
+            HashIterator() : h(0), bin(-1), entry(0), pinned(false) {}
 
             /// Makes begin/end iterator
             HashIterator(hashT* h, bool begin)
-                    : h(h), bin(-1), entry(0) {
-                if (begin) next_non_null_entry();
+                    : h(h), bin(-1), entry(0), pinned(begin) {
+                if (begin) {
+                    pin();
+                    next_non_null_entry();
+                }
             }
 
             /// Makes iterator to specific entry
             HashIterator(hashT* h, int bin, entryT* entry)
-                    : h(h), bin(bin), entry(entry) {}
+                    : h(h), bin(bin), entry(entry), pinned(false) {}
 
             /// Copy constructor
             HashIterator(const HashIterator& other)
-                    : h(other.h), bin(other.bin), entry(other.entry) {}
+                    : h(other.h), bin(other.bin), entry(other.entry), pinned(other.pinned) {
+                pin();
+            }
 
             /// Implicit conversion of another hash type to this hash type
 
@@ -245,7 +415,25 @@ namespace madness {
             /// types.
             template <class otherHashT>
             HashIterator(const HashIterator<otherHashT>& other)
-                    : h(other.h), bin(other.bin), entry(other.entry) {}
+                    : h(other.h), bin(other.bin), entry(other.entry), pinned(other.pinned) {
+                pin();
+            }
+
+            HashIterator& operator=(const HashIterator& other) {
+                if (this != &other) {
+                    unpin();
+                    h = other.h;
+                    bin = other.bin;
+                    entry = other.entry;
+                    pinned = other.pinned;
+                    pin();
+                }
+                return *this;
+            }
+
+            ~HashIterator() {
+                unpin();
+            }
 
             HashIterator& operator++() {
                 if (!entry) return *this;
@@ -286,16 +474,16 @@ namespace madness {
                 // If here, will point to first entry in
                 // a bin ... determine which bin contains
                 // our end point.
-                while (unsigned(n) >= h->bins[bin].size()) {
-                    n -= h->bins[bin].size();
+                while (unsigned(n) >= h->bins()[bin].size()) {
+                    n -= h->bins()[bin].size();
                     ++bin;
-                    if (unsigned(bin) == h->nbins) {
+                    if (unsigned(bin) == h->nbins()) {
                         entry = 0;
                         return; // end
                     }
                 }
 
-                entry = h->bins[bin].p;
+                entry = h->bins()[bin].p;
                 MADNESS_ASSERT(entry);
 
                 // Linear increment to target
@@ -392,6 +580,19 @@ namespace madness {
 
     } // End of namespace Hash_private
 
+    /// A concurrent hash map with vague compatibility with the TBB API
+
+    /// Insertion, erasure and the accessor versions of find lock the bin
+    /// holding the key.  find returning an iterator takes no lock at all,
+    /// which makes read-mostly tables (the local part of a WorldContainer,
+    /// caches) scale with the number of threads.
+    ///
+    /// The number of bins given to the constructor is only a starting
+    /// point.  When an insertion finds a long chain and the table holds
+    /// more than twice as many entries as bins, all bins are locked and the
+    /// entries are moved to a table about twice as large.  Growth is
+    /// deferred while any iterator made by begin() is alive so iteration
+    /// concurrent with insertion remains valid.
     template < class keyT, class valueT, class hashfunT = Hash<keyT> >
     class ConcurrentHashMap {
     public:
@@ -408,12 +609,27 @@ namespace madness {
         friend class Hash_private::HashIterator<const hashT>;
 
     protected:
-        const size_t nbins;         // Number of bins
-        binT* bins;                 // Array of bins
+        /// An array of bins ... replaced as a whole when the map grows
+        struct tableT {
+            const size_t nbins;     // Number of bins
+            binT* const bins;       // Array of bins
+
+            tableT(size_t nbins) : nbins(nbins), bins(new binT[nbins]) {}
+
+            ~tableT() {
+                delete [] bins;
+            }
+        };
+
+        std::atomic<tableT*> table;                 // Current array of bins
+        mutable std::atomic<unsigned long> version; // Odd while entries move to a new table
+        mutable std::atomic<int> npinned;           // No. of live iterators made by begin()
 
     private:
         hashfunT hashfun;
 
+        static const int maxchain = 8; // Chain length that makes an insert consider growth
+
         //unsigned int hash(const keyT& key) const {return hashfunT::hash(key)%nbins;}
 
         static int nbins_prime(int n) {
@@ -432,25 +648,183 @@ namespace madness {
             return primes[nprimes-1];
         }
 
-        unsigned int hash_to_bin(const keyT& key) const {
-            return hashfun(key)%nbins;
+        // Used by iterators, which keep the table from changing
+        size_t nbins() const {
+            return table.load(std::memory_order_acquire)->nbins;
+        }
+
+        binT* bins() const {
+            return table.load(std::memory_order_acquire)->bins;
+        }
+
+        /// Holds off growth of the table ... waits for a growth in progress
+        void pin_table() const {
+            npinned.fetch_add(1);
+            madness::MutexWaiter waiter;
+            while (version.load() & 1) waiter.wait();
+        }
+
+        void unpin_table() const {
+            npinned.fetch_sub(1);
+        }
+
+        /// Locks and returns the bin of key in the current table
+
+        /// Must be called inside an Epoch::Guard.  A writer that loses a
+        /// race with growth finds the table replaced once it gets the lock,
+        /// and tries again with the new table.
+        binT* lock_bin(const keyT& key, int& bin) const {
+            const std::size_t hash = hashfun(key);
+            while (true) {
+                tableT* t = table.load(std::memory_order_acquire);
+                bin = hash%t->nbins;
+                binT* b = t->bins + bin;
+                b->lock();              // BEGIN CRITICAL SECTION
+                if (t == table.load(std::memory_order_relaxed)) return b;
+                b->unlock();            // END CRITICAL SECTION
+            }
+        }
+
+        /// Lock-free lookup ... returns the entry (or null) and its bin
+        entryT* find_entry(const keyT& key, int& bin) const {
+            const std::size_t hash = hashfun(key);
+            Hash_private::Epoch::Guard guard;
+            madness::MutexWaiter waiter;
+            while (true) {
+                const unsigned long v = version.load(std::memory_order_acquire);
+                if (v & 1) {
+                    waiter.wait();
+                    continue;
+                }
+                tableT* t = table.load(std::memory_order_acquire);
+                bin = hash%t->nbins;
+                entryT* result = t->bins[bin].match(key);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (version.load(std::memory_order_relaxed) == v) return result;
+            }
+        }
+
+        /// Finds key and acquires the entry lock (unless not found)
+        entryT* find_entry(const keyT& key, int lockmode, int& bin) const {
+            madness::MutexWaiter waiter;
+            while (true) {
+                entryT* result;
+                bool gotlock;
+                {
+                    Hash_private::Epoch::Guard guard;
+                    binT* b = lock_bin(key, bin);
+                    result = b->match(key);
+                    gotlock = !result || result->try_lock(lockmode);
+                    b->unlock();        // END CRITICAL SECTION
+                }
+                if (gotlock) return result;
+                waiter.wait();
+            }
+        }
+
+        /// Inserts datum unless key is present and acquires the entry lock
+        std::pair<entryT*,bool> insert_entry(const datumT& datum, int lockmode, int& bin) {
+            madness::MutexWaiter waiter;
+            bool longchain = false;
+            while (true) {
+                entryT* result;
+                bool notfound, gotlock;
+                {
+                    Hash_private::Epoch::Guard guard;
+                    binT* b = lock_bin(datum.first, bin);
+                    result = b->match(datum.first);
+                    notfound = !result;
+                    if (notfound) {
+                        result = b->push(datum);
+                        longchain = b->size() > size_t(maxchain);
+                    }
+                    gotlock = result->try_lock(lockmode);
+                    b->unlock();        // END CRITICAL SECTION
+                }
+                if (gotlock) {
+                    if (longchain) grow();
+                    return std::pair<entryT*,bool>(result,notfound);
+                }
+                waiter.wait();
+            }
+        }
+
+        /// Removes key and releases the entry lock ... returns true if found
+        bool erase_entry(const keyT& key, int lockmode) {
+            Hash_private::Epoch::Guard guard;
+            int bin;
+            binT* b = lock_bin(key, bin);
+            entryT* t = b->unlink(key);
+            if (t) t->unlock(lockmode);
+            b->unlock();                // END CRITICAL SECTION
+            if (t) Hash_private::Epoch::retire(t);
+            return t;
+        }
+
+        /// Moves all entries to a table about twice the size if the map is crowded
+
+        /// Gives up if another thread is growing the table or an
+        /// iterator made by begin() is alive.
+        void grow() {
+            Hash_private::Epoch::Guard guard;
+            tableT* t = table.load(std::memory_order_acquire);
+            const size_t newnbins = nbins_prime(int(std::min(size_t(2)*t->nbins, size_t(1)<<30)));
+            if (newnbins <= t->nbins) return;
+
+            // Cheap estimate of the load from a sample of bins
+            const size_t nsample = std::min(t->nbins, size_t(64));
+            size_t nsampled = 0;
+            for (size_t i=0; i<nsample; ++i) nsampled += t->bins[(i*t->nbins)/nsample].size();
+            if (nsampled <= 2*nsample) return;
+
+            unsigned long v = version.load();
+            if ((v & 1) || t != table.load() || !version.compare_exchange_strong(v, v+1)) return;
+            if (npinned.load() != 0) {
+                version.store(v);
+                return;
+            }
+
+            for (size_t i=0; i<t->nbins; ++i) t->bins[i].lock();
+            size_t n = 0;
+            for (size_t i=0; i<t->nbins; ++i) n += t->bins[i].size();
+            tableT* newt = 0;
+            if (n > 2*t->nbins) {
+                newt = new tableT(newnbins);
+                for (size_t i=0; i<t->nbins; ++i) {
+                    entryT* p = t->bins[i].detach();
+                    while (p) {
+                        entryT* next = p->next;
+                        newt->bins[hashfun(p->datum.first)%newnbins].relink(p);
+                        p = next;
+                    }
+                }
+                table.store(newt, std::memory_order_release);
+                version.store(v+2, std::memory_order_release);
+            }
+            else {
+                version.store(v);
+            }
+            for (size_t i=0; i<t->nbins; ++i) t->bins[i].unlock();
+            if (newt) Hash_private::Epoch::retire(t);
         }
 
     public:
         ConcurrentHashMap(int n=1021, const hashfunT& hf = hashfunT())
-                : nbins(hashT::nbins_prime(n))
-                , bins(new binT[nbins])
+                : table(new tableT(hashT::nbins_prime(n)))
+                , version(0)
+                , npinned(0)
                 , hashfun(hf) {}
 
         ConcurrentHashMap(const  hashT& h)
-                : nbins(h.nbins)
-                , bins(new binT[nbins])
+                : table(new tableT(h.nbins()))
+                , version(0)
+                , npinned(0)
                 , hashfun(h.hashfun) {
             *this = h;
         }
 
         virtual ~ConcurrentHashMap() {
-            delete [] bins;
+            delete table.load();
         }
 
         hashT& operator=(const  hashT& h) {
@@ -465,16 +839,16 @@ namespace madness {
         }
 
         std::pair<iterator,bool> insert(const datumT& datum) {
-            int bin = hash_to_bin(datum.first);
-            std::pair<entryT*,bool> result = bins[bin].insert(datum,entryT::NOLOCK);
+            int bin;
+            std::pair<entryT*,bool> result = insert_entry(datum,entryT::NOLOCK,bin);
             return std::pair<iterator,bool>(iterator(this,bin,result.first),result.second);
         }
 
         /// Returns true if new pair was inserted; false if key is already in the map and the datum was not inserted
         bool insert(accessor& result, const datumT& datum) {
             result.release();
-            int bin = hash_to_bin(datum.first);
-            std::pair<entryT*,bool> r = bins[bin].insert(datum,entryT::WRITELOCK);
+            int bin;
+            std::pair<entryT*,bool> r = insert_entry(datum,entryT::WRITELOCK,bin);
             result.set(r.first);
             return r.second;
         }
@@ -482,8 +856,8 @@ namespace madness {
         /// Returns true if new pair was inserted; false if key is already in the map and the datum was not inserted
         bool insert(const_accessor& result, const datumT& datum) {
             result.release();
-            int bin = hash_to_bin(datum.first);
-            std::pair<entryT*,bool> r = bins[bin].insert(datum,entryT::READLOCK);
+            int bin;
+            std::pair<entryT*,bool> r = insert_entry(datum,entryT::READLOCK,bin);
             result.set(r.first);
             return r.second;
         }
@@ -499,7 +873,7 @@ namespace madness {
         }
 
         std::size_t erase(const keyT& key) {
-            if (bins[hash_to_bin(key)].del(key,entryT::NOLOCK)) return 1;
+            if (erase_entry(key,entryT::NOLOCK)) return 1;
             else return 0;
         }
 
@@ -509,34 +883,36 @@ namespace madness {
         }
 
         void erase(accessor& item) {
-            bins[hash_to_bin(item->first)].del(item->first,entryT::WRITELOCK);
+            erase_entry(item->first,entryT::WRITELOCK);
             item.unset();
         }
 
         void erase(const_accessor& item) {
             item.convert_read_lock_to_write_lock();
-            bins[hash_to_bin(item->first)].del(item->first,entryT::WRITELOCK);
+            erase_entry(item->first,entryT::WRITELOCK);
             item.unset();
         }
 
+        /// Finds key without taking any lock
         iterator find(const keyT& key) {
-            int bin = hash_to_bin(key);
-            entryT* entry = bins[bin].find(key,entryT::NOLOCK);
+            int bin;
+            entryT* entry = find_entry(key,bin);
             if (!entry) return end();
             else return iterator(this,bin,entry);
         }
 
+        /// Finds key without taking any lock
         const_iterator find(const keyT& key) const {
-            int bin = hash_to_bin(key);
-            const entryT* entry = bins[bin].find(key,entryT::NOLOCK);
+            int bin;
+            const entryT* entry = find_entry(key,bin);
             if (!entry) return end();
             else return const_iterator(this,bin,entry);
         }
 
         bool find(accessor& result, const keyT& key) {
             result.release();
-            int bin = hash_to_bin(key);
-            entryT* entry = bins[bin].find(key,entryT::WRITELOCK);
+            int bin;
+            entryT* entry = find_entry(key,entryT::WRITELOCK,bin);
             bool foundit = entry;
             if (foundit) result.set(entry);
             return foundit;
@@ -544,21 +920,45 @@ namespace madness {
 
         bool find(const_accessor& result, const keyT& key) const {
             result.release();
-            int bin = hash_to_bin(key);
-            entryT* entry = bins[bin].find(key,entryT::READLOCK);
+            int bin;
+            entryT* entry = find_entry(key,entryT::READLOCK,bin);
             bool foundit = entry;
             if (foundit) result.set(entry);
             return foundit;
         }
 
         void clear() {
-            for (unsigned int i=0; i<nbins; ++i) bins[i].clear();
+            Hash_private::Epoch::Guard guard;
+            tableT* t = table.load(std::memory_order_acquire);
+            for (size_t i=0; i<t->nbins; ++i) {
+                binT& b = t->bins[i];
+                b.lock();               // BEGIN CRITICAL SECTION
+                if (t != table.load(std::memory_order_relaxed)) {
+                    // The table grew ... start over on the new one
+                    b.unlock();
+                    t = table.load(std::memory_order_acquire);
+                    i = size_t(-1);
+                    continue;
+                }
+                entryT* p = b.detach();
+                b.unlock();             // END CRITICAL SECTION
+                while (p) {
+                    entryT* next = p->next;
+                    Hash_private::Epoch::retire(p);
+                    p = next;
+                }
+            }
         }
 
         size_t size() const {
-            size_t sum = 0;
-            for (size_t i=0; i<nbins; ++i) sum += bins[i].size();
-            return sum;
+            Hash_private::Epoch::Guard guard;
+            while (true) {
+                const unsigned long v = version.load(std::memory_order_acquire);
+                const tableT* t = table.load(std::memory_order_acquire);
+                size_t sum = 0;
+                for (size_t i=0; i<t->nbins; ++i) sum += t->bins[i].size();
+                if (!(v & 1) && version.load(std::memory_order_acquire) == v) return sum;
+            }
         }
 
         valueT& operator[](const keyT& key) {
@@ -582,12 +982,14 @@ namespace madness {
             return const_iterator(this,false);
         }
 
-        hashfunT& get_hash() const { return hashfun; }
+        const hashfunT& get_hash() const { return hashfun; }
 
         void print_stats() const {
-            for (unsigned int i=0; i<nbins; ++i) {
+            Hash_private::Epoch::Guard guard;
+            const tableT* t = table.load(std::memory_order_acquire);
+            for (unsigned int i=0; i<t->nbins; ++i) {
                 if (i && (i%10)==0) printf("\n");
-                printf("%8d", int(bins[i].size()));
+                printf("%8d", int(t->bins[i].size()));
             }
             printf("\n");
         }
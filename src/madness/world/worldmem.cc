@@ -59,7 +59,7 @@
  */
 
 
-static madness::WorldMemInfo stats = {0, 0, 0, 0, 0, 0, ULONG_MAX, false};
+static madness::WorldMemInfo stats = {0, 0, 0, 0, 0, 0, ULONG_MAX, false, 0, 0, 0, 0, 0, 0, 0};
 
 namespace madness {
     WorldMemInfo* world_mem_info() {
@@ -87,6 +87,7 @@ namespace madness {
     }
 
     void WorldMemInfo::print() const {
+        if (update_pool_stats) update_pool_stats(const_cast<WorldMemInfo*>(this));
         std::cout.flush();
         std::cout << "\n    MADNESS memory statistics\n";
         std::cout << "    -------------------------\n";
@@ -98,6 +99,14 @@ namespace madness {
             << cur_num_frags << " " << std::setw(12) << max_num_frags << "\n";
         std::cout << "  cur and max bytes allocated " << std::setw(12)
             << cur_num_bytes << " " << std::setw(12) << max_num_bytes << "\n";
+        if (update_pool_stats) {
+            std::cout << "         pool hits and misses " << std::setw(12)
+                << pool_num_hits << " " << std::setw(12) << pool_num_misses << "\n";
+            std::cout << "           pool frees to heap " << std::setw(12)
+                << pool_num_frees << "\n";
+            std::cout << "    cur and max bytes in pool " << std::setw(12)
+                << pool_cur_bytes << " " << std::setw(12) << pool_max_bytes << "\n";
+        }
     }
 
     void WorldMemInfo::reset() {
@@ -107,6 +116,11 @@ namespace madness {
         max_num_frags = 0;
         cur_num_bytes = 0;
         max_num_bytes = 0;
+        pool_num_hits = 0;
+        pool_num_misses = 0;
+        pool_num_frees = 0;
+        pool_cur_bytes = 0;
+        pool_max_bytes = 0;
     }
 
 }
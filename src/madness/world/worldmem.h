@@ -74,6 +74,19 @@ namespace madness {
         unsigned long max_mem_limit;   ///< if size+cur_num_bytes>max_mem_limit new will throw MadnessException
         bool trace;
 
+        /// Statistics of the tensor storage pool (configure with --enable-tensor-pool)
+        unsigned long pool_num_hits;   ///< Tensor allocations served from a per-thread pool
+        unsigned long pool_num_misses; ///< Tensor allocations that went to the heap
+        unsigned long pool_num_frees;  ///< Tensor buffers returned to the heap
+        unsigned long pool_cur_bytes;  ///< Bytes currently cached in the pools
+        unsigned long pool_max_bytes;  ///< Sum over threads of the maximum bytes cached
+
+        /// If set, invoked by print() to refresh the pool statistics
+        void (*update_pool_stats)(WorldMemInfo*);
+
+        /// If set, invoked at the end of each global fence to trim the cached tensor buffers
+        void (*trim_pool)();
+
         /// Prints memory use statistics to std::cout
         void print() const;
 
@@ -36,8 +36,16 @@
 #include <madness/world/timers.h>
 #include <iostream>
 #include <algorithm>
+#include <cstring>
 #include <utility>
 #include <sstream>
+#include <atomic>
+#ifdef HAVE_SHM_OPEN
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // HAVE_SHM_OPEN
 
 namespace madness {
 
@@ -49,6 +57,17 @@ namespace madness {
     tbb::task* RMI::tbb_rmi_parent_task = nullptr;
 #endif
 
+    // Count a message for func in a table of RMIStats ... the tables of
+    // sent messages are only touched under the send lock and those of
+    // received ones only by the server thread
+    static void count_handler(RMIHandlerStats* table, rmi_handlerT func, bool batched, bool shm) {
+        RMIHandlerStats* s = RMIStats::slot(table, func);
+        if (!s) return;
+        ++(s->nmsg);
+        if (batched) ++(s->nmsg_batched);
+        if (shm) ++(s->nmsg_shm);
+    }
+
     void RMI::RmiTask::process_some() {
 
         const bool print_debug_info = RMI::debugging;
@@ -60,11 +79,14 @@ namespace madness {
         // If MPI is not safe for simultaneous entry by multiple threads we
         // cannot call Waitsome ... have to poll via Testsome
         int narrived = 0, iterations = 0;
+        bool shm_arrived = false;
 
         MutexWaiter waiter;
-        while((narrived == 0) && (iterations < 1000)) {
+        while((narrived == 0) && !shm_arrived && (iterations < 1000)) {
 	  narrived = SafeMPI::Request::Testsome(maxq_, recv_req.get(), ind.get(), status.get());
+	  shm_arrived = shm_poll();
 	  ++iterations;
+	  flush_stale();
 	  myusleep(RMI::testsome_backoff_us);
         }
 
@@ -89,6 +111,7 @@ namespace madness {
                 rmi_handlerT func = h->func;
                 const attrT attr = h->attr;
                 const counterT count = (attr>>16); //&&0xffff;
+                count_handler(RMI::stats.handler_recv, func, false, false);
 
                 if (!is_ordered(attr) || count==recv_counters[src]) {
                     // Unordered and in order messages should be digested as soon as possible.
@@ -102,7 +125,7 @@ namespace madness {
                                   << std::endl;
 
                     if (is_ordered(attr)) ++(recv_counters[src]);
-                    func(recv_buf[i], len);
+                    invoke(func, recv_buf[i], len, src);
                     post_recv_buf(i);
                 }
                 else {
@@ -122,48 +145,65 @@ namespace madness {
                 }
             }
 
-            // Only ordered messages can end up in the queue due to
-            // out-of-order receipt or order of recv buffer processing.
+            process_queue();
 
-            // Sort queued messages by ascending recv count
-            std::sort(q.get(),q.get()+n_in_q);
+            post_pending_huge_msg();
+        }
 
-            // Loop thru messages ... since we have sorted only one pass
-            // is necessary and if we cannot process a message we
-            // save it at the beginning of the queue
-            int nleftover = 0;
-            for (int m=0; m<n_in_q; ++m) {
-                const int src = q[m].src;
-                if (q[m].count == recv_counters[src]) {
-                    if (print_debug_info)
-                        std::cerr << rank
-                                  << ":RMI: queue invoking from=" << src
-                                  << " nbyte=" << q[m].len
-                                  << " func=" << q[m].func
-                                  << " ordered=" << is_ordered(q[m].attr)
-                                  << " count=" << q[m].count
-                                  << std::endl;
+        // Messages from this host ... these and the queued messages may
+        // release each other
+        if (shm_arrived || narrived) {
+            while (shm_process() && n_in_q && process_queue()) {}
+        }
+    }
 
-                    ++(recv_counters[src]);
-                    q[m].func(recv_buf[q[m].i], q[m].len);
-                    post_recv_buf(q[m].i);
-                }
-                else {
-                    q[nleftover++] = q[m];
-                    if (print_debug_info)
-                        std::cerr << rank
-                                  << ":RMI: queue pending out of order from=" << src
-                                  << " nbyte=" << q[m].len
-                                  << " func=" << q[m].func
-                                  << " ordered=" << is_ordered(q[m].attr)
-                                  << " count=" << q[m].count
-                                  << std::endl;
-                }
+    // Invoke queued messages that are now in order ... returns the number invoked
+    int RMI::RmiTask::process_queue() {
+        const bool print_debug_info = RMI::debugging;
+        int ninvoked = 0;
+
+        // Only ordered messages can end up in the queue due to
+        // out-of-order receipt or order of recv buffer processing.
+
+        // Sort queued messages by ascending recv count
+        std::sort(q.get(),q.get()+n_in_q);
+
+        // Loop thru messages ... since we have sorted only one pass
+        // is necessary and if we cannot process a message we
+        // save it at the beginning of the queue
+        int nleftover = 0;
+        for (int m=0; m<n_in_q; ++m) {
+            const int src = q[m].src;
+            if (q[m].count == recv_counters[src]) {
+                if (print_debug_info)
+                    std::cerr << rank
+                              << ":RMI: queue invoking from=" << src
+                              << " nbyte=" << q[m].len
+                              << " func=" << q[m].func
+                              << " ordered=" << is_ordered(q[m].attr)
+                              << " count=" << q[m].count
+                              << std::endl;
+
+                ++(recv_counters[src]);
+                invoke(q[m].func, recv_buf[q[m].i], q[m].len, src);
+                ++ninvoked;
+                post_recv_buf(q[m].i);
+            }
+            else {
+                q[nleftover++] = q[m];
+                if (print_debug_info)
+                    std::cerr << rank
+                              << ":RMI: queue pending out of order from=" << src
+                              << " nbyte=" << q[m].len
+                              << " func=" << q[m].func
+                              << " ordered=" << is_ordered(q[m].attr)
+                              << " count=" << q[m].count
+                              << std::endl;
             }
-            n_in_q = nleftover;
-
-            post_pending_huge_msg();
         }
+        n_in_q = nleftover;
+
+        return ninvoked;
     }
 
     void RMI::RmiTask::post_pending_huge_msg() {
@@ -198,6 +238,29 @@ namespace madness {
         }
     }
 
+    // Get a size in bytes with an optional unit (KB, MB or GB) from the environment
+    static bool getenv_bytes(const char* name, double& memory) {
+        const char* value = getenv(name);
+        if (!value) return false;
+        std::stringstream ss(value);
+        memory = 0.0;
+        if(ss >> memory) {
+            if(memory > 0.0) {
+                std::string unit;
+                if(ss >> unit) { // Failure == assume bytes
+                    if(unit == "KB" || unit == "kB") {
+                        memory *= 1024.0;
+                    } else if(unit == "MB") {
+                        memory *= 1048576.0;
+                    } else if(unit == "GB") {
+                        memory *= 1073741824.0;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
     RMI::RmiTask::~RmiTask() {
         //         if (!SafeMPI::Is_finalized()) {
         //             for (int i=0; i<nrecv_; ++i) {
@@ -206,6 +269,16 @@ namespace madness {
         //             }
         //         }
         //for (int i=0; i<nrecv_; ++i) free(recv_buf[i]);
+        // The server thread waits for the batches in flight before exit()
+        // returns ... once MPI is finalized no send can still read them
+        if (!SafeMPI::Is_finalized()) wait_inflight();
+        for (std::list< std::pair<void*,Request> >::iterator it=inflight.begin(); it!=inflight.end(); ++it)
+            free(it->first);
+        if (batches) {
+            for (int p=0; p<nproc; ++p) free(batches[p].buf);
+        }
+        for (std::size_t i=0; i<free_batch_buf.size(); ++i) free(free_batch_buf[i]);
+        shm_detach();
     }
 
     RMI::RmiTask::RmiTask()
@@ -224,29 +297,17 @@ namespace madness {
             , ind()
             , q()
             , n_in_q(0)
+            , batch_size_(0)
+            , batch_timeout_(100e-6)
+            , shm_size_(0)
+            , shm_base_(0)
+            , shm_bytes_(0)
+            , shm_nlocal_(0)
     {
         // Get the maximum buffer size from the MAD_BUFFER_SIZE environment
         // variable.
-        const char* mad_buffer_size = getenv("MAD_BUFFER_SIZE");
-        if(mad_buffer_size) {
-            // Convert the string into bytes
-            std::stringstream ss(mad_buffer_size);
-            double memory = 0.0;
-            if(ss >> memory) {
-                if(memory > 0.0) {
-                    std::string unit;
-                    if(ss >> unit) { // Failure == assume bytes
-                        if(unit == "KB" || unit == "kB") {
-                            memory *= 1024.0;
-                        } else if(unit == "MB") {
-                            memory *= 1048576.0;
-                        } else if(unit == "GB") {
-                            memory *= 1073741824.0;
-                        }
-                    }
-                }
-            }
-
+        double memory = 0.0;
+        if(getenv_bytes("MAD_BUFFER_SIZE", memory)) {
             max_msg_len_ = memory;
             // Check that the size of the receive buffers is reasonable.
             if(max_msg_len_ < 1024) {
@@ -275,6 +336,33 @@ namespace madness {
             maxq_ = nrecv_ + 1;
         }
 
+        // Get the size of message batches from the MAD_BATCH_SIZE environment
+        // variable ... zero or unset means no aggregation
+        if(getenv_bytes("MAD_BATCH_SIZE", memory) && memory > 0.0) {
+            batch_size_ = std::min(std::size_t(memory), max_msg_len_);
+            if(batch_size_ < 4*HEADER_LEN) {
+                batch_size_ = 4*HEADER_LEN;
+                std::cerr << "!!! WARNING: MAD_BATCH_SIZE must be at least " << batch_size_ << " bytes.\n"
+                          << "!!! WARNING: Increasing MAD_BATCH_SIZE to " << batch_size_ << " bytes.\n";
+            }
+            batch_size_ -= batch_size_ % ALIGNMENT;
+
+            const char* mad_batch_timeout = getenv("MAD_BATCH_TIMEOUT_US");
+            if(mad_batch_timeout) {
+                std::stringstream ss(mad_batch_timeout);
+                double us = 0.0;
+                if(ss >> us && us >= 0.0) batch_timeout_ = us*1e-6;
+            }
+
+            batches.reset(new batch[nproc]);
+            for(int p = 0; p < nproc; ++p) {
+                batches[p].buf = 0;
+                batches[p].nbyte = HEADER_LEN;
+                batches[p].nmsg = 0;
+                batches[p].start = 0.0;
+            }
+        }
+
         // Allocate memory for receive buffer and requests
         recv_buf.reset(new void*[maxq_]);
         recv_req.reset(new Request[maxq_]);
@@ -296,6 +384,8 @@ namespace madness {
                 post_recv_buf(i);
             }
             recv_buf[nrecv_] = 0;
+
+            shm_attach();
         }
     }
 
@@ -310,8 +400,377 @@ namespace madness {
         RMI::task_ptr->post_pending_huge_msg();
     }
 
+    void RMI::RmiTask::batch_handler(void *buf, size_t nbytein) {
+        char* p = static_cast<char*>(buf) + HEADER_LEN;
+        char* const end = static_cast<char*>(buf) + nbytein;
+        while (p < end) {
+            const batch_header* h = (const batch_header*)(p);
+            const size_t nbyte = h->nbyte;
+            count_handler(RMI::stats.handler_recv, h->h.func, true, false);
+            h->h.func(p, nbyte);
+            p += (nbyte + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+            ++(RMI::stats.nmsg_batched_recv);
+        }
+        ++(RMI::stats.nbatch_recv);
+    }
+
+    // Copy a message into the batch for dest, sending the batch first if it is full
+    void RMI::RmiTask::add_to_batch_with_lock(const void* buf, size_t nbyte, ProcessID dest, rmi_handlerT func, attrT attr) {
+        // ASSUME WE ALREADY HAVE THE MUTEX WHEN IN HERE
+        batch& b = batches[dest];
+        const size_t nalign = (nbyte + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        if (b.buf && b.nbyte + nalign > batch_size_) send_batch_with_lock(dest);
+
+        if (!b.buf) {
+            // Reuse buffers of batches that have been sent
+            for (std::list< std::pair<void*,Request> >::iterator it=inflight.begin(); it!=inflight.end(); ) {
+                if (it->second.Test()) {
+                    free_batch_buf.push_back(it->first);
+                    it = inflight.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+            if (free_batch_buf.empty()) {
+                if (posix_memalign(&b.buf, ALIGNMENT, batch_size_))
+                    MADNESS_EXCEPTION("RMI: failed allocating batch buffer", 1);
+            }
+            else {
+                b.buf = free_batch_buf.back();
+                free_batch_buf.pop_back();
+            }
+            b.nbyte = HEADER_LEN;
+            b.nmsg = 0;
+            b.start = wall_time();
+            pending.push_back(dest);
+        }
+
+        char* p = static_cast<char*>(b.buf) + b.nbyte;
+        memcpy(p, buf, nbyte);
+        batch_header* h = (batch_header*)(p);
+        h->h.func = func;
+        h->h.attr = attr;
+        h->nbyte = nbyte;
+        b.nbyte += nalign;
+        ++b.nmsg;
+        ++(RMI::stats.nmsg_batched_sent);
+        count_handler(RMI::stats.handler_sent, func, true, false);
+    }
+
+    // Send the batch for dest as one ordered message
+    void RMI::RmiTask::send_batch_with_lock(ProcessID dest) {
+        // ASSUME WE ALREADY HAVE THE MUTEX WHEN IN HERE
+        batch& b = batches[dest];
+        if (!b.buf) return;
+
+        header* h = (header*)(b.buf);
+        h->func = batch_handler;
+        h->attr = ATTR_ORDERED | ((send_counters[dest]++)<<16);
+
+        if (RMI::debugging)
+            std::cerr << rank
+                      << ":RMI: sending batch nmsg=" << b.nmsg
+                      << " nbyte=" << b.nbyte
+                      << " dest=" << dest
+                      << " count=" << (h->attr>>16)
+                      << std::endl;
+
+        ++(RMI::stats.nmsg_sent);
+        ++(RMI::stats.nbatch_sent);
+        RMI::stats.nbyte_sent += b.nbyte;
+        count_handler(RMI::stats.handler_sent, batch_handler, false, false);
+
+        if (shm_send_with_lock(b.buf, b.nbyte, dest))
+            free_batch_buf.push_back(b.buf);
+        else
+            inflight.push_back(std::make_pair(b.buf, comm.Isend(b.buf, b.nbyte, MPI_BYTE, dest, SafeMPI::RMI_TAG)));
+        b.buf = 0;
+        pending.erase(std::find(pending.begin(), pending.end(), dest));
+    }
+
+    // Wait until the batches being sent are delivered and keep their buffers for freeing
+    // ... only the server thread calls this, when no more messages are being sent
+    void RMI::RmiTask::wait_inflight() {
+        while (!inflight.empty()) {
+            std::pair<void*,Request>& s = inflight.front();
+            while (!s.second.Test()) myusleep(100);
+            free_batch_buf.push_back(s.first);
+            inflight.pop_front();
+        }
+    }
+
+    // Send pending batches ... if stale_only just those that have waited too long
+    void RMI::RmiTask::flush_with_lock(bool stale_only) {
+        // ASSUME WE ALREADY HAVE THE MUTEX WHEN IN HERE
+        if (pending.empty()) return;
+        const double now = stale_only ? wall_time() : 0.0;
+        for (int i=int(pending.size())-1; i>=0; --i) {
+            const ProcessID dest = pending[i];
+            if (!stale_only || (now - batches[dest].start) > batch_timeout_)
+                send_batch_with_lock(dest);
+        }
+    }
+
+    // Send batches that have waited too long ... if a sender is busy
+    // with the mutex it will do so itself
+    void RMI::RmiTask::flush_stale() {
+        if (batch_size_ && try_lock()) {
+            flush_with_lock(true);
+            unlock();
+        }
+    }
+
+    void RMI::RmiTask::flush() {
+        if (!batch_size_) return;
+        lock();
+        flush_with_lock(false);
+        unlock();
+    }
+
+    // A ring of messages from one process to another on the same host.
+    // The positions only increase ... the offset into the data is the
+    // position modulo the capacity.  Each message is preceded by ALIGNMENT
+    // bytes holding its length and is padded to a multiple of ALIGNMENT so
+    // the handler sees the same alignment as with a recv buffer.  A length
+    // of zero marks the end of the data that the receiver skips so that a
+    // message never wraps around.
+    struct RMI::RmiTask::shm_ring {
+        std::atomic<std::size_t> head; // Written by the sender
+        char pad0[ALIGNMENT - sizeof(std::atomic<std::size_t>)];
+        std::atomic<std::size_t> tail; // Written by the receiver
+        char pad1[ALIGNMENT - sizeof(std::atomic<std::size_t>)];
+
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+    }; // struct shm_ring
+
+    // Map the rings shared with the other processes on this host ... collective
+    void RMI::RmiTask::shm_attach() {
+#ifdef HAVE_SHM_OPEN
+        // Get the capacity of each ring from the MAD_SHM_SIZE environment
+        // variable ... unset or zero means use MPI for all messages.  The
+        // rings of a host take nlocal^2 times this much memory.
+        double memory = 0.0;
+        getenv_bytes("MAD_SHM_SIZE", memory);
+        unsigned long size = std::max(memory, 0.0);
+        size -= size % ALIGNMENT;
+        unsigned long minsize = 0;
+        comm.Allreduce(&size, &minsize, 1, MPI_UNSIGNED_LONG, MPI_MIN);
+        if (minsize < 4*HEADER_LEN) return;
+
+        // Find the processes on this host ... the first of them creates the rings
+        struct procinfo {
+            char host[256];
+            long pid;
+        };
+        procinfo me;
+        memset(&me, 0, sizeof(me));
+        gethostname(me.host, sizeof(me.host) - 1);
+        me.pid = getpid();
+        std::unique_ptr<procinfo[]> all(new procinfo[nproc]);
+        comm.Allgather(&me, sizeof(me), MPI_BYTE, all.get(), sizeof(me), MPI_BYTE);
+
+        shm_index.reset(new int[nproc]);
+        int nlocal = 0;
+        ProcessID first = -1;
+        for (ProcessID p=0; p<nproc; ++p) {
+            if (strcmp(all[p].host, me.host) == 0) {
+                if (first < 0) first = p;
+                if (p != rank) shm_procs.push_back(p);
+                shm_index[p] = nlocal++;
+            }
+            else {
+                shm_index[p] = -1;
+            }
+        }
+
+        std::stringstream ss;
+        ss << "/madness_rmi_" << all[first].pid;
+        const std::string name = ss.str();
+        const std::size_t bytes = std::size_t(nlocal)*nlocal*(sizeof(shm_ring) + minsize);
+
+        int ok = 1, fd = -1;
+        if (nlocal > 1 && rank == first) {
+            shm_unlink(name.c_str()); // Left by a job that did not finish
+            fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+            // Allocate now so that running out of memory is not a SIGBUS later
+            if (fd < 0 || posix_fallocate(fd, 0, bytes) != 0) ok = 0;
+        }
+        comm.Barrier();
+        if (nlocal > 1 && rank != first) {
+            fd = shm_open(name.c_str(), O_RDWR, 0);
+            if (fd < 0) ok = 0;
+        }
+        void* base = 0;
+        if (ok && fd >= 0) {
+            base = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (base == MAP_FAILED) {
+                base = 0;
+                ok = 0;
+            }
+        }
+        if (fd >= 0) close(fd);
+
+        int allok = 0;
+        comm.Allreduce(&ok, &allok, 1, MPI_INT, MPI_MIN);
+        if (nlocal > 1 && rank == first) shm_unlink(name.c_str()); // All are mapped now
+
+        if (allok && base) {
+            shm_size_ = minsize;
+            shm_base_ = base;
+            shm_bytes_ = bytes;
+            shm_nlocal_ = nlocal;
+        }
+        else {
+            if (base) munmap(base, bytes);
+            shm_procs.clear();
+            if (!allok && rank == 0)
+                std::cerr << "!!! WARNING: RMI could not map shared memory for processes on the same host.\n"
+                          << "!!! WARNING: Sending all messages with MPI.\n";
+        }
+#endif // HAVE_SHM_OPEN
+    }
+
+    void RMI::RmiTask::shm_detach() {
+#ifdef HAVE_SHM_OPEN
+        if (shm_base_) munmap(shm_base_, shm_bytes_);
+#endif // HAVE_SHM_OPEN
+        shm_base_ = 0;
+        shm_size_ = 0;
+    }
+
+    RMI::RmiTask::shm_ring* RMI::RmiTask::shm_ring_between(ProcessID src, ProcessID dest) const {
+        const std::size_t i = std::size_t(shm_index[src])*shm_nlocal_ + shm_index[dest];
+        return reinterpret_cast<shm_ring*>(static_cast<char*>(shm_base_) + i*(sizeof(shm_ring) + shm_size_));
+    }
+
+    // Copy a message into the ring to dest ... false if dest is on another
+    // host or the message does not fit, in which case MPI must send it
+    bool RMI::RmiTask::shm_send_with_lock(const void* buf, size_t nbyte, ProcessID dest) {
+        // ASSUME WE ALREADY HAVE THE MUTEX WHEN IN HERE
+        if (!shm_size_ || dest == rank || shm_index[dest] < 0) return false;
+
+        const size_t need = ALIGNMENT + ((nbyte + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+        if (4*need > shm_size_) return false;
+
+        shm_ring* r = shm_ring_between(rank, dest);
+        size_t head = r->head.load(std::memory_order_relaxed);
+        const size_t tail = r->tail.load(std::memory_order_acquire);
+        size_t off = head % shm_size_;
+        const size_t skip = (shm_size_ - off < need) ? shm_size_ - off : 0;
+        if (head + skip + need - tail > shm_size_) return false;
+
+        char* data = r->data();
+        if (skip) {
+            *reinterpret_cast<size_t*>(data + off) = 0;
+            head += skip;
+            off = 0;
+        }
+        *reinterpret_cast<size_t*>(data + off) = nbyte;
+        memcpy(data + off + ALIGNMENT, buf, nbyte);
+        r->head.store(head + need, std::memory_order_release);
+
+        ++(RMI::stats.nmsg_shm_sent);
+        // The message was counted for its handler by the caller
+        RMIHandlerStats* s = RMIStats::slot(RMI::stats.handler_sent, reinterpret_cast<const header*>(buf)->func);
+        if (s) ++(s->nmsg_shm);
+        return true;
+    }
+
+    // True if a ring to this process holds a message that can be invoked
+    // now ... an ordered message that waits for earlier ones sent with MPI
+    // does not count, so the server does not spin on it
+    bool RMI::RmiTask::shm_poll() const {
+        for (std::size_t k=0; k<shm_procs.size(); ++k) {
+            const ProcessID src = shm_procs[k];
+            shm_ring* r = shm_ring_between(src, rank);
+            const size_t tail = r->tail.load(std::memory_order_relaxed);
+            if (r->head.load(std::memory_order_acquire) == tail) continue;
+
+            const char* data = r->data() + tail % shm_size_;
+            if (*reinterpret_cast<const size_t*>(data) == 0) return true; // Skip to the start
+            const attrT attr = reinterpret_cast<const header*>(data + ALIGNMENT)->attr;
+            if (!is_ordered(attr) || counterT(attr>>16) == recv_counters[src]) return true;
+        }
+        return false;
+    }
+
+    // Invoke the messages in the rings to this process ... returns the number invoked
+    int RMI::RmiTask::shm_process() {
+        const bool print_debug_info = RMI::debugging;
+        int ninvoked = 0;
+
+        for (std::size_t k=0; k<shm_procs.size(); ++k) {
+            const ProcessID src = shm_procs[k];
+            shm_ring* r = shm_ring_between(src, rank);
+            char* data = r->data();
+            size_t tail = r->tail.load(std::memory_order_relaxed);
+            const size_t head = r->head.load(std::memory_order_acquire);
+            while (tail != head) {
+                const size_t off = tail % shm_size_;
+                const size_t len = *reinterpret_cast<const size_t*>(data + off);
+                if (len == 0) {
+                    tail += shm_size_ - off;
+                    r->tail.store(tail, std::memory_order_release);
+                    continue;
+                }
+
+                void* buf = data + off + ALIGNMENT;
+                const header* h = (const header*)(buf);
+                rmi_handlerT func = h->func;
+                const attrT attr = h->attr;
+                const counterT count = (attr>>16);
+
+                // An ordered message waits at the front of the ring for
+                // earlier ones that were sent with MPI
+                if (is_ordered(attr) && count != recv_counters[src]) break;
+
+                if (print_debug_info)
+                    std::cerr << rank
+                              << ":RMI: shm invoking from=" << src
+                              << " nbyte=" << len
+                              << " func=" << func
+                              << " ordered=" << is_ordered(attr)
+                              << " count=" << count
+                              << std::endl;
+
+                ++(RMI::stats.nmsg_recv);
+                ++(RMI::stats.nmsg_shm_recv);
+                RMI::stats.nbyte_recv += len;
+                count_handler(RMI::stats.handler_recv, func, false, true);
+
+                if (is_ordered(attr)) ++(recv_counters[src]);
+                invoke(func, buf, len, src);
+                ++ninvoked;
+
+                tail += ALIGNMENT + ((len + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+                r->tail.store(tail, std::memory_order_release);
+            }
+        }
+
+        return ninvoked;
+    }
+
+    RMI::Request
+    RMI::RmiTask::isend(const void* buf, size_t nbyte, ProcessID dest, rmi_handlerT func, attrT attr) {
+#ifdef MADNESS_TASK_PROFILING
+        profiling::TraceEvents::instant("rmi send", "rmi", wall_time(), "dest", dest, "nbyte", nbyte);
+#endif // MADNESS_TASK_PROFILING
+        if (batch_size_ && nbyte >= HEADER_LEN && 4*nbyte <= batch_size_) {
+            // The message is copied so the buffer may be reused at once,
+            // which the null request that is returned indicates
+            lock();
+            add_to_batch_with_lock(buf, nbyte, dest, func, attr);
+            if ((wall_time() - batches[dest].start) > batch_timeout_)
+                send_batch_with_lock(dest);
+            unlock();
+            return Request();
+        }
+        return isend_now(buf, nbyte, dest, func, attr);
+    }
+
     RMI::Request
-    RMI::RmiTask::RmiTask::isend(const void* buf, size_t nbyte, ProcessID dest, rmi_handlerT func, attrT attr) {
+    RMI::RmiTask::isend_now(const void* buf, size_t nbyte, ProcessID dest, rmi_handlerT func, attrT attr) {
         int tag = SafeMPI::RMI_TAG;
 
         if (nbyte > max_msg_len_) {
@@ -324,7 +783,7 @@ namespace madness {
 
             int ack;
             Request req_ack = comm.Irecv(&ack, sizeof(ack), MPI_BYTE, dest, SafeMPI::RMI_HUGE_ACK_TAG);
-            Request req_send = isend(info, sizeof(info), dest, RMI::RmiTask::huge_msg_handler, ATTR_UNORDERED);
+            Request req_send = isend_now(info, sizeof(info), dest, RMI::RmiTask::huge_msg_handler, ATTR_UNORDERED);
 
             MutexWaiter waiter;
             while (!req_send.Test()) waiter.wait();
@@ -356,6 +815,8 @@ namespace madness {
         // holding an early counter.
         if (is_ordered(attr)) {
             //lock();
+            // Aggregated messages to dest were sent before this one
+            if (batch_size_) send_batch_with_lock(dest);
             attr |= ((send_counters[dest]++)<<16);
         }
 
@@ -365,8 +826,12 @@ namespace madness {
 
         ++(RMI::stats.nmsg_sent);
         RMI::stats.nbyte_sent += nbyte;
+        count_handler(RMI::stats.handler_sent, func, false, false);
 
-        Request result = comm.Isend(buf, nbyte, MPI_BYTE, dest, tag);
+        // The message has been copied if it went through shared memory
+        Request result;
+        if (tag != SafeMPI::RMI_TAG || !shm_send_with_lock(buf, nbyte, dest))
+            result = comm.Isend(buf, nbyte, MPI_BYTE, dest, tag);
 
         //if (is_ordered(attr)) unlock();
         unlock();
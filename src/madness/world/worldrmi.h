@@ -39,6 +39,7 @@
 #include <utility>
 #include <list>
 #include <memory>
+#include <vector>
 
 /*
   There is just one server thread and it is the only one
@@ -80,6 +81,18 @@
   void RMI::end()
   - to terminate the server thread
 
+  void RMI::flush()
+  - to send all messages that are waiting to be aggregated
+
+  If MAD_SHM_SIZE is set to the capacity of a ring in bytes, messages
+  to processes on the same host go through rings in shared memory (one
+  per ordered pair of processes) instead of MPI.  The rings take
+  nlocal^2*MAD_SHM_SIZE bytes for nlocal processes on the host.  By
+  default all messages use MPI.  A message that does not fit in the ring,
+  including any huge message, is sent with MPI as before.  The order
+  counters are the same for both routes so ordered messages stay in
+  order.
+
   bool RMI::get_debug()
   - to get the debug flag
 
@@ -120,15 +133,60 @@ namespace madness {
     }; // struct qmsg
 
 
+    /// Message counts for one handler
+    struct RMIHandlerStats {
+        rmi_handlerT func;          ///< The handler ... null if the slot is free
+        uint64_t nmsg;              ///< Messages for it
+        uint64_t nmsg_batched;      ///< ... of which went in batches
+        uint64_t nmsg_shm;          ///< ... of which went through shared memory
+    };
+
     // Holds message passing statistics
     struct RMIStats {
+        static const int NHANDLER = 16; ///< Handlers counted separately ... later ones are not
         uint64_t nmsg_sent;
         uint64_t nbyte_sent;
         uint64_t nmsg_recv;
         uint64_t nbyte_recv;
+        uint64_t nbatch_sent;       ///< Messages sent by the batch handler
+        uint64_t nmsg_batched_sent; ///< Messages aggregated into them
+        uint64_t nbatch_recv;       ///< Messages received by the batch handler
+        uint64_t nmsg_batched_recv; ///< Messages unpacked from them
+        uint64_t nmsg_shm_sent;     ///< Messages sent through shared memory
+        uint64_t nmsg_shm_recv;     ///< Messages received through shared memory
+        RMIHandlerStats handler_sent[NHANDLER]; ///< Messages sent, by handler (under the send lock)
+        RMIHandlerStats handler_recv[NHANDLER]; ///< Messages received, by handler (by the server thread)
 
         RMIStats()
-                : nmsg_sent(0), nbyte_sent(0), nmsg_recv(0), nbyte_recv(0) {}
+                : nmsg_sent(0), nbyte_sent(0), nmsg_recv(0), nbyte_recv(0)
+                , nbatch_sent(0), nmsg_batched_sent(0), nbatch_recv(0), nmsg_batched_recv(0)
+                , nmsg_shm_sent(0), nmsg_shm_recv(0), handler_sent(), handler_recv() {}
+
+        /// Counts of messages sent with handler \c func (zero if none were)
+        RMIHandlerStats sent(rmi_handlerT func) const { return find(handler_sent, func); }
+
+        /// Counts of messages received with handler \c func (zero if none were)
+        RMIHandlerStats recv(rmi_handlerT func) const { return find(handler_recv, func); }
+
+        /// The slot of \c func in \c table, taking a free one if needed ... null if the table is full
+        static RMIHandlerStats* slot(RMIHandlerStats* table, rmi_handlerT func) {
+            for (int i=0; i<NHANDLER; ++i) {
+                if (table[i].func == func) return table + i;
+                if (!table[i].func) {
+                    table[i].func = func;
+                    return table + i;
+                }
+            }
+            return 0;
+        }
+
+    private:
+        static RMIHandlerStats find(const RMIHandlerStats* table, rmi_handlerT func) {
+            for (int i=0; i<NHANDLER && table[i].func; ++i)
+                if (table[i].func == func) return table[i];
+            RMIHandlerStats none = {func, 0, 0, 0};
+            return none;
+        }
     };
 
 
@@ -166,6 +224,20 @@ namespace madness {
                 attrT attr;
             }; // struct header
 
+            /// Header of a message inside a batch ... records its length
+            struct batch_header {
+                header h;
+                size_t nbyte;
+            }; // struct batch_header
+
+            /// Small messages waiting to be sent to one process as one message
+            struct batch {
+                void* buf;          // At least ALIGNMENT aligned, null if not in use
+                size_t nbyte;       // Bytes used including the header
+                int nmsg;           // No. of messages in the batch
+                double start;       // Time that the first message was added
+            }; // struct batch
+
             std::list< std::pair<int,size_t> > hugeq; // q for incoming huge messages
 
             SafeMPI::Intracomm comm;
@@ -186,10 +258,42 @@ namespace madness {
             std::unique_ptr<qmsg[]> q;
             int n_in_q;
 
+            // Aggregation of small messages, all protected by the mutex
+            std::size_t batch_size_;    // Size of a batch ... zero if not aggregating
+            double batch_timeout_;      // Max. age in seconds of a batch before it is sent
+            std::unique_ptr<batch[]> batches; // One per process
+            std::vector<int> pending;   // Processes with a batch in use
+            std::list< std::pair<void*,Request> > inflight; // Batches being sent
+            std::vector<void*> free_batch_buf; // Batch buffers for reuse
+
+            // Transport between processes on this host ... the rings are
+            // written with the mutex held and read only by the server thread
+            struct shm_ring;
+            std::size_t shm_size_;      // Capacity of a ring ... zero if not in use
+            void* shm_base_;            // Mapping holding the rings of this host
+            std::size_t shm_bytes_;     // Size of the mapping
+            int shm_nlocal_;            // No. of processes on this host
+            std::unique_ptr<int[]> shm_index; // Index of each process on this host, -1 if elsewhere
+            std::vector<ProcessID> shm_procs; // The other processes on this host
+
             static inline bool is_ordered(attrT attr) { return attr & ATTR_ORDERED; }
 
+            /// Invokes the handler of a message from src, which is traced when profiling
+            static inline void invoke(rmi_handlerT func, void* buf, size_t len, ProcessID src) {
+#ifdef MADNESS_TASK_PROFILING
+                const double start = wall_time();
+                func(buf, len);
+                profiling::TraceEvents::record("rmi recv", "rmi", start, wall_time(),
+                        "src", src, "nbyte", len);
+#else
+                func(buf, len);
+#endif // MADNESS_TASK_PROFILING
+            }
+
             void process_some();
 
+            int process_queue();
+
             RmiTask();
             virtual ~RmiTask();
 
@@ -201,6 +305,7 @@ namespace madness {
                    tbb::task::increment_ref_count();
                    tbb::task::recycle_as_safe_continuation();
                 } else {
+                    wait_inflight();
                     finished = false;
                 }
                 return nullptr;
@@ -209,6 +314,7 @@ namespace madness {
             void run() {
                 try {
                     while (! finished) process_some();
+                    wait_inflight();
                     finished = false;
                 } catch(...) {
                     delete this;
@@ -230,8 +336,36 @@ namespace madness {
 
             static void huge_msg_handler(void *buf, size_t nbytein);
 
+            static void batch_handler(void *buf, size_t nbytein);
+
             Request isend(const void* buf, size_t nbyte, ProcessID dest, rmi_handlerT func, attrT attr);
 
+            Request isend_now(const void* buf, size_t nbyte, ProcessID dest, rmi_handlerT func, attrT attr);
+
+            void add_to_batch_with_lock(const void* buf, size_t nbyte, ProcessID dest, rmi_handlerT func, attrT attr);
+
+            void send_batch_with_lock(ProcessID dest);
+
+            void flush_with_lock(bool stale_only);
+
+            void flush_stale();
+
+            void flush();
+
+            void wait_inflight();
+
+            void shm_attach();
+
+            void shm_detach();
+
+            shm_ring* shm_ring_between(ProcessID src, ProcessID dest) const;
+
+            bool shm_send_with_lock(const void* buf, size_t nbyte, ProcessID dest);
+
+            bool shm_poll() const;
+
+            int shm_process();
+
             void post_pending_huge_msg();
 
             void post_recv_buf(int i);
@@ -305,6 +439,7 @@ namespace madness {
             tbb::task::enqueue(*task_ptr, tbb::priority_high);
 #else
             task_ptr = new RmiTask();
+            ThreadPool::set_rmi_thread(task_ptr);
             task_ptr->start();
 #endif // HAVE_INTEL_TBB
         }
@@ -320,6 +455,17 @@ namespace madness {
             }
         }
 
+        /// Send all messages waiting to be aggregated
+
+        /// Messages no larger than a quarter of \c MAD_BATCH_SIZE bytes are
+        /// collected per destination and sent together when the batch is
+        /// full, when it is older than \c MAD_BATCH_TIMEOUT_US, or when this is
+        /// called (\c WorldGopInterface::fence() does so).  Aggregation is
+        /// off unless \c MAD_BATCH_SIZE is set.
+        static void flush() {
+            if (task_ptr) task_ptr->flush();
+        }
+
         static void set_debug(bool status) { debugging = status; }
 
         static bool get_debug() { return debugging; }
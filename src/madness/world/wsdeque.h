@@ -0,0 +1,174 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+#ifndef MADNESS_WORLD_WSDEQUE_H__INCLUDED
+#define MADNESS_WORLD_WSDEQUE_H__INCLUDED
+
+#include <atomic>
+#include <cstddef>
+
+/// \file wsdeque.h
+/// \brief Implements WSDeque
+
+namespace madness {
+
+    /// A lock-free work-stealing deque (Chase and Lev).
+
+    /// Only the owning thread may call \c push() and \c pop(), which work
+    /// on the bottom of the deque, so the owner runs its most recent work
+    /// first.  Any thread may call \c steal(), which takes the oldest
+    /// element from the top.  The buffer is circular and doubles when
+    /// full.  Since a thief may still be reading from a buffer that has
+    /// been replaced, old buffers are kept until the deque is destroyed.
+    ///
+    /// The memory ordering follows Le, Pop, Cohen and Zappa Nardelli,
+    /// "Correct and efficient work-stealing for weak memory models",
+    /// PPoPP 2013.
+    template <typename T>
+    class WSDeque {
+        class Array {
+        public:
+            const long size;        ///< Capacity, a power of two
+            std::atomic<T>* buf;    ///< The elements
+            Array* const prev;      ///< Buffer this one replaced
+
+            Array(long size, Array* prev) : size(size), buf(new std::atomic<T>[size]), prev(prev) {}
+
+            ~Array() {
+                delete [] buf;
+            }
+
+            T get(long i) const {
+                return buf[i & (size-1)].load(std::memory_order_relaxed);
+            }
+
+            void put(long i, const T& value) {
+                buf[i & (size-1)].store(value, std::memory_order_relaxed);
+            }
+        };
+
+        std::atomic<long> top;          ///< Next element to steal
+        char pad[64];                   ///< To put top and bottom in separate cache lines
+        std::atomic<long> bottom;       ///< Next free slot of the owner
+        std::atomic<Array*> array;      ///< Current buffer
+
+        WSDeque(const WSDeque&);                // Verboten
+        void operator=(const WSDeque&);         // Verboten
+
+        Array* grow(Array* a, long t, long b) {
+            // ASSUME WE ARE THE OWNER WHEN IN HERE
+            Array* na = new Array(2*a->size, a);
+            for (long i=t; i<b; ++i) na->put(i, a->get(i));
+            array.store(na, std::memory_order_release);
+            return na;
+        }
+
+    public:
+        WSDeque(long hint=4096) : top(0), bottom(0), array(nullptr) {
+            long sz = 2;
+            while (sz < hint) sz *= 2;
+            array.store(new Array(sz, nullptr), std::memory_order_relaxed);
+        }
+
+        ~WSDeque() {
+            Array* a = array.load(std::memory_order_relaxed);
+            while (a) {
+                Array* prev = a->prev;
+                delete a;
+                a = prev;
+            }
+        }
+
+        /// Push value onto the bottom ... owner only
+        void push(const T& value) {
+            const long b = bottom.load(std::memory_order_relaxed);
+            const long t = top.load(std::memory_order_acquire);
+            Array* a = array.load(std::memory_order_relaxed);
+            if (b - t > a->size - 1) a = grow(a, t, b);
+            a->put(b, value);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b+1, std::memory_order_relaxed);
+        }
+
+        /// Pop value off the bottom ... owner only; returns false if empty
+        bool pop(T& value) {
+            const long b = bottom.load(std::memory_order_relaxed) - 1;
+            Array* a = array.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long t = top.load(std::memory_order_relaxed);
+
+            if (t > b) { // Was empty
+                bottom.store(b+1, std::memory_order_relaxed);
+                return false;
+            }
+
+            value = a->get(b);
+            if (t == b) { // Last element ... race thieves for it
+                const bool won = top.compare_exchange_strong(t, t+1,
+                        std::memory_order_seq_cst, std::memory_order_relaxed);
+                bottom.store(b+1, std::memory_order_relaxed);
+                return won;
+            }
+            return true;
+        }
+
+        /// Steal value from the top ... any thread
+
+        /// Returns false if the deque is empty or if another thread took
+        /// the element first, in which case the caller may try again.
+        bool steal(T& value) {
+            long t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const long b = bottom.load(std::memory_order_acquire);
+            if (t >= b) return false;
+
+            Array* a = array.load(std::memory_order_acquire);
+            value = a->get(t);
+            return top.compare_exchange_strong(t, t+1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed);
+        }
+
+        /// Approximate number of elements
+        std::size_t size() const {
+            const long n = bottom.load(std::memory_order_relaxed) - top.load(std::memory_order_relaxed);
+            return n > 0 ? n : 0;
+        }
+
+        bool empty() const {
+            return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+        }
+    };
+
+}
+
+#endif // MADNESS_WORLD_WSDEQUE_H__INCLUDED